@@ -0,0 +1,97 @@
+#pragma once
+#include "mts/platform.h"
+#include <algorithm>
+#include <random>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+namespace mts::bench {
+/// Options of every benchmark. --quick runs fewer iterations, for the checks.
+struct options {
+  bool is_quick = false;
+
+  inline options(int argc, char** argv) {
+    for (int i = 1; i < argc; i++) {
+      is_quick = is_quick || !strcmp(argv[i], "--quick");
+    }
+  }
+
+  inline int get_runs() const noexcept { return is_quick ? 3 : 11; }
+  inline int get_iterations() const noexcept { return is_quick ? 10 : 100; }
+};
+
+/// Median time of a call in microseconds over `runs` runs of `iterations` calls. The median keeps
+/// the interruptions out, the first run warms the caches and is dropped.
+template <typename Function>
+inline double measure(const options& o, Function&& function) {
+  std::vector<double> runs;
+  const int iterations = o.get_iterations();
+  struct mach_timebase_info timebase;
+  mach_timebase_info(&timebase);
+
+  for (int r = 0; r <= o.get_runs(); r++) {
+    const UInt64 start = mach_absolute_time();
+
+    for (int i = 0; i < iterations; i++) {
+      function();
+    }
+
+    const UInt64 ticks = mach_absolute_time() - start;
+
+    if (r > 0) {
+      runs.push_back((double)ticks * timebase.numer / timebase.denom / 1000.0 / iterations);
+    }
+  }
+
+  std::nth_element(runs.begin(), runs.begin() + runs.size() / 2, runs.end());
+  return runs[runs.size() / 2];
+}
+
+/// White noise in [-amplitude, amplitude], the same for every run.
+template <typename T>
+inline std::vector<T> make_noise(size_t size, T amplitude = 1, unsigned seed = 1) {
+  std::mt19937 generator(seed);
+  std::uniform_real_distribution<double> distribution(-amplitude, amplitude);
+  std::vector<T> noise(size);
+
+  for (T& value : noise) {
+    value = (T)distribution(generator);
+  }
+
+  return noise;
+}
+
+template <typename T>
+inline double max_difference(const T* a, const T* b, size_t size) {
+  double difference = 0;
+
+  for (size_t i = 0; i < size; i++) {
+    difference = std::max(difference, fabs((double)a[i] - (double)b[i]));
+  }
+
+  return difference;
+}
+
+/// Counts the failed checks, the exit status of a benchmark.
+class checks {
+public:
+  inline void expect(bool is_passed, const char* what) {
+    if (!is_passed) {
+      fprintf(stderr, "FAILED: %s\n", what);
+      m_failures++;
+    }
+  }
+
+  inline int get_status() const noexcept {
+    if (m_failures) {
+      fprintf(stderr, "%d checks failed\n", m_failures);
+    }
+
+    return m_failures ? 1 : 0;
+  }
+
+private:
+  int m_failures = 0;
+};
+} // namespace mts::bench.
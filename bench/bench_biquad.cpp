@@ -0,0 +1,98 @@
+// biquad_cascade against its scalar reference, process_reference(), for 2 to 64 interleaved
+// channels and 1 to 16 sections. Checks that both give the same output, interleaved and planar.
+#include "bench.h"
+#include "mts/filters.h"
+
+namespace {
+using namespace mts;
+
+constexpr UInt32 frames = 512;
+
+// The reference runs the same sections in the same order, only the rounding of the vector
+// multiply-adds differs.
+constexpr double tolerance = 1e-4;
+
+template <UInt32 Channels, UInt32 Sections>
+void run(const bench::options& o, bench::checks& checks) {
+  using cascade = dsp::biquad_cascade<Float32, Channels, Sections>;
+  static cascade vector_filter;
+  static cascade scalar_filter;
+
+  dsp::biquad_coefficients coefficients[Sections];
+
+  for (UInt32 s = 0; s < Sections; s++) {
+    coefficients[s] = dsp::make_biquad(dsp::biquad_type::peak, 48000, 60.0 * (s + 1), 1, s % 2 ? -3 : 3);
+  }
+
+  vector_filter.reset();
+  scalar_filter.reset();
+  vector_filter.set(coefficients, Sections, 0);
+  scalar_filter.set(coefficients, Sections, 0);
+
+  const std::vector<Float32> input = bench::make_noise<Float32>((size_t)frames * Channels, 0.5f);
+  std::vector<Float32> interleaved = input;
+  std::vector<Float32> reference = input;
+  vector_filter.process(interleaved.data(), frames, Channels, 1);
+  scalar_filter.process_reference(reference.data(), frames, Channels, 1);
+  const double error = bench::max_difference(interleaved.data(), reference.data(), input.size());
+
+  // The same input, one channel after the other.
+  std::vector<Float32> planar(input.size());
+
+  for (UInt32 f = 0; f < frames; f++) {
+    for (UInt32 c = 0; c < Channels; c++) {
+      planar[c * frames + f] = input[f * Channels + c];
+    }
+  }
+
+  vector_filter.reset();
+  vector_filter.process(planar.data(), frames, 1, frames);
+  double planar_error = 0;
+
+  for (UInt32 f = 0; f < frames; f++) {
+    for (UInt32 c = 0; c < Channels; c++) {
+      planar_error = std::max(planar_error, fabs((double)planar[c * frames + f] - reference[f * Channels + c]));
+    }
+  }
+
+  std::vector<Float32> buffer = input;
+  const double vector_us = bench::measure(o, [&] { vector_filter.process(buffer.data(), frames, Channels, 1); });
+  const double scalar_us
+      = bench::measure(o, [&] { scalar_filter.process_reference(buffer.data(), frames, Channels, 1); });
+  const double samples = (double)frames * Channels * Sections;
+
+  printf("%8u %8u %10.2f %10.2f %8.2fx %10.3f %10.1e %10.1e\n", Channels, Sections, vector_us, scalar_us,
+      scalar_us / vector_us, vector_us * 1000 / samples, error, planar_error);
+
+  char what[64];
+  snprintf(what, sizeof(what), "%u channels, %u sections match the reference", Channels, Sections);
+  checks.expect(error < tolerance && planar_error < tolerance, what);
+}
+
+template <UInt32 Channels>
+void run_sections(const bench::options& o, bench::checks& checks) {
+  run<Channels, 1>(o, checks);
+  run<Channels, 2>(o, checks);
+  run<Channels, 4>(o, checks);
+  run<Channels, 8>(o, checks);
+  run<Channels, 16>(o, checks);
+}
+} // namespace
+
+int main(int argc, char** argv) {
+  const mts::bench::options o(argc, argv);
+  mts::bench::checks checks;
+
+  printf("biquad_cascade, %u frames per call\n", frames);
+  printf("%8s %8s %10s %10s %9s %10s %10s %10s\n", "channels", "sections", "vector us", "scalar us", "speedup",
+      "ns/sample", "error", "planar");
+
+  run_sections<2>(o, checks);
+  run_sections<4>(o, checks);
+  run_sections<8>(o, checks);
+  run_sections<16>(o, checks);
+  run_sections<32>(o, checks);
+  run_sections<64>(o, checks);
+
+  return checks.get_status();
+}
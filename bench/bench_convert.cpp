@@ -0,0 +1,201 @@
+// convert_from_format and convert_to_format for every sample format of a stream, on a 512-frame
+// stereo cycle, with the driver samples in Float32 and Float64. Checks that the conversions match
+// dsp::convert_sample, that every Int16, Int24 and Int32 sample a Float32 holds and every Float32
+// in Float64 come back exactly, and that the dither moves an integer sample by at most 1 LSB.
+#include "bench.h"
+#include "mts/format.h"
+
+namespace {
+using namespace mts;
+
+constexpr size_t samples = 512 * 2;
+
+const char* get_name(sample_format format) {
+  switch (format) {
+  case sample_format::float32:
+    return "Float32";
+  case sample_format::float64:
+    return "Float64";
+  case sample_format::int16:
+    return "Int16";
+  case sample_format::int24:
+    return "Int24";
+  case sample_format::int32:
+    return "Int32";
+  }
+
+  return "";
+}
+
+// Noise a little over full scale, so that the integer formats clip.
+template <typename T>
+void run_throughput(const bench::options& o, const char* type, sample_format format, bool has_dither) {
+  const std::vector<T> src = bench::make_noise<T>(samples, (T)1.1);
+  std::vector<UInt8> io(samples * sizeof(Float64));
+  std::vector<T> dst(samples);
+  dsp::tpdf_dither dither;
+
+  const double to_us = bench::measure(o, [&] {
+    convert_to_format(src.data(), io.data(), format, samples, has_dither ? &dither : nullptr);
+  });
+
+  const double from_us = bench::measure(o, [&] { convert_from_format(io.data(), format, dst.data(), samples); });
+
+  printf("%-8s %-8s %-7s %12.2f %12.2f\n", type, get_name(format), has_dither ? "yes" : "no",
+      to_us * 1000 / samples, from_us * 1000 / samples);
+}
+
+/// Every value of `values` converted to a Float32 and back.
+template <typename T>
+bool is_round_trip_exact(const std::vector<T>& values, sample_format format) {
+  std::vector<Float32> samples(values.size());
+  std::vector<T> back(values.size());
+
+  convert_from_format(values.data(), format, samples.data(), values.size());
+  convert_to_format(samples.data(), back.data(), format, values.size(), nullptr);
+  return memcmp(values.data(), back.data(), values.size() * sizeof(T)) == 0;
+}
+
+void check_round_trips(bench::checks& checks) {
+  std::vector<SInt16> int16(65536);
+
+  for (SInt32 i = 0; i < 65536; i++) {
+    int16[i] = (SInt16)(i - 32768);
+  }
+
+  checks.expect(is_round_trip_exact(int16, sample_format::int16), "every Int16 comes back exactly");
+
+  // A Float32 has 24 bits of precision: every Int24 and the Int32 multiples of 256.
+  std::vector<dsp::int24> int24(1 << 24);
+  std::vector<SInt32> int32(1 << 24);
+
+  for (SInt32 i = 0; i < (1 << 24); i++) {
+    int24[i] = dsp::pack_int24(i - (1 << 23));
+    int32[i] = (i - (1 << 23)) * 256;
+  }
+
+  checks.expect(is_round_trip_exact(int24, sample_format::int24), "every Int24 comes back exactly");
+  checks.expect(is_round_trip_exact(int32, sample_format::int32), "every Int32 multiple of 256 comes back exactly");
+
+  std::vector<Float32> noise = bench::make_noise<Float32>(1 << 16);
+  std::vector<Float64> float64(noise.begin(), noise.end());
+  checks.expect(is_round_trip_exact(float64, sample_format::float64), "every Float32 in Float64 comes back exactly");
+}
+
+/// The vectorized paths against the scalar reference, over full scale so that they clip.
+template <typename To>
+bool is_reference(const std::vector<Float32>& src, sample_format format) {
+  std::vector<To> converted(src.size());
+  convert_to_format(src.data(), converted.data(), format, src.size(), nullptr);
+
+  std::vector<Float32> back(src.size());
+  convert_from_format(converted.data(), format, back.data(), src.size());
+
+  for (size_t i = 0; i < src.size(); i++) {
+    const To expected = dsp::convert_sample<To>(src[i]);
+
+    if (memcmp(&converted[i], &expected, sizeof(To)) != 0 || back[i] != dsp::convert_sample<Float32>(expected)) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+void check_references(bench::checks& checks) {
+  const std::vector<Float32> noise = bench::make_noise<Float32>(1 << 16, 1.5f, 2);
+
+  checks.expect(is_reference<Float64>(noise, sample_format::float64), "Float64 matches convert_sample");
+  checks.expect(is_reference<SInt16>(noise, sample_format::int16), "Int16 matches convert_sample");
+  checks.expect(is_reference<dsp::int24>(noise, sample_format::int24), "Int24 matches convert_sample");
+  checks.expect(is_reference<SInt32>(noise, sample_format::int32), "Int32 matches convert_sample");
+}
+
+/// Largest distance in LSB between the dithered and the plain conversion.
+template <typename To>
+SInt64 get_dither_distance(const std::vector<Float32>& src, sample_format format, size_t& changed) {
+  std::vector<To> plain(src.size());
+  std::vector<To> dithered(src.size());
+  dsp::tpdf_dither dither;
+
+  convert_to_format(src.data(), plain.data(), format, src.size(), nullptr);
+  convert_to_format(src.data(), dithered.data(), format, src.size(), &dither);
+
+  SInt64 distance = 0;
+  changed = 0;
+
+  for (size_t i = 0; i < src.size(); i++) {
+    SInt64 a, b;
+
+    if constexpr (std::is_same_v<To, dsp::int24>) {
+      a = dsp::unpack_int24(plain[i]);
+      b = dsp::unpack_int24(dithered[i]);
+    }
+    else {
+      a = plain[i];
+      b = dithered[i];
+    }
+
+    distance = std::max(distance, a > b ? a - b : b - a);
+    changed += a != b;
+  }
+
+  return distance;
+}
+
+void check_dither(bench::checks& checks) {
+  dsp::tpdf_dither dither;
+  Float64 low = 0;
+  Float64 high = 0;
+  Float64 sum = 0;
+  constexpr UInt32 count = 1 << 20;
+
+  for (UInt32 i = 0; i < count; i++) {
+    const Float64 d = dither.next();
+    low = std::min(low, d);
+    high = std::max(high, d);
+    sum += d;
+  }
+
+  printf("dither in [%.4f, %.4f] LSB, mean %.5f\n", low, high, sum / count);
+  checks.expect(low > -1 && high < 1, "the dither stays within 1 LSB");
+  checks.expect(fabs(sum / count) < 0.01, "the dither has no offset");
+
+  const std::vector<Float32> noise = bench::make_noise<Float32>(1 << 16, 0.9f, 3);
+  size_t changed = 0;
+
+  const SInt64 int16 = get_dither_distance<SInt16>(noise, sample_format::int16, changed);
+  checks.expect(int16 == 1 && changed > 0, "the dither moves an Int16 by at most 1 LSB");
+
+  const SInt64 int24 = get_dither_distance<dsp::int24>(noise, sample_format::int24, changed);
+  checks.expect(int24 == 1 && changed > 0, "the dither moves an Int24 by at most 1 LSB");
+}
+} // namespace
+
+int main(int argc, char** argv) {
+  const mts::bench::options o(argc, argv);
+  mts::bench::checks checks;
+
+  printf("%zu samples, ns per sample\n", samples);
+  printf("%-8s %-8s %-7s %12s %12s\n", "samples", "format", "dither", "to format", "from format");
+
+  for (UInt32 i = 0; i < mts::sample_format_count; i++) {
+    const mts::sample_format format = static_cast<mts::sample_format>(i);
+    const bool can_dither = format == mts::sample_format::int16 || format == mts::sample_format::int24;
+
+    run_throughput<Float32>(o, "Float32", format, false);
+
+    if (can_dither) {
+      run_throughput<Float32>(o, "Float32", format, true);
+    }
+  }
+
+  for (UInt32 i = 0; i < mts::sample_format_count; i++) {
+    run_throughput<Float64>(o, "Float64", static_cast<mts::sample_format>(i), false);
+  }
+
+  check_round_trips(checks);
+  check_references(checks);
+  check_dither(checks);
+  return checks.get_status();
+}
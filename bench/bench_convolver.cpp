@@ -0,0 +1,241 @@
+// real_fft against a DFT and its cost per size, then partitioned_convolver on stereo at 48 kHz
+// across impulse lengths and cycle sizes, the block size being the cycle size. Checks the output
+// against a direct convolution and compares their costs.
+#include "bench.h"
+#include "mts/convolver.h"
+
+namespace {
+using namespace mts;
+
+constexpr Float64 sample_rate = 48000;
+constexpr UInt32 channels = 2;
+
+// Relative to the largest output sample, the FFTs round in single precision.
+constexpr double tolerance = 1e-4;
+
+// Relative to the largest bin or sample, for a single transform.
+constexpr double fft_tolerance = 1e-5;
+
+/// real_fft against a DFT in double precision, and inverse(forward(x)) against size * x.
+void check_fft(UInt32 size, bench::checks& checks) {
+  dsp::real_fft fft;
+  char what[96];
+  snprintf(what, sizeof(what), "real_fft of %u points", size);
+  checks.expect(fft.init(size), what);
+
+  const std::vector<Float32> signal = bench::make_noise<Float32>(size, 1.0f, size);
+  std::vector<Float32> re(size / 2), im(size / 2), back(size);
+  fft.forward(signal.data(), re.data(), im.data());
+  fft.inverse(re.data(), im.data(), back.data());
+
+  double error = 0;
+  double largest = 0;
+
+  for (UInt32 k = 0; k <= size / 2; k++) {
+    double dft_re = 0;
+    double dft_im = 0;
+
+    for (UInt32 t = 0; t < size; t++) {
+      const double angle = -2 * M_PI * (double)((UInt64)k * t % size) / size;
+      dft_re += signal[t] * cos(angle);
+      dft_im += signal[t] * sin(angle);
+    }
+
+    // The DC and the Nyquist frequency are real, packed in the first bin.
+    const double fft_re = k == 0 ? re[0] : k == size / 2 ? im[0] : re[k];
+    const double fft_im = k == 0 || k == size / 2 ? 0 : im[k];
+    error = std::max(error, std::max(fabs(fft_re - dft_re), fabs(fft_im - dft_im)));
+    largest = std::max(largest, std::max(fabs(dft_re), fabs(dft_im)));
+  }
+
+  snprintf(what, sizeof(what), "real_fft of %u points matches the DFT (error %.1e)", size, error / largest);
+  checks.expect(error <= fft_tolerance * largest, what);
+
+  double round_trip = 0;
+  double peak = 0;
+
+  for (UInt32 t = 0; t < size; t++) {
+    round_trip = std::max(round_trip, fabs((double)back[t] / size - signal[t]));
+    peak = std::max(peak, fabs((double)signal[t]));
+  }
+
+  snprintf(what, sizeof(what), "real_fft of %u points inverts (error %.1e)", size, round_trip / peak);
+  checks.expect(round_trip <= fft_tolerance * peak, what);
+  fft.free();
+}
+
+/// Time of a forward and an inverse real_fft, and of vDSP_fft_zrip on macOS.
+void measure_fft(const bench::options& o, UInt32 size) {
+  dsp::real_fft fft;
+  fft.init(size);
+  const std::vector<Float32> signal = bench::make_noise<Float32>(size);
+  std::vector<Float32> re(size / 2), im(size / 2), back(size);
+
+  const double us = bench::measure(o, [&] {
+    fft.forward(signal.data(), re.data(), im.data());
+    fft.inverse(re.data(), im.data(), back.data());
+  });
+
+  fft.free();
+#if defined(__APPLE__)
+  const vDSP_Length log2n = (vDSP_Length)log2(size);
+  FFTSetup setup = vDSP_create_fftsetup(log2n, kFFTRadix2);
+  DSPSplitComplex z = { re.data(), im.data() };
+
+  const double vdsp_us = bench::measure(o, [&] {
+    vDSP_ctoz((const DSPComplex*)signal.data(), 2, &z, 1, size / 2);
+    vDSP_fft_zrip(setup, &z, 1, log2n, kFFTDirection_Forward);
+    vDSP_fft_zrip(setup, &z, 1, log2n, kFFTDirection_Inverse);
+    vDSP_ztoc(&z, 1, (DSPComplex*)back.data(), 2, size / 2);
+  });
+
+  vDSP_destroy_fftsetup(setup);
+  printf("%8u %10.2f %10.2f\n", size, us, vdsp_us);
+#else
+  printf("%8u %10.2f\n", size, us);
+#endif
+}
+
+/// A decaying noise, like a room, normalized to a gain of about 1.
+std::vector<Float32> make_impulse(UInt32 frames) {
+  std::vector<Float32> impulse = bench::make_noise<Float32>(frames, 1.0f, 3);
+  double energy = 0;
+
+  for (UInt32 i = 0; i < frames; i++) {
+    impulse[i] *= expf(-6.0f * (Float32)i / frames);
+    energy += (double)impulse[i] * impulse[i];
+  }
+
+  for (Float32& tap : impulse) {
+    tap = (Float32)(tap / sqrt(energy));
+  }
+
+  return impulse;
+}
+
+/// Direct convolution of `frames` frames of interleaved input, in double precision and delayed by
+/// `delay` frames like the output of the convolver.
+void convolve_direct(
+    const std::vector<Float32>& impulse, const Float32* input, Float64* output, UInt32 frames, UInt32 delay) {
+  const UInt32 taps = (UInt32)impulse.size();
+
+  for (UInt32 f = 0; f < frames; f++) {
+    for (UInt32 c = 0; c < channels; c++) {
+      Float64 sum = 0;
+
+      for (UInt32 k = 0; k < taps && k + delay <= f; k++) {
+        sum += (Float64)impulse[k] * input[(size_t)(f - delay - k) * channels + c];
+      }
+
+      output[(size_t)f * channels + c] = sum;
+    }
+  }
+}
+
+/// Time of a time-domain FIR for a cycle, a vDSP_dotpr per sample with the reversed impulse on
+/// planar channels. Measured on a few frames, the cost per frame doesn't change.
+double measure_direct(const bench::options& o, const std::vector<Float32>& impulse, UInt32 cycle_frames) {
+  const UInt32 taps = (UInt32)impulse.size();
+  const UInt32 frames = std::min<UInt32>(cycle_frames, 16);
+  const std::vector<Float32> reversed(impulse.rbegin(), impulse.rend());
+  const std::vector<Float32> history = bench::make_noise<Float32>(taps + frames);
+  std::vector<Float32> output(frames);
+
+  const double us = bench::measure(o, [&] {
+    for (UInt32 c = 0; c < channels; c++) {
+      for (UInt32 f = 0; f < frames; f++) {
+        vDSP_dotpr(history.data() + f, 1, reversed.data(), 1, output.data() + f, taps);
+      }
+    }
+  });
+
+  return us * cycle_frames / frames;
+}
+
+void run(const bench::options& o, UInt32 impulse_frames, UInt32 cycle_frames, bench::checks& checks) {
+  const std::vector<Float32> impulse = make_impulse(impulse_frames);
+  dsp::partitioned_convolver* convolver = dsp::partitioned_convolver::create(
+      impulse.data(), impulse_frames, 1, channels, 0, sample_rate, cycle_frames, 1);
+
+  char what[96];
+  snprintf(what, sizeof(what), "convolver of %u taps in blocks of %u", impulse_frames, cycle_frames);
+  checks.expect(convolver != nullptr, what);
+
+  if (!convolver) {
+    return;
+  }
+
+  // Past the impulse, in cycles of odd sizes. The last partitions of the longest impulses run the
+  // same code as the first ones, the check stops at 16384 taps.
+  const UInt32 check_frames = (o.is_quick ? 256 : std::min<UInt32>(impulse_frames, 16384)) + 2 * cycle_frames;
+  const std::vector<Float32> input = bench::make_noise<Float32>((size_t)check_frames * channels, 0.5f, 4);
+  std::vector<Float32> output = input;
+  std::vector<Float64> expected((size_t)check_frames * channels);
+
+  for (UInt32 offset = 0, call = 0; offset < check_frames; call++) {
+    const UInt32 count = std::min(check_frames - offset, 1 + (call * 97) % (2 * cycle_frames));
+    convolver->process(output.data() + (size_t)offset * channels, count, channels, 1);
+    offset += count;
+  }
+
+  convolve_direct(impulse, input.data(), expected.data(), check_frames, cycle_frames);
+  double error = 0;
+  double largest = 0;
+
+  for (size_t i = 0; i < expected.size(); i++) {
+    error = std::max(error, fabs(output[i] - expected[i]));
+    largest = std::max(largest, fabs(expected[i]));
+  }
+
+  snprintf(what, sizeof(what), "%u taps in blocks of %u match the direct convolution (error %.1e)", impulse_frames,
+      cycle_frames, error / largest);
+  checks.expect(error <= tolerance * largest, what);
+
+  // Every cycle completes a block.
+  convolver->reset();
+  const std::vector<Float32> noise = bench::make_noise<Float32>((size_t)cycle_frames * channels);
+  std::vector<Float32> buffer(noise.size());
+  const double us = bench::measure(o, [&] {
+    memcpy(buffer.data(), noise.data(), noise.size() * sizeof(Float32));
+    convolver->process(buffer.data(), cycle_frames, channels, 1);
+  });
+
+  const double direct_us = measure_direct(o, impulse, cycle_frames);
+  const double cycle_us = cycle_frames / sample_rate * 1e6;
+  printf("%8u %8u %10.2f %9.2f%% %12.1f %9.1fx\n", impulse_frames, cycle_frames, us, 100 * us / cycle_us, direct_us,
+      direct_us / us);
+
+  dsp::partitioned_convolver::destroy(convolver);
+}
+} // namespace
+
+int main(int argc, char** argv) {
+  const mts::bench::options o(argc, argv);
+  mts::bench::checks checks;
+
+  for (UInt32 size = dsp::real_fft::min_size; size <= 4096; size *= 2) {
+    check_fft(size, checks);
+  }
+
+  printf("real_fft, forward and inverse\n");
+#if defined(__APPLE__)
+  printf("%8s %10s %10s\n", "points", "us", "vDSP us");
+#else
+  printf("%8s %10s\n", "points", "us");
+#endif
+
+  for (UInt32 size = 128; size <= 2 * dsp::partitioned_convolver::max_block_size; size *= 2) {
+    measure_fft(o, size);
+  }
+
+  printf("\npartitioned_convolver, stereo at 48 kHz, one block per cycle\n");
+  printf("%8s %8s %10s %10s %12s %10s\n", "taps", "frames", "us", "cycle", "direct us", "speedup");
+
+  for (UInt32 impulse_frames : { 256, 1024, 4096, 16384, 65536 }) {
+    for (UInt32 cycle_frames : { 64, 128, 256, 512, 1024 }) {
+      run(o, impulse_frames, cycle_frames, checks);
+    }
+  }
+
+  return checks.get_status();
+}
@@ -0,0 +1,151 @@
+// Kernels of gain_automation for a 512-frame cycle: unity, one gain for every channel, a gain per
+// channel and the linear and exponential ramps, interleaved and planar. Checks the ramps against
+// their closed forms.
+#include "bench.h"
+#include "mts/automation.h"
+
+namespace {
+using namespace mts;
+
+constexpr UInt32 frames = 512;
+
+// The ramps accumulate their step frame by frame in single precision.
+constexpr double tolerance = 1e-4;
+
+template <UInt32 Channels>
+using automation = gain_automation<Float32, Channels>;
+
+template <UInt32 Channels>
+gain_event<Channels> make_event(const Float32* gains, UInt32 ramp_frames, ramp_shape shape) {
+  gain_event<Channels> e = {};
+
+  for (UInt32 c = 0; c < Channels; c++) {
+    e.gains[c] = gains[c];
+  }
+
+  e.ramp_frames = ramp_frames;
+  e.time_type = event_time::immediate;
+  e.shape = shape;
+  return e;
+}
+
+/// Gain of a ramp from 1 to `target` after `f` frames of `ramp_frames`.
+double get_ramp_gain(ramp_shape shape, double target, UInt32 f, UInt32 ramp_frames) {
+  if (f >= ramp_frames) {
+    return target;
+  }
+
+  const double x = (double)f / ramp_frames;
+  return shape == ramp_shape::linear ? 1 + (target - 1) * x : pow(target, x);
+}
+
+template <UInt32 Channels>
+void check_ramp(ramp_shape shape, bool is_planar, bench::checks& checks) {
+  static automation<Channels> gains;
+  Float32 targets[Channels];
+  Float32 ones[Channels];
+
+  for (UInt32 c = 0; c < Channels; c++) {
+    targets[c] = 0.25f + 0.5f * (Float32)c / Channels;
+    ones[c] = 1;
+  }
+
+  gains.reset(ones);
+  gains.push(make_event<Channels>(targets, frames, shape));
+
+  // Two cycles, the ramp and the settled gains.
+  std::vector<Float32> buffer(2 * frames * Channels, 1.0f);
+  const AudioTimeStamp time = {};
+  double error = 0;
+
+  for (UInt32 cycle = 0; cycle < 2; cycle++) {
+    Float32* data = buffer.data() + cycle * frames * Channels;
+    gains.process(data, frames, is_planar ? 1 : Channels, is_planar ? frames : 1, time, 1);
+
+    for (UInt32 f = 0; f < frames; f++) {
+      for (UInt32 c = 0; c < Channels; c++) {
+        const Float32 value = is_planar ? data[c * frames + f] : data[f * Channels + c];
+        const double expected = get_ramp_gain(shape, targets[c], cycle * frames + f, frames);
+        error = std::max(error, fabs(value - expected));
+      }
+    }
+  }
+
+  char what[96];
+  snprintf(what, sizeof(what), "%s %s ramp of %u channels (error %.1e)", is_planar ? "planar" : "interleaved",
+      shape == ramp_shape::linear ? "linear" : "exponential", Channels, error);
+  checks.expect(error < tolerance, what);
+}
+
+/// A ramp too long to end while it is measured.
+template <UInt32 Channels>
+double measure_kernel(const bench::options& o, const Float32* from, const Float32* to, UInt32 ramp_frames,
+    ramp_shape shape, bool is_planar) {
+  static automation<Channels> gains;
+  gains.reset(from);
+
+  if (ramp_frames) {
+    gains.push(make_event<Channels>(to, ramp_frames, shape));
+  }
+
+  // Each call starts from the noise, the gains applied again and again would reach the denormals.
+  const std::vector<Float32> noise = bench::make_noise<Float32>((size_t)frames * Channels);
+  std::vector<Float32> buffer(noise.size());
+  const AudioTimeStamp time = {};
+  return bench::measure(o, [&] {
+    memcpy(buffer.data(), noise.data(), noise.size() * sizeof(Float32));
+    gains.process(buffer.data(), frames, is_planar ? 1 : Channels, is_planar ? frames : 1, time, 1);
+  });
+}
+
+template <UInt32 Channels>
+double measure_copy(const bench::options& o) {
+  const std::vector<Float32> noise = bench::make_noise<Float32>((size_t)frames * Channels);
+  std::vector<Float32> buffer(noise.size());
+  return bench::measure(o, [&] { memcpy(buffer.data(), noise.data(), noise.size() * sizeof(Float32)); });
+}
+
+template <UInt32 Channels>
+void run(const bench::options& o, bench::checks& checks) {
+  constexpr UInt32 endless = 1U << 30;
+  Float32 ones[Channels];
+  Float32 uniform[Channels];
+  Float32 varied[Channels];
+
+  for (UInt32 c = 0; c < Channels; c++) {
+    ones[c] = 1;
+    uniform[c] = 0.5f;
+    varied[c] = 0.25f + 0.5f * (Float32)c / Channels;
+  }
+
+  for (bool is_planar : { false, true }) {
+    const double unity = measure_kernel<Channels>(o, ones, ones, 0, ramp_shape::linear, is_planar);
+    const double gain = measure_kernel<Channels>(o, uniform, uniform, 0, ramp_shape::linear, is_planar);
+    const double gains = measure_kernel<Channels>(o, varied, varied, 0, ramp_shape::linear, is_planar);
+    const double linear = measure_kernel<Channels>(o, ones, varied, endless, ramp_shape::linear, is_planar);
+    const double exponential
+        = measure_kernel<Channels>(o, ones, varied, endless, ramp_shape::exponential, is_planar);
+
+    printf("%8u %12s %8.2f %8.2f %8.2f %8.2f %8.2f %8.2f\n", Channels, is_planar ? "planar" : "interleaved",
+        measure_copy<Channels>(o), unity, gain, gains, linear, exponential);
+
+    check_ramp<Channels>(ramp_shape::linear, is_planar, checks);
+    check_ramp<Channels>(ramp_shape::exponential, is_planar, checks);
+  }
+}
+} // namespace
+
+int main(int argc, char** argv) {
+  const mts::bench::options o(argc, argv);
+  mts::bench::checks checks;
+
+  printf("gain_automation, us per %u-frame call including the copy of the input\n", frames);
+  printf("%8s %12s %8s %8s %8s %8s %8s %8s\n", "channels", "layout", "copy", "unity", "gain", "gains", "linear",
+      "exp");
+
+  run<2>(o, checks);
+  run<8>(o, checks);
+  run<32>(o, checks);
+
+  return checks.get_status();
+}
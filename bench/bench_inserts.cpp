@@ -0,0 +1,109 @@
+// Cost of each node of an insert_chain against a budget, as a share of the duration of the IO
+// cycle at 48 kHz, for 64 to 1024 frame cycles. The chain runs every node: high-pass, four EQ
+// bands, a 4096 tap convolution and the limiter, on stereo and on 8 channels.
+#include "bench.h"
+#include "mts/inserts.h"
+
+namespace {
+using namespace mts;
+
+constexpr Float64 sample_rate = 48000;
+constexpr UInt32 impulse_frames = 4096;
+
+// Share of the cycle each node may take, from the node measures of insert_chain.
+constexpr double node_budgets[insert_node_count] = { 0.01, 0.03, 0.15, 0.05 };
+const char* const node_names[insert_node_count] = { "high_pass", "eq", "convolution", "limiter" };
+
+insert_config make_config(const Float32* impulse) {
+  insert_config config;
+  config.has_high_pass = true;
+  config.high_pass_frequency = 30;
+  config.eq_band_count = insert_eq_band_count;
+
+  for (UInt32 i = 0; i < insert_eq_band_count; i++) {
+    config.eq_bands[i].frequency = 100.0f * (Float32)(1 << (2 * i));
+    config.eq_bands[i].gain_db = i % 2 ? -4.0f : 4.0f;
+  }
+
+  config.impulse = impulse;
+  config.impulse_frames = impulse_frames;
+  config.impulse_channels = 1;
+  config.convolution_block_size = 256;
+  config.has_limiter = true;
+  config.limiter_ceiling_db = -6;
+  return config;
+}
+
+template <UInt32 Channels>
+void run(const bench::options& o, UInt32 frames, bench::checks& checks) {
+  using chain = insert_chain<Float32, Channels>;
+  static chain inserts;
+
+  // A decaying noise, like a room.
+  std::vector<Float32> impulse = bench::make_noise<Float32>(impulse_frames, 0.1f, 2);
+
+  for (UInt32 i = 0; i < impulse_frames; i++) {
+    impulse[i] *= expf(-6.0f * (Float32)i / impulse_frames);
+  }
+
+  checks.expect(inserts.set(make_config(impulse.data()), sample_rate), "the chain is set");
+  inserts.reset();
+
+  const std::vector<Float32> noise = bench::make_noise<Float32>((size_t)frames * Channels);
+  std::vector<Float32> buffer(noise.size());
+  UInt64 ticks[insert_node_count] = {};
+  UInt64 calls[insert_node_count] = {};
+
+  for (UInt32 n = 0; n < insert_node_count; n++) {
+    ticks[n] = inserts.get_cost((insert_node)n).ticks.load(std::memory_order_relaxed);
+    calls[n] = inserts.get_cost((insert_node)n).calls.load(std::memory_order_relaxed);
+  }
+
+  const double total_us = bench::measure(o, [&] {
+    memcpy(buffer.data(), noise.data(), noise.size() * sizeof(Float32));
+    inserts.process(buffer.data(), frames, Channels, 1);
+  });
+
+  struct mach_timebase_info timebase;
+  mach_timebase_info(&timebase);
+  const double cycle_us = frames / sample_rate * 1e6;
+
+  printf("%8u %8u %10.2f %9.2f%%", Channels, frames, total_us, 100 * total_us / cycle_us);
+
+  for (UInt32 n = 0; n < insert_node_count; n++) {
+    const insert_cost& cost = inserts.get_cost((insert_node)n);
+    const UInt64 node_calls = cost.calls.load(std::memory_order_relaxed) - calls[n];
+    const UInt64 node_ticks = cost.ticks.load(std::memory_order_relaxed) - ticks[n];
+    const double node_us = node_calls ? (double)node_ticks * timebase.numer / timebase.denom / 1000 / node_calls : 0;
+    const double share = node_us / cycle_us;
+    printf(" %10.2f%%", 100 * share);
+
+    char what[96];
+    snprintf(what, sizeof(what), "%s of %u channels at %u frames within %.0f%% of the cycle", node_names[n],
+        Channels, frames, 100 * node_budgets[n]);
+    checks.expect(share <= node_budgets[n], what);
+  }
+
+  printf("\n");
+}
+} // namespace
+
+int main(int argc, char** argv) {
+  const mts::bench::options o(argc, argv);
+  mts::bench::checks checks;
+
+  printf("insert_chain at 48 kHz, share of the cycle (budgets: high_pass 1%%, eq 3%%, convolution 15%%, "
+         "limiter 5%%)\n");
+  printf("%8s %8s %10s %10s %11s %11s %11s %11s\n", "channels", "frames", "total us", "total", "high_pass", "eq",
+      "convolution", "limiter");
+
+  for (UInt32 frames : { 64, 128, 256, 512, 1024 }) {
+    run<2>(o, frames, checks);
+  }
+
+  for (UInt32 frames : { 64, 256, 1024 }) {
+    run<8>(o, frames, checks);
+  }
+
+  return checks.get_status();
+}
@@ -0,0 +1,84 @@
+// dsp::interleave and dsp::deinterleave of a 512-frame cycle at 2 to 64 channels, against the
+// scalar transposition, with contiguous and strided planar buffers. Checks that both give the same
+// samples. Outside macOS the vDSP and BLAS calls of the kernels are the scalar stand-ins of
+// mts/platform.h, only the macOS timings compare the kernels.
+#include "bench.h"
+#include "mts/dsp.h"
+
+namespace {
+using namespace mts;
+
+constexpr UInt32 frames = 512;
+
+void interleave_scalar(const Float32* src, size_t src_stride, Float32* dst, size_t channels) {
+  for (size_t f = 0; f < frames; f++) {
+    for (size_t c = 0; c < channels; c++) {
+      dst[f * channels + c] = src[c * src_stride + f];
+    }
+  }
+}
+
+void deinterleave_scalar(const Float32* src, Float32* dst, size_t channels, size_t dst_stride) {
+  for (size_t c = 0; c < channels; c++) {
+    for (size_t f = 0; f < frames; f++) {
+      dst[c * dst_stride + f] = src[f * channels + c];
+    }
+  }
+}
+
+void run(const bench::options& o, UInt32 channels, size_t stride, bench::checks& checks) {
+  const size_t samples = (size_t)frames * channels;
+  const std::vector<Float32> interleaved = bench::make_noise<Float32>(samples);
+  const std::vector<Float32> planar = bench::make_noise<Float32>(stride * channels);
+  std::vector<Float32> a(std::max(samples, stride * channels));
+  std::vector<Float32> b(a.size());
+
+  dsp::interleave(planar.data(), stride, a.data(), channels, frames);
+  interleave_scalar(planar.data(), stride, b.data(), channels);
+  const bool is_interleave_exact = bench::max_difference(a.data(), b.data(), samples) == 0;
+
+  const double interleave_us
+      = bench::measure(o, [&] { dsp::interleave(planar.data(), stride, a.data(), channels, frames); });
+  const double interleave_scalar_us
+      = bench::measure(o, [&] { interleave_scalar(planar.data(), stride, b.data(), channels); });
+
+  std::fill(a.begin(), a.end(), 0.0f);
+  std::fill(b.begin(), b.end(), 0.0f);
+  dsp::deinterleave(interleaved.data(), a.data(), channels, frames, stride);
+  deinterleave_scalar(interleaved.data(), b.data(), channels, stride);
+  const bool is_deinterleave_exact = bench::max_difference(a.data(), b.data(), a.size()) == 0;
+
+  const double deinterleave_us
+      = bench::measure(o, [&] { dsp::deinterleave(interleaved.data(), a.data(), channels, frames, stride); });
+  const double deinterleave_scalar_us
+      = bench::measure(o, [&] { deinterleave_scalar(interleaved.data(), b.data(), channels, stride); });
+
+  char what[96];
+  snprintf(what, sizeof(what), "interleave of %u channels with a stride of %zu is the transposition", channels,
+      stride);
+  checks.expect(is_interleave_exact, what);
+  snprintf(what, sizeof(what), "deinterleave of %u channels with a stride of %zu is the transposition", channels,
+      stride);
+  checks.expect(is_deinterleave_exact, what);
+
+  printf("%8u %8zu %10.2f %10.2f %7.2fx %10.2f %10.2f %7.2fx\n", channels, stride, interleave_us,
+      interleave_scalar_us, interleave_scalar_us / interleave_us, deinterleave_us, deinterleave_scalar_us,
+      deinterleave_scalar_us / deinterleave_us);
+}
+} // namespace
+
+int main(int argc, char** argv) {
+  const mts::bench::options o(argc, argv);
+  mts::bench::checks checks;
+
+  printf("%u frames, us per call, the strided planar buffers have 16 frames of padding\n", frames);
+  printf("%8s %8s %10s %10s %8s %10s %10s %8s\n", "channels", "stride", "interleave", "scalar", "speedup",
+      "deinterl.", "scalar", "speedup");
+
+  for (UInt32 channels : { 2, 4, 6, 8, 16, 32, 64 }) {
+    run(o, channels, frames, checks);
+    run(o, channels, frames + 16, checks);
+  }
+
+  return checks.get_status();
+}
@@ -0,0 +1,82 @@
+// true_peak_limiter against the budget of 5% of a 64-frame cycle at 48 kHz stereo, and its cost
+// for other cycles and channel counts. Checks that loud noise comes out under the ceiling.
+#include "bench.h"
+#include "mts/limiter.h"
+
+namespace {
+using namespace mts;
+
+constexpr Float64 sample_rate = 48000;
+constexpr double budget = 0.05;
+
+// 1.5 ms of lookahead and 50 ms of release, the defaults of the inserts.
+constexpr UInt32 lookahead = 72;
+const Float32 release = (Float32)exp(-1.0 / (0.05 * sample_rate));
+const Float32 ceiling = 0.5f;
+
+template <UInt32 Channels>
+double run(const bench::options& o, UInt32 frames, bench::checks& checks) {
+  static dsp::true_peak_limiter<Float32, Channels, 1024> limiter;
+  limiter.set(ceiling, release, lookahead);
+  limiter.reset();
+
+  // Noise up to 4 times over the ceiling, in one-second bursts.
+  const UInt32 total_frames = (UInt32)sample_rate;
+  std::vector<Float32> signal = bench::make_noise<Float32>((size_t)total_frames * Channels, 2.0f);
+  std::vector<Float32> output = signal;
+  Float32 peak = 0;
+  Float32 smallest_gain = 1;
+
+  UInt32 offset = 0;
+
+  for (; offset + frames <= total_frames; offset += frames) {
+    limiter.process(output.data() + (size_t)offset * Channels, frames, Channels, 1);
+    smallest_gain = std::min(smallest_gain, (Float32)limiter.get_gain());
+  }
+
+  for (size_t i = 0; i < (size_t)offset * Channels; i++) {
+    peak = std::max(peak, fabsf(output[i]));
+  }
+
+  char what[96];
+  snprintf(what, sizeof(what), "%u channels at %u frames stay under the ceiling (peak %.4f)", Channels, frames,
+      peak);
+  checks.expect(peak <= ceiling * 1.0001f && smallest_gain < 1, what);
+
+  // Always limiting, each call starts from the noise.
+  const size_t samples = (size_t)frames * Channels;
+  std::vector<Float32> buffer(samples);
+  size_t position = 0;
+  const double us = bench::measure(o, [&] {
+    memcpy(buffer.data(), signal.data() + position, samples * sizeof(Float32));
+    limiter.process(buffer.data(), frames, Channels, 1);
+    position = (position + samples) % (signal.size() - samples);
+  });
+
+  const double share = us / (frames / sample_rate * 1e6);
+  printf("%8u %8u %10.2f %9.2f%% %10.1f\n", Channels, frames, us, 100 * share, us * 1000 / frames);
+  return share;
+}
+} // namespace
+
+int main(int argc, char** argv) {
+  const mts::bench::options o(argc, argv);
+  mts::bench::checks checks;
+
+  printf("true_peak_limiter at 48 kHz, %u frames of lookahead, budget %.0f%% of a 64-frame stereo cycle\n",
+      lookahead, 100 * budget);
+  printf("%8s %8s %10s %10s %10s\n", "channels", "frames", "us", "cycle", "ns/frame");
+
+  const double share = run<2>(o, 64, checks);
+  checks.expect(share < budget, "stereo at 64 frames within the budget");
+
+  for (UInt32 frames : { 128, 256, 512, 1024 }) {
+    run<2>(o, frames, checks);
+  }
+
+  for (UInt32 frames : { 64, 512 }) {
+    run<8>(o, frames, checks);
+  }
+
+  return checks.get_status();
+}
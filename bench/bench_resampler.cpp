@@ -0,0 +1,109 @@
+// CPU cost of polyphase_resampler per channel for each quality tier, on 512-frame input cycles
+// between the usual rates. Checks the gain of a 1 kHz sine and the stop band of each tier from 96
+// to 48 kHz, where a 46 kHz sine would alias to 2 kHz. The transition band is wider for the lower
+// tiers, a 30 kHz sine shows it.
+#include "bench.h"
+#include "mts/resampler.h"
+
+namespace {
+using namespace mts;
+
+constexpr UInt32 frames = 512;
+
+const char* get_name(dsp::resampler_quality quality) {
+  switch (quality) {
+  case dsp::resampler_quality::low:
+    return "low";
+  case dsp::resampler_quality::medium:
+    return "medium";
+  case dsp::resampler_quality::high:
+    return "high";
+  case dsp::resampler_quality::best:
+    return "best";
+  }
+
+  return "";
+}
+
+/// RMS gain in dB of a sine at `frequency` through a mono resampler, once the filter is full.
+double get_gain(UInt32 input_rate, UInt32 output_rate, dsp::resampler_quality quality, double frequency) {
+  dsp::polyphase_resampler resampler;
+  resampler.init(input_rate, output_rate, 1, quality);
+
+  const UInt32 input_frames = input_rate / 2;
+  std::vector<Float32> input(input_frames);
+  std::vector<Float32> output(resampler.get_max_output_frames(input_frames));
+
+  for (UInt32 i = 0; i < input_frames; i++) {
+    input[i] = (Float32)(0.5 * sin(2 * M_PI * frequency * i / input_rate));
+  }
+
+  const UInt32 output_frames = resampler.process(input.data(), input_frames, output.data());
+  const UInt32 skip = 2 * resampler.get_latency();
+  double energy = 0;
+
+  for (UInt32 i = skip; i < output_frames; i++) {
+    energy += (double)output[i] * output[i];
+  }
+
+  resampler.free();
+  return 10 * log10(energy / (output_frames - skip) / (0.5 * 0.5 / 2));
+}
+
+void run(const bench::options& o, UInt32 input_rate, UInt32 output_rate, UInt32 channels,
+    dsp::resampler_quality quality) {
+  dsp::polyphase_resampler resampler;
+  resampler.init(input_rate, output_rate, channels, quality);
+
+  const std::vector<Float32> input = bench::make_noise<Float32>((size_t)frames * channels, 0.5f);
+  std::vector<Float32> output((size_t)resampler.get_max_output_frames(frames) * channels);
+
+  const double us = bench::measure(o, [&] { resampler.process(input.data(), frames, output.data()); });
+  const double us_per_channel = us / channels;
+
+  printf("%6u %6u %8u %-7s %5u %10.2f %12.2f %9.3f%%\n", input_rate, output_rate, channels, get_name(quality),
+      dsp::get_resampler_tier(quality).taps, us, us_per_channel,
+      100 * us_per_channel / (frames * 1e6 / input_rate));
+  resampler.free();
+}
+} // namespace
+
+int main(int argc, char** argv) {
+  const mts::bench::options o(argc, argv);
+  mts::bench::checks checks;
+  const mts::dsp::resampler_quality qualities[] = { mts::dsp::resampler_quality::low,
+    mts::dsp::resampler_quality::medium, mts::dsp::resampler_quality::high, mts::dsp::resampler_quality::best };
+
+  printf("%u-frame input cycles, cost of a cycle and of a channel, per channel in %% of the cycle\n", frames);
+  printf("%6s %6s %8s %-7s %5s %10s %12s %10s\n", "from", "to", "channels", "quality", "taps", "us", "us/channel",
+      "cycle");
+
+  const UInt32 rates[][2] = { { 48000, 44100 }, { 44100, 48000 }, { 48000, 96000 }, { 96000, 48000 } };
+
+  for (const auto& rate : rates) {
+    for (mts::dsp::resampler_quality quality : qualities) {
+      for (UInt32 channels : { 2, 8 }) {
+        run(o, rate[0], rate[1], channels, quality);
+      }
+    }
+  }
+
+  printf("%-7s %12s %12s %12s\n", "quality", "1 kHz dB", "30 kHz dB", "46 kHz dB");
+
+  // About 60, 80, 100 and 120 dB of stop band.
+  const double rejections[] = { 55, 75, 95, 115 };
+
+  for (UInt32 i = 0; i < 4; i++) {
+    const double pass = get_gain(96000, 48000, qualities[i], 1000);
+    const double transition = get_gain(96000, 48000, qualities[i], 30000);
+    const double stop = get_gain(96000, 48000, qualities[i], 46000);
+    printf("%-7s %12.3f %12.1f %12.1f\n", get_name(qualities[i]), pass, transition, stop);
+
+    char what[96];
+    snprintf(what, sizeof(what), "%s quality passes 1 kHz and rejects 46 kHz by %.0f dB", get_name(qualities[i]),
+        rejections[i]);
+    checks.expect(fabs(pass) < 0.1 && stop < -rejections[i], what);
+  }
+
+  return checks.get_status();
+}
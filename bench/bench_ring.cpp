@@ -0,0 +1,136 @@
+// Throughput of the ring at 256 channels and 192 kHz, a 512-frame cycle written and read back per
+// call, against the flat interleaved ring the driver had before mts::ring_buffer. An interleaved
+// tile is the same memory as a flat ring, so ring_layout::interleaved is the tiled interleaved
+// layout. The reader is either a cycle behind the writer or half a ring behind, where the driver
+// switches to non-temporal stores. Checks that every variant reads back what it wrote.
+#include "bench.h"
+#include "mts/ring_buffer.h"
+
+namespace {
+using namespace mts;
+
+constexpr UInt32 channels = 256;
+constexpr Float64 sample_rate = 192000;
+constexpr UInt32 frames = 512;
+constexpr UInt32 ring_frames = 65536;
+constexpr size_t cycle_samples = (size_t)frames * channels;
+
+/// The ring of the driver before mts::ring_buffer: interleaved frames, one or two copies a cycle.
+class flat_ring {
+public:
+  inline flat_ring() : m_data((size_t)ring_frames * channels) {}
+
+  inline void write(const Float32* src, UInt64 sample_time) {
+    const UInt32 start = sample_time & (ring_frames - 1);
+    const UInt32 first = std::min(frames, ring_frames - start);
+    dsp::copy(src, m_data.data() + (size_t)start * channels, (size_t)first * channels);
+    dsp::copy(src + (size_t)first * channels, m_data.data(), (size_t)(frames - first) * channels);
+  }
+
+  inline void read(Float32* dst, UInt64 sample_time) const {
+    const UInt32 start = sample_time & (ring_frames - 1);
+    const UInt32 first = std::min(frames, ring_frames - start);
+    dsp::copy(m_data.data() + (size_t)start * channels, dst, (size_t)first * channels);
+    dsp::copy(m_data.data(), dst + (size_t)first * channels, (size_t)(frames - first) * channels);
+  }
+
+private:
+  std::vector<Float32> m_data;
+};
+
+/// The ring under test, with interleaved or planar IO buffers. A planar IO buffer has the channels
+/// one after the other, `frames` samples each.
+template <ring_layout Layout, bool IsPlanarIO>
+class tested_ring {
+public:
+  inline tested_ring(bool non_temporal) : m_non_temporal(non_temporal) { m_ring.allocate(ring_frames, channels); }
+  inline ~tested_ring() { m_ring.free(); }
+
+  inline void write(const Float32* src, UInt64 sample_time) {
+    if constexpr (IsPlanarIO) {
+      m_ring.write_planar(src, frames, sample_time, frames, m_non_temporal);
+    }
+    else {
+      m_ring.write(src, sample_time, frames, m_non_temporal);
+    }
+  }
+
+  inline void read(Float32* dst, UInt64 sample_time) const {
+    if constexpr (IsPlanarIO) {
+      m_ring.read_planar(dst, frames, sample_time, frames);
+    }
+    else {
+      m_ring.read(dst, sample_time, frames);
+    }
+  }
+
+private:
+  ring_buffer<Float32, Layout> m_ring;
+  bool m_non_temporal;
+};
+
+template <typename Ring>
+void run(const bench::options& o, const char* layout, const char* io, const char* stores, Ring& ring,
+    bench::checks& checks) {
+  // Three cycles across the end of the ring, read back after they are all written.
+  std::vector<Float32> written = bench::make_noise<Float32>(3 * cycle_samples);
+  std::vector<Float32> read(3 * cycle_samples);
+  const UInt64 start = 2 * (UInt64)ring_frames - frames;
+
+  for (UInt32 i = 0; i < 3; i++) {
+    ring.write(written.data() + i * cycle_samples, start + i * frames);
+  }
+
+  for (UInt32 i = 0; i < 3; i++) {
+    ring.read(read.data() + i * cycle_samples, start + i * frames);
+  }
+
+  char what[128];
+  snprintf(what, sizeof(what), "%s ring with %s IO and %s stores reads back what it wrote", layout, io, stores);
+  checks.expect(bench::max_difference(written.data(), read.data(), written.size()) == 0, what);
+
+  for (UInt32 distance : { frames, ring_frames / 2 }) {
+    UInt64 sample_time = ring_frames;
+
+    const double us = bench::measure(o, [&] {
+      ring.write(written.data(), sample_time);
+      ring.read(read.data(), sample_time - distance);
+      sample_time += frames;
+    });
+
+    const double bytes = 2.0 * cycle_samples * sizeof(Float32);
+    printf("%-12s %-12s %-14s %9u %10.1f %9.2f %9.2f%%\n", layout, io, stores, distance, us, bytes / us / 1000,
+        100 * us / (frames / sample_rate * 1e6));
+  }
+}
+
+template <ring_layout Layout, bool IsPlanarIO>
+void run_ring(const bench::options& o, const char* layout, const char* io, bench::checks& checks) {
+  for (bool non_temporal : { false, true }) {
+    tested_ring<Layout, IsPlanarIO> ring(non_temporal);
+    run(o, layout, io, non_temporal ? "non-temporal" : "temporal", ring, checks);
+  }
+}
+} // namespace
+
+int main(int argc, char** argv) {
+  const mts::bench::options o(argc, argv);
+  mts::bench::checks checks;
+
+  printf("%u-frame ring of %u channels at %.0f kHz, a %u-frame cycle written and read per call\n", ring_frames,
+      channels, sample_rate / 1000, frames);
+#if defined(__builtin_nontemporal_store)
+  printf("the non-temporal stores are plain stores with this compiler\n");
+#endif
+  printf("%-12s %-12s %-14s %9s %10s %9s %10s\n", "ring", "io", "stores", "distance", "us", "GB/s", "cycle");
+
+  flat_ring flat;
+  run(o, "flat", "interleaved", "temporal", flat, checks);
+
+  run_ring<mts::ring_layout::interleaved, false>(o, "interleaved", "interleaved", checks);
+  run_ring<mts::ring_layout::planar, false>(o, "planar", "interleaved", checks);
+  run_ring<mts::ring_layout::planar, true>(o, "planar", "planar", checks);
+  run_ring<mts::ring_layout::interleaved, true>(o, "interleaved", "planar", checks);
+
+  return checks.get_status();
+}
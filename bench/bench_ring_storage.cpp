@@ -0,0 +1,98 @@
+// Half precision storage of the ring against Float32: the memory of a 65536-frame ring of 128
+// channels, the time of a 512-frame cycle written and read back half a ring behind the writer and
+// the signal to noise ratio of the samples that come back, for full scale noise and quieter
+// sines. Checks that Float32 is exact and that half and bfloat16 keep their precision.
+#include "bench.h"
+#include "mts/ring_buffer.h"
+
+namespace {
+using namespace mts;
+
+constexpr UInt32 channels = 128;
+constexpr UInt32 frames = 512;
+constexpr UInt32 ring_frames = 65536;
+constexpr size_t cycle_samples = (size_t)frames * channels;
+
+/// Signal to noise ratio in dB of `output` against `input`, infinite when they are the same.
+double get_snr(const std::vector<Float32>& input, const std::vector<Float32>& output) {
+  double signal = 0;
+  double noise = 0;
+
+  for (size_t i = 0; i < input.size(); i++) {
+    const double e = (double)output[i] - input[i];
+    signal += (double)input[i] * input[i];
+    noise += e * e;
+  }
+
+  return noise == 0 ? INFINITY : 10 * log10(signal / noise);
+}
+
+/// A sine per channel at `level_db`, every channel at another frequency.
+std::vector<Float32> make_sines(double level_db) {
+  std::vector<Float32> sines(cycle_samples);
+  const double amplitude = decibel_to_amplitude(level_db);
+
+  for (UInt32 f = 0; f < frames; f++) {
+    for (UInt32 c = 0; c < channels; c++) {
+      sines[(size_t)f * channels + c] = (Float32)(amplitude * sin(2 * M_PI * (c + 1) * f / frames));
+    }
+  }
+
+  return sines;
+}
+
+/// The SNR of the signal written and read back through the ring.
+template <typename T>
+double get_ring_snr(ring_buffer<T, ring_layout::interleaved>& ring, const std::vector<Float32>& signal) {
+  std::vector<Float32> output(signal.size());
+  ring.write(signal.data(), 0, frames, false);
+  ring.read(output.data(), 0, frames);
+  return get_snr(signal, output);
+}
+
+template <typename T>
+void run(const bench::options& o, const char* name, double min_snr, bench::checks& checks) {
+  ring_buffer<T, ring_layout::interleaved> ring;
+  ring.allocate(ring_frames, channels);
+
+  const std::vector<Float32> noise = bench::make_noise<Float32>(cycle_samples);
+  std::vector<Float32> output(cycle_samples);
+  UInt64 sample_time = ring_frames;
+
+  const double us = bench::measure(o, [&] {
+    ring.write(noise.data(), sample_time, frames, false);
+    ring.read(output.data(), sample_time - ring_frames / 2, frames);
+    sample_time += frames;
+  });
+
+  const double memory = (double)ring_frames * channels * sizeof(T) / (1024 * 1024);
+  const double ring_bytes = 2.0 * cycle_samples * sizeof(T);
+  const double snr = get_ring_snr(ring, noise);
+  const double snr_20 = get_ring_snr(ring, make_sines(-20));
+  const double snr_60 = get_ring_snr(ring, make_sines(-60));
+
+  printf("%-9s %8.1f %10.1f %10.2f %9.1f %9.1f %9.1f\n", name, memory, us, ring_bytes / us / 1000, snr, snr_20,
+      snr_60);
+
+  char what[96];
+  snprintf(what, sizeof(what), "%s keeps %.0f dB of SNR at full scale, -20 and -60 dBFS", name, min_snr);
+  checks.expect(snr >= min_snr && snr_20 >= min_snr && snr_60 >= min_snr, what);
+  ring.free();
+}
+} // namespace
+
+int main(int argc, char** argv) {
+  const mts::bench::options o(argc, argv);
+  mts::bench::checks checks;
+
+  printf("%u-frame ring of %u channels, a %u-frame cycle written and read per call\n", ring_frames, channels,
+      frames);
+  printf("%-9s %8s %10s %10s %9s %9s %9s\n", "storage", "MB", "us", "ring GB/s", "SNR dB", "-20 dBFS", "-60 dBFS");
+
+  // 11 and 8 bits of precision, about 6 dB a bit.
+  run<Float32>(o, "Float32", INFINITY, checks);
+  run<mts::dsp::half>(o, "half", 60, checks);
+  run<mts::dsp::bfloat16>(o, "bfloat16", 45, checks);
+
+  return checks.get_status();
+}
@@ -0,0 +1,130 @@
+// Kernels of routing_matrix on a 512-frame cycle at 2, 16 and 64 channels, interleaved and planar:
+// the identity, a permutation that reverses the channels and a sparse mix of two sources per
+// channel. The dense matrix product is the reference, the kernels are checked against it.
+#include "bench.h"
+#include "mts/routing.h"
+
+namespace {
+using namespace mts;
+
+constexpr UInt32 frames = 512;
+
+// Sums in a different order than the kernels.
+constexpr double tolerance = 1e-6;
+
+const char* get_name(routing_kernel kernel) {
+  switch (kernel) {
+  case routing_kernel::identity:
+    return "identity";
+  case routing_kernel::permutation:
+    return "permutation";
+  case routing_kernel::sparse:
+    return "sparse";
+  }
+
+  return "";
+}
+
+template <UInt32 Channels>
+std::vector<route> make_routes(routing_kernel kernel) {
+  std::vector<route> routes;
+
+  for (UInt32 c = 0; c < Channels; c++) {
+    switch (kernel) {
+    case routing_kernel::identity:
+      routes.push_back({ c, c, 1 });
+      break;
+
+    case routing_kernel::permutation:
+      routes.push_back({ c, Channels - 1 - c, 1 });
+      break;
+
+    case routing_kernel::sparse:
+      routes.push_back({ c, c, 0.5f });
+      routes.push_back({ (c + 1) % Channels, c, 0.25f });
+      break;
+    }
+  }
+
+  return routes;
+}
+
+/// Every destination is the dot product of a row of the matrix with the sources.
+template <UInt32 Channels>
+void process_dense(const std::vector<route>& routes, const Float32* src, Float32* dst, size_t frame_stride,
+    size_t channel_stride) {
+  std::vector<Float32> gains((size_t)Channels * Channels);
+
+  for (const route& r : routes) {
+    gains[(size_t)r.destination * Channels + r.source] += r.gain;
+  }
+
+  for (UInt32 f = 0; f < frames; f++) {
+    for (UInt32 d = 0; d < Channels; d++) {
+      Float32 sum = 0;
+
+      for (UInt32 s = 0; s < Channels; s++) {
+        sum += gains[(size_t)d * Channels + s] * src[f * frame_stride + s * channel_stride];
+      }
+
+      dst[f * frame_stride + d * channel_stride] = sum;
+    }
+  }
+}
+
+template <UInt32 Channels>
+void run(const bench::options& o, routing_kernel kernel, bool is_planar, bench::checks& checks) {
+  static routing_matrix<Float32, Channels> matrix;
+  const std::vector<route> routes = make_routes<Channels>(kernel);
+  matrix.compile(routes.data(), (UInt32)routes.size());
+
+  const size_t frame_stride = is_planar ? 1 : Channels;
+  const size_t channel_stride = is_planar ? frames : 1;
+  const std::vector<Float32> src = bench::make_noise<Float32>((size_t)frames * Channels);
+  std::vector<Float32> dst(src.size());
+  std::vector<Float32> expected(src.size());
+
+  matrix.process(src.data(), dst.data(), frames, frame_stride, channel_stride);
+  process_dense<Channels>(routes, src.data(), expected.data(), frame_stride, channel_stride);
+
+  char what[128];
+  snprintf(what, sizeof(what), "%u channels %s compile to the %s kernel", Channels, get_name(kernel),
+      get_name(kernel));
+  checks.expect(matrix.get_kernel() == kernel, what);
+  snprintf(what, sizeof(what), "%s kernel at %u channels %s matches the dense matrix", get_name(kernel), Channels,
+      is_planar ? "planar" : "interleaved");
+  checks.expect(bench::max_difference(dst.data(), expected.data(), dst.size()) <= tolerance, what);
+
+  const double us
+      = bench::measure(o, [&] { matrix.process(src.data(), dst.data(), frames, frame_stride, channel_stride); });
+  const double dense_us = bench::measure(
+      o, [&] { process_dense<Channels>(routes, src.data(), expected.data(), frame_stride, channel_stride); });
+
+  printf("%8u %-12s %-12s %8zu %10.2f %10.2f %10.1fx\n", Channels, is_planar ? "planar" : "interleaved",
+      get_name(kernel), routes.size(), us, dense_us, dense_us / us);
+}
+
+template <UInt32 Channels>
+void run_all(const bench::options& o, bench::checks& checks) {
+  for (bool is_planar : { false, true }) {
+    for (routing_kernel kernel : { routing_kernel::identity, routing_kernel::permutation, routing_kernel::sparse }) {
+      run<Channels>(o, kernel, is_planar, checks);
+    }
+  }
+}
+} // namespace
+
+int main(int argc, char** argv) {
+  const mts::bench::options o(argc, argv);
+  mts::bench::checks checks;
+
+  printf("%u frames, us per call against the dense matrix product\n", frames);
+  printf("%8s %-12s %-12s %8s %10s %10s %11s\n", "channels", "layout", "kernel", "routes", "us", "dense",
+      "speedup");
+
+  run_all<2>(o, checks);
+  run_all<16>(o, checks);
+  run_all<64>(o, checks);
+
+  return checks.get_status();
+}
@@ -0,0 +1,71 @@
+// Cost of an IO trace event against the budget of 20 ns: recorder::record with the tracer compiled
+// in, then with the host time taken by trace::record, a begin and end scope and a record with a
+// payload. Outside macOS the host time is clock_gettime(), which costs more than mach_absolute_time().
+#include "bench.h"
+#include "mts/trace.h"
+
+namespace {
+using namespace mts;
+
+constexpr double budget_ns = 20;
+
+// Events per measured call, more than a ring holds so that it wraps around.
+constexpr UInt32 events = 8192;
+
+template <typename Function>
+double run(const bench::options& o, const char* name, Function&& function) {
+  const double ns = bench::measure(o, function) * 1000 / events;
+  printf("%-28s %10.2f\n", name, ns);
+  return ns;
+}
+
+struct payload_event {
+  UInt64 host_time;
+  UInt64 payload_offset;
+  UInt32 payload_size;
+  UInt32 type;
+};
+
+trace::recorder<payload_event, 4096, 4, 65536> g_payload_events;
+} // namespace
+
+int main(int argc, char** argv) {
+  const mts::bench::options o(argc, argv);
+  mts::bench::checks checks;
+
+  printf("trace events of one thread, budget %.0f ns per event\n", budget_ns);
+  printf("%-28s %10s\n", "", "ns/event");
+
+  UInt32 arg = 0;
+
+  const double ns = run(o, "recorder::record", [&] {
+    for (UInt32 i = 0; i < events; i++) {
+      trace::g_events.record(trace::event{ i, 1, arg++, 0, trace::event_type::do_io_operation,
+          trace::event_phase::instant });
+    }
+  });
+
+  checks.expect(ns < budget_ns, "recorder::record within the budget");
+
+  run(o, "trace::record", [&] {
+    for (UInt32 i = 0; i < events; i++) {
+      trace::record(trace::event_type::do_io_operation, trace::event_phase::instant, 1, arg++, 0);
+    }
+  });
+
+  run(o, "trace::scope<true>", [&] {
+    for (UInt32 i = 0; i < events / 2; i++) {
+      trace::scope<true> scope(trace::event_type::do_io_operation, 1, arg++);
+    }
+  });
+
+  const UInt8 payload[64] = {};
+
+  run(o, "record with 64 bytes", [&] {
+    for (UInt32 i = 0; i < events; i++) {
+      g_payload_events.record(payload_event{ i, 0, 0, arg++ }, payload, sizeof(payload));
+    }
+  });
+
+  return checks.get_status();
+}
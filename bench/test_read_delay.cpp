@@ -0,0 +1,116 @@
+// Accuracy of the read delay: the frames written by the output at sample time T are read back by
+// the input at sample time T + delay, exactly, for delays given in frames and in milliseconds. The
+// IO cycles are those of the driver, the input reads its ring `delay` frames behind its sample time
+// (see Driver::beginIOOperation()). Also checks that the strings that aren't a delay are rejected.
+#include "bench.h"
+#include "mts/ring_buffer.h"
+
+namespace {
+using namespace mts;
+
+constexpr UInt32 ring_frames = 16384;
+constexpr UInt32 channels = 2;
+
+// Sample c of the frame written at sample time t, exact in Float32 for the cycles run here.
+inline Float32 get_sample(UInt64 t, UInt32 c) {
+  return (Float32)(t * channels + c);
+}
+
+template <ring_layout Layout>
+void run(const char* text, Float64 sample_rate, UInt32 expected, UInt32 frames, bench::checks& checks) {
+  // The same bound as Driver::getMaxReadDelay().
+  const UInt32 max_delay = ring_frames - 2 * frames;
+  UInt32 delay = 0;
+  char what[128];
+
+  snprintf(what, sizeof(what), "'%s' at %.0f Hz is %u frames", text, sample_rate, expected);
+  checks.expect(parse_read_delay(text, sample_rate, max_delay, delay) && delay == expected, what);
+
+  ring_buffer<Float32, Layout> ring;
+  ring.allocate(ring_frames, channels);
+  std::vector<Float32> buffer((size_t)frames * channels);
+  UInt64 wrong = 0;
+  UInt64 checked = 0;
+
+  // The input time of a cycle is one cycle behind the current time and the output time one cycle
+  // ahead, the input is read before the output is written. The first frame written is at 2 cycles.
+  for (UInt64 current = frames; current < 8 * (UInt64)ring_frames; current += frames) {
+    const SInt64 read_time = (SInt64)(current - frames) - (SInt64)delay;
+
+    if (read_time >= 2 * (SInt64)frames) {
+      ring.read(buffer.data(), (UInt64)read_time, frames);
+
+      for (UInt32 f = 0; f < frames; f++) {
+        for (UInt32 c = 0; c < channels; c++) {
+          wrong += buffer[(size_t)f * channels + c] != get_sample((UInt64)read_time + f, c);
+        }
+      }
+
+      checked += frames;
+    }
+
+    for (UInt32 f = 0; f < frames; f++) {
+      for (UInt32 c = 0; c < channels; c++) {
+        buffer[(size_t)f * channels + c] = get_sample(current + frames + f, c);
+      }
+    }
+
+    ring.write(buffer.data(), current + frames, frames, false);
+  }
+
+  ring.free();
+
+  printf("%12s %8.0f %8u %8u %12s %10llu %8llu\n", Layout == ring_layout::planar ? "planar" : "interleaved",
+      sample_rate, frames, delay, text, (unsigned long long)checked, (unsigned long long)wrong);
+  snprintf(what, sizeof(what), "'%s' at %u frames reads every frame %u frames later", text, frames, delay);
+  checks.expect(checked > 0 && wrong == 0, what);
+}
+
+struct delay_case {
+  const char* text;
+  Float64 sample_rate;
+  UInt32 frames;
+};
+
+template <ring_layout Layout>
+void run_all(bench::checks& checks) {
+  const delay_case cases[] = {
+    { "0", 48000, 0 },
+    { "1", 48000, 1 },
+    { "480", 48000, 480 },
+    { "10ms", 48000, 480 },
+    { " 10 ms ", 48000, 480 },
+    { "2.5ms", 44100, 110 },
+    { "0.5ms", 192000, 96 },
+    { "333", 96000, 333 },
+    { "1e6", 48000, ring_frames - 2 * 512 },
+  };
+
+  for (const delay_case& c : cases) {
+    for (UInt32 frames : { 64, 512 }) {
+      // The clamp depends on the cycle.
+      const UInt32 expected = c.frames == ring_frames - 2 * 512 ? ring_frames - 2 * frames : c.frames;
+      run<Layout>(c.text, c.sample_rate, expected, frames, checks);
+    }
+  }
+}
+} // namespace
+
+int main(int argc, char** argv) {
+  mts::bench::checks checks;
+
+  printf("read delay of a %u-frame ring, %u channels\n", ring_frames, channels);
+  printf("%12s %8s %8s %8s %12s %10s %8s\n", "layout", "rate", "cycle", "delay", "text", "frames", "wrong");
+
+  run_all<mts::ring_layout::interleaved>(checks);
+  run_all<mts::ring_layout::planar>(checks);
+
+  for (const char* text : { "", "ms", "abc", "12abc", "10 s", "10msec", "-1", "-5ms", "nan", "inf", "1,5" }) {
+    UInt32 frames = 7;
+    char what[64];
+    snprintf(what, sizeof(what), "'%s' is rejected", text);
+    checks.expect(!mts::parse_read_delay(text, 48000, 1024, frames) && frames == 7, what);
+  }
+
+  return checks.get_status();
+}
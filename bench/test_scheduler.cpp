@@ -0,0 +1,216 @@
+// Injects IO load into deadline_scheduler, cycle after cycle as the driver does, and checks that
+// it degrades the stages in order, holds between its thresholds, backs off the restores of a stage
+// that doesn't fit and reports every transition as the IOLoad ('mlod') property does: from the
+// queue, one level at a time, with the load and the cycle they happened at.
+#include "bench.h"
+#include "mts/scheduler.h"
+#include <functional>
+
+namespace {
+using namespace mts;
+
+constexpr UInt32 stages = 3;
+constexpr Float64 sample_rate = 48000;
+constexpr UInt32 frames = 512;
+constexpr Float64 ticks_per_frame = 1e9 / sample_rate;
+constexpr Float64 cycle_seconds = frames / sample_rate;
+
+using scheduler = deadline_scheduler<stages>;
+
+/// The IO thread of a device whose load depends on the level of the scheduler.
+class simulation {
+public:
+  /// The load of a cycle at a level, 1 is the whole cycle.
+  using load_model = std::function<Float64(UInt32 level)>;
+
+  scheduler s;
+  std::vector<quality_transition> transitions;
+
+  inline simulation() {
+    s.set_timing(sample_rate, ticks_per_frame);
+    s.reset();
+  }
+
+  /// Runs the IO cycles of `seconds` seconds, the transitions are taken after each cycle unless
+  /// `is_read` is false. Each cycle has two IO calls, the read and the write.
+  inline void run(Float64 seconds, const load_model& model, bool is_read = true) {
+    const UInt64 cycles = (UInt64)(seconds / cycle_seconds + 0.5);
+
+    for (UInt64 i = 0; i < cycles; i++) {
+      const UInt64 ticks = (UInt64)(model(s.get_level()) * frames * ticks_per_frame);
+      s.add(m_time, frames, ticks / 4);
+      s.add(m_time, frames, ticks - ticks / 4);
+      m_time += frames;
+
+      if (is_read) {
+        take_transitions();
+      }
+    }
+
+    // The next cycle completes the last one.
+    s.add(m_time, frames, 0);
+  }
+
+  inline void take_transitions() {
+    quality_transition t;
+
+    while (s.pop_transition(t)) {
+      transitions.push_back(t);
+    }
+  }
+
+  inline Float64 get_seconds(const quality_transition& t) const { return t.sample_time / sample_rate; }
+
+private:
+  Float64 m_time = 0;
+};
+
+/// The load at level 0 is `base` plus the cost of every stage, degrading a stage removes its cost.
+simulation::load_model make_stage_model(Float64 base, Float64 cost) {
+  return [=](UInt32 level) { return base + cost * (stages - mts::min(level, stages)); };
+}
+
+void check_degrade_order(bench::checks& checks) {
+  simulation sim;
+  sim.run(5, [](UInt32) { return 0.9; });
+
+  bool is_in_order = sim.transitions.size() == stages;
+  bool is_held = true;
+
+  for (size_t i = 0; i < sim.transitions.size(); i++) {
+    const quality_transition& t = sim.transitions[i];
+    is_in_order = is_in_order && t.from == i && t.to == i + 1 && t.load > scheduler::degrade_load;
+
+    if (i > 0) {
+      const Float64 interval = sim.get_seconds(t) - sim.get_seconds(sim.transitions[i - 1]);
+      is_held = is_held && interval >= scheduler::degrade_hold_seconds - 1e-9;
+    }
+  }
+
+  bool is_degraded_in_order = true;
+
+  for (UInt32 s = 0; s < stages; s++) {
+    is_degraded_in_order = is_degraded_in_order && sim.s.is_degraded(s);
+  }
+
+  printf("overload: %zu transitions, level %u\n", sim.transitions.size(), sim.s.get_level());
+  checks.expect(is_in_order, "an overload degrades one stage at a time, in order, up to the last one");
+  checks.expect(is_held, "the degrades are degrade_hold_seconds apart");
+  checks.expect(is_degraded_in_order && sim.s.level.load() == stages, "every stage is degraded at the last level");
+  checks.expect(sim.s.transition_count.load() == stages, "the transition count is the number of transitions");
+}
+
+void check_hysteresis(bench::checks& checks) {
+  // 0.75 at full quality, 0.6 then 0.45 with one and two stages degraded.
+  simulation sim;
+  sim.run(10, make_stage_model(0.3, 0.15));
+
+  printf("stage costs: level %u after %zu transitions, load %.3f\n", sim.s.get_level(), sim.transitions.size(),
+      sim.s.load.load());
+  checks.expect(sim.s.get_level() == 2 && sim.transitions.size() == 2,
+      "the scheduler stops degrading once the load is below degrade_load");
+  checks.expect(!sim.s.is_degraded(2) && sim.s.is_degraded(1) && sim.s.is_degraded(0),
+      "the first stages are the degraded ones");
+
+  // 0.15 at level 2, 0.3 once a stage is restored: only one restore.
+  const Float64 drop = 10;
+  sim.run(20, make_stage_model(0, 0.15));
+
+  const bool is_restored = sim.transitions.size() == 3 && sim.transitions[2].from == 2 && sim.transitions[2].to == 1;
+  printf("lower load: level %u after %zu transitions\n", sim.s.get_level(), sim.transitions.size());
+  checks.expect(
+      is_restored && sim.s.get_level() == 1, "a stage is restored only while the load stays below restore_load");
+
+  if (is_restored) {
+    const quality_transition& t = sim.transitions[2];
+    checks.expect(t.load < scheduler::restore_load, "a restore happens below restore_load");
+    checks.expect(sim.get_seconds(t) - drop >= scheduler::restore_seconds,
+        "a stage is restored after restore_seconds below restore_load");
+  }
+}
+
+void check_restore_backoff(bench::checks& checks) {
+  // The first stage doesn't fit: every restore overloads again.
+  simulation sim;
+  sim.run(300, [](UInt32 level) { return level ? 0.1 : 0.8; });
+
+  std::vector<Float64> delays;
+  bool is_alternating = true;
+  Float64 last_degrade = 0;
+
+  for (size_t i = 0; i < sim.transitions.size(); i++) {
+    const quality_transition& t = sim.transitions[i];
+    const bool is_degrade = i % 2 == 0;
+    is_alternating = is_alternating && t.from == (is_degrade ? 0u : 1u) && t.to == (is_degrade ? 1u : 0u);
+
+    if (is_degrade) {
+      last_degrade = sim.get_seconds(t);
+    }
+    else {
+      delays.push_back(sim.get_seconds(t) - last_degrade);
+    }
+  }
+
+  printf("restores of a stage that doesn't fit, seconds after the degrade:");
+
+  for (Float64 d : delays) {
+    printf(" %.1f", d);
+  }
+
+  printf("\n");
+
+  // The average of the load takes a few cycles to go below restore_load.
+  bool is_backing_off = delays.size() >= 5;
+  Float64 expected = scheduler::restore_seconds;
+
+  for (Float64 d : delays) {
+    is_backing_off = is_backing_off && d >= expected && d < expected + 0.2;
+    expected = mts::min(2 * expected, scheduler::max_restore_seconds);
+  }
+
+  checks.expect(is_alternating, "the stage that doesn't fit goes back and forth");
+  checks.expect(is_backing_off, "each restore waits twice as long as the one before, up to max_restore_seconds");
+}
+
+void check_dropped_transitions(bench::checks& checks) {
+  // Nothing reads the property for an hour.
+  simulation sim;
+  sim.run(3600, [](UInt32 level) { return level ? 0.1 : 0.8; }, false);
+  sim.take_transitions();
+
+  const UInt64 count = sim.s.transition_count.load();
+  const UInt32 dropped = sim.s.dropped_transitions.load();
+
+  printf("unread for an hour: %llu transitions, %zu kept, %u dropped\n", (unsigned long long)count,
+      sim.transitions.size(), dropped);
+  checks.expect(sim.transitions.size() == scheduler::transition_capacity && count == sim.transitions.size() + dropped,
+      "the transitions beyond the queue are counted as dropped");
+  checks.expect(sim.transitions.front().from == 0 && sim.transitions.front().to == 1,
+      "the oldest transitions are the ones kept");
+}
+
+void check_disabled(bench::checks& checks) {
+  simulation sim;
+  sim.s.set_enabled(false);
+  sim.run(1, [](UInt32) { return 0.7; });
+  sim.run(0.1, [](UInt32) { return 1.5; });
+
+  printf("disabled: level %u, peak %.2f, %u overruns\n", sim.s.get_level(), sim.s.peak_load.load(),
+      sim.s.overruns.load());
+  checks.expect(sim.s.get_level() == 0 && sim.transitions.empty(), "a disabled scheduler doesn't degrade");
+  checks.expect(fabs(sim.s.peak_load.load() - 1.5) < 1e-3 && sim.s.overruns.load() == 9,
+      "a disabled scheduler still measures the peak and the overruns");
+}
+} // namespace
+
+int main(int argc, char** argv) {
+  mts::bench::checks checks;
+
+  printf("deadline_scheduler with %u stages, %u-frame cycles at %.0f kHz\n", stages, frames, sample_rate / 1000);
+  check_degrade_order(checks);
+  check_hysteresis(checks);
+  check_restore_backoff(checks);
+  check_dropped_transitions(checks);
+  check_disabled(checks);
+  return checks.get_status();
+}
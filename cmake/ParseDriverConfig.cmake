@@ -24,9 +24,31 @@ macro(ParseConfigFile Filepath prefix)
     endforeach()
 endmacro()
 
+# Sets ${prefix}_${key} to value when the config file doesn't have the key.
+macro(SetConfigDefault prefix key value)
+    if (NOT DEFINED ${prefix}_${key})
+        set(${prefix}_${key} "${value}")
+        message("${prefix}_${key} = ${value} (default)")
+    endif()
+endmacro()
+
 macro(ParseDriverConfig Filepath prefix)
     ParseConfigFile(${Filepath} ${prefix})
 
+    # Keys added after a config may have been generated.
+    SetConfigDefault(${prefix} OUTPUT_CHANNEL_LAYOUT "Stereo")
+    SetConfigDefault(${prefix} INPUT_CHANNEL_LAYOUT "Stereo")
+    SetConfigDefault(${prefix} DOWNMIX "itu")
+    SetConfigDefault(${prefix} STREAM_COUNT "1")
+    SetConfigDefault(${prefix} DITHER "false")
+    SetConfigDefault(${prefix} RING_PLANAR_LAYOUT "false")
+    SetConfigDefault(${prefix} RING_STORAGE "native")
+    SetConfigDefault(${prefix} LATENCY_PROFILE "balanced")
+    SetConfigDefault(${prefix} VOLUME_RAMP_MS "10.0")
+    SetConfigDefault(${prefix} ADAPTIVE_QUALITY "true")
+    SetConfigDefault(${prefix} IO_TRACE "false")
+    SetConfigDefault(${prefix} IO_CAPTURE "false")
+
     set(${prefix}_DEVICE_UID "${${prefix}_DEVICE_UID_PREFIX}Device_UID")
     set(${prefix}_BOX_UID "${${prefix}_DEVICE_UID_PREFIX}Box_UID")
     set(${prefix}_DEVICE_MODEL_UID "${${prefix}_DEVICE_UID_PREFIX}DeviceModel_UID")
@@ -1,21 +1,38 @@
 #include "config.h"
 #include "mts/common.h"
+#include "mts/format.h"
+#include "mts/ring_buffer.h"
+#include "mts/automation.h"
+#include "mts/routing.h"
+#include "mts/clients.h"
+#include "mts/inserts.h"
+#include "mts/loudness.h"
+#include "mts/downmix.h"
+#include "mts/scheduler.h"
 #include "mts/object/mute_control.h"
 #include "mts/object/volume_control.h"
 #include "mts/object/box.h"
 #include "mts/object/device.h"
 #include "mts/object/stream.h"
 #include "mts/object/plugin.h"
+#include "mts/trace.h"
+#include "mts/capture.h"
 
 //
 // Config validation.
 //
 namespace mts::config {
-static_assert(bits_per_channel == 32, "only 32 bits is currently supported");
-static_assert(is_power_of_two(ring_buffer_size), "ringBufferSize must be a power of two");
-static_assert(is_power_of_two(ring_buffer_frame_size), "ringBufferFrameSize must be a power of two");
+static_assert(bits_per_channel == 32 || bits_per_channel == 64, "only 32 and 64 bits floats are supported");
+static_assert(is_all_latency_profiles_valid(), "latency profile sizes must be powers of two and fit in the period");
 static_assert(is_default_sample_rate_supported(), "defaultSampleRate must be a supported sample rate");
 static_assert(is_all_sample_rate_integers(), "supported sample rates must be integers");
+static_assert(stream_count > 0, "the device needs at least one stream pair");
+static_assert(get_layout_channel_count(output_channel_layout) != 0
+        && get_layout_channel_count(output_channel_layout) <= channel_count,
+    "output_channel_layout must be a supported layout of at most channel_count channels");
+static_assert(get_layout_channel_count(input_channel_layout) != 0
+        && get_layout_channel_count(input_channel_layout) <= channel_count,
+    "input_channel_layout must be a supported layout of at most channel_count channels");
 } // namespace mts::config.
 
 /// The plug-in is responsible for defining the AudioObjectIDs to be used as handles for the
@@ -26,19 +43,696 @@ enum class ObjectID : AudioObjectID {
   Box,
   Device,
 
-  // Device input scope.
-  StreamInput,
+  // Master controls.
   VolumeInputMaster,
   MuteInputMaster,
-
-  // Device output scope.
-  StreamOutput,
   VolumeOutputMaster,
-  MuteOutputMaster
+  MuteOutputMaster,
+
+  // Streams of pair k are StreamInput + k and StreamOutput + k, see getStreamPair().
+  StreamInput,
+  StreamOutput = StreamInput + mts::config::stream_count,
+
+  // Volume of each device channel, element c + 1 is channel c.
+  VolumeInputChannel = StreamOutput + mts::config::stream_count,
+  VolumeOutputChannel = VolumeInputChannel + mts::config::device_channel_count
+};
+
+/// Direction and pair of a stream from its object ID, or false if it isn't a stream. The IDs of
+/// the streams are contiguous so this doesn't look at the objects.
+inline bool getStreamPair(AudioObjectID objID, mts::direction& dir, UInt32& pair) noexcept {
+  // The IDs below StreamInput wrap around.
+  const UInt32 index = objID - static_cast<AudioObjectID>(ObjectID::StreamInput);
+
+  if (index >= 2 * mts::config::stream_count) {
+    return false;
+  }
+
+  const bool isInput = index < mts::config::stream_count;
+  dir = isInput ? mts::direction::input : mts::direction::output;
+  pair = isInput ? index : index - mts::config::stream_count;
+  return true;
+}
+
+/// Custom device properties. The HAL only allows CFString and CFPropertyList values for these.
+enum class CustomProperty : AudioObjectPropertySelector {
+  /// Setting any value writes the IO trace to the temporary directory, the value is the path of
+  /// the last trace file.
+  IOTraceDump = 'mtrd',
+
+  /// Setting any value writes the captured IO calls to the temporary directory, the value is the
+  /// path of the last capture file.
+  IOCaptureDump = 'mcap',
+
+  /// Name of the latency profile: "ultra_low", "balanced" or "power_saving". Setting it goes
+  /// through a device configuration change.
+  LatencyProfile = 'mlat',
+
+  /// Delay of the input stream behind the output stream, in frames ("480") or in milliseconds
+  /// ("10ms"). The value is always in frames. Setting it goes through a device configuration change.
+  ReadDelay = 'mdly',
+
+  /// Time stamped master volume and mute change, a CFDictionary with the optional keys "scope"
+  /// ("input" or "output", both when absent), "volume" (dB), "mute" (boolean), "sample_time" (of the
+  /// stream of the scope) or "host_time", "ramp_ms" and "shape" ("linear" or "exponential"). The value
+  /// has an "input" and an "output" dictionary with the current "volume" and "mute".
+  GainAutomation = 'mgan',
+
+  /// Routing matrix from the output channels to the input channels of a stream pair, used by every
+  /// pair. It is applied when reading the ring, which holds the output channels, instead of the
+  /// downmix. A CFArray of CFDictionary with a "source" and a "destination" channel (starting at 1)
+  /// and an optional "gain" (1 by default). An empty array is the identity. The matrix is saved in
+  /// the host storage, setting it goes through a device configuration change.
+  Routing = 'mrte',
+
+  /// Stream pairs that only capture some clients, a CFArray of CFDictionary with a "bundle_id" and
+  /// a "stream" pair (starting at 1). What a matching client sends to the first pair, the one
+  /// shared by every client, is also mixed into the ring of its pair instead of the output of that
+  /// pair. The rules are saved in the host storage, setting them goes through a device
+  /// configuration change.
+  ClientRules = 'mcli',
+
+  /// IO statistics of every client, a CFData with an mts::client_stats_header followed by one
+  /// mts::client_stats_record per client (see mts/clients.h). Reading it starts the peaks again.
+  ClientStats = 'mcst',
+
+  /// Insert chain applied to the output of every stream pair before it is written to the ring, a
+  /// CFDictionary with the optional nodes "high_pass" ({"frequency"}), "eq" (a CFArray of at most
+  /// 4 bands {"type": "peak", "low_shelf" or "high_shelf", "frequency", "gain" in dB, "q"}) and
+  /// "convolution" ({"impulse", a CFData of native Float32 frames with "channels" 1 or channel_count
+  /// interleaved channels, "sample_rate", 0 for the rate of the device, "block_size", a power of
+  /// two, and "gain" in dB}) and "limiter" ({"ceiling" in dBTP, "release_ms", "lookahead_ms"}). A
+  /// missing node is disabled. The
+  /// value also has a "load" dictionary with the "average_us" and "worst_us" time of each enabled
+  /// node per IO cycle, and "limiter_reduction_db", the largest gain reduction of the limiter since
+  /// the last read. The limiter delays the loopback by its lookahead and 6 frames, the read delay
+  /// hides as much of it as its length. The chain is saved in the host storage, setting it goes
+  /// through a device configuration change since it can change the latency.
+  Inserts = 'mins',
+
+  /// Loudness of the output of every stream pair by EBU R128, a CFDictionary with the "target" in
+  /// LUFS, "auto_gain" and "streams", a CFArray with the "momentary", "short_term" and
+  /// "integrated" loudness in LUFS (missing while unknown or below -70 LUFS) and the auto "gain" in
+  /// dB of each pair. The loudness is measured before the auto gain and the inserts. Setting
+  /// "target" or "auto_gain" saves them in the host storage, setting "reset" to true starts the
+  /// integrated loudness again.
+  Loudness = 'mlud',
+
+  /// Downmix applied when reading the channels of the output layout as the input layout, a
+  /// CFDictionary with the "mode" ("none", "itu" or "binaural"), the "center_db" and "surround_db"
+  /// gains of the folded or rendered channels, "lfe" (false leaves the LFE out) and its "lfe_db"
+  /// gain. The value also has the "output_layout" and "input_layout" tags of the config. A routing
+  /// other than the identity replaces it. The settings are saved in the host storage, setting them
+  /// goes through a device configuration change.
+  Downmix = 'mdmx',
+
+  /// Load of the IO thread, a CFDictionary with the "budget_us" of a cycle at the last buffer size,
+  /// the rolling "load" (1 is the whole cycle), the "peak_load" and the "overruns", the cycles that
+  /// took longer than their duration, since the last read, "adaptive" (the adaptive_quality of the
+  /// config), the quality "level" and "stages", a CFArray with the "name" of each optional stage in
+  /// priority order and whether it is "degraded". "transitions" holds the level changes since the
+  /// last read ({"sample_time", "host_time", "from", "to", "load"}), "transition_count" counts them
+  /// all and "dropped_transitions" the ones that didn't fit between two reads. Read only.
+  IOLoad = 'mlod'
+};
+
+/// Device configuration changes requested with RequestDeviceConfigurationChange(). The action is
+/// passed in inChangeAction and its value in inChangeInfo.
+enum class ConfigChange : UInt64 {
+  /// inChangeInfo is the new sample rate.
+  SampleRate,
+
+  /// inChangeInfo is an encoded StreamFormatChange.
+  StreamFormat,
+
+  /// inChangeInfo is the new mts::config::latency_profile_type.
+  LatencyProfile,
+
+  /// inChangeInfo is the new input safety offset in frames.
+  SafetyOffset,
+
+  /// inChangeInfo is the new read delay in frames.
+  ReadDelay,
+
+  /// inChangeInfo is a RoutingChange allocated with new, deleted by the perform or the abort.
+  Routing,
+
+  /// inChangeInfo is the retained CFArray of the rules, released by the perform or the abort.
+  ClientRules,
+
+  /// inChangeInfo is an mts::downmix_settings allocated with new, deleted by the perform or the abort.
+  Downmix,
+
+  /// inChangeInfo is an InsertsChange allocated with new, deleted by the perform or the abort.
+  Inserts
+};
+
+/// New format of one of the streams. It is small enough to be passed by value in inChangeInfo.
+struct StreamFormatChange {
+  bool isInput;
+  UInt32 pair;
+  mts::stream_format format;
+
+  inline uintptr_t encode() const noexcept {
+    return (uintptr_t)isInput | ((uintptr_t)format.non_interleaved << 1) | ((uintptr_t)format.format << 8)
+        | ((uintptr_t)pair << 16);
+  }
+
+  static inline StreamFormatChange decode(void* info) noexcept {
+    const uintptr_t value = (uintptr_t)info;
+    return { (value & 1) != 0, (UInt32)(value >> 16),
+      { static_cast<mts::sample_format>((value >> 8) & 0xFF), (value & 2) != 0 } };
+  }
 };
 
 using Float = std::conditional_t<mts::config::bits_per_channel == 32, Float32, Float64>;
 
+/// Format of the streams until a client changes it.
+inline constexpr mts::stream_format defaultStreamFormat
+    = { mts::config::bits_per_channel == 32 ? mts::sample_format::float32 : mts::sample_format::float64, false };
+
+using RingSample = std::conditional_t<mts::config::ring_storage == mts::config::ring_storage_type::int16, SInt16,
+    std::conditional_t<mts::config::ring_storage == mts::config::ring_storage_type::half, mts::dsp::half,
+        std::conditional_t<mts::config::ring_storage == mts::config::ring_storage_type::bfloat16, mts::dsp::bfloat16,
+            Float>>>;
+
+using RingBuffer = mts::ring_buffer<RingSample,
+    mts::config::ring_planar_layout ? mts::ring_layout::planar : mts::ring_layout::interleaved>;
+
+using ChannelGains = mts::gain_automation<Float, mts::config::channel_count>;
+
+/// The ring of a stream pair and the last IO cycles of its streams.
+struct StreamPair {
+  RingBuffer ring;
+  Float64 lastOutputSampleTime = 0;
+  UInt32 lastOutputFrameSize = 0;
+  Float64 lastInputSampleTime = 0;
+  Boolean isBufferClear = true;
+
+  // The output is written this many frames before its sample time, the part of the delay of the
+  // inserts that the read delay hides. Only changed with IO stopped, see updateWriteDelays().
+  UInt32 writeDelay = 0;
+
+  // A captured pair writes the sum of the clients routed to it, interleaved, to its ring instead
+  // of the output of its stream. clientMixSampleTime is the IO cycle of the sum.
+  bool isCaptured = false;
+  Float* clientMix = nullptr;
+  Float64 clientMixSampleTime = -1;
+};
+
+using ClientRegistry = mts::client_registry<256>;
+
+/// An IO operation of a client, taken by BeginIOOperation for the DoIOOperation of each stream and
+/// finished by EndIOOperation. Only used by the IO thread.
+///
+/// What is the same for every stream is looked up once: the client, the cycle times, the controls
+/// and where the frames of the cycle are in the rings, which all have the same size. Each stream
+/// adds its results and EndIOOperation publishes them once, the cycle times of the pairs and the
+/// statistics of the client.
+struct IOOperation {
+  bool isValid = false;
+  UInt32 clientID = 0;
+  UInt32 operationID = 0;
+  UInt32 frames = 0;
+  Float64 currentTime = 0;
+
+  ClientRegistry::client* client = nullptr;
+
+  // The input time for ReadInput, the output time otherwise.
+  AudioTimeStamp time = {};
+
+  // First frame of the operation in the rings, after the read delay for ReadInput, and its span.
+  // The span is only valid when the sample time isn't negative.
+  Float64 ringSampleTime = 0;
+  mts::ring_span span = {};
+
+  bool isRouted = false;
+
+  // A reader more than this behind the writer isn't late, the writer is stopped.
+  Float64 maxReadDeficit = 0;
+
+  // Results of the streams.
+  bool isPairDone[mts::config::stream_count] = {};
+  UInt32 pairCount = 0;
+  Float64 readDeficit = 0;
+  Float32 peak = 0;
+};
+
+using RoutingMatrix = mts::routing_matrix<Float, mts::config::channel_count>;
+
+using InsertChain = mts::insert_chain<Float, mts::config::channel_count>;
+using LoudnessMeter = mts::loudness_meter<Float, mts::config::channel_count>;
+using LoudnessMonitor = mts::loudness_monitor<mts::config::stream_count>;
+using Downmix = mts::downmix<Float, mts::config::channel_count>;
+
+/// Optional stages of the IO path, in the order the scheduler degrades them. A degraded loudness
+/// meter doesn't measure and the auto gain holds, a degraded binaural downmix is the itu one and a
+/// degraded convolution only delays.
+enum class IOStage : UInt32 { LoudnessMeter, Binaural, Convolution };
+inline constexpr UInt32 ioStageCount = 3;
+
+using IOScheduler = mts::deadline_scheduler<ioStageCount>;
+
+/// A routing matrix compiled when it is set and the CFArray it comes from.
+struct RoutingChange {
+  RoutingMatrix matrix;
+  CFArrayRef routes;
+};
+
+/// An insert chain and the retained CFData its impulse points into, if any.
+struct InsertsChange {
+  mts::insert_config config;
+  CFDataRef impulse;
+};
+
+/// Reads a CFNumber or a CFBoolean of a dictionary.
+template <typename T>
+inline bool getDictionaryNumber(CFDictionaryRef dict, CFStringRef key, CFNumberType type, T& value) {
+  CFTypeRef v = CFDictionaryGetValue(dict, key);
+
+  if (!v) {
+    return false;
+  }
+
+  if (CFGetTypeID(v) == CFBooleanGetTypeID()) {
+    value = (T)CFBooleanGetValue((CFBooleanRef)v);
+    return true;
+  }
+
+  return CFGetTypeID(v) == CFNumberGetTypeID() && CFNumberGetValue((CFNumberRef)v, type, &value);
+}
+
+/// Checks the value of the ClientRules custom property.
+inline bool isValidClientRules(CFPropertyListRef value) {
+  if (!value || CFGetTypeID(value) != CFArrayGetTypeID()) {
+    return false;
+  }
+
+  CFArrayRef rules = (CFArrayRef)value;
+
+  for (CFIndex i = 0; i < CFArrayGetCount(rules); i++) {
+    CFTypeRef item = CFArrayGetValueAtIndex(rules, i);
+    SInt32 stream = 0;
+
+    if (!item || CFGetTypeID(item) != CFDictionaryGetTypeID()
+        || !getDictionaryNumber((CFDictionaryRef)item, CFSTR("stream"), kCFNumberSInt32Type, stream)
+        || stream < 1 || stream > (SInt32)mts::config::stream_count) {
+      return false;
+    }
+
+    CFTypeRef bundleID = CFDictionaryGetValue((CFDictionaryRef)item, CFSTR("bundle_id"));
+
+    if (!bundleID || CFGetTypeID(bundleID) != CFStringGetTypeID()) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+/// Stream pair of the first rule matching a bundle ID, the rules must be valid.
+inline UInt32 findClientRoute(CFArrayRef rules, CFStringRef bundleID) {
+  if (!rules || !bundleID) {
+    return ClientRegistry::no_route;
+  }
+
+  for (CFIndex i = 0; i < CFArrayGetCount(rules); i++) {
+    CFDictionaryRef rule = (CFDictionaryRef)CFArrayGetValueAtIndex(rules, i);
+    SInt32 stream = 0;
+    getDictionaryNumber(rule, CFSTR("stream"), kCFNumberSInt32Type, stream);
+
+    if (CFStringCompare((CFStringRef)CFDictionaryGetValue(rule, CFSTR("bundle_id")), bundleID, 0)
+        == kCFCompareEqualTo) {
+      return (UInt32)stream - 1;
+    }
+  }
+
+  return ClientRegistry::no_route;
+}
+
+/// Compiles the value of the Routing custom property.
+inline bool compileRoutes(CFPropertyListRef value, RoutingMatrix& matrix) {
+  if (!value || CFGetTypeID(value) != CFArrayGetTypeID()) {
+    return false;
+  }
+
+  CFArrayRef array = (CFArrayRef)value;
+  const CFIndex count = CFArrayGetCount(array);
+
+  if (count > RoutingMatrix::max_routes) {
+    return false;
+  }
+
+  mts::route routes[RoutingMatrix::max_routes];
+
+  for (CFIndex i = 0; i < count; i++) {
+    CFTypeRef item = CFArrayGetValueAtIndex(array, i);
+    SInt32 source = 0;
+    SInt32 destination = 0;
+    Float32 gain = 1;
+
+    if (!item || CFGetTypeID(item) != CFDictionaryGetTypeID()
+        || !getDictionaryNumber((CFDictionaryRef)item, CFSTR("source"), kCFNumberSInt32Type, source)
+        || !getDictionaryNumber((CFDictionaryRef)item, CFSTR("destination"), kCFNumberSInt32Type, destination)
+        || source < 1 || destination < 1) {
+      return false;
+    }
+
+    getDictionaryNumber((CFDictionaryRef)item, CFSTR("gain"), kCFNumberFloat32Type, gain);
+    routes[i] = { (UInt32)source - 1, (UInt32)destination - 1, gain };
+  }
+
+  return matrix.compile(routes, (UInt32)count);
+}
+
+inline CFStringRef getBiquadTypeName(mts::dsp::biquad_type type) {
+  switch (type) {
+  case mts::dsp::biquad_type::high_pass:
+    return CFSTR("high_pass");
+  case mts::dsp::biquad_type::peak:
+    return CFSTR("peak");
+  case mts::dsp::biquad_type::low_shelf:
+    return CFSTR("low_shelf");
+  case mts::dsp::biquad_type::high_shelf:
+    return CFSTR("high_shelf");
+  }
+
+  return CFSTR("");
+}
+
+/// Parses the value of the Inserts custom property, the missing parameters keep their default.
+/// The impulse of the convolution points into `impulse`, which isn't retained.
+inline bool parseInserts(CFPropertyListRef value, mts::insert_config& config, CFDataRef& impulse) {
+  if (!value || CFGetTypeID(value) != CFDictionaryGetTypeID()) {
+    return false;
+  }
+
+  CFDictionaryRef dict = (CFDictionaryRef)value;
+  config = mts::insert_config{};
+  impulse = nullptr;
+
+  if (CFTypeRef node = CFDictionaryGetValue(dict, CFSTR("high_pass"))) {
+    if (CFGetTypeID(node) != CFDictionaryGetTypeID()) {
+      return false;
+    }
+
+    config.has_high_pass = true;
+    getDictionaryNumber((CFDictionaryRef)node, CFSTR("frequency"), kCFNumberFloat32Type, config.high_pass_frequency);
+  }
+
+  if (CFTypeRef node = CFDictionaryGetValue(dict, CFSTR("eq"))) {
+    if (CFGetTypeID(node) != CFArrayGetTypeID() || CFArrayGetCount((CFArrayRef)node) > mts::insert_eq_band_count) {
+      return false;
+    }
+
+    for (CFIndex i = 0; i < CFArrayGetCount((CFArrayRef)node); i++) {
+      CFTypeRef item = CFArrayGetValueAtIndex((CFArrayRef)node, i);
+
+      if (!item || CFGetTypeID(item) != CFDictionaryGetTypeID()) {
+        return false;
+      }
+
+      mts::insert_eq_band& band = config.eq_bands[config.eq_band_count++];
+      CFTypeRef type = CFDictionaryGetValue((CFDictionaryRef)item, CFSTR("type"));
+
+      if (type) {
+        const mts::dsp::biquad_type types[]
+            = { mts::dsp::biquad_type::peak, mts::dsp::biquad_type::low_shelf, mts::dsp::biquad_type::high_shelf };
+        bool isKnown = false;
+
+        for (mts::dsp::biquad_type t : types) {
+          if (CFGetTypeID(type) == CFStringGetTypeID()
+              && CFStringCompare((CFStringRef)type, getBiquadTypeName(t), 0) == kCFCompareEqualTo) {
+            band.type = t;
+            isKnown = true;
+          }
+        }
+
+        if (!isKnown) {
+          return false;
+        }
+      }
+
+      getDictionaryNumber((CFDictionaryRef)item, CFSTR("frequency"), kCFNumberFloat32Type, band.frequency);
+      getDictionaryNumber((CFDictionaryRef)item, CFSTR("gain"), kCFNumberFloat32Type, band.gain_db);
+      getDictionaryNumber((CFDictionaryRef)item, CFSTR("q"), kCFNumberFloat32Type, band.q);
+    }
+  }
+
+  if (CFTypeRef node = CFDictionaryGetValue(dict, CFSTR("convolution"))) {
+    if (CFGetTypeID(node) != CFDictionaryGetTypeID()) {
+      return false;
+    }
+
+    CFTypeRef data = CFDictionaryGetValue((CFDictionaryRef)node, CFSTR("impulse"));
+    getDictionaryNumber((CFDictionaryRef)node, CFSTR("channels"), kCFNumberSInt32Type, config.impulse_channels);
+    getDictionaryNumber((CFDictionaryRef)node, CFSTR("sample_rate"), kCFNumberFloat64Type, config.impulse_sample_rate);
+    getDictionaryNumber(
+        (CFDictionaryRef)node, CFSTR("block_size"), kCFNumberSInt32Type, config.convolution_block_size);
+    getDictionaryNumber((CFDictionaryRef)node, CFSTR("gain"), kCFNumberFloat32Type, config.convolution_gain_db);
+
+    if (!data || CFGetTypeID(data) != CFDataGetTypeID()
+        || (config.impulse_channels != 1 && config.impulse_channels != mts::config::channel_count)) {
+      return false;
+    }
+
+    const size_t frameSize = config.impulse_channels * sizeof(Float32);
+    const size_t size = (size_t)CFDataGetLength((CFDataRef)data);
+
+    if (size == 0 || size % frameSize || size / frameSize > mts::dsp::partitioned_convolver::max_impulse_frames) {
+      return false;
+    }
+
+    impulse = (CFDataRef)data;
+    config.impulse = (const Float32*)CFDataGetBytePtr(impulse);
+    config.impulse_frames = (UInt32)(size / frameSize);
+  }
+
+  if (CFTypeRef node = CFDictionaryGetValue(dict, CFSTR("limiter"))) {
+    if (CFGetTypeID(node) != CFDictionaryGetTypeID()) {
+      return false;
+    }
+
+    config.has_limiter = true;
+    getDictionaryNumber((CFDictionaryRef)node, CFSTR("ceiling"), kCFNumberFloat32Type, config.limiter_ceiling_db);
+    getDictionaryNumber((CFDictionaryRef)node, CFSTR("release_ms"), kCFNumberFloat32Type, config.limiter_release_ms);
+    getDictionaryNumber(
+        (CFDictionaryRef)node, CFSTR("lookahead_ms"), kCFNumberFloat32Type, config.limiter_lookahead_ms);
+  }
+
+  return true;
+}
+
+/// Adds a CFNumber to a dictionary.
+inline void setDictionaryNumber(CFMutableDictionaryRef dict, CFStringRef key, Float64 value) {
+  CFNumberRef number = CFNumberCreate(kCFAllocatorDefault, kCFNumberFloat64Type, &value);
+  CFDictionarySetValue(dict, key, number);
+  CFRelease(number);
+}
+
+inline CFMutableDictionaryRef createMutableDictionary() {
+  return CFDictionaryCreateMutable(
+      kCFAllocatorDefault, 0, &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
+}
+
+/// Value of the Inserts custom property, without the load. `impulse` is the data of the impulse of
+/// the convolution.
+inline CFMutableDictionaryRef copyInsertsDictionary(const mts::insert_config& config, CFDataRef impulse) {
+  CFMutableDictionaryRef dict = createMutableDictionary();
+
+  if (config.has_high_pass) {
+    CFMutableDictionaryRef node = createMutableDictionary();
+    setDictionaryNumber(node, CFSTR("frequency"), config.high_pass_frequency);
+    CFDictionarySetValue(dict, CFSTR("high_pass"), node);
+    CFRelease(node);
+  }
+
+  if (config.eq_band_count) {
+    CFMutableArrayRef bands = CFArrayCreateMutable(kCFAllocatorDefault, 0, &kCFTypeArrayCallBacks);
+
+    for (UInt32 i = 0; i < config.eq_band_count; i++) {
+      CFMutableDictionaryRef band = createMutableDictionary();
+      CFDictionarySetValue(band, CFSTR("type"), getBiquadTypeName(config.eq_bands[i].type));
+      setDictionaryNumber(band, CFSTR("frequency"), config.eq_bands[i].frequency);
+      setDictionaryNumber(band, CFSTR("gain"), config.eq_bands[i].gain_db);
+      setDictionaryNumber(band, CFSTR("q"), config.eq_bands[i].q);
+      CFArrayAppendValue(bands, band);
+      CFRelease(band);
+    }
+
+    CFDictionarySetValue(dict, CFSTR("eq"), bands);
+    CFRelease(bands);
+  }
+
+  if (impulse) {
+    CFMutableDictionaryRef node = createMutableDictionary();
+    CFDictionarySetValue(node, CFSTR("impulse"), impulse);
+    setDictionaryNumber(node, CFSTR("channels"), config.impulse_channels);
+    setDictionaryNumber(node, CFSTR("sample_rate"), config.impulse_sample_rate);
+    setDictionaryNumber(node, CFSTR("block_size"), config.convolution_block_size);
+    setDictionaryNumber(node, CFSTR("gain"), config.convolution_gain_db);
+    CFDictionarySetValue(dict, CFSTR("convolution"), node);
+    CFRelease(node);
+  }
+
+  if (config.has_limiter) {
+    CFMutableDictionaryRef node = createMutableDictionary();
+    setDictionaryNumber(node, CFSTR("ceiling"), config.limiter_ceiling_db);
+    setDictionaryNumber(node, CFSTR("release_ms"), config.limiter_release_ms);
+    setDictionaryNumber(node, CFSTR("lookahead_ms"), config.limiter_lookahead_ms);
+    CFDictionarySetValue(dict, CFSTR("limiter"), node);
+    CFRelease(node);
+  }
+
+  return dict;
+}
+
+/// Value of the Loudness custom property saved in the host storage.
+inline CFMutableDictionaryRef copyLoudnessSettings(const LoudnessMonitor& monitor) {
+  CFMutableDictionaryRef dict = createMutableDictionary();
+  setDictionaryNumber(dict, CFSTR("target"), monitor.get_target());
+  CFDictionarySetValue(dict, CFSTR("auto_gain"), monitor.is_auto_gain() ? kCFBooleanTrue : kCFBooleanFalse);
+  return dict;
+}
+
+/// Applies the settings of a value of the Loudness custom property, the missing ones are kept.
+inline bool setLoudnessSettings(CFPropertyListRef value, LoudnessMonitor& monitor) {
+  if (!value || CFGetTypeID(value) != CFDictionaryGetTypeID()) {
+    return false;
+  }
+
+  CFDictionaryRef dict = (CFDictionaryRef)value;
+  Float32 target;
+  SInt32 flag;
+
+  if (getDictionaryNumber(dict, CFSTR("target"), kCFNumberFloat32Type, target)) {
+    monitor.set_target(mts::clamp(target, -70.0f, 0.0f));
+  }
+
+  if (getDictionaryNumber(dict, CFSTR("auto_gain"), kCFNumberSInt32Type, flag)) {
+    monitor.set_auto_gain(flag != 0);
+  }
+
+  if (getDictionaryNumber(dict, CFSTR("reset"), kCFNumberSInt32Type, flag) && flag) {
+    monitor.request_reset();
+  }
+
+  return true;
+}
+
+/// Adds a loudness to a dictionary, unless it is unknown.
+inline void setDictionaryLoudness(CFMutableDictionaryRef dict, CFStringRef key, const std::atomic<Float32>& lufs) {
+  const Float32 value = lufs.load(std::memory_order_relaxed);
+
+  if (value != mts::loudness_none) {
+    setDictionaryNumber(dict, key, value);
+  }
+}
+
+/// Layout of the channels of a stream pair in a scope.
+inline AudioChannelLayoutTag getChannelLayout(AudioObjectPropertyScope scope) {
+  return scope == kAudioObjectPropertyScopeInput ? mts::config::input_channel_layout
+                                                 : mts::config::output_channel_layout;
+}
+
+inline mts::downmix_mode getDefaultDownmixMode() {
+  switch (mts::config::default_downmix) {
+  case mts::config::downmix_type::none:
+    return mts::downmix_mode::none;
+  case mts::config::downmix_type::itu:
+    return mts::downmix_mode::itu;
+  case mts::config::downmix_type::binaural:
+    return mts::downmix_mode::binaural;
+  }
+
+  return mts::downmix_mode::itu;
+}
+
+inline CFStringRef getDownmixModeName(mts::downmix_mode mode) {
+  switch (mode) {
+  case mts::downmix_mode::none:
+    return CFSTR("none");
+  case mts::downmix_mode::itu:
+    return CFSTR("itu");
+  case mts::downmix_mode::binaural:
+    return CFSTR("binaural");
+  }
+
+  return CFSTR("");
+}
+
+/// Applies a value of the Downmix custom property to `settings`, the missing keys are kept.
+inline bool parseDownmixSettings(CFPropertyListRef value, mts::downmix_settings& settings) {
+  if (!value || CFGetTypeID(value) != CFDictionaryGetTypeID()) {
+    return false;
+  }
+
+  CFDictionaryRef dict = (CFDictionaryRef)value;
+
+  if (CFTypeRef mode = CFDictionaryGetValue(dict, CFSTR("mode"))) {
+    if (CFGetTypeID(mode) != CFStringGetTypeID()) {
+      return false;
+    }
+
+    bool isFound = false;
+
+    for (mts::downmix_mode m : { mts::downmix_mode::none, mts::downmix_mode::itu, mts::downmix_mode::binaural }) {
+      if (CFStringCompare((CFStringRef)mode, getDownmixModeName(m), 0) == kCFCompareEqualTo) {
+        settings.mode = m;
+        isFound = true;
+      }
+    }
+
+    if (!isFound) {
+      return false;
+    }
+  }
+
+  SInt32 lfe;
+  getDictionaryNumber(dict, CFSTR("center_db"), kCFNumberFloat32Type, settings.center_db);
+  getDictionaryNumber(dict, CFSTR("surround_db"), kCFNumberFloat32Type, settings.surround_db);
+  getDictionaryNumber(dict, CFSTR("lfe_db"), kCFNumberFloat32Type, settings.lfe_db);
+
+  if (getDictionaryNumber(dict, CFSTR("lfe"), kCFNumberSInt32Type, lfe)) {
+    settings.has_lfe = lfe != 0;
+  }
+
+  settings.center_db = mts::clamp(settings.center_db, -96.0f, 12.0f);
+  settings.surround_db = mts::clamp(settings.surround_db, -96.0f, 12.0f);
+  settings.lfe_db = mts::clamp(settings.lfe_db, -96.0f, 12.0f);
+  return true;
+}
+
+/// Value of the Downmix custom property saved in the host storage.
+inline CFMutableDictionaryRef copyDownmixSettings(const mts::downmix_settings& settings) {
+  CFMutableDictionaryRef dict = createMutableDictionary();
+  CFDictionarySetValue(dict, CFSTR("mode"), getDownmixModeName(settings.mode));
+  setDictionaryNumber(dict, CFSTR("center_db"), settings.center_db);
+  setDictionaryNumber(dict, CFSTR("surround_db"), settings.surround_db);
+  CFDictionarySetValue(dict, CFSTR("lfe"), settings.has_lfe ? kCFBooleanTrue : kCFBooleanFalse);
+  setDictionaryNumber(dict, CFSTR("lfe_db"), settings.lfe_db);
+  return dict;
+}
+
+inline CFStringRef getLatencyProfileName(mts::config::latency_profile_type type) {
+  switch (type) {
+  case mts::config::latency_profile_type::ultra_low:
+    return CFSTR("ultra_low");
+  case mts::config::latency_profile_type::balanced:
+    return CFSTR("balanced");
+  case mts::config::latency_profile_type::power_saving:
+    return CFSTR("power_saving");
+  }
+
+  return CFSTR("");
+}
+
+/// Records begin and end events of the IO calls when io_trace is enabled in the config.
+using io_trace_scope = mts::trace::scope<mts::config::io_trace>;
+
+/// Captures the DoIOOperation calls when io_capture is enabled in the config.
+using io_capture_scope = mts::capture::io_scope<mts::config::io_capture>;
+
 ///
 /// An AudioServerPlugIn is a CFPlugIn that is loaded by the host process as a driver. The plug-in
 /// bundle is installed in /Library/Audio/Plug-Ins/HAL. The bundle's name has the suffix ".driver".
@@ -106,23 +800,55 @@ public:
   inline CFStringRef get_box_name() const noexcept { return m_boxName; }
   inline UInt64 getIoRunning() const noexcept { return m_ioRunning; }
   inline Float64 get_sample_rate() const noexcept { return m_sampleRate; }
-  inline bool isInputStreamActive() const noexcept { return m_streamInputActive; }
-  inline void setInputStreamActive(bool active) noexcept { m_streamInputActive = active; }
-  inline bool isOutputStreamActive() const noexcept { return m_streamOutputActive; }
-  inline void setOutputStreamActive(bool active) noexcept { m_streamOutputActive = active; }
-  inline void setMasterMute(bool muted) noexcept { m_muteMasterValue = muted; }
-  inline bool isMasterMuted() const noexcept { return m_muteMasterValue; }
-  inline Float32 getMasterVolume() const noexcept { return m_volumeMasterValue; }
-  inline void setMasterVolume(Float32 value) noexcept { m_volumeMasterValue = value; }
-
-  inline Float32 getMasterVolumeDecibel() const noexcept {
+  inline bool isStreamActive(mts::direction dir, UInt32 pair) const noexcept {
+    return m_streamActive[scopeIndex(dir)][pair];
+  }
+  inline void setStreamActive(mts::direction dir, UInt32 pair, bool active) noexcept {
+    m_streamActive[scopeIndex(dir)][pair] = active;
+  }
+  inline mts::stream_format getStreamFormat(mts::direction dir, UInt32 pair) const noexcept {
+    return m_streamFormats[scopeIndex(dir)][pair];
+  }
+  inline void setMuted(mts::direction dir, bool muted) noexcept { m_muted[scopeIndex(dir)] = muted; }
+  inline bool isMuted(mts::direction dir) const noexcept { return m_muted[scopeIndex(dir)]; }
+  inline Float32 getVolume(mts::direction dir, UInt32 element) const noexcept {
+    return m_volumes[scopeIndex(dir)][element];
+  }
+  inline void setVolume(mts::direction dir, UInt32 element, Float32 value) noexcept {
+    m_volumes[scopeIndex(dir)][element] = value;
+  }
+  inline mts::config::latency_profile_type getLatencyProfileType() const noexcept { return m_latencyProfile; }
+  inline UInt32 getReadDelay() const noexcept { return m_readDelay; }
+  inline UInt32 getInputLatency() const noexcept {
+    return m_readDelay + (m_insertLatency > m_readDelay ? m_insertLatency - m_readDelay : 0);
+  }
+  inline UInt32 getInputSafetyOffset() const noexcept { return m_inputSafetyOffset; }
+  inline CFArrayRef getRoutes() const noexcept { return m_routes; }
+  inline CFArrayRef getClientRules() const noexcept { return m_clientRules; }
+  inline const mts::insert_config& getInsertConfig() const noexcept { return m_insertConfig; }
+  inline const mts::downmix_settings& getDownmixSettings() const noexcept { return m_downmixSettings; }
+  inline CFStringRef getIOTracePath() const noexcept { return m_ioTracePath; }
+  inline CFStringRef getIOCapturePath() const noexcept { return m_ioCapturePath; }
+
+  inline Float32 getVolumeDecibel(mts::direction dir, UInt32 element) const noexcept {
     return mts::clamp(
-        mts::amplitude_to_decibel(m_volumeMasterValue), mts::config::volume_min_db, mts::config::volume_max_db);
+        mts::amplitude_to_decibel(getVolume(dir, element)), mts::config::volume_min_db, mts::config::volume_max_db);
   }
 
-  inline Float32 getMasterVolumeNormalized() const noexcept {
+  inline Float32 getVolumeNormalized(mts::direction dir, UInt32 element) const noexcept {
     return mts::amplitude_to_normalized_value(
-        m_volumeMasterValue, mts::config::volume_min_db, mts::config::volume_max_db);
+        getVolume(dir, element), mts::config::volume_min_db, mts::config::volume_max_db);
+  }
+
+  inline const mts::config::latency_profile& getLatencyProfile() const noexcept {
+    return mts::config::latency_profiles[static_cast<UInt32>(m_latencyProfile)];
+  }
+
+  /// The delayed frames must still be in the ring once the largest buffer has been written after
+  /// them and the reader has read its own.
+  inline UInt32 getMaxReadDelay() const noexcept {
+    const mts::config::latency_profile& profile = getLatencyProfile();
+    return profile.ring_buffer_frame_size - 2 * profile.max_buffer_frame_size;
   }
 
   template <typename Fct>
@@ -132,26 +858,155 @@ public:
     m_stateMutex.unlock();
   }
 
+  void dumpDiagnostics(CustomProperty property);
+
+  /// Asks the host for a configuration change, it is performed later in
+  /// PerformDeviceConfigurationChange() once IO is stopped.
+  void requestConfigurationChange(ConfigChange action, uintptr_t value);
+
+  /// Sends the current volumes and mute of a scope to the IO thread, the gains ramp to them over
+  /// `rampMs` milliseconds from the given time. Must be called with the state mutex held.
+  void queueGainChange(mts::direction dir, mts::event_time timeType = mts::event_time::immediate, UInt64 time = 0,
+      mts::ramp_shape shape = mts::ramp_shape::exponential, Float64 rampMs = mts::config::volume_ramp_ms);
+
+  /// The gains of the channels of a stream pair for the current volumes and mute of a scope. Must
+  /// be called with the state mutex held.
+  void getChannelGains(mts::direction dir, UInt32 pairIndex, Float32* gains) const;
+
+  /// Notifies the host that the values of the master volume and mute controls of a scope changed.
+  void notifyGainControlsChanged(mts::direction dir);
+
+  /// Asks for a larger input safety offset if a reader went past the frames written during the
+  /// last IO session. Called when IO stops.
+  void updateSafetyOffset();
+
+  /// Replaces the client rules, which must be valid and are now owned by the driver, and routes
+  /// the clients again. Must be called with the state mutex held and IO stopped.
+  void setClientRules(CFArrayRef rules);
+
+  /// Returns the current IO operation, taken again if it isn't this one. Called by the IO thread.
+  IOOperation& beginIOOperation(
+      UInt32 clientID, UInt32 operationID, UInt32 frames, const AudioServerPlugInIOCycleInfo* cycle);
+
+  /// Publishes the results of the current IO operation. Called by the IO thread.
+  void endIOOperation();
+
+  /// Measures the ProcessOutput of a client and adds it to the mix of the pair it is routed to.
+  /// Called by the IO thread.
+  OSStatus processClientOutput(IOOperation& op, UInt32 pairIndex, const void* buffer);
+
+  /// Snapshot of the statistics of the clients, see CustomProperty::ClientStats. Must be called
+  /// with the state mutex held.
+  CFDataRef copyClientStats();
+
+  /// Replaces the insert chain of every stream pair. `impulse` is the data the impulse of the
+  /// convolution points into, it is retained. Must be called with the state mutex held and IO
+  /// stopped, from a configuration change or the initialization.
+  void setInsertConfig(const mts::insert_config& config, CFDataRef impulse);
+
+  /// Sets the write delay of every pair from the inserts and the read delay. A pair whose delay
+  /// changes starts again from a silent ring. Must be called with the state mutex held and IO
+  /// stopped.
+  void updateWriteDelays();
+
+  /// Value of the Inserts custom property with the load of the nodes. Must be called with the
+  /// state mutex held.
+  CFDictionaryRef copyInserts();
+
+  /// The settings are atomics, they don't need the state mutex.
+  inline LoudnessMonitor& getLoudnessMonitor() noexcept { return m_loudness; }
+
+  /// Value of the Loudness custom property.
+  CFDictionaryRef copyLoudness() const;
+
+  /// Sets the downmix of every stream pair. Must be called with the state mutex held and IO
+  /// stopped, from a configuration change or the initialization.
+  void setDownmix(const mts::downmix_settings& settings);
+
+  /// Value of the IOLoad custom property. Must be called with the state mutex held.
+  CFDictionaryRef copyIOLoad();
+
 private:
   ULONG m_refCount;
   const AudioServerPlugInHostInterface* m_pluginHost = nullptr;
   CFStringRef m_boxName = nullptr;
   bool m_isBoxAcquired = true;
   Float64 m_sampleRate = mts::config::default_sample_rate;
+  mts::config::latency_profile_type m_latencyProfile = mts::config::default_latency_profile;
   UInt64 m_ioRunning = 0;
   Float64 m_hostTicksPerFrame = 0.0;
   UInt64 m_numberTimeStamps = 0;
   Float64 m_anchorSampleTime = 0.0;
   UInt64 m_anchorHostTime = 0;
-  bool m_streamInputActive = true;
-  bool m_streamOutputActive = true;
-  Float32 m_volumeMasterValue = 1.0;
-  bool m_muteMasterValue = false;
-  Float* m_ringBuffer = nullptr;
-
-  // Keep track of last outputSampleTime and the cleared buffer status.
-  Float64 m_lastOutputSampleTime = 0;
-  Boolean m_isBufferClear = true;
+  // Active state and format of the streams of each scope, see scopeIndex(). Set in the constructor.
+  bool m_streamActive[2][mts::config::stream_count];
+  mts::stream_format m_streamFormats[2][mts::config::stream_count];
+
+  // Volumes and mute of the input and output scopes, see scopeIndex(). Element 0 is the master
+  // volume, the volume of device channel c is element c + 1. Set to 1 in the constructor.
+  Float32 m_volumes[2][mts::config::device_channel_count + 1];
+  bool m_muted[2] = { false, false };
+
+  // The gains of the channels of each stream pair as applied by the IO thread, see
+  // queueGainChange(). The input gains are applied when reading and the output gains when writing.
+  ChannelGains m_inputGains[mts::config::stream_count];
+  ChannelGains m_outputGains[mts::config::stream_count];
+
+  static inline UInt32 scopeIndex(mts::direction dir) noexcept { return dir == mts::direction::input ? 0 : 1; }
+
+  // Routing from the output to the input channels, applied when reading the ring in place of the
+  // downmix. Only changed by a configuration change, m_routes is the CFArray it was compiled from.
+  RoutingMatrix m_routing;
+  CFArrayRef m_routes = nullptr;
+
+  // Clients of the device and the rules that route them to a stream pair, see setClientRules().
+  ClientRegistry m_clients;
+  CFArrayRef m_clientRules = nullptr;
+
+  // Insert chain of each stream pair, applied when writing. Every pair has the same config.
+  mts::insert_config m_insertConfig;
+  CFDataRef m_insertImpulse = nullptr;
+  InsertChain m_inserts[mts::config::stream_count];
+
+  // The IO thread feeds the meters and applies the auto gain, the monitor integrates on its own
+  // thread.
+  LoudnessMeter m_loudnessMeters[mts::config::stream_count];
+  LoudnessMonitor m_loudness;
+
+  // Downmix of each stream pair from the output to the input layout, applied when reading. Only
+  // changed by a configuration change.
+  mts::downmix_settings m_downmixSettings;
+  Downmix m_downmixes[mts::config::stream_count];
+
+  // Measures the IO calls of each cycle and degrades the optional stages, see IOStage. The budget
+  // is the last buffer size of the IO thread.
+  IOScheduler m_scheduler;
+  std::atomic<UInt32> m_ioBufferFrameSize{ 0 };
+
+  StreamPair m_streamPairs[mts::config::stream_count];
+  IOOperation m_ioOperation;
+
+  // Streams in another format than Float go through this buffer of m_ioScratchFrames frames, the
+  // routing and the downmix read the ring into the other one.
+  Float* m_ioScratch = nullptr;
+  Float* m_routeScratch = nullptr;
+  UInt32 m_ioScratchFrames = 0;
+  mts::dsp::tpdf_dither m_dither;
+  CFStringRef m_ioTracePath = nullptr;
+  CFStringRef m_ioCapturePath = nullptr;
+
+  // The input reads the ring this many frames behind its sample time. A frame written at output
+  // sample time T is read at input sample time T + m_readDelay, this is the input latency. The
+  // output presents a frame at its sample time so its latency is 0.
+  UInt32 m_readDelay = 0;
+
+  // Delay of the inserts of the last config set, the part the read delay doesn't hide adds to the
+  // input latency, see updateWriteDelays().
+  UInt32 m_insertLatency = 0;
+
+  // How many frames the reader stays behind the last frame written, see updateSafetyOffset().
+  UInt32 m_inputSafetyOffset = 0;
+  Float64 m_maxReadDeficit = 0;
 
   mts::mutex m_stateMutex;
   mts::mutex m_ioMutex;
@@ -268,54 +1123,44 @@ inline void async(dispatch_block_t block) {
 ///
 ///
 ///
-class MasterMute : public mts::core::mute_control<MasterMute> {
+class Mute : public mts::core::mute_control<Mute> {
 public:
-  inline MasterMute(ObjectID objID, ObjectID deviceID, mts::direction direction)
+  inline Mute(ObjectID objID, ObjectID deviceID, mts::direction direction)
       : mute_control(static_cast<AudioObjectID>(objID), static_cast<AudioObjectID>(deviceID), direction) {}
 
   void set_muted(bool muted) const {
-    driver().safeCall([=]() { driver().setMasterMute(muted); });
+    driver().safeCall([=]() {
+      driver().setMuted(get_direction(), muted);
+      driver().queueGainChange(get_direction());
+    });
   }
 
-  bool is_muted() const { return driver().isMasterMuted(); }
+  bool is_muted() const { return driver().isMuted(get_direction()); }
 };
 
 ///
+/// The master volume of a scope (kAudioObjectPropertyElementMain) or the volume of one of its
+/// channels. The gain of a channel is the product of both.
 ///
-///
-class MasterVolume : public mts::core::volume_control<MasterVolume> {
+class Volume : public mts::core::volume_control<Volume> {
 public:
-  inline MasterVolume(ObjectID objID, ObjectID deviceID, mts::direction direction)
-      : volume_control(static_cast<AudioObjectID>(objID), static_cast<AudioObjectID>(deviceID), direction) {}
+  inline Volume(ObjectID objID, ObjectID deviceID, mts::direction direction,
+      AudioObjectPropertyElement element = kAudioObjectPropertyElementMain)
+      : volume_control(static_cast<AudioObjectID>(objID), static_cast<AudioObjectID>(deviceID), direction, element) {}
 
   bool set_volume_normalized(Float32 value) const {
     Float32 volume = mts::normalized_value_to_amplitude(value, mts::config::volume_min_db, mts::config::volume_max_db);
-
-    mts::scoped_lock lock(driver().getMutex());
-
-    if (driver().getMasterVolume() == volume) {
-      return false;
-    }
-
-    driver().setMasterVolume(volume);
-    return true;
+    return set_volume(volume);
   }
 
   bool set_volume_decibel(Float32 db) const {
     Float32 volume = mts::max(mts::decibel_to_amplitude(db), mts::config::volume_min_amplitude);
-
-    mts::scoped_lock lock(driver().getMutex());
-    if (driver().getMasterVolume() == volume) {
-      return false;
-    }
-
-    driver().setMasterVolume(volume);
-    return true;
+    return set_volume(volume);
   }
 
-  Float32 get_volume_decibel() const { return driver().getMasterVolumeDecibel(); }
+  Float32 get_volume_decibel() const { return driver().getVolumeDecibel(get_direction(), get_element()); }
 
-  Float32 get_volume_normalized() const { return driver().getMasterVolumeNormalized(); }
+  Float32 get_volume_normalized() const { return driver().getVolumeNormalized(get_direction(), get_element()); }
 
   Float32 convert_normalized_to_decibel(Float32 value) const {
     // We square the scalar value before converting to dB so as to
@@ -331,6 +1176,19 @@ public:
   }
 
   AudioValueRange get_volume_decibel_range() const { return mts::config::volume_range_db; }
+
+private:
+  bool set_volume(Float32 volume) const {
+    mts::scoped_lock lock(driver().getMutex());
+
+    if (driver().getVolume(get_direction(), get_element()) == volume) {
+      return false;
+    }
+
+    driver().setVolume(get_direction(), get_element(), volume);
+    driver().queueGainChange(get_direction());
+    return true;
+  }
 };
 
 ///
@@ -446,20 +1304,60 @@ public:
   inline Device(ObjectID pluginID)
       : mts::core::device<Device>(static_cast<AudioObjectID>(ObjectID::Device), static_cast<AudioObjectID>(pluginID)) {}
 
-  static constexpr std::array objectsDescription = {
-    mts::object_description{
-        static_cast<AudioObjectID>(ObjectID::StreamInput), mts::object_type::stream, mts::direction::input },
-    mts::object_description{
-        static_cast<AudioObjectID>(ObjectID::VolumeInputMaster), mts::object_type::control, mts::direction::input },
-    mts::object_description{
-        static_cast<AudioObjectID>(ObjectID::MuteInputMaster), mts::object_type::control, mts::direction::input },
-
-    mts::object_description{
-        static_cast<AudioObjectID>(ObjectID::StreamOutput), mts::object_type::stream, mts::direction::output },
-    mts::object_description{
-        static_cast<AudioObjectID>(ObjectID::VolumeOutputMaster), mts::object_type::control, mts::direction::output },
-    mts::object_description{
-        static_cast<AudioObjectID>(ObjectID::MuteOutputMaster), mts::object_type::control, mts::direction::output },
+  /// The streams of a scope come first, the volume of each channel follows the master controls.
+  static constexpr std::array objectsDescription = [] {
+    constexpr UInt32 streamCount = mts::config::stream_count;
+    constexpr UInt32 channelCount = mts::config::device_channel_count;
+    std::array<mts::object_description, 2 * (streamCount + 2 + channelCount)> objs = {};
+    UInt32 k = 0;
+
+    for (mts::direction dir : { mts::direction::input, mts::direction::output }) {
+      const bool isInput = dir == mts::direction::input;
+      const ObjectID firstStream = isInput ? ObjectID::StreamInput : ObjectID::StreamOutput;
+      const ObjectID firstChannel = isInput ? ObjectID::VolumeInputChannel : ObjectID::VolumeOutputChannel;
+
+      for (UInt32 s = 0; s < streamCount; s++) {
+        objs[k++] = { static_cast<AudioObjectID>(firstStream) + s, mts::object_type::stream, dir };
+      }
+
+      objs[k++] = { static_cast<AudioObjectID>(isInput ? ObjectID::VolumeInputMaster : ObjectID::VolumeOutputMaster),
+        mts::object_type::control, dir };
+      objs[k++] = { static_cast<AudioObjectID>(isInput ? ObjectID::MuteInputMaster : ObjectID::MuteOutputMaster),
+        mts::object_type::control, dir };
+
+      for (UInt32 c = 0; c < channelCount; c++) {
+        objs[k++] = { static_cast<AudioObjectID>(firstChannel) + c, mts::object_type::control, dir };
+      }
+    }
+
+    return objs;
+  }();
+
+  static constexpr std::array customProperties = {
+    mts::custom_property_description{ static_cast<AudioObjectPropertySelector>(CustomProperty::IOTraceDump),
+        kAudioServerPlugInCustomPropertyDataTypeCFString, true, mts::config::io_trace },
+    mts::custom_property_description{ static_cast<AudioObjectPropertySelector>(CustomProperty::IOCaptureDump),
+        kAudioServerPlugInCustomPropertyDataTypeCFString, true, mts::config::io_capture },
+    mts::custom_property_description{ static_cast<AudioObjectPropertySelector>(CustomProperty::LatencyProfile),
+        kAudioServerPlugInCustomPropertyDataTypeCFString, true },
+    mts::custom_property_description{ static_cast<AudioObjectPropertySelector>(CustomProperty::ReadDelay),
+        kAudioServerPlugInCustomPropertyDataTypeCFString, true },
+    mts::custom_property_description{ static_cast<AudioObjectPropertySelector>(CustomProperty::GainAutomation),
+        kAudioServerPlugInCustomPropertyDataTypeCFPropertyList, true },
+    mts::custom_property_description{ static_cast<AudioObjectPropertySelector>(CustomProperty::Routing),
+        kAudioServerPlugInCustomPropertyDataTypeCFPropertyList, true },
+    mts::custom_property_description{ static_cast<AudioObjectPropertySelector>(CustomProperty::ClientRules),
+        kAudioServerPlugInCustomPropertyDataTypeCFPropertyList, true },
+    mts::custom_property_description{ static_cast<AudioObjectPropertySelector>(CustomProperty::ClientStats),
+        kAudioServerPlugInCustomPropertyDataTypeCFPropertyList, false },
+    mts::custom_property_description{ static_cast<AudioObjectPropertySelector>(CustomProperty::Inserts),
+        kAudioServerPlugInCustomPropertyDataTypeCFPropertyList, true },
+    mts::custom_property_description{ static_cast<AudioObjectPropertySelector>(CustomProperty::Loudness),
+        kAudioServerPlugInCustomPropertyDataTypeCFPropertyList, true },
+    mts::custom_property_description{ static_cast<AudioObjectPropertySelector>(CustomProperty::Downmix),
+        kAudioServerPlugInCustomPropertyDataTypeCFPropertyList, true },
+    mts::custom_property_description{ static_cast<AudioObjectPropertySelector>(CustomProperty::IOLoad),
+        kAudioServerPlugInCustomPropertyDataTypeCFPropertyList, false },
   };
 
   bool is_hidden() const { return mts::config::hidden; }
@@ -492,11 +1390,7 @@ public:
     driver().safeCall([&]() { oldSampleRate = driver().get_sample_rate(); });
 
     if (oldSampleRate != sr) {
-      // We dispatch this so that the change can happen asynchronously.
-      async(^{
-          driver().getPluginHost()->RequestDeviceConfigurationChange(
-              driver().getPluginHost(), static_cast<AudioObjectID>(ObjectID::Device), (UInt64)sr, nullptr);
-      });
+      driver().requestConfigurationChange(ConfigChange::SampleRate, (uintptr_t)sr);
     }
 
     return kAudioHardwareNoError;
@@ -507,102 +1401,415 @@ public:
     return driver().getIoRunning() > 0;
   }
 
-  UInt32 get_channel_count() const { return mts::config::channel_count; }
-  UInt32 get_ring_buffer_size() const { return mts::config::ring_buffer_size; }
+  UInt32 get_channel_count() const { return mts::config::device_channel_count; }
+
+  // The channels of every pair have the layout of their scope, a tag only describes the device
+  // when it has a single pair of exactly that many channels.
+  AudioChannelLayoutTag get_channel_layout_tag(AudioObjectPropertyScope scope) const {
+    const AudioChannelLayoutTag tag = getChannelLayout(scope);
+    return mts::config::stream_count == 1 && mts::get_layout_channel_count(tag) == mts::config::channel_count
+        ? tag
+        : kAudioChannelLayoutTag_UseChannelDescriptions;
+  }
+
+  AudioChannelLabel get_channel_label(AudioObjectPropertyScope scope, UInt32 channel) const {
+    return mts::get_channel_label(getChannelLayout(scope), channel % mts::config::channel_count);
+  }
+  UInt32 get_zero_timestamp_period() const {
+    mts::scoped_lock lock(driver().getMutex());
+    return driver().getLatencyProfile().zero_timestamp_period;
+  }
+
+  UInt32 get_latency(AudioObjectPropertyScope scope) const {
+    mts::scoped_lock lock(driver().getMutex());
+    return scope == kAudioObjectPropertyScopeInput ? driver().getInputLatency() : 0;
+  }
+
+  UInt32 get_safety_offset(AudioObjectPropertyScope scope) const {
+    mts::scoped_lock lock(driver().getMutex());
+    return scope == kAudioObjectPropertyScopeInput ? driver().getInputSafetyOffset() : 0;
+  }
+
+  AudioValueRange get_buffer_frame_size_range() const {
+    mts::scoped_lock lock(driver().getMutex());
+    const mts::config::latency_profile& profile = driver().getLatencyProfile();
+    return AudioValueRange{ (Float64)profile.min_buffer_frame_size, (Float64)profile.max_buffer_frame_size };
+  }
   CFStringRef get_device_name() const { return CFSTR(MTS_DEVICE_NAME); }
   CFStringRef get_manufacturer_name() const { return CFSTR(MTS_MANUFACTURER_NAME); }
   CFStringRef get_device_uid() const { return CFSTR(MTS_DEVICE_UID); }
   CFStringRef get_device_model_uid() const { return CFSTR(MTS_DEVICE_MODEL_UID); }
   CFStringRef get_bundle_id() const { return CFSTR(MTS_PLUGIN_BUNDLE_ID); }
   CFStringRef get_icon_file() const { return CFSTR(MTS_ICON_FILE); }
+
+  OSStatus get_custom_property(AudioObjectPropertySelector selector, CFPropertyListRef* value) const {
+    switch (static_cast<CustomProperty>(selector)) {
+    case CustomProperty::IOTraceDump: {
+      mts::scoped_lock lock(driver().getMutex());
+      CFStringRef path = driver().getIOTracePath();
+      *value = CFRetain(path ? path : CFSTR(""));
+    } break;
+
+    case CustomProperty::IOCaptureDump: {
+      mts::scoped_lock lock(driver().getMutex());
+      CFStringRef path = driver().getIOCapturePath();
+      *value = CFRetain(path ? path : CFSTR(""));
+    } break;
+
+    case CustomProperty::LatencyProfile: {
+      mts::scoped_lock lock(driver().getMutex());
+      *value = CFRetain(getLatencyProfileName(driver().getLatencyProfileType()));
+    } break;
+
+    case CustomProperty::ReadDelay: {
+      mts::scoped_lock lock(driver().getMutex());
+      *value = CFStringCreateWithFormat(kCFAllocatorDefault, nullptr, CFSTR("%u"), driver().getReadDelay());
+    } break;
+
+    case CustomProperty::GainAutomation: {
+      const void* keys[] = { CFSTR("input"), CFSTR("output") };
+      const void* scopes[2];
+
+      for (mts::direction dir : { mts::direction::input, mts::direction::output }) {
+        Float64 db;
+        bool muted;
+        driver().safeCall([&]() {
+          db = driver().getVolumeDecibel(dir, kAudioObjectPropertyElementMain);
+          muted = driver().isMuted(dir);
+        });
+
+        CFNumberRef volume = CFNumberCreate(kCFAllocatorDefault, kCFNumberFloat64Type, &db);
+        const void* scopeKeys[] = { CFSTR("volume"), CFSTR("mute") };
+        const void* scopeValues[] = { volume, muted ? kCFBooleanTrue : kCFBooleanFalse };
+        scopes[dir == mts::direction::input ? 0 : 1] = CFDictionaryCreate(kCFAllocatorDefault, scopeKeys, scopeValues,
+            2, &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
+        CFRelease(volume);
+      }
+
+      *value = CFDictionaryCreate(
+          kCFAllocatorDefault, keys, scopes, 2, &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
+      CFRelease(scopes[0]);
+      CFRelease(scopes[1]);
+    } break;
+
+    case CustomProperty::Routing: {
+      mts::scoped_lock lock(driver().getMutex());
+      CFArrayRef routes = driver().getRoutes();
+      *value = routes ? CFRetain(routes) : CFArrayCreate(kCFAllocatorDefault, nullptr, 0, &kCFTypeArrayCallBacks);
+    } break;
+
+    case CustomProperty::ClientRules: {
+      mts::scoped_lock lock(driver().getMutex());
+      CFArrayRef rules = driver().getClientRules();
+      *value = rules ? CFRetain(rules) : CFArrayCreate(kCFAllocatorDefault, nullptr, 0, &kCFTypeArrayCallBacks);
+    } break;
+
+    case CustomProperty::ClientStats:
+      driver().safeCall([&]() { *value = driver().copyClientStats(); });
+      break;
+
+    case CustomProperty::Inserts:
+      driver().safeCall([&]() { *value = driver().copyInserts(); });
+      break;
+
+    case CustomProperty::Loudness:
+      *value = driver().copyLoudness();
+      break;
+
+    case CustomProperty::Downmix: {
+      CFMutableDictionaryRef dict;
+      driver().safeCall([&]() { dict = copyDownmixSettings(driver().getDownmixSettings()); });
+      setDictionaryNumber(dict, CFSTR("output_layout"), (UInt32)mts::config::output_channel_layout);
+      setDictionaryNumber(dict, CFSTR("input_layout"), (UInt32)mts::config::input_channel_layout);
+      *value = dict;
+    } break;
+
+    case CustomProperty::IOLoad:
+      driver().safeCall([&]() { *value = driver().copyIOLoad(); });
+      break;
+    }
+
+    return kAudioHardwareNoError;
+  }
+
+  OSStatus set_custom_property(AudioObjectPropertySelector selector, CFPropertyListRef value, bool& changed) const {
+    switch (static_cast<CustomProperty>(selector)) {
+    // The files are written asynchronously, a notification is sent once they exist.
+    case CustomProperty::IOTraceDump:
+    case CustomProperty::IOCaptureDump:
+      async(^{
+          driver().dumpDiagnostics(static_cast<CustomProperty>(selector));
+      });
+      break;
+
+    // The notification is sent once the configuration change is performed.
+    case CustomProperty::LatencyProfile: {
+      RETURN_ERROR_IF(!value || CFGetTypeID(value) != CFStringGetTypeID(), kAudioHardwareIllegalOperationError,
+          "the latency profile must be a CFString");
+
+      for (UInt32 i = 0; i < mts::config::latency_profile_count; i++) {
+        const auto type = static_cast<mts::config::latency_profile_type>(i);
+
+        if (CFStringCompare((CFStringRef)value, getLatencyProfileName(type), 0) == kCFCompareEqualTo) {
+          bool isCurrent;
+          driver().safeCall([&]() { isCurrent = driver().getLatencyProfileType() == type; });
+
+          if (!isCurrent) {
+            driver().requestConfigurationChange(ConfigChange::LatencyProfile, i);
+          }
+
+          return kAudioHardwareNoError;
+        }
+      }
+
+      MTS_DBG("unknown latency profile");
+      return kAudioHardwareIllegalOperationError;
+    }
+
+    // The notification is sent once the configuration change is performed.
+    case CustomProperty::ReadDelay: {
+      RETURN_ERROR_IF(!value || CFGetTypeID(value) != CFStringGetTypeID(), kAudioHardwareIllegalOperationError,
+          "the read delay must be a CFString");
+
+      // CFStringGetDoubleValue() returns 0 for a string that isn't a number.
+      char text[64];
+      RETURN_ERROR_IF(!CFStringGetCString((CFStringRef)value, text, sizeof(text), kCFStringEncodingUTF8),
+          kAudioHardwareIllegalOperationError, "the read delay is too long");
+
+      bool isValid = false;
+      bool isCurrent = true;
+      UInt32 frames = 0;
+
+      driver().safeCall([&]() {
+        isValid = mts::parse_read_delay(text, driver().get_sample_rate(), driver().getMaxReadDelay(), frames);
+        isCurrent = frames == driver().getReadDelay();
+      });
+
+      RETURN_ERROR_IF(!isValid, kAudioHardwareIllegalOperationError,
+          "the read delay must be a number of frames, or of milliseconds followed by 'ms'");
+
+      if (!isCurrent) {
+        driver().requestConfigurationChange(ConfigChange::ReadDelay, frames);
+      }
+    } break;
+
+    case CustomProperty::GainAutomation: {
+      RETURN_ERROR_IF(!value || CFGetTypeID(value) != CFDictionaryGetTypeID(), kAudioHardwareIllegalOperationError,
+          "the gain automation must be a CFDictionary");
+
+      CFDictionaryRef dict = (CFDictionaryRef)value;
+      Float64 db = 0;
+      Float64 rampMs = mts::config::volume_ramp_ms;
+      SInt32 muted = 0;
+      SInt64 time = 0;
+
+      const bool hasVolume = getDictionaryNumber(dict, CFSTR("volume"), kCFNumberFloat64Type, db);
+      const bool hasMute = getDictionaryNumber(dict, CFSTR("mute"), kCFNumberSInt32Type, muted);
+      RETURN_ERROR_IF(!hasVolume && !hasMute, kAudioHardwareIllegalOperationError, "no volume or mute to change");
+      getDictionaryNumber(dict, CFSTR("ramp_ms"), kCFNumberFloat64Type, rampMs);
+
+      mts::event_time timeType = mts::event_time::immediate;
+      if (getDictionaryNumber(dict, CFSTR("sample_time"), kCFNumberSInt64Type, time)) {
+        timeType = mts::event_time::sample_time;
+      }
+      else if (getDictionaryNumber(dict, CFSTR("host_time"), kCFNumberSInt64Type, time)) {
+        timeType = mts::event_time::host_time;
+      }
+
+      CFTypeRef shape = CFDictionaryGetValue(dict, CFSTR("shape"));
+      const bool isLinear = shape && CFGetTypeID(shape) == CFStringGetTypeID()
+          && CFStringCompare((CFStringRef)shape, CFSTR("linear"), 0) == kCFCompareEqualTo;
+
+      CFTypeRef scope = CFDictionaryGetValue(dict, CFSTR("scope"));
+      const bool isString = scope && CFGetTypeID(scope) == CFStringGetTypeID();
+      const bool isInput = !isString || CFStringCompare((CFStringRef)scope, CFSTR("input"), 0) == kCFCompareEqualTo;
+      const bool isOutput = !isString || CFStringCompare((CFStringRef)scope, CFSTR("output"), 0) == kCFCompareEqualTo;
+      RETURN_ERROR_IF(!isInput && !isOutput, kAudioHardwareIllegalOperationError, "unknown scope");
+
+      const Float32 volume = mts::max(
+          mts::decibel_to_amplitude((Float32)mts::clamp<Float64>(db, mts::config::volume_min_db,
+              mts::config::volume_max_db)),
+          mts::config::volume_min_amplitude);
+
+      for (mts::direction dir : { mts::direction::input, mts::direction::output }) {
+        if (!(dir == mts::direction::input ? isInput : isOutput)) {
+          continue;
+        }
+
+        driver().safeCall([&]() {
+          if (hasVolume) {
+            driver().setVolume(dir, kAudioObjectPropertyElementMain, volume);
+          }
+
+          if (hasMute) {
+            driver().setMuted(dir, muted);
+          }
+
+          driver().queueGainChange(dir, timeType, (UInt64)mts::max<SInt64>(time, 0),
+              isLinear ? mts::ramp_shape::linear : mts::ramp_shape::exponential, mts::max(rampMs, 0.0));
+        });
+
+        // The HAL only knows that the custom property changed.
+        async(^{
+            driver().notifyGainControlsChanged(dir);
+        });
+      }
+
+      changed = true;
+    } break;
+
+    // The matrix is compiled here, the notification is sent once the configuration change is performed.
+    case CustomProperty::Routing: {
+      RoutingChange* change = new RoutingChange;
+      RETURN_ERROR_IF(!change, kAudioHardwareUnspecifiedError, "unable to allocate the routing");
+
+      if (!compileRoutes(value, change->matrix)) {
+        delete change;
+        MTS_DBG("invalid routing");
+        return kAudioHardwareIllegalOperationError;
+      }
+
+      change->routes = (CFArrayRef)CFRetain(value);
+      driver().requestConfigurationChange(ConfigChange::Routing, (uintptr_t)change);
+    } break;
+
+    // The notification is sent once the configuration change is performed.
+    case CustomProperty::ClientRules: {
+      RETURN_ERROR_IF(!isValidClientRules(value), kAudioHardwareIllegalOperationError, "invalid client rules");
+      driver().requestConfigurationChange(ConfigChange::ClientRules, (uintptr_t)CFRetain(value));
+    } break;
+
+    // Read only.
+    case CustomProperty::ClientStats:
+    case CustomProperty::IOLoad:
+      return kAudioHardwareUnsupportedOperationError;
+
+    // The chain can change the latency, it is set once the configuration change is performed.
+    case CustomProperty::Inserts: {
+      InsertsChange* change = new InsertsChange;
+      RETURN_ERROR_IF(!change, kAudioHardwareUnspecifiedError, "unable to allocate the inserts");
+
+      if (!parseInserts(value, change->config, change->impulse)) {
+        delete change;
+        MTS_DBG("invalid inserts");
+        return kAudioHardwareIllegalOperationError;
+      }
+
+      if (change->impulse) {
+        CFRetain(change->impulse);
+      }
+
+      driver().requestConfigurationChange(ConfigChange::Inserts, (uintptr_t)change);
+    } break;
+
+    // The background thread of the monitor picks the settings up on its next step.
+    case CustomProperty::Loudness: {
+      LoudnessMonitor& monitor = driver().getLoudnessMonitor();
+      RETURN_ERROR_IF(!setLoudnessSettings(value, monitor), kAudioHardwareIllegalOperationError, "invalid loudness");
+
+      CFDictionaryRef saved = copyLoudnessSettings(monitor);
+      driver().getPluginHost()->WriteToStorage(driver().getPluginHost(), CFSTR(MTS_PROPERTY_LOUDNESS), saved);
+      CFRelease(saved);
+      changed = true;
+    } break;
+
+    // The missing keys keep their value, the notification is sent once the configuration change is
+    // performed.
+    case CustomProperty::Downmix: {
+      mts::downmix_settings* settings = new mts::downmix_settings;
+      RETURN_ERROR_IF(!settings, kAudioHardwareUnspecifiedError, "unable to allocate the downmix");
+      driver().safeCall([&]() { *settings = driver().getDownmixSettings(); });
+
+      if (!parseDownmixSettings(value, *settings)) {
+        delete settings;
+        MTS_DBG("invalid downmix");
+        return kAudioHardwareIllegalOperationError;
+      }
+
+      driver().requestConfigurationChange(ConfigChange::Downmix, (uintptr_t)settings);
+    } break;
+    }
+
+    return kAudioHardwareNoError;
+  }
 };
 
 ///
 ///
 ///
-class MasterStream : public mts::core::stream<MasterStream> {
+class Stream : public mts::core::stream<Stream> {
 public:
-  inline MasterStream(ObjectID objID, ObjectID deviceID, mts::direction direction)
-      : stream(static_cast<AudioObjectID>(objID), static_cast<AudioObjectID>(deviceID), direction) {}
+  inline Stream(ObjectID objID, ObjectID deviceID, mts::direction direction, UInt32 pair)
+      : stream(static_cast<AudioObjectID>(objID), static_cast<AudioObjectID>(deviceID), direction)
+      , m_pair(pair) {}
 
   inline bool isInput() const { return get_direction() == mts::direction::input; }
 
-  UInt32 get_sample_rate_count() const { return mts::config::supported_sample_rates_count; }
+  inline mts::stream_format getFormat() const { return driver().getStreamFormat(get_direction(), m_pair); }
 
-  bool is_active() const { return isInput() ? driver().isInputStreamActive() : driver().isOutputStreamActive(); }
+  // Every supported sample rate is available in every format.
+  UInt32 get_format_count() const { return mts::config::supported_sample_rates_count * mts::stream_format_count; }
 
-  bool set_active(bool active) const {
-    mts::scoped_lock lock(driver().getMutex());
+  // The channels of the device are those of the first pair, then those of the second one...
+  UInt32 get_starting_channel() const { return m_pair * mts::config::channel_count + 1; }
 
-    if (isInput()) {
-      if (driver().isInputStreamActive() == active) {
-        return false;
-      }
+  bool is_active() const { return driver().isStreamActive(get_direction(), m_pair); }
 
-      driver().setInputStreamActive(active);
-      return true;
-    }
+  bool set_active(bool active) const {
+    mts::scoped_lock lock(driver().getMutex());
 
-    if (driver().isOutputStreamActive() == active) {
+    if (driver().isStreamActive(get_direction(), m_pair) == active) {
       return false;
     }
 
-    driver().setOutputStreamActive(active);
+    driver().setStreamActive(get_direction(), m_pair, active);
     return true;
   }
 
   void get_basic_description(AudioStreamBasicDescription& desc) const {
     driver().safeCall([&]() {
-      desc.mSampleRate = driver().get_sample_rate();
-      desc.mFormatID = mts::config::format_id;
-      desc.mFormatFlags = mts::config::format_flags;
-      desc.mBytesPerPacket = mts::config::bytes_per_packet;
-      desc.mFramesPerPacket = mts::config::frames_per_packet;
-      desc.mBytesPerFrame = mts::config::bytes_per_frame;
-      desc.mChannelsPerFrame = mts::config::channel_count;
-      desc.mBitsPerChannel = mts::config::bits_per_channel;
+      mts::fill_description(desc, driver().get_sample_rate(), mts::config::channel_count, getFormat());
     });
   }
 
   void get_ranged_descriptions(AudioStreamRangedDescription* desc, UInt32 itemCount) const {
     for (UInt32 i = 0; i < itemCount; i++) {
-      desc[i].mFormat.mSampleRate = mts::config::supported_sample_rates[i];
-      desc[i].mFormat.mFormatID = mts::config::format_id;
-      desc[i].mFormat.mFormatFlags = mts::config::format_flags;
-      desc[i].mFormat.mBytesPerPacket = mts::config::bytes_per_packet;
-      desc[i].mFormat.mFramesPerPacket = mts::config::frames_per_packet;
-      desc[i].mFormat.mBytesPerFrame = mts::config::bytes_per_frame;
-      desc[i].mFormat.mChannelsPerFrame = mts::config::channel_count;
-      desc[i].mFormat.mBitsPerChannel = mts::config::bits_per_channel;
-      desc[i].mSampleRateRange.mMinimum = mts::config::supported_sample_rates[i];
-      desc[i].mSampleRateRange.mMaximum = mts::config::supported_sample_rates[i];
+      const Float64 sr = mts::config::supported_sample_rates[i % mts::config::supported_sample_rates_count];
+      const mts::stream_format format = mts::get_stream_format(i / mts::config::supported_sample_rates_count);
+
+      mts::fill_description(desc[i].mFormat, sr, mts::config::channel_count, format);
+      desc[i].mSampleRateRange.mMinimum = sr;
+      desc[i].mSampleRateRange.mMaximum = sr;
     }
   }
 
   OSStatus set_format(const AudioStreamBasicDescription* desc) const {
-    RETURN_FORMAT_ERROR_IF(desc->mFormatID != mts::config::format_id);
-    RETURN_FORMAT_ERROR_IF(desc->mFormatFlags != mts::config::format_flags);
-    RETURN_FORMAT_ERROR_IF(desc->mBytesPerPacket != mts::config::bytes_per_packet);
-    RETURN_FORMAT_ERROR_IF(desc->mFramesPerPacket != mts::config::frames_per_packet);
-    RETURN_FORMAT_ERROR_IF(desc->mBytesPerFrame != mts::config::bytes_per_frame);
-    RETURN_FORMAT_ERROR_IF(desc->mChannelsPerFrame != mts::config::channel_count);
-    RETURN_FORMAT_ERROR_IF(desc->mBitsPerChannel != mts::config::bits_per_channel);
+    mts::stream_format format;
+    RETURN_FORMAT_ERROR_IF(!mts::find_stream_format(*desc, mts::config::channel_count, format));
     RETURN_ERROR_IF(!mts::config::is_supported_sample_rate(desc->mSampleRate), kAudioHardwareIllegalOperationError,
         "unsupported sample rate in kAudioStreamPropertyVirtualFormat");
 
     Float64 oldSampleRate;
-    driver().safeCall([&]() { oldSampleRate = driver().get_sample_rate(); });
+    mts::stream_format oldFormat;
+    driver().safeCall([&]() {
+      oldSampleRate = driver().get_sample_rate();
+      oldFormat = getFormat();
+    });
 
     if (desc->mSampleRate != oldSampleRate) {
-      // We dispatch this so that the change can happen asynchronously.
-      async(^{
-          driver().getPluginHost()->RequestDeviceConfigurationChange(driver().getPluginHost(),
-              static_cast<AudioObjectID>(get_device_id()), (UInt64)desc->mSampleRate, nullptr);
-      });
+      driver().requestConfigurationChange(ConfigChange::SampleRate, (uintptr_t)desc->mSampleRate);
+    }
+
+    if (format != oldFormat) {
+      driver().requestConfigurationChange(
+          ConfigChange::StreamFormat, StreamFormatChange{ isInput(), m_pair, format }.encode());
     }
 
     return kAudioHardwareNoError;
   }
+
+private:
+  UInt32 m_pair;
 };
 
 ///
@@ -694,23 +1901,39 @@ inline R callObject(AudioObjectID auid, Fct&& fct, R ret) {
   case ObjectID::Device:
     return fct(Device(ObjectID::Plugin));
 
-  case ObjectID::StreamInput:
-    return fct(MasterStream(ObjectID::StreamInput, ObjectID::Device, mts::direction::input));
-
   case ObjectID::VolumeInputMaster:
-    return fct(MasterVolume(ObjectID::VolumeInputMaster, ObjectID::Device, mts::direction::input));
+    return fct(Volume(ObjectID::VolumeInputMaster, ObjectID::Device, mts::direction::input));
 
   case ObjectID::MuteInputMaster:
-    return fct(MasterMute(ObjectID::MuteInputMaster, ObjectID::Device, mts::direction::input));
-
-  case ObjectID::StreamOutput:
-    return fct(MasterStream(ObjectID::StreamOutput, ObjectID::Device, mts::direction::output));
+    return fct(Mute(ObjectID::MuteInputMaster, ObjectID::Device, mts::direction::input));
 
   case ObjectID::VolumeOutputMaster:
-    return fct(MasterVolume(ObjectID::VolumeOutputMaster, ObjectID::Device, mts::direction::output));
+    return fct(Volume(ObjectID::VolumeOutputMaster, ObjectID::Device, mts::direction::output));
 
   case ObjectID::MuteOutputMaster:
-    return fct(MasterMute(ObjectID::MuteOutputMaster, ObjectID::Device, mts::direction::output));
+    return fct(Mute(ObjectID::MuteOutputMaster, ObjectID::Device, mts::direction::output));
+
+  default:
+    break;
+  }
+
+  // Streams.
+  mts::direction dir;
+  UInt32 pair;
+
+  if (getStreamPair(auid, dir, pair)) {
+    return fct(Stream(static_cast<ObjectID>(auid), ObjectID::Device, dir, pair));
+  }
+
+  // Channel volumes.
+  constexpr AudioObjectID firstChannel = static_cast<AudioObjectID>(ObjectID::VolumeInputChannel);
+  constexpr AudioObjectID firstOutputChannel = static_cast<AudioObjectID>(ObjectID::VolumeOutputChannel);
+
+  if (auid >= firstChannel && auid < firstOutputChannel + mts::config::device_channel_count) {
+    const bool isInput = auid < firstOutputChannel;
+    const AudioObjectPropertyElement element = auid - (isInput ? firstChannel : firstOutputChannel) + 1;
+    return fct(Volume(static_cast<ObjectID>(auid), ObjectID::Device,
+        isInput ? mts::direction::input : mts::direction::output, element));
   }
 
   return ret;
@@ -727,6 +1950,19 @@ Driver::Driver() {
 
   m_refCount = 0;
 
+  for (auto& volumes : m_volumes) {
+    for (Float32& v : volumes) {
+      v = 1.0f;
+    }
+  }
+
+  for (UInt32 scope = 0; scope < 2; scope++) {
+    for (UInt32 pair = 0; pair < mts::config::stream_count; pair++) {
+      m_streamActive[scope][pair] = true;
+      m_streamFormats[scope][pair] = defaultStreamFormat;
+    }
+  }
+
   QueryInterface = [](void* drv, REFIID inUUID, LPVOID* outInterface) -> HRESULT {
     if (drv != handle()) {
       return kAudioHardwareBadObjectError;
@@ -884,6 +2120,319 @@ inline CFStringRef getInitBoxNameProperty(AudioServerPlugInHostRef host) {
   return result;
 }
 
+// Writes the IO trace or the IO capture file and notifies the host of the new path.
+void Driver::dumpDiagnostics(CustomProperty property) {
+  const bool isTrace = property == CustomProperty::IOTraceDump;
+  char path[PATH_MAX];
+
+  const bool isDumped = isTrace ? mts::trace::dump(path, sizeof(path))
+                                : mts::capture::dump<mts::config::io_capture>(path, sizeof(path));
+
+  if (!isDumped) {
+    MTS_DBG("unable to write the diagnostics file");
+    return;
+  }
+
+  CFStringRef pathString = CFStringCreateWithCString(kCFAllocatorDefault, path, kCFStringEncodingUTF8);
+
+  safeCall([&]() {
+    CFStringRef& current = isTrace ? m_ioTracePath : m_ioCapturePath;
+
+    if (current) {
+      CFRelease(current);
+    }
+
+    current = pathString;
+  });
+
+  AudioObjectPropertyAddress theAddress
+      = { static_cast<AudioObjectPropertySelector>(property), kAudioObjectPropertyScopeGlobal,
+          kAudioObjectPropertyElementMain };
+
+  m_pluginHost->PropertiesChanged(m_pluginHost, static_cast<AudioObjectID>(ObjectID::Device), 1, &theAddress);
+}
+
+void Driver::requestConfigurationChange(ConfigChange action, uintptr_t value) {
+  // We dispatch this so that the change can happen asynchronously.
+  async(^{
+      m_pluginHost->RequestDeviceConfigurationChange(
+          m_pluginHost, static_cast<AudioObjectID>(ObjectID::Device), static_cast<UInt64>(action), (void*)value);
+  });
+}
+
+void Driver::queueGainChange(
+    mts::direction dir, mts::event_time timeType, UInt64 time, mts::ramp_shape shape, Float64 rampMs) {
+  mts::gain_event<mts::config::channel_count> e;
+  e.ramp_frames = (UInt32)round(rampMs * m_sampleRate / 1000.0);
+  e.time = time;
+  e.time_type = timeType;
+  e.shape = shape;
+
+  ChannelGains* gains = dir == mts::direction::input ? m_inputGains : m_outputGains;
+
+  for (UInt32 pair = 0; pair < mts::config::stream_count; pair++) {
+    getChannelGains(dir, pair, e.gains);
+    gains[pair].push(e);
+  }
+}
+
+void Driver::getChannelGains(mts::direction dir, UInt32 pairIndex, Float32* gains) const {
+  const UInt32 scope = scopeIndex(dir);
+  const Float32 master = m_muted[scope] ? 0.0f : m_volumes[scope][0];
+
+  for (UInt32 c = 0; c < mts::config::channel_count; c++) {
+    gains[c] = master * m_volumes[scope][pairIndex * mts::config::channel_count + c + 1];
+  }
+}
+
+void Driver::notifyGainControlsChanged(mts::direction dir) {
+  const bool isInput = dir == mts::direction::input;
+
+  AudioObjectPropertyAddress volumeAddresses[] = {
+    { kAudioLevelControlPropertyScalarValue, kAudioObjectPropertyScopeGlobal, kAudioObjectPropertyElementMain },
+    { kAudioLevelControlPropertyDecibelValue, kAudioObjectPropertyScopeGlobal, kAudioObjectPropertyElementMain },
+  };
+
+  AudioObjectPropertyAddress muteAddress
+      = { kAudioBooleanControlPropertyValue, kAudioObjectPropertyScopeGlobal, kAudioObjectPropertyElementMain };
+
+  m_pluginHost->PropertiesChanged(m_pluginHost,
+      static_cast<AudioObjectID>(isInput ? ObjectID::VolumeInputMaster : ObjectID::VolumeOutputMaster), 2,
+      volumeAddresses);
+
+  m_pluginHost->PropertiesChanged(m_pluginHost,
+      static_cast<AudioObjectID>(isInput ? ObjectID::MuteInputMaster : ObjectID::MuteOutputMaster), 1, &muteAddress);
+}
+
+// The HAL places the input time a safety offset before now. When a reader ends past the last frame
+// written, it reads stale frames (or silence), moving the reader back by that many frames fixes
+// it. The offset only grows, so that it settles after a few sessions instead of oscillating.
+// Must be called with the state mutex held and IO stopped.
+void Driver::updateSafetyOffset() {
+  constexpr UInt32 granularity = 16;
+  const UInt32 maxOffset = getLatencyProfile().max_buffer_frame_size;
+  const UInt32 deficit = (UInt32)m_maxReadDeficit;
+  const UInt32 required = mts::min(maxOffset, (deficit + granularity - 1) / granularity * granularity);
+
+  if (required > m_inputSafetyOffset) {
+    requestConfigurationChange(ConfigChange::SafetyOffset, required);
+  }
+}
+
+// A pair is captured as soon as a rule names it, it is silent while none of its clients plays.
+void Driver::setClientRules(CFArrayRef rules) {
+  m_clientRules = rules;
+
+  for (StreamPair& pair : m_streamPairs) {
+    pair.isCaptured = false;
+  }
+
+  for (CFIndex i = 0; rules && i < CFArrayGetCount(rules); i++) {
+    CFDictionaryRef rule = (CFDictionaryRef)CFArrayGetValueAtIndex(rules, i);
+    SInt32 stream = 0;
+    getDictionaryNumber(rule, CFSTR("stream"), kCFNumberSInt32Type, stream);
+    m_streamPairs[stream - 1].isCaptured = true;
+  }
+
+  m_clients.reroute([&](const ClientRegistry::client& c) { return findClientRoute(rules, c.bundle_id); });
+}
+
+CFDataRef Driver::copyClientStats() {
+  constexpr size_t maxSize
+      = sizeof(mts::client_stats_header) + sizeof(mts::client_stats_record) * ClientRegistry::capacity;
+  UInt8* data = (UInt8*)malloc(maxSize);
+
+  if (!data) {
+    return nullptr;
+  }
+
+  struct mach_timebase_info timebase;
+  mach_timebase_info(&timebase);
+  const Float64 ticksPerMicrosecond = ((Float64)timebase.denom / (Float64)timebase.numer) * 1000.0;
+
+  mts::client_stats_header* header = (mts::client_stats_header*)data;
+  header->version = mts::client_stats_version;
+  header->record_size = sizeof(mts::client_stats_record);
+  header->reserved = 0;
+  header->record_count = m_clients.snapshot(
+      (mts::client_stats_record*)(header + 1), ClientRegistry::capacity, ticksPerMicrosecond);
+
+  const size_t size = sizeof(mts::client_stats_header) + sizeof(mts::client_stats_record) * header->record_count;
+  CFDataRef result = CFDataCreate(kCFAllocatorDefault, data, (CFIndex)size);
+  free(data);
+  return result;
+}
+
+// Every pair gets the same program, with its own convolution. A chain only fails on an invalid
+// impulse response, the program is then set without the convolution.
+void Driver::setInsertConfig(const mts::insert_config& config, CFDataRef impulse) {
+  if (impulse) {
+    CFRetain(impulse);
+  }
+
+  if (m_insertImpulse) {
+    CFRelease(m_insertImpulse);
+  }
+
+  m_insertImpulse = impulse;
+  m_insertConfig = config;
+  m_insertLatency = 0;
+
+  for (InsertChain& chain : m_inserts) {
+    if (!chain.set(m_insertConfig, m_sampleRate)) {
+      MTS_DBG("insert chain not set");
+    }
+
+    m_insertLatency = mts::max(m_insertLatency, chain.get_set_latency());
+  }
+
+  updateWriteDelays();
+}
+
+// The convolution and the limiter delay the frames. They go back in the ring by as much of that
+// delay as the read delay hides, the rest adds to the input latency, see getInputLatency(). A new
+// delay would leave old frames or a gap in the ring.
+void Driver::updateWriteDelays() {
+  for (UInt32 i = 0; i < mts::config::stream_count; i++) {
+    StreamPair& pair = m_streamPairs[i];
+    const UInt32 writeDelay = mts::min(m_inserts[i].get_set_latency(), m_readDelay);
+
+    if (writeDelay != pair.writeDelay && pair.ring.is_allocated()) {
+      pair.ring.clear();
+      pair.isBufferClear = true;
+    }
+
+    pair.writeDelay = writeDelay;
+  }
+}
+
+// The load of a node is summed over the pairs that ran it, the reduction is the largest of the pairs.
+CFDictionaryRef Driver::copyInserts() {
+  struct mach_timebase_info timebase;
+  mach_timebase_info(&timebase);
+  const Float64 ticksPerMicrosecond = ((Float64)timebase.denom / (Float64)timebase.numer) * 1000.0;
+
+  const CFStringRef names[mts::insert_node_count]
+      = { CFSTR("high_pass"), CFSTR("eq"), CFSTR("convolution"), CFSTR("limiter") };
+  CFMutableDictionaryRef dict = copyInsertsDictionary(m_insertConfig, m_insertImpulse);
+  CFMutableDictionaryRef load = createMutableDictionary();
+
+  for (UInt32 n = 0; n < mts::insert_node_count; n++) {
+    UInt64 calls = 0;
+    UInt64 ticks = 0;
+    UInt64 worstTicks = 0;
+
+    for (const InsertChain& chain : m_inserts) {
+      const mts::insert_cost& cost = chain.get_cost(static_cast<mts::insert_node>(n));
+      calls += cost.calls.load(std::memory_order_relaxed);
+      ticks += cost.ticks.load(std::memory_order_relaxed);
+      worstTicks = mts::max(worstTicks, cost.worst_ticks.load(std::memory_order_relaxed));
+    }
+
+    if (!calls) {
+      continue;
+    }
+
+    CFMutableDictionaryRef node = createMutableDictionary();
+    setDictionaryNumber(node, CFSTR("average_us"), (Float64)ticks / calls / ticksPerMicrosecond);
+    setDictionaryNumber(node, CFSTR("worst_us"), (Float64)worstTicks / ticksPerMicrosecond);
+    CFDictionarySetValue(load, names[n], node);
+    CFRelease(node);
+  }
+
+  CFDictionarySetValue(dict, CFSTR("load"), load);
+  CFRelease(load);
+
+  Float32 reduction = 0;
+
+  for (InsertChain& chain : m_inserts) {
+    reduction = mts::max(reduction, chain.take_limiter_reduction());
+  }
+
+  setDictionaryNumber(dict, CFSTR("limiter_reduction_db"), reduction);
+  return dict;
+}
+
+// The layouts are fixed by the config, only the settings and the sample rate change.
+void Driver::setDownmix(const mts::downmix_settings& settings) {
+  m_downmixSettings = settings;
+
+  for (Downmix& downmix : m_downmixes) {
+    downmix.set(mts::config::output_channel_layout, mts::config::input_channel_layout, settings, m_sampleRate);
+  }
+}
+
+CFDictionaryRef Driver::copyLoudness() const {
+  CFMutableDictionaryRef dict = copyLoudnessSettings(m_loudness);
+  CFMutableArrayRef streams = CFArrayCreateMutable(kCFAllocatorDefault, 0, &kCFTypeArrayCallBacks);
+
+  for (UInt32 i = 0; i < mts::config::stream_count; i++) {
+    const mts::loudness_values& values = m_loudness.get_values(i);
+    CFMutableDictionaryRef stream = createMutableDictionary();
+
+    setDictionaryLoudness(stream, CFSTR("momentary"), values.momentary);
+    setDictionaryLoudness(stream, CFSTR("short_term"), values.short_term);
+    setDictionaryLoudness(stream, CFSTR("integrated"), values.integrated);
+    setDictionaryNumber(stream, CFSTR("gain"), values.gain_db.load(std::memory_order_relaxed));
+    CFArrayAppendValue(streams, stream);
+    CFRelease(stream);
+  }
+
+  CFDictionarySetValue(dict, CFSTR("streams"), streams);
+  CFRelease(streams);
+  return dict;
+}
+
+// The peaks start again and the transitions are taken, the mutex keeps a single reader.
+CFDictionaryRef Driver::copyIOLoad() {
+  const CFStringRef names[ioStageCount] = { CFSTR("loudness_meter"), CFSTR("binaural"), CFSTR("convolution") };
+  const UInt32 level = m_scheduler.level.load(std::memory_order_relaxed);
+  const UInt32 frames = m_ioBufferFrameSize.load(std::memory_order_relaxed);
+  CFMutableDictionaryRef dict = createMutableDictionary();
+
+  setDictionaryNumber(dict, CFSTR("budget_us"), frames / m_sampleRate * 1000000.0);
+  setDictionaryNumber(dict, CFSTR("load"), m_scheduler.load.load(std::memory_order_relaxed));
+  setDictionaryNumber(dict, CFSTR("peak_load"), m_scheduler.peak_load.exchange(0, std::memory_order_relaxed));
+  setDictionaryNumber(dict, CFSTR("overruns"), m_scheduler.overruns.exchange(0, std::memory_order_relaxed));
+  CFDictionarySetValue(dict, CFSTR("adaptive"), m_scheduler.is_enabled() ? kCFBooleanTrue : kCFBooleanFalse);
+  setDictionaryNumber(dict, CFSTR("level"), level);
+
+  CFMutableArrayRef stages = CFArrayCreateMutable(kCFAllocatorDefault, 0, &kCFTypeArrayCallBacks);
+
+  for (UInt32 i = 0; i < ioStageCount; i++) {
+    CFMutableDictionaryRef stage = createMutableDictionary();
+    CFDictionarySetValue(stage, CFSTR("name"), names[i]);
+    CFDictionarySetValue(stage, CFSTR("degraded"), level > i ? kCFBooleanTrue : kCFBooleanFalse);
+    CFArrayAppendValue(stages, stage);
+    CFRelease(stage);
+  }
+
+  CFDictionarySetValue(dict, CFSTR("stages"), stages);
+  CFRelease(stages);
+
+  CFMutableArrayRef transitions = CFArrayCreateMutable(kCFAllocatorDefault, 0, &kCFTypeArrayCallBacks);
+  mts::quality_transition t;
+
+  while (m_scheduler.pop_transition(t)) {
+    CFMutableDictionaryRef transition = createMutableDictionary();
+    setDictionaryNumber(transition, CFSTR("sample_time"), t.sample_time);
+    setDictionaryNumber(transition, CFSTR("host_time"), t.host_time);
+    setDictionaryNumber(transition, CFSTR("from"), t.from);
+    setDictionaryNumber(transition, CFSTR("to"), t.to);
+    setDictionaryNumber(transition, CFSTR("load"), t.load);
+    CFArrayAppendValue(transitions, transition);
+    CFRelease(transition);
+  }
+
+  CFDictionarySetValue(dict, CFSTR("transitions"), transitions);
+  CFRelease(transitions);
+
+  setDictionaryNumber(dict, CFSTR("transition_count"), m_scheduler.transition_count.load(std::memory_order_relaxed));
+  setDictionaryNumber(
+      dict, CFSTR("dropped_transitions"), m_scheduler.dropped_transitions.exchange(0, std::memory_order_relaxed));
+  return dict;
+}
+
 // The job of this method is, as the name implies, to get the driver initialized. One specific
 // thing that needs to be done is to store the AudioServerPlugInHostRef so that it can be used
 // later. Note that when this call returns, the HAL will scan the various lists the driver
@@ -891,28 +2440,98 @@ inline CFStringRef getInitBoxNameProperty(AudioServerPlugInHostRef host) {
 // publishing. So, there is no need to notifiy the HAL about any objects created as part of the
 // execution of this method.
 
-///
-/// @method         Initialize
-/// @abstract       This method is called to initialize the instance of the plug-in.
-/// @discussion     As part of initialization, the plug-in should publish all the objects it
-///                 knows about at the time.
-///
-/// @param          inDriver
-///                        The plug-in to initialize.
-/// @param          inHost
-///                        An AudioServerPlugInHostInterface struct that the plug-in is to use for
-///                        communication with the Host. The Host guarantees that the storage
-///                        pointed to by inHost will remain valid for the lifetime of the plug-in.
-/// @result         An OSStatus indicating success or failure.
-///
-OSStatus Driver::InitializeImpl(AudioServerPlugInHostRef inHost) {
-  m_pluginHost = inHost;
+///
+/// @method         Initialize
+/// @abstract       This method is called to initialize the instance of the plug-in.
+/// @discussion     As part of initialization, the plug-in should publish all the objects it
+///                 knows about at the time.
+///
+/// @param          inDriver
+///                        The plug-in to initialize.
+/// @param          inHost
+///                        An AudioServerPlugInHostInterface struct that the plug-in is to use for
+///                        communication with the Host. The Host guarantees that the storage
+///                        pointed to by inHost will remain valid for the lifetime of the plug-in.
+/// @result         An OSStatus indicating success or failure.
+///
+OSStatus Driver::InitializeImpl(AudioServerPlugInHostRef inHost) {
+  m_pluginHost = inHost;
+
+  // Start emitting the records captured by MTS_DBG(...).
+  mts::log::start();
+
+  // Initialize the box acquired property from the settings.
+  m_isBoxAcquired = getInitBoxAcquiredProperty(m_pluginHost);
+
+  // Initialize box name from the settings.
+  m_boxName = getInitBoxNameProperty(m_pluginHost);
+
+  // Initialize the routing from the settings, an invalid one is the identity.
+  CFPropertyListRef routes = nullptr;
+  if (m_pluginHost->CopyFromStorage(m_pluginHost, CFSTR(MTS_PROPERTY_ROUTING), &routes) == kAudioHardwareNoError
+      && routes) {
+    if (compileRoutes(routes, m_routing)) {
+      m_routes = (CFArrayRef)routes;
+    }
+    else {
+      CFRelease(routes);
+    }
+  }
+
+  // Initialize the client rules from the settings.
+  CFPropertyListRef rules = nullptr;
+  if (m_pluginHost->CopyFromStorage(m_pluginHost, CFSTR(MTS_PROPERTY_CLIENT_RULES), &rules) == kAudioHardwareNoError
+      && rules) {
+    if (isValidClientRules(rules)) {
+      setClientRules((CFArrayRef)rules);
+    }
+    else {
+      CFRelease(rules);
+    }
+  }
+
+  // Initialize the insert chain from the settings.
+  CFPropertyListRef inserts = nullptr;
+  if (m_pluginHost->CopyFromStorage(m_pluginHost, CFSTR(MTS_PROPERTY_INSERTS), &inserts) == kAudioHardwareNoError
+      && inserts) {
+    mts::insert_config config;
+    CFDataRef impulse;
+
+    if (parseInserts(inserts, config, impulse)) {
+      setInsertConfig(config, impulse);
+    }
+
+    CFRelease(inserts);
+  }
+
+  // Initialize the loudness settings from the settings and start integrating.
+  CFPropertyListRef loudness = nullptr;
+  if (m_pluginHost->CopyFromStorage(m_pluginHost, CFSTR(MTS_PROPERTY_LOUDNESS), &loudness) == kAudioHardwareNoError
+      && loudness) {
+    setLoudnessSettings(loudness, m_loudness);
+    CFRelease(loudness);
+  }
+
+  for (LoudnessMeter& meter : m_loudnessMeters) {
+    meter.set_layout(mts::config::output_channel_layout);
+    meter.set_sample_rate(m_sampleRate);
+  }
+
+  m_loudness.start();
+
+  // Initialize the downmix from the settings, the mode of the config by default.
+  mts::downmix_settings downmix;
+  downmix.mode = getDefaultDownmixMode();
+  CFPropertyListRef downmixSettings = nullptr;
 
-  // Initialize the box acquired property from the settings.
-  m_isBoxAcquired = getInitBoxAcquiredProperty(m_pluginHost);
+  if (m_pluginHost->CopyFromStorage(m_pluginHost, CFSTR(MTS_PROPERTY_DOWNMIX), &downmixSettings)
+          == kAudioHardwareNoError
+      && downmixSettings) {
+    parseDownmixSettings(downmixSettings, downmix);
+    CFRelease(downmixSettings);
+  }
 
-  // Initialize box name from the settings.
-  m_boxName = getInitBoxNameProperty(m_pluginHost);
+  setDownmix(downmix);
 
   // Calculate the host ticks per frame.
   struct mach_timebase_info theTimeBaseInfo;
@@ -920,6 +2539,9 @@ OSStatus Driver::InitializeImpl(AudioServerPlugInHostRef inHost) {
   Float64 theHostClockFrequency = ((Float64)theTimeBaseInfo.denom / (Float64)theTimeBaseInfo.numer) * 1000000000.0;
   m_hostTicksPerFrame = theHostClockFrequency / m_sampleRate;
 
+  m_scheduler.set_enabled(mts::config::adaptive_quality);
+  m_scheduler.set_timing(m_sampleRate, m_hostTicksPerFrame);
+
   return kAudioHardwareNoError;
 }
 
@@ -938,14 +2560,24 @@ OSStatus Driver::CreateDeviceImpl(
 OSStatus Driver::DestroyDeviceImpl(AudioObjectID inDeviceObjectID) { return kAudioHardwareUnsupportedOperationError; }
 
 // This method is used to inform the driver about a new client that is using the given device.
-// This allows the device to act differently depending on who the client is. This driver does
-// not need to track the clients using the device, so we just check the arguments and return
-// successfully.
+// This allows the device to act differently depending on who the client is. The client is
+// registered in m_clients with the stream pair its bundle ID is routed to by the client rules,
+// its IO is measured for the ClientStats property and its output captured by that pair.
 OSStatus Driver::AddDeviceClientImpl(AudioObjectID inDeviceObjectID, const AudioServerPlugInClientInfo* inClientInfo) {
   if (static_cast<ObjectID>(inDeviceObjectID) != ObjectID::Device) {
     return kAudioHardwareBadObjectError;
   }
 
+  // A client that doesn't fit in the registry is still heard on the shared pair.
+  mts::scoped_lock lock(m_stateMutex);
+  mts::capture::client<mts::config::io_capture>(mts::capture::record_type::add_client, inClientInfo->mClientID,
+      inClientInfo->mProcessID, inClientInfo->mBundleID);
+  const UInt32 route = findClientRoute(m_clientRules, inClientInfo->mBundleID);
+
+  if (!m_clients.add(inClientInfo->mClientID, inClientInfo->mProcessID, inClientInfo->mBundleID, route)) {
+    MTS_DBG("unable to register client");
+  }
+
   return kAudioHardwareNoError;
 }
 
@@ -955,6 +2587,10 @@ OSStatus Driver::RemoveDeviceClientImpl(
     return kAudioHardwareBadObjectError;
   }
 
+  mts::scoped_lock lock(m_stateMutex);
+  mts::capture::client<mts::config::io_capture>(
+      mts::capture::record_type::remove_client, inClientInfo->mClientID, inClientInfo->mProcessID, nullptr);
+  m_clients.remove(inClientInfo->mClientID);
   return kAudioHardwareNoError;
 }
 
@@ -968,26 +2604,203 @@ OSStatus Driver::RemoveDeviceClientImpl(
 // means that the only notifications that would need to be sent here would be for either
 // custom properties the HAL doesn't know about or for controls.
 //
-// For the device implemented by this driver, only sample rate changes go through this process
-// as it is the only state that can be changed for the device that isn't a control. For this
-// change, the new sample rate is passed in the inChangeAction argument.
+// For the device implemented by this driver, the sample rate, the stream formats and the latency
+// profile go through this process. inChangeAction is a ConfigChange and inChangeInfo carries the new value.
 OSStatus Driver::PerformDeviceConfigurationChangeImpl(
     AudioObjectID inDeviceObjectID, UInt64 inChangeAction, void* inChangeInfo) {
   RETURN_ERROR_IF(
       inDeviceObjectID != static_cast<AudioObjectID>(ObjectID::Device), kAudioHardwareBadObjectError, "Bad device ID");
-  RETURN_ERROR_IF(
-      !mts::config::is_supported_sample_rate((Float64)inChangeAction), kAudioHardwareBadObjectError, "Bad sample rate");
+
+  switch (static_cast<ConfigChange>(inChangeAction)) {
+  case ConfigChange::SampleRate:
+    break;
+
+  case ConfigChange::LatencyProfile: {
+    RETURN_ERROR_IF((uintptr_t)inChangeInfo >= mts::config::latency_profile_count, kAudioHardwareBadObjectError,
+        "Bad latency profile");
+
+    {
+      mts::scoped_lock lock(m_stateMutex);
+      m_latencyProfile = static_cast<mts::config::latency_profile_type>((uintptr_t)inChangeInfo);
+
+      // A smaller ring may not hold the delay anymore.
+      m_readDelay = mts::min(m_readDelay, getMaxReadDelay());
+      updateWriteDelays();
+    }
+
+    // The HAL doesn't know about the custom property.
+    AudioObjectPropertyAddress theAddress
+        = { static_cast<AudioObjectPropertySelector>(CustomProperty::LatencyProfile), kAudioObjectPropertyScopeGlobal,
+            kAudioObjectPropertyElementMain };
+
+    m_pluginHost->PropertiesChanged(m_pluginHost, static_cast<AudioObjectID>(ObjectID::Device), 1, &theAddress);
+    return kAudioHardwareNoError;
+  }
+
+  case ConfigChange::SafetyOffset: {
+    mts::scoped_lock lock(m_stateMutex);
+    m_inputSafetyOffset = (UInt32)(uintptr_t)inChangeInfo;
+    return kAudioHardwareNoError;
+  }
+
+  case ConfigChange::ReadDelay: {
+    {
+      mts::scoped_lock lock(m_stateMutex);
+      m_readDelay = mts::min((UInt32)(uintptr_t)inChangeInfo, getMaxReadDelay());
+      updateWriteDelays();
+    }
+
+    // The HAL reads the latency again after the change, but doesn't know about the custom property.
+    AudioObjectPropertyAddress theAddress
+        = { static_cast<AudioObjectPropertySelector>(CustomProperty::ReadDelay), kAudioObjectPropertyScopeGlobal,
+            kAudioObjectPropertyElementMain };
+
+    m_pluginHost->PropertiesChanged(m_pluginHost, static_cast<AudioObjectID>(ObjectID::Device), 1, &theAddress);
+    return kAudioHardwareNoError;
+  }
+
+  case ConfigChange::Routing: {
+    RoutingChange* change = (RoutingChange*)inChangeInfo;
+    RETURN_ERROR_IF(!change, kAudioHardwareIllegalOperationError, "Bad routing");
+    CFArrayRef previous;
+
+    {
+      mts::scoped_lock lock(m_stateMutex);
+      m_routing = change->matrix;
+      previous = m_routes;
+      m_routes = change->routes;
+    }
+
+    m_pluginHost->WriteToStorage(m_pluginHost, CFSTR(MTS_PROPERTY_ROUTING), change->routes);
+
+    if (previous) {
+      CFRelease(previous);
+    }
+
+    delete change;
+
+    AudioObjectPropertyAddress theAddress
+        = { static_cast<AudioObjectPropertySelector>(CustomProperty::Routing), kAudioObjectPropertyScopeGlobal,
+            kAudioObjectPropertyElementMain };
+
+    m_pluginHost->PropertiesChanged(m_pluginHost, static_cast<AudioObjectID>(ObjectID::Device), 1, &theAddress);
+    return kAudioHardwareNoError;
+  }
+
+  case ConfigChange::ClientRules: {
+    CFArrayRef rules = (CFArrayRef)inChangeInfo;
+    RETURN_ERROR_IF(!rules, kAudioHardwareIllegalOperationError, "Bad client rules");
+    CFArrayRef previous;
+
+    {
+      mts::scoped_lock lock(m_stateMutex);
+      previous = m_clientRules;
+      setClientRules(rules);
+    }
+
+    m_pluginHost->WriteToStorage(m_pluginHost, CFSTR(MTS_PROPERTY_CLIENT_RULES), rules);
+
+    if (previous) {
+      CFRelease(previous);
+    }
+
+    AudioObjectPropertyAddress theAddress
+        = { static_cast<AudioObjectPropertySelector>(CustomProperty::ClientRules), kAudioObjectPropertyScopeGlobal,
+            kAudioObjectPropertyElementMain };
+
+    m_pluginHost->PropertiesChanged(m_pluginHost, static_cast<AudioObjectID>(ObjectID::Device), 1, &theAddress);
+    return kAudioHardwareNoError;
+  }
+
+  case ConfigChange::Downmix: {
+    mts::downmix_settings* settings = (mts::downmix_settings*)inChangeInfo;
+    RETURN_ERROR_IF(!settings, kAudioHardwareIllegalOperationError, "Bad downmix");
+
+    {
+      mts::scoped_lock lock(m_stateMutex);
+      setDownmix(*settings);
+    }
+
+    CFDictionaryRef saved = copyDownmixSettings(*settings);
+    m_pluginHost->WriteToStorage(m_pluginHost, CFSTR(MTS_PROPERTY_DOWNMIX), saved);
+    CFRelease(saved);
+    delete settings;
+
+    AudioObjectPropertyAddress theAddress
+        = { static_cast<AudioObjectPropertySelector>(CustomProperty::Downmix), kAudioObjectPropertyScopeGlobal,
+            kAudioObjectPropertyElementMain };
+
+    m_pluginHost->PropertiesChanged(m_pluginHost, static_cast<AudioObjectID>(ObjectID::Device), 1, &theAddress);
+    return kAudioHardwareNoError;
+  }
+
+  case ConfigChange::Inserts: {
+    InsertsChange* change = (InsertsChange*)inChangeInfo;
+    RETURN_ERROR_IF(!change, kAudioHardwareIllegalOperationError, "Bad inserts");
+
+    {
+      mts::scoped_lock lock(m_stateMutex);
+      setInsertConfig(change->config, change->impulse);
+    }
+
+    CFDictionaryRef saved = copyInsertsDictionary(change->config, change->impulse);
+    m_pluginHost->WriteToStorage(m_pluginHost, CFSTR(MTS_PROPERTY_INSERTS), saved);
+    CFRelease(saved);
+
+    if (change->impulse) {
+      CFRelease(change->impulse);
+    }
+
+    delete change;
+
+    // The HAL reads the latency again after the change, but doesn't know about the custom property.
+    AudioObjectPropertyAddress theAddress
+        = { static_cast<AudioObjectPropertySelector>(CustomProperty::Inserts), kAudioObjectPropertyScopeGlobal,
+            kAudioObjectPropertyElementMain };
+
+    m_pluginHost->PropertiesChanged(m_pluginHost, static_cast<AudioObjectID>(ObjectID::Device), 1, &theAddress);
+    return kAudioHardwareNoError;
+  }
+
+  case ConfigChange::StreamFormat: {
+    const StreamFormatChange change = StreamFormatChange::decode(inChangeInfo);
+    mts::scoped_lock lock(m_stateMutex);
+    RETURN_ERROR_IF((UInt32)change.format.format >= mts::sample_format_count, kAudioHardwareBadObjectError,
+        "Bad stream format");
+    RETURN_ERROR_IF(change.pair >= mts::config::stream_count, kAudioHardwareBadObjectError, "Bad stream pair");
+    m_streamFormats[change.isInput ? 0 : 1][change.pair] = change.format;
+    return kAudioHardwareNoError;
+  }
+
+  default:
+    return kAudioHardwareBadObjectError;
+  }
+
+  const Float64 sampleRate = (Float64)(uintptr_t)inChangeInfo;
+  RETURN_ERROR_IF(!mts::config::is_supported_sample_rate(sampleRate), kAudioHardwareBadObjectError, "Bad sample rate");
 
   mts::scoped_lock lock(m_stateMutex);
 
   // Set sample rate.
-  m_sampleRate = inChangeAction;
+  m_sampleRate = sampleRate;
 
   // Recalculate the state that depends on the sample rate.
   struct mach_timebase_info theTimeBaseInfo;
   mach_timebase_info(&theTimeBaseInfo);
   Float64 theHostClockFrequency = ((Float64)theTimeBaseInfo.denom / (Float64)theTimeBaseInfo.numer) * 1000000000.0;
   m_hostTicksPerFrame = theHostClockFrequency / m_sampleRate;
+  m_scheduler.set_timing(m_sampleRate, m_hostTicksPerFrame);
+
+  // The coefficients of the inserts, of the loudness meters and of the downmix depend on the
+  // sample rate.
+  setInsertConfig(m_insertConfig, m_insertImpulse);
+  setDownmix(m_downmixSettings);
+
+  for (LoudnessMeter& meter : m_loudnessMeters) {
+    meter.set_sample_rate(m_sampleRate);
+  }
+
+  m_loudness.request_reset();
 
   return kAudioHardwareNoError;
 }
@@ -1000,6 +2813,30 @@ OSStatus Driver::AbortDeviceConfigurationChangeImpl(
     AudioObjectID inDeviceObjectID, UInt64 inChangeAction, void* inChangeInfo) {
   RETURN_ERROR_IF(
       inDeviceObjectID != static_cast<AudioObjectID>(ObjectID::Device), kAudioHardwareBadObjectError, "Bad device ID");
+
+  // The routing, the client rules, the downmix and the inserts are the only changes that own their
+  // info.
+  if (static_cast<ConfigChange>(inChangeAction) == ConfigChange::Routing && inChangeInfo) {
+    RoutingChange* change = (RoutingChange*)inChangeInfo;
+    CFRelease(change->routes);
+    delete change;
+  }
+  else if (static_cast<ConfigChange>(inChangeAction) == ConfigChange::ClientRules && inChangeInfo) {
+    CFRelease((CFArrayRef)inChangeInfo);
+  }
+  else if (static_cast<ConfigChange>(inChangeAction) == ConfigChange::Downmix && inChangeInfo) {
+    delete (mts::downmix_settings*)inChangeInfo;
+  }
+  else if (static_cast<ConfigChange>(inChangeAction) == ConfigChange::Inserts && inChangeInfo) {
+    InsertsChange* change = (InsertsChange*)inChangeInfo;
+
+    if (change->impulse) {
+      CFRelease(change->impulse);
+    }
+
+    delete change;
+  }
+
   return kAudioHardwareNoError;
 }
 
@@ -1078,6 +2915,9 @@ OSStatus Driver::SetPropertyDataImpl(AudioObjectID inObjectID, pid_t inClientPro
     return kAudioHardwareIllegalOperationError;
   }
 
+  mts::trace::instant<mts::config::io_trace>(
+      mts::trace::event_type::set_property, inClientProcessID, inObjectID, inAddress->mSelector);
+
   UInt32 theNumberPropertiesChanged = 0;
   AudioObjectPropertyAddress theChangedAddresses[2];
 
@@ -1105,7 +2945,17 @@ OSStatus Driver::StartIOImpl(AudioObjectID inDeviceObjectID, UInt32 inClientID)
   RETURN_ERROR_IF(
       inDeviceObjectID != static_cast<AudioObjectID>(ObjectID::Device), kAudioHardwareBadObjectError, "Bad device ID");
 
+  mts::trace::instant<mts::config::io_trace>(mts::trace::event_type::start_io, inClientID);
+
   mts::scoped_lock lock(m_stateMutex);
+  const UInt64 hostTime = mts::capture::host_time();
+  mts::capture::io_state<mts::config::io_capture>(mts::capture::record_type::start_io, inClientID, hostTime);
+
+  if (ClientRegistry::client* client = m_clients.get(inClientID)) {
+    client->stats.is_running.store(1, std::memory_order_relaxed);
+    mts::add_relaxed<UInt32>(client->stats.io_starts, 1);
+    client->stats.last_cycle_time.store(-1, std::memory_order_relaxed);
+  }
 
   if (m_ioRunning == UINT64_MAX) {
     return kAudioHardwareIllegalOperationError;
@@ -1116,10 +2966,45 @@ OSStatus Driver::StartIOImpl(AudioObjectID inDeviceObjectID, UInt32 inClientID)
     m_ioRunning = 1;
     m_numberTimeStamps = 0;
     m_anchorSampleTime = 0;
-    m_anchorHostTime = mach_absolute_time();
+    m_anchorHostTime = hostTime;
 
-    // Allocate ring buffer.
-    m_ringBuffer = (Float*)calloc(mts::config::ring_buffer_frame_size * mts::config::channel_count, sizeof(Float));
+    // Allocate a ring buffer per stream pair, the scratch buffers are shared by every stream.
+    const mts::config::latency_profile& profile = getLatencyProfile();
+
+    m_ioScratchFrames = profile.max_buffer_frame_size;
+
+    for (StreamPair& pair : m_streamPairs) {
+      pair.ring.allocate(profile.ring_buffer_frame_size, mts::config::channel_count);
+      pair.clientMix = (Float*)calloc((size_t)m_ioScratchFrames * mts::config::channel_count, sizeof(Float));
+      pair.clientMixSampleTime = -1;
+      pair.lastInputSampleTime = 0;
+      pair.lastOutputFrameSize = 0;
+    }
+
+    // The IO thread isn't running, the filters start from silence and the stages at full quality.
+    for (InsertChain& chain : m_inserts) {
+      chain.reset();
+    }
+
+    for (Downmix& downmix : m_downmixes) {
+      downmix.reset();
+    }
+
+    // The ramps queued while IO was stopped are stale, the gains start at the current volumes.
+    for (UInt32 pair = 0; pair < mts::config::stream_count; pair++) {
+      Float32 gains[mts::config::channel_count];
+      getChannelGains(mts::direction::input, pair, gains);
+      m_inputGains[pair].reset(gains);
+      getChannelGains(mts::direction::output, pair, gains);
+      m_outputGains[pair].reset(gains);
+    }
+
+    m_scheduler.reset();
+
+    m_ioScratch = (Float*)calloc((size_t)m_ioScratchFrames * mts::config::channel_count, sizeof(Float));
+    m_routeScratch = (Float*)calloc((size_t)m_ioScratchFrames * mts::config::channel_count, sizeof(Float));
+    m_maxReadDeficit = 0;
+    m_ioOperation.isValid = false;
 
     return kAudioHardwareNoError;
   }
@@ -1136,7 +3021,14 @@ OSStatus Driver::StopIOImpl(AudioObjectID inDeviceObjectID, UInt32 inClientID) {
   RETURN_ERROR_IF(
       inDeviceObjectID != static_cast<AudioObjectID>(ObjectID::Device), kAudioHardwareBadObjectError, "Bad device ID");
 
+  mts::trace::instant<mts::config::io_trace>(mts::trace::event_type::stop_io, inClientID);
+
   mts::scoped_lock lock(m_stateMutex);
+  mts::capture::io_state<mts::config::io_capture>(mts::capture::record_type::stop_io, inClientID, 0);
+
+  if (ClientRegistry::client* client = m_clients.get(inClientID)) {
+    client->stats.is_running.store(0, std::memory_order_relaxed);
+  }
 
   if (m_ioRunning == 0) {
     return kAudioHardwareIllegalOperationError;
@@ -1145,8 +3037,18 @@ OSStatus Driver::StopIOImpl(AudioObjectID inDeviceObjectID, UInt32 inClientID) {
   if (m_ioRunning == 1) {
     // We need to stop the hardware, which in this case means that there's nothing to do.
     m_ioRunning = 0;
-    free(m_ringBuffer);
-    m_ringBuffer = nullptr;
+
+    for (StreamPair& pair : m_streamPairs) {
+      pair.ring.free();
+      free(pair.clientMix);
+      pair.clientMix = nullptr;
+    }
+
+    free(m_ioScratch);
+    free(m_routeScratch);
+    m_ioScratch = nullptr;
+    m_routeScratch = nullptr;
+    updateSafetyOffset();
     return kAudioHardwareNoError;
   }
 
@@ -1161,20 +3063,22 @@ OSStatus Driver::StopIOImpl(AudioObjectID inDeviceObjectID, UInt32 inClientID) {
 // kAudioDevicePropertyZeroTimeStampPeriod apart. This is often modeled using a ring buffer
 // where the zero time stamp is updated when wrapping around the ring buffer.
 //
-// For this device, the zero time stamps' sample time increments every kDevice_RingBufferSize
-// frames and the host time increments by kDevice_RingBufferSize * gDevice_HostTicksPerFrame.
+// For this device, the zero time stamps' sample time increments every zero_timestamp_period frames
+// of the latency profile and the host time increments by that period * m_hostTicksPerFrame.
 OSStatus Driver::GetZeroTimeStampImpl(
     AudioObjectID inDeviceObjectID, UInt32 inClientID, Float64* outSampleTime, UInt64* outHostTime, UInt64* outSeed) {
   RETURN_ERROR_IF(
       inDeviceObjectID != static_cast<AudioObjectID>(ObjectID::Device), kAudioHardwareBadObjectError, "Bad device ID");
 
+  io_trace_scope trace(mts::trace::event_type::zero_timestamp, inClientID);
   mts::scoped_lock lock(m_ioMutex);
 
   // Get the current host time.
-  UInt64 currentHostTime = mach_absolute_time();
+  UInt64 currentHostTime = mts::capture::host_time();
 
-  // Calculate the next host time.
-  Float64 hostTicksPerRingBuffer = m_hostTicksPerFrame * ((Float64)mts::config::ring_buffer_size);
+  // Calculate the next host time. The profile only changes while IO is stopped.
+  const UInt32 period = getLatencyProfile().zero_timestamp_period;
+  Float64 hostTicksPerRingBuffer = m_hostTicksPerFrame * ((Float64)period);
 
   Float64 hostTickOffset = ((Float64)(m_numberTimeStamps + 1)) * hostTicksPerRingBuffer;
 
@@ -1186,10 +3090,12 @@ OSStatus Driver::GetZeroTimeStampImpl(
   }
 
   // Set the return values.
-  *outSampleTime = m_numberTimeStamps * mts::config::ring_buffer_size;
+  *outSampleTime = m_numberTimeStamps * period;
   *outHostTime = m_anchorHostTime + (((Float64)m_numberTimeStamps) * hostTicksPerRingBuffer);
   *outSeed = 1;
 
+  mts::capture::zero_timestamp<mts::config::io_capture>(
+      inClientID, currentHostTime, *outSampleTime, *outHostTime, *outSeed);
   return kAudioHardwareNoError;
 }
 
@@ -1204,9 +3110,11 @@ OSStatus Driver::WillDoIOOperationImpl(AudioObjectID inDeviceObjectID, UInt32 in
   bool willDo = false;
   bool willDoInPlace = true;
 
+  // ProcessOutput is where the output of each client can be captured, see processClientOutput().
   switch (inOperationID) {
   case kAudioServerPlugInIOOperationReadInput:
   case kAudioServerPlugInIOOperationWriteMix:
+  case kAudioServerPlugInIOOperationProcessOutput:
     willDo = true;
     willDoInPlace = true;
   }
@@ -1223,13 +3131,127 @@ OSStatus Driver::WillDoIOOperationImpl(AudioObjectID inDeviceObjectID, UInt32 in
   return kAudioHardwareNoError;
 }
 
-// This is called at the beginning of an IO operation. This device doesn't do anything, so just
-// check the arguments and return.
+// This is called at the beginning of an IO operation, before the DoIOOperation of each stream. It
+// takes what every stream of the operation uses, see IOOperation.
 OSStatus Driver::BeginIOOperationImpl(AudioObjectID inDeviceObjectID, UInt32 inClientID, UInt32 inOperationID,
     UInt32 inIOBufferFrameSize, const AudioServerPlugInIOCycleInfo* inIOCycleInfo) {
   RETURN_ERROR_IF(
       inDeviceObjectID != static_cast<AudioObjectID>(ObjectID::Device), kAudioHardwareBadObjectError, "Bad device ID");
 
+  mts::trace::instant<mts::config::io_trace>(
+      mts::trace::event_type::begin_io_operation, inClientID, inOperationID, inIOBufferFrameSize);
+
+  if (inIOCycleInfo
+      && mts::is_one_of(inOperationID, kAudioServerPlugInIOOperationReadInput, kAudioServerPlugInIOOperationWriteMix,
+          kAudioServerPlugInIOOperationProcessOutput)) {
+    beginIOOperation(inClientID, inOperationID, inIOBufferFrameSize, inIOCycleInfo);
+  }
+
+  return kAudioHardwareNoError;
+}
+
+// DoIOOperation takes the operation itself when BeginIOOperation wasn't called for it. An operation
+// that wasn't ended is published first so that its results aren't lost.
+IOOperation& Driver::beginIOOperation(
+    UInt32 clientID, UInt32 operationID, UInt32 frames, const AudioServerPlugInIOCycleInfo* cycle) {
+  IOOperation& op = m_ioOperation;
+
+  if (op.isValid && op.clientID == clientID && op.operationID == operationID && op.frames == frames
+      && op.currentTime == cycle->mCurrentTime.mSampleTime) {
+    return op;
+  }
+
+  if (op.isValid) {
+    endIOOperation();
+  }
+
+  const bool isReading = operationID == kAudioServerPlugInIOOperationReadInput;
+
+  op.clientID = clientID;
+  op.operationID = operationID;
+  op.frames = frames;
+  op.currentTime = cycle->mCurrentTime.mSampleTime;
+  op.client = m_clients.get(clientID);
+  op.time = isReading ? cycle->mInputTime : cycle->mOutputTime;
+
+  // The delay only moves the read cursor back, the frames are still in the ring.
+  op.ringSampleTime = isReading ? op.time.mSampleTime - m_readDelay : op.time.mSampleTime;
+  op.span = op.ringSampleTime >= 0 ? m_streamPairs[0].ring.get_span((UInt64)op.ringSampleTime, frames)
+                                   : mts::ring_span{};
+
+  op.isRouted = isReading && !m_routing.is_identity();
+  op.maxReadDeficit = getLatencyProfile().zero_timestamp_period;
+
+  for (bool& isDone : op.isPairDone) {
+    isDone = false;
+  }
+
+  op.pairCount = 0;
+  op.readDeficit = 0;
+  op.peak = 0;
+  op.isValid = true;
+
+  if (op.client) {
+    op.client->stats.add_cycle(op.currentTime, frames);
+  }
+
+  return op;
+}
+
+// The output of a client with a rule, sent to the first pair, is added to the client mix of the pair
+// it is routed to. The WriteMix of that pair writes the client mix to its ring, it comes after the
+// ProcessOutput of every client in the IO cycle. The first client of a cycle overwrites the mix.
+// The output of every client is measured for its statistics first.
+OSStatus Driver::processClientOutput(IOOperation& op, UInt32 pairIndex, const void* buffer) {
+  ClientRegistry::client* client = op.client;
+
+  if (!client) {
+    return kAudioHardwareNoError;
+  }
+
+  const mts::stream_format format = getStreamFormat(mts::direction::output, pairIndex);
+  const size_t sampleCount = (size_t)op.frames * mts::config::channel_count;
+  const UInt32 route = pairIndex == 0 ? client->route.load(std::memory_order_relaxed) : ClientRegistry::no_route;
+  const bool isNativeFormat = format.format == defaultStreamFormat.format;
+
+  if ((!isNativeFormat || route < mts::config::stream_count)
+      && (!m_ioScratch || !m_routeScratch || op.frames > m_ioScratchFrames)) {
+    return kAudioHardwareIllegalOperationError;
+  }
+
+  const Float* samples = (const Float*)buffer;
+
+  if (!isNativeFormat) {
+    mts::convert_from_format(buffer, format.format, m_ioScratch, sampleCount);
+    samples = m_ioScratch;
+  }
+
+  op.peak = mts::max(op.peak, (Float32)mts::dsp::max_magnitude(samples, sampleCount));
+
+  if (route >= mts::config::stream_count) {
+    return kAudioHardwareNoError;
+  }
+
+  StreamPair& target = m_streamPairs[route];
+
+  if (!target.clientMix) {
+    return kAudioHardwareIllegalOperationError;
+  }
+
+  // The client mix is interleaved.
+  if (format.non_interleaved) {
+    mts::dsp::interleave(samples, op.frames, m_routeScratch, mts::config::channel_count, op.frames);
+    samples = m_routeScratch;
+  }
+
+  if (target.clientMixSampleTime != op.time.mSampleTime) {
+    mts::dsp::copy(samples, target.clientMix, sampleCount);
+    target.clientMixSampleTime = op.time.mSampleTime;
+  }
+  else {
+    mts::dsp::add(samples, target.clientMix, sampleCount);
+  }
+
   return kAudioHardwareNoError;
 }
 
@@ -1241,92 +3263,295 @@ OSStatus Driver::DoIOOperationImpl(AudioObjectID inDeviceObjectID, AudioObjectID
     return kAudioHardwareBadObjectError;
   }
 
-  if (!mts::is_one_of(static_cast<ObjectID>(inStreamObjectID), ObjectID::StreamInput, ObjectID::StreamOutput)) {
+  io_trace_scope trace(mts::trace::event_type::do_io_operation, inClientID, inOperationID, inIOBufferFrameSize);
+  io_capture_scope capture(inClientID, inStreamObjectID, inOperationID, inIOBufferFrameSize, inIOCycleInfo);
+
+  mts::direction streamDirection;
+  UInt32 pairIndex;
+
+  if (!getStreamPair(inStreamObjectID, streamDirection, pairIndex)) {
     return kAudioHardwareBadObjectError;
   }
 
-  if (!mts::is_one_of(inOperationID, kAudioServerPlugInIOOperationReadInput, kAudioServerPlugInIOOperationWriteMix)) {
+  if (!mts::is_one_of(inOperationID, kAudioServerPlugInIOOperationReadInput, kAudioServerPlugInIOOperationWriteMix,
+          kAudioServerPlugInIOOperationProcessOutput)) {
     return kAudioHardwareNoError;
   }
 
-  const bool isReading = inOperationID == kAudioServerPlugInIOOperationReadInput;
+  // The client output is in the native format, a stream in its own.
+  if constexpr (mts::config::io_capture) {
+    const mts::stream_format bufferFormat = inOperationID == kAudioServerPlugInIOOperationProcessOutput
+        ? defaultStreamFormat
+        : getStreamFormat(streamDirection, pairIndex);
+    capture.set_buffer(ioMainBuffer,
+        inIOBufferFrameSize * mts::config::channel_count * mts::get_bytes_per_sample(bufferFormat.format));
+  }
 
-  // Calculate the ring buffer offsets and splits.
-  UInt64 mSampleTime = isReading ? inIOCycleInfo->mInputTime.mSampleTime : inIOCycleInfo->mOutputTime.mSampleTime;
+  IOOperation& op = beginIOOperation(inClientID, inOperationID, inIOBufferFrameSize, inIOCycleInfo);
+  mts::client_io_scope clientIO(op.client ? &op.client->stats : nullptr);
 
-  // 'mSampleTime % mts::config::ringBufferFrameSize' == 'mSampleTime & mts::config::ringBufferFrameMask'
-  // since mts::config::ringBufferFrameSize is a power of 2.
-  UInt32 ringBufferFrameLocationStart = mSampleTime & mts::config::ring_buffer_frame_mask;
-  UInt32 firstPartFrameSize = mts::config::ring_buffer_frame_size - ringBufferFrameLocationStart;
-  UInt32 secondPartFrameSize = 0;
+  // Every call of a cycle counts against its duration, the stages are set by the cycles before.
+  mts::deadline_scope<ioStageCount> deadline(m_scheduler, inIOCycleInfo->mCurrentTime.mSampleTime, inIOBufferFrameSize);
+  m_ioBufferFrameSize.store(inIOBufferFrameSize, std::memory_order_relaxed);
 
-  if (firstPartFrameSize >= inIOBufferFrameSize) {
-    firstPartFrameSize = inIOBufferFrameSize;
+  if (!op.isPairDone[pairIndex]) {
+    op.isPairDone[pairIndex] = true;
+    op.pairCount++;
   }
-  else {
-    secondPartFrameSize = inIOBufferFrameSize - firstPartFrameSize;
+
+  if (inOperationID == kAudioServerPlugInIOOperationProcessOutput) {
+    return processClientOutput(op, pairIndex, ioMainBuffer);
+  }
+
+  const bool isReading = inOperationID == kAudioServerPlugInIOOperationReadInput;
+  StreamPair& pair = m_streamPairs[pairIndex];
+
+  // A captured pair writes its client mix, in the native format, instead of the mix of its stream.
+  const bool isCaptured = !isReading && pair.isCaptured;
+  const mts::stream_format format = isCaptured ? defaultStreamFormat : getStreamFormat(streamDirection, pairIndex);
+  ChannelGains& gains = isReading ? m_inputGains[pairIndex] : m_outputGains[pairIndex];
+  const size_t sampleCount = (size_t)inIOBufferFrameSize * mts::config::channel_count;
+
+  // Streams in another sample format are converted through the scratch buffer. The conversion is
+  // sample by sample, so it is the same for both layouts.
+  const bool isNativeFormat = format.format == defaultStreamFormat.format;
+
+  // The output gain is applied to a copy of the mix in the scratch buffer, the routing copies the
+  // mix from one scratch buffer to the other. The auto gain and the inserts work in place in a
+  // scratch buffer.
+  const bool isOutputGain = !isReading && !gains.is_unity();
+  const Float autoGain = isReading ? 1 : (Float)m_loudness.get_gain(pairIndex);
+  const bool isAutoGain = !isReading && !m_loudnessMeters[pairIndex].is_unity(autoGain);
+  const bool isInserted = !isReading && !m_inserts[pairIndex].is_bypassed();
+
+  // The routing or the downmix reads the ring into the route scratch buffer. The routing maps the
+  // output channels to the input channels itself, it replaces the downmix.
+  const bool isDownmixed = isReading && !op.isRouted && !m_downmixes[pairIndex].is_identity();
+
+  if ((!isNativeFormat || isOutputGain || op.isRouted || isCaptured || isAutoGain || isInserted || isDownmixed)
+      && (!m_ioScratch || !m_routeScratch || inIOBufferFrameSize > m_ioScratchFrames)) {
+    return kAudioHardwareIllegalOperationError;
+  }
+
+  if (isCaptured && !pair.clientMix) {
+    return kAudioHardwareIllegalOperationError;
   }
 
+  // Sample f of channel c is at f * frameStride + c * channelStride.
+  const size_t frameStride = format.non_interleaved ? 1 : mts::config::channel_count;
+  const size_t channelStride = format.non_interleaved ? inIOBufferFrameSize : 1;
+
   // From driver to application.
   if (isReading) {
-    Float* outputBuffer = (Float*)ioMainBuffer;
+    Float* outputBuffer = isNativeFormat ? (Float*)ioMainBuffer : m_ioScratch;
+    const Float64 readSampleTime = op.ringSampleTime;
+
+    // Frames at the end of this read that the writer hasn't written yet. Only measured while the
+    // writer is running, a stopped writer is more than a period behind.
+    const Float64 readDeficit
+        = (readSampleTime + inIOBufferFrameSize) - (pair.lastOutputSampleTime + pair.lastOutputFrameSize);
+
+    if (readDeficit > op.readDeficit && readDeficit < op.maxReadDeficit) {
+      op.readDeficit = readDeficit;
+    }
 
     // If mute is one let's just fill the buffer with zeros or if there's no apps outputing audio.
-    if (m_muteMasterValue || (m_lastOutputSampleTime - inIOBufferFrameSize < inIOCycleInfo->mInputTime.mSampleTime)) {
-      // Clear the outputBuffer
-      mts::dsp::clear(outputBuffer, inIOBufferFrameSize * mts::config::channel_count);
+    // Nothing was written yet before the start of the delay.
+    if (gains.is_silent() || readSampleTime < 0
+        || (pair.lastOutputSampleTime - inIOBufferFrameSize < readSampleTime)) {
+      // Clear the outputBuffer, zero is all bits cleared in every format.
+      memset(ioMainBuffer, 0, sampleCount * mts::get_bytes_per_sample(format.format));
 
       // Clear the ring buffer.
-      if (!m_isBufferClear) {
+      if (!pair.isBufferClear) {
         // TODO: There is probably a better way than clearing this buffer everytime.
-        mts::dsp::clear(m_ringBuffer, mts::config::ring_buffer_frame_size * mts::config::channel_count);
-        m_isBufferClear = true;
+        pair.ring.clear();
+        pair.isBufferClear = true;
       }
     }
     else {
-      // Copy the buffers.
-      mts::dsp::copy(m_ringBuffer + ringBufferFrameLocationStart * mts::config::channel_count, // Src.
-          outputBuffer, // Dst.
-          firstPartFrameSize * mts::config::channel_count);
+      // Copy the buffers, a non-interleaved buffer is one block of inIOBufferFrameSize frames per channel.
+      Float* ringBuffer = op.isRouted || isDownmixed ? m_routeScratch : outputBuffer;
+
+      if (format.non_interleaved) {
+        pair.ring.read_planar(ringBuffer, inIOBufferFrameSize, op.span);
+      }
+      else {
+        pair.ring.read(ringBuffer, op.span);
+      }
 
-      mts::dsp::copy(m_ringBuffer, // Src.
-          outputBuffer + firstPartFrameSize * mts::config::channel_count, // Dst.
-          secondPartFrameSize * mts::config::channel_count);
+      // The ring holds the channels of the output layout.
+      if (op.isRouted) {
+        m_routing.process(m_routeScratch, outputBuffer, inIOBufferFrameSize, frameStride, channelStride);
+      }
+      else if (isDownmixed) {
+        m_downmixes[pairIndex].process(m_routeScratch, outputBuffer, inIOBufferFrameSize, frameStride, channelStride,
+            m_scheduler.is_degraded((UInt32)IOStage::Binaural));
+      }
 
-      // Finally we'll apply the output volume to the buffer.
-      mts::dsp::mul(outputBuffer, (Float)m_volumeMasterValue, inIOBufferFrameSize * mts::config::channel_count);
+      // Finally we'll apply the input volumes and mute, the changes start at their frame in this cycle.
+      gains.process(outputBuffer, inIOBufferFrameSize, frameStride, channelStride, op.time, m_hostTicksPerFrame);
+
+      if (!isNativeFormat) {
+        mts::convert_to_format(
+            outputBuffer, ioMainBuffer, format.format, sampleCount, mts::config::dither ? &m_dither : nullptr);
+      }
     }
   }
 
   // From application to driver.
   else {
-    // Save the last output time.
-    m_lastOutputSampleTime = inIOCycleInfo->mOutputTime.mSampleTime;
-    m_isBufferClear = false;
-
     const Float* inputBuffer = (const Float*)ioMainBuffer;
 
-    mts::dsp::copy(inputBuffer, // Src.
-        m_ringBuffer + ringBufferFrameLocationStart * mts::config::channel_count, // Dst.
-        firstPartFrameSize * mts::config::channel_count);
+    // The client mix is silent when no client routed to this pair played during this cycle.
+    if (isCaptured) {
+      if (pair.clientMixSampleTime != op.time.mSampleTime) {
+        mts::dsp::clear(pair.clientMix, sampleCount);
+      }
+
+      inputBuffer = pair.clientMix;
+    }
+
+    if (!isNativeFormat) {
+      mts::convert_from_format(ioMainBuffer, format.format, m_ioScratch, sampleCount);
+      inputBuffer = m_ioScratch;
+    }
+
+    // The ring has a single reader, the output volumes and mute are applied once here so that the
+    // read stays a copy.
+    if (isOutputGain) {
+      if (isNativeFormat) {
+        mts::dsp::copy(inputBuffer, m_ioScratch, sampleCount);
+        inputBuffer = m_ioScratch;
+      }
+
+      gains.process(m_ioScratch, inIOBufferFrameSize, frameStride, channelStride, op.time, m_hostTicksPerFrame);
+    }
+
+    // The meter hears the mix before the auto gain, which doesn't change what it measures.
+    if (!m_scheduler.is_degraded((UInt32)IOStage::LoudnessMeter)) {
+      m_loudnessMeters[pairIndex].process(inputBuffer, inIOBufferFrameSize, frameStride, channelStride,
+          [&](Float64 energy) { m_loudness.push(pairIndex, energy); });
+    }
+
+    // The loopback hears the output of the auto gain and of the inserts.
+    if ((isAutoGain || isInserted) && inputBuffer != m_ioScratch && inputBuffer != m_routeScratch) {
+      mts::dsp::copy(inputBuffer, m_ioScratch, sampleCount);
+      inputBuffer = m_ioScratch;
+    }
+
+    if (isAutoGain) {
+      m_loudnessMeters[pairIndex].apply_gain(
+          (Float*)inputBuffer, inIOBufferFrameSize, frameStride, channelStride, autoGain);
+    }
+
+    if (isInserted) {
+      m_inserts[pairIndex].set_convolution_bypassed(m_scheduler.is_degraded((UInt32)IOStage::Convolution));
+      m_inserts[pairIndex].process((Float*)inputBuffer, inIOBufferFrameSize, frameStride, channelStride);
+    }
+
+    // The frames go back in the ring by the part of the delay of the inserts that the read delay
+    // hides, see updateWriteDelays().
+    const UInt32 writeDelay = pair.writeDelay;
+
+    const Float64 writeSampleTime = op.time.mSampleTime - writeDelay;
+    const mts::ring_span span = !writeDelay ? op.span
+        : writeSampleTime >= 0              ? pair.ring.get_span((UInt64)writeSampleTime, inIOBufferFrameSize)
+                                            : mts::ring_span{};
 
-    mts::dsp::copy(inputBuffer + firstPartFrameSize * mts::config::channel_count, // Src.
-        m_ringBuffer, // Dst.
-        secondPartFrameSize * mts::config::channel_count);
+    if (op.client) {
+      op.peak = mts::max(op.peak, (Float32)mts::dsp::max_magnitude(inputBuffer, sampleCount));
+    }
+
+    // When the reader is far behind (or there is none), the frames written now won't be in the
+    // cache when they are read.
+    const bool nonTemporal = op.time.mSampleTime - pair.lastInputSampleTime > pair.ring.get_non_temporal_distance();
+
+    if (format.non_interleaved) {
+      pair.ring.write_planar(inputBuffer, inIOBufferFrameSize, span, nonTemporal);
+    }
+    else {
+      pair.ring.write(inputBuffer, span, nonTemporal);
+    }
   }
 
   return kAudioHardwareNoError;
 }
 
-// This is called at the end of an IO operation. This device doesn't do anything, so just check
-// the arguments and return.
+// This is called at the end of an IO operation, after the DoIOOperation of each stream.
 OSStatus Driver::EndIOOperationImpl(AudioObjectID inDeviceObjectID, UInt32 inClientID, UInt32 inOperationID,
     UInt32 inIOBufferFrameSize, const AudioServerPlugInIOCycleInfo* inIOCycleInfo) {
   RETURN_ERROR_IF(
       inDeviceObjectID != static_cast<AudioObjectID>(ObjectID::Device), kAudioHardwareBadObjectError, "Bad device ID");
+
+  mts::trace::instant<mts::config::io_trace>(
+      mts::trace::event_type::end_io_operation, inClientID, inOperationID, inIOBufferFrameSize);
+
+  const IOOperation& op = m_ioOperation;
+
+  if (op.isValid && op.clientID == inClientID && op.operationID == inOperationID) {
+    endIOOperation();
+  }
+
   return kAudioHardwareNoError;
 }
 
+// The cycle times of the pairs are only read by the operations of the next cycles, they are saved
+// once for every stream of the operation.
+void Driver::endIOOperation() {
+  IOOperation& op = m_ioOperation;
+  op.isValid = false;
+
+  if (op.pairCount == 0) {
+    return;
+  }
+
+  const bool isReading = op.operationID == kAudioServerPlugInIOOperationReadInput;
+  const bool isWriting = op.operationID == kAudioServerPlugInIOOperationWriteMix;
+
+  for (UInt32 i = 0; i < mts::config::stream_count && (isReading || isWriting); i++) {
+    if (!op.isPairDone[i]) {
+      continue;
+    }
+
+    StreamPair& pair = m_streamPairs[i];
+
+    if (isReading) {
+      pair.lastInputSampleTime = op.time.mSampleTime;
+    }
+    else {
+      // Save the last output time, where the frames are in the ring.
+      pair.lastOutputSampleTime = op.time.mSampleTime - pair.writeDelay;
+      pair.lastOutputFrameSize = op.frames;
+      pair.isBufferClear = false;
+    }
+  }
+
+  if (isReading && op.readDeficit > m_maxReadDeficit) {
+    m_maxReadDeficit = op.readDeficit;
+  }
+
+  if (!op.client) {
+    return;
+  }
+
+  mts::client_stats& stats = op.client->stats;
+  const UInt64 frames = (UInt64)op.frames * op.pairCount;
+
+  if (isReading) {
+    mts::add_relaxed<UInt64>(stats.frames_read, frames);
+
+    // The reader went past the writer.
+    if (op.readDeficit > 0) {
+      mts::add_relaxed<UInt32>(stats.xruns, 1);
+    }
+  }
+  else {
+    mts::add_relaxed<UInt64>(stats.frames_written, frames);
+    stats.add_peak(op.peak);
+  }
+}
+
 // This is the CFPlugIn factory function. Its job is to create the implementation for the given
 // type provided that the type is supported. Because this driver is simple and all its
 // initialization is handled via static iniitalization when the bundle is loaded, all that
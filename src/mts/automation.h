@@ -0,0 +1,393 @@
+#pragma once
+#include "mts/platform.h"
+#include "mts/util.h"
+#include "mts/dsp.h"
+#include <atomic>
+#include <math.h>
+
+namespace mts {
+/// Lock-free single producer single consumer queue. Capacity must be a power of two.
+/// push() fails when the queue is full, pop() when it is empty.
+template <typename T, UInt32 Capacity>
+class spsc_queue {
+public:
+  static_assert(mts::is_power_of_two(Capacity), "Capacity must be a power of two");
+
+  /// Must only be called from the producer.
+  inline bool push(const T& value) noexcept {
+    const UInt32 head = m_head.load(std::memory_order_relaxed);
+
+    if (head - m_tail.load(std::memory_order_acquire) == Capacity) {
+      return false;
+    }
+
+    m_items[head & (Capacity - 1)] = value;
+    m_head.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  /// Must only be called from the consumer.
+  inline bool pop(T& value) noexcept {
+    const UInt32 tail = m_tail.load(std::memory_order_relaxed);
+
+    if (tail == m_head.load(std::memory_order_acquire)) {
+      return false;
+    }
+
+    value = m_items[tail & (Capacity - 1)];
+    m_tail.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  /// Must only be called from the consumer.
+  inline bool empty() const noexcept {
+    return m_tail.load(std::memory_order_relaxed) == m_head.load(std::memory_order_acquire);
+  }
+
+private:
+  T m_items[Capacity];
+  alignas(64) std::atomic<UInt32> m_head{ 0 };
+  alignas(64) std::atomic<UInt32> m_tail{ 0 };
+};
+
+/// Linear ramps are linear in amplitude, exponential ones are linear in decibels.
+enum class ramp_shape : UInt8 { linear, exponential };
+
+/// Time base of a gain event. An immediate event, or one that is already late, starts at the first
+/// frame of the next cycle.
+enum class event_time : UInt8 { immediate, sample_time, host_time };
+
+/// A change of the gain of every channel starting at `time` (a sample time or a mach host time)
+/// and reaching `gains` after `ramp_frames` frames.
+template <UInt32 Channels>
+struct gain_event {
+  Float32 gains[Channels];
+  UInt32 ramp_frames;
+  UInt64 time;
+  event_time time_type;
+  ramp_shape shape;
+};
+
+/// Per channel gain of the IO thread driven by time stamped events.
+///
+/// The events are pushed by a single thread and applied by process() on the IO thread in the order
+/// they were pushed. Each one ramps from the current gains, a new event interrupts the ramps where
+/// they are. The ramps are vDSP_vrampmul for linear ones and vvexpf of a linear ramp for the
+/// exponential ones, computed in blocks on the stack.
+///
+/// Once the gains settle they are expanded into an interleaved gain vector, so that an interleaved
+/// buffer is a single vDSP_vmul per block of the vector. Equal gains are a vDSP_vsmul and a gain of
+/// one does nothing.
+template <typename T, UInt32 Channels>
+class gain_automation {
+public:
+  using event = gain_event<Channels>;
+
+  static constexpr UInt32 queue_capacity = 64;
+
+  /// Number of frames of the interleaved gain vector.
+  static constexpr UInt32 vector_frames = 256;
+
+  /// An exponential ramp from or to a gain of 0 starts or stops at -100dB.
+  static constexpr Float32 exponential_floor = 1e-5f;
+
+  inline gain_automation() noexcept {
+    for (UInt32 c = 0; c < Channels; c++) {
+      m_gains[c] = 1;
+      m_targets[c] = 1;
+    }
+
+    settle();
+  }
+
+  /// Must only be called from one thread at a time. An event that doesn't fit in the queue
+  /// replaces the latest target, applied once the queue is empty, so the last event always wins.
+  inline void push(const event& e) noexcept {
+    const UInt32 version = m_latest_version.load(std::memory_order_relaxed);
+
+    if (m_latest_taken.load(std::memory_order_acquire) == version && m_queue.push(e)) {
+      return;
+    }
+
+    // A seqlock, the version is odd while the event is written.
+    m_latest_version.store(version + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    m_latest = e;
+    m_latest_version.store(version + 2, std::memory_order_release);
+  }
+
+  /// Drop the events and snap to `gains`. Must only be called while process() isn't running.
+  inline void reset(const Float32* gains) noexcept {
+    while (m_queue.pop(m_pending)) {
+    }
+
+    m_latest_taken.store(m_latest_version.load(std::memory_order_acquire), std::memory_order_release);
+    m_has_pending = false;
+    m_ramp_remaining = 0;
+
+    for (UInt32 c = 0; c < Channels; c++) {
+      m_targets[c] = gains[c];
+    }
+
+    settle();
+  }
+
+  /// Every gain is 0 and nothing will change them, the buffer can be cleared instead.
+  /// Must only be called from the IO thread.
+  inline bool is_silent() const noexcept { return is_idle() && m_is_uniform && m_gains[0] == 0; }
+
+  /// Every gain is 1 and nothing will change them, the buffer can be used as is.
+  /// Must only be called from the IO thread.
+  inline bool is_unity() const noexcept { return is_idle() && m_is_uniform && m_gains[0] == 1; }
+
+  /// Apply the gains to `frames` frames. Sample f of channel c is at
+  /// buffer[f * frame_stride + c * channel_stride], this is (Channels, 1) for interleaved frames and
+  /// (1, frames) for non-interleaved ones. `time` is the time stamp of the first frame, with valid
+  /// sample and host times. `ticks_per_frame` converts host times.
+  inline void process(T* buffer, UInt32 frames, size_t frame_stride, size_t channel_stride, const AudioTimeStamp& time,
+      Float64 ticks_per_frame) noexcept {
+    const strides s = { frame_stride, channel_stride };
+    UInt32 offset = 0;
+
+    while (offset < frames) {
+      if (!m_has_pending) {
+        m_has_pending = m_queue.pop(m_pending) || pop_latest(m_pending);
+      }
+
+      UInt32 end = frames;
+
+      if (m_has_pending) {
+        const Float64 start = ceil(get_event_offset(m_pending, time, ticks_per_frame));
+
+        if (start <= offset) {
+          begin(m_pending);
+          m_has_pending = false;
+          continue;
+        }
+
+        end = (UInt32)mts::min((Float64)frames, start);
+      }
+
+      apply(buffer + offset * frame_stride, s, end - offset);
+      offset = end;
+    }
+  }
+
+private:
+  struct strides {
+    size_t frame;
+    size_t channel;
+  };
+
+  spsc_queue<event, queue_capacity> m_queue;
+  event m_pending = {};
+  bool m_has_pending = false;
+
+  // The event pushed when the queue was full, see push(). It is pending until the IO thread takes
+  // the version it was written with, and every event pushed meanwhile replaces it.
+  event m_latest = {};
+  std::atomic<UInt32> m_latest_version{ 0 };
+  std::atomic<UInt32> m_latest_taken{ 0 };
+
+  ramp_shape m_shape = ramp_shape::linear;
+  UInt32 m_ramp_remaining = 0;
+  Float32 m_gains[Channels];
+  Float32 m_targets[Channels];
+  Float32 m_steps[Channels] = {};
+
+  // Steady state, see settle().
+  bool m_is_uniform = true;
+  T m_vector[vector_frames * Channels];
+
+  inline bool is_idle() const noexcept {
+    return m_ramp_remaining == 0 && !m_has_pending && m_queue.empty()
+        && m_latest_version.load(std::memory_order_acquire) == m_latest_taken.load(std::memory_order_relaxed);
+  }
+
+  /// The latest target, once every queued event was taken. A target being written is taken on the
+  /// next cycle.
+  inline bool pop_latest(event& e) noexcept {
+    const UInt32 version = m_latest_version.load(std::memory_order_acquire);
+
+    if (version == m_latest_taken.load(std::memory_order_relaxed) || (version & 1)) {
+      return false;
+    }
+
+    e = m_latest;
+    std::atomic_thread_fence(std::memory_order_acquire);
+
+    if (m_latest_version.load(std::memory_order_relaxed) != version) {
+      return false;
+    }
+
+    m_latest_taken.store(version, std::memory_order_release);
+    return true;
+  }
+
+  static inline Float64 get_event_offset(const event& e, const AudioTimeStamp& time, Float64 ticks_per_frame) noexcept {
+    switch (e.time_type) {
+    case event_time::immediate:
+      return 0;
+    case event_time::sample_time:
+      return (Float64)e.time - time.mSampleTime;
+    case event_time::host_time:
+      return ticks_per_frame > 0 ? ((Float64)e.time - (Float64)time.mHostTime) / ticks_per_frame : 0;
+    }
+
+    return 0;
+  }
+
+  /// For an exponential ramp, a step is the log of the ratio between two frames. A channel that
+  /// doesn't change keeps a step of 0, even at a gain of 0.
+  inline void begin(const event& e) noexcept {
+    m_shape = e.shape;
+    m_ramp_remaining = e.ramp_frames;
+
+    for (UInt32 c = 0; c < Channels; c++) {
+      m_targets[c] = e.gains[c];
+      m_steps[c] = 0;
+
+      if (e.ramp_frames == 0 || m_targets[c] == m_gains[c]) {
+        continue;
+      }
+
+      if (e.shape == ramp_shape::linear) {
+        m_steps[c] = (m_targets[c] - m_gains[c]) / (Float32)e.ramp_frames;
+      }
+      else {
+        m_gains[c] = mts::max(m_gains[c], exponential_floor);
+        m_steps[c] = logf(mts::max(m_targets[c], exponential_floor) / m_gains[c]) / (Float32)e.ramp_frames;
+      }
+    }
+
+    if (e.ramp_frames == 0) {
+      settle();
+    }
+  }
+
+  /// Snap to the targets, the accumulated steps drift a little, and build the gain vector.
+  inline void settle() noexcept {
+    m_is_uniform = true;
+
+    for (UInt32 c = 0; c < Channels; c++) {
+      m_gains[c] = m_targets[c];
+      m_is_uniform = m_is_uniform && m_gains[c] == m_gains[0];
+    }
+
+    for (UInt32 f = 0; f < vector_frames; f++) {
+      for (UInt32 c = 0; c < Channels; c++) {
+        m_vector[f * Channels + c] = (T)m_gains[c];
+      }
+    }
+  }
+
+  inline void apply(T* buffer, const strides& s, UInt32 frames) noexcept {
+    const UInt32 ramp_frames = mts::min(frames, m_ramp_remaining);
+
+    if (ramp_frames) {
+      if (m_shape == ramp_shape::linear) {
+        apply_linear_ramp(buffer, s, ramp_frames);
+      }
+      else {
+        apply_exponential_ramp(buffer, s, ramp_frames);
+      }
+
+      m_ramp_remaining -= ramp_frames;
+
+      if (m_ramp_remaining == 0) {
+        settle();
+      }
+    }
+
+    if (frames > ramp_frames && !(m_is_uniform && m_gains[0] == 1)) {
+      apply_gains(buffer + ramp_frames * s.frame, s, frames - ramp_frames);
+    }
+  }
+
+  inline void apply_gains(T* buffer, const strides& s, UInt32 frames) noexcept {
+    const bool is_interleaved = s.frame == Channels && s.channel == 1;
+
+    if (is_interleaved && m_is_uniform) {
+      mts::dsp::mul(buffer, (T)m_gains[0], (size_t)frames * Channels);
+      return;
+    }
+
+    if (is_interleaved) {
+      for (UInt32 offset = 0; offset < frames; offset += vector_frames) {
+        const size_t count = (size_t)mts::min(vector_frames, frames - offset) * Channels;
+        T* block = buffer + (size_t)offset * Channels;
+
+        if constexpr (sizeof(T) == 4) {
+          vDSP_vmul(block, 1, m_vector, 1, block, 1, count);
+        }
+        else {
+          vDSP_vmulD(block, 1, m_vector, 1, block, 1, count);
+        }
+      }
+
+      return;
+    }
+
+    for (UInt32 c = 0; c < Channels; c++) {
+      T* channel = buffer + c * s.channel;
+      const T gain = (T)m_gains[c];
+
+      if constexpr (sizeof(T) == 4) {
+        vDSP_vsmul(channel, s.frame, &gain, channel, s.frame, frames);
+      }
+      else {
+        vDSP_vsmulD(channel, s.frame, &gain, channel, s.frame, frames);
+      }
+    }
+  }
+
+  /// vDSP_vrampmul updates its start value so it is copied.
+  inline void apply_linear_ramp(T* buffer, const strides& s, UInt32 frames) noexcept {
+    for (UInt32 c = 0; c < Channels; c++) {
+      T* channel = buffer + c * s.channel;
+
+      if constexpr (sizeof(T) == 4) {
+        Float32 start = m_gains[c];
+        vDSP_vrampmul(channel, s.frame, &start, &m_steps[c], channel, s.frame, frames);
+      }
+      else {
+        Float64 start = m_gains[c];
+        const Float64 step = m_steps[c];
+        vDSP_vrampmulD(channel, s.frame, &start, &step, channel, s.frame, frames);
+      }
+
+      m_gains[c] += m_steps[c] * (Float32)frames;
+    }
+  }
+
+  inline void apply_exponential_ramp(T* buffer, const strides& s, UInt32 frames) noexcept {
+    constexpr UInt32 block_size = 256;
+    T gains[block_size];
+
+    for (UInt32 offset = 0; offset < frames; offset += block_size) {
+      const UInt32 count = mts::min(block_size, frames - offset);
+      const int n = (int)count;
+
+      for (UInt32 c = 0; c < Channels; c++) {
+        T* channel = buffer + offset * s.frame + c * s.channel;
+
+        if constexpr (sizeof(T) == 4) {
+          Float32 start = logf(m_gains[c]);
+          vDSP_vramp(&start, &m_steps[c], gains, 1, count);
+          vvexpf(gains, gains, &n);
+          vDSP_vmul(channel, s.frame, gains, 1, channel, s.frame, count);
+        }
+        else {
+          const Float64 start = ::log((Float64)m_gains[c]);
+          const Float64 step = m_steps[c];
+          vDSP_vrampD(&start, &step, gains, 1, count);
+          vvexp(gains, gains, &n);
+          vDSP_vmulD(channel, s.frame, gains, 1, channel, s.frame, count);
+        }
+
+        m_gains[c] *= expf(m_steps[c] * (Float32)count);
+      }
+    }
+  }
+};
+} // namespace mts.
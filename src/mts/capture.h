@@ -0,0 +1,169 @@
+#pragma once
+#include "mts/trace.h"
+
+namespace mts::capture {
+/// Keep in sync with tools/trace and tools/replay.
+enum class record_type : UInt32 { io_operation, zero_timestamp, start_io, stop_io, add_client, remove_client };
+
+/// Everything the host handed to a call and what the driver answered, so that the sequence of
+/// calls can be fed back to the driver (see tools/replay). `sequence` orders the records of every
+/// thread and `duration` is the time spent in a DoIOOperation in host ticks.
+///
+/// The payload of a DoIOOperation is its main buffer when it returns, what the client wrote or
+/// what the driver read. The payload of an added client is its bundle ID in UTF-8.
+struct cycle_record {
+  record_type type;
+  UInt32 client_id;
+  UInt32 operation_id;
+  UInt32 frame_size;
+  UInt64 cycle_counter;
+  UInt32 nominal_frame_size;
+  UInt32 stream_id;
+  Float64 input_sample_time;
+  UInt64 input_host_time;
+  Float64 output_sample_time;
+  UInt64 output_host_time;
+  Float64 current_sample_time;
+  UInt64 current_host_time;
+  Float64 rate_scalar;
+  Float64 zero_sample_time;
+  UInt64 zero_host_time;
+  UInt64 zero_seed;
+  UInt64 duration;
+  UInt64 sequence;
+  UInt64 payload_offset;
+  UInt32 payload_size;
+  UInt32 process_id;
+};
+
+static_assert(sizeof(cycle_record) == 144, "the capture file layout changed");
+
+inline constexpr char file_magic[4] = { 'M', 'T', 'S', 'C' };
+
+// Per thread, about 4.5MB of records and 32MB of buffers in zero pages, only touched when
+// capturing. The IO thread and the threads calling StartIO and StopIO each take one.
+template <bool Enabled>
+inline mts::trace::recorder<cycle_record, Enabled ? 32768 : 1, Enabled ? 4 : 1, Enabled ? (1 << 25) : 0> g_cycles;
+inline std::atomic<UInt64> g_sequence{ 0 };
+
+/// Host time the time line of the driver is based on. The replay sets it to the captured times.
+inline UInt64 (*g_host_time)() = mach_absolute_time;
+
+inline UInt64 host_time() noexcept { return g_host_time(); }
+
+inline UInt64 next_sequence() noexcept { return g_sequence.fetch_add(1, std::memory_order_relaxed); }
+
+/// Records a DoIOOperation call on destruction, including the time spent in it and the buffer
+/// given to set_buffer(). Everything is compiled out when Enabled is false.
+template <bool Enabled>
+class io_scope {
+public:
+  inline io_scope(UInt32 client, AudioObjectID stream, UInt32 operation, UInt32 frames,
+      const AudioServerPlugInIOCycleInfo* info) noexcept {
+    if constexpr (Enabled) {
+      m_record = {};
+      m_record.type = record_type::io_operation;
+      m_record.client_id = client;
+      m_record.operation_id = operation;
+      m_record.frame_size = frames;
+      m_record.stream_id = stream;
+
+      if (info) {
+        m_record.cycle_counter = info->mIOCycleCounter;
+        m_record.nominal_frame_size = info->mNominalIOBufferFrameSize;
+        m_record.input_sample_time = info->mInputTime.mSampleTime;
+        m_record.input_host_time = info->mInputTime.mHostTime;
+        m_record.output_sample_time = info->mOutputTime.mSampleTime;
+        m_record.output_host_time = info->mOutputTime.mHostTime;
+        m_record.current_sample_time = info->mCurrentTime.mSampleTime;
+        m_record.current_host_time = info->mCurrentTime.mHostTime;
+        m_record.rate_scalar = info->mCurrentTime.mRateScalar;
+      }
+
+      m_record.sequence = next_sequence();
+      m_start = mach_absolute_time();
+    }
+  }
+
+  inline ~io_scope() {
+    if constexpr (Enabled) {
+      m_record.duration = mach_absolute_time() - m_start;
+      g_cycles<Enabled>.record(m_record, m_buffer, m_size);
+    }
+  }
+
+  /// The buffer of the call and its size in bytes, captured when the call returns.
+  inline void set_buffer(const void* buffer, UInt32 size) noexcept {
+    if constexpr (Enabled) {
+      m_buffer = buffer;
+      m_size = size;
+    }
+  }
+
+  io_scope(const io_scope&) = delete;
+  io_scope& operator=(const io_scope&) = delete;
+
+private:
+  struct empty {};
+  std::conditional_t<Enabled, cycle_record, empty> m_record;
+  std::conditional_t<Enabled, UInt64, empty> m_start;
+  std::conditional_t<Enabled, const void*, empty> m_buffer{};
+  std::conditional_t<Enabled, UInt32, empty> m_size{};
+};
+
+/// Records the answer of a GetZeroTimeStamp call and the host time it was based on.
+template <bool Enabled>
+inline void zero_timestamp(
+    UInt32 client, UInt64 current_host_time, Float64 sample_time, UInt64 host_time, UInt64 seed) noexcept {
+  if constexpr (Enabled) {
+    cycle_record r = {};
+    r.type = record_type::zero_timestamp;
+    r.client_id = client;
+    r.current_host_time = current_host_time;
+    r.zero_sample_time = sample_time;
+    r.zero_host_time = host_time;
+    r.zero_seed = seed;
+    r.sequence = next_sequence();
+    g_cycles<Enabled>.record(r);
+  }
+}
+
+/// Records a StartIO or a StopIO call. `host_time` is the anchor of the time line of a StartIO
+/// that started the device, 0 otherwise.
+template <bool Enabled>
+inline void io_state(record_type type, UInt32 client, UInt64 host_time) noexcept {
+  if constexpr (Enabled) {
+    cycle_record r = {};
+    r.type = type;
+    r.client_id = client;
+    r.current_host_time = host_time;
+    r.sequence = next_sequence();
+    g_cycles<Enabled>.record(r);
+  }
+}
+
+/// Records an added client with its bundle ID, or a removed one.
+template <bool Enabled>
+inline void client(record_type type, UInt32 client, pid_t process_id, CFStringRef bundle_id) noexcept {
+  if constexpr (Enabled) {
+    char id[256] = {};
+
+    if (bundle_id && !CFStringGetCString(bundle_id, id, sizeof(id), kCFStringEncodingUTF8)) {
+      id[0] = 0;
+    }
+
+    cycle_record r = {};
+    r.type = type;
+    r.client_id = client;
+    r.process_id = (UInt32)process_id;
+    r.sequence = next_sequence();
+    g_cycles<Enabled>.record(r, id, (UInt32)strlen(id));
+  }
+}
+
+/// Write the captured calls in the user temporary directory.
+template <bool Enabled>
+inline bool dump(char* path, size_t path_size) {
+  return g_cycles<Enabled>.dump("mts_io_capture", file_magic, path, path_size);
+}
+} // namespace mts::capture.
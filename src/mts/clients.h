@@ -0,0 +1,313 @@
+#pragma once
+#include <CoreAudio/AudioServerPlugIn.h>
+#include "mts/util.h"
+#include <mach/mach_time.h>
+#include <atomic>
+#include <string.h>
+
+namespace mts {
+/// Adds `value` to an atomic that has a single writer, without a locked read-modify-write.
+template <typename T>
+inline void add_relaxed(std::atomic<T>& a, T value) noexcept {
+  a.store(a.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
+/// IO statistics of a client.
+///
+/// is_running and io_starts are written by StartIO and StopIO with the state mutex held, the other
+/// counters only by the IO thread. Each counter has a single writer so relaxed loads and stores are
+/// enough, a snapshot only needs each value to be whole. The peak is the exception, the snapshot
+/// takes it with an exchange.
+struct client_stats {
+  std::atomic<UInt32> is_running{ 0 };
+  std::atomic<UInt32> io_starts{ 0 };
+  std::atomic<UInt32> xruns{ 0 };
+  std::atomic<UInt64> cycles{ 0 };
+  std::atomic<UInt64> frames_read{ 0 };
+  std::atomic<UInt64> frames_written{ 0 };
+
+  // Time spent in DoIOOperation, in host ticks.
+  std::atomic<UInt64> io_calls{ 0 };
+  std::atomic<UInt64> io_ticks{ 0 };
+  std::atomic<UInt64> worst_io_ticks{ 0 };
+
+  // Largest absolute sample written since the last snapshot.
+  std::atomic<Float32> peak{ 0 };
+
+  // Current time of the last IO cycle of the IO thread, set to -1 by StartIO.
+  std::atomic<Float64> last_cycle_time{ -1 };
+
+  inline void reset() noexcept {
+    is_running.store(0, std::memory_order_relaxed);
+    io_starts.store(0, std::memory_order_relaxed);
+    xruns.store(0, std::memory_order_relaxed);
+    cycles.store(0, std::memory_order_relaxed);
+    frames_read.store(0, std::memory_order_relaxed);
+    frames_written.store(0, std::memory_order_relaxed);
+    io_calls.store(0, std::memory_order_relaxed);
+    io_ticks.store(0, std::memory_order_relaxed);
+    worst_io_ticks.store(0, std::memory_order_relaxed);
+    peak.store(0, std::memory_order_relaxed);
+    last_cycle_time.store(-1, std::memory_order_relaxed);
+  }
+
+  /// Every operation of an IO cycle has the same current time, the first one counts the cycle.
+  /// Consecutive cycles are one IO buffer apart, a cycle more than half a buffer late means that at
+  /// least one was skipped.
+  inline void add_cycle(Float64 current_time, UInt32 frames) noexcept {
+    const Float64 last = last_cycle_time.load(std::memory_order_relaxed);
+
+    if (current_time == last) {
+      return;
+    }
+
+    if (last >= 0 && current_time - last > 1.5 * frames) {
+      add_relaxed<UInt32>(xruns, 1);
+    }
+
+    last_cycle_time.store(current_time, std::memory_order_relaxed);
+    add_relaxed<UInt64>(cycles, 1);
+  }
+
+  inline void add_io_time(UInt64 ticks) noexcept {
+    add_relaxed<UInt64>(io_calls, 1);
+    add_relaxed<UInt64>(io_ticks, ticks);
+
+    if (ticks > worst_io_ticks.load(std::memory_order_relaxed)) {
+      worst_io_ticks.store(ticks, std::memory_order_relaxed);
+    }
+  }
+
+  /// A snapshot resets the peak concurrently, a plain store could bring back the peak it took.
+  inline void add_peak(Float32 value) noexcept {
+    Float32 current = peak.load(std::memory_order_relaxed);
+
+    while (value > current && !peak.compare_exchange_weak(current, value, std::memory_order_relaxed)) {
+    }
+  }
+};
+
+/// Adds the duration of its scope to the IO time of a client, if there is one.
+class client_io_scope {
+public:
+  inline client_io_scope(client_stats* stats) noexcept
+      : m_stats(stats)
+      , m_start(stats ? mach_absolute_time() : 0) {}
+
+  inline ~client_io_scope() noexcept {
+    if (m_stats) {
+      m_stats->add_io_time(mach_absolute_time() - m_start);
+    }
+  }
+
+private:
+  client_stats* m_stats;
+  UInt64 m_start;
+};
+
+/// A statistics snapshot is a client_stats_header followed by `record_count` records of
+/// `record_size` bytes, in native byte order. A reader should check the version and use the
+/// record size to step through the records.
+inline constexpr UInt32 client_stats_version = 1;
+
+struct client_stats_header {
+  UInt32 version;
+  UInt32 record_size;
+  UInt32 record_count;
+  UInt32 reserved;
+};
+
+struct client_stats_record {
+  UInt32 client_id;
+  SInt32 process_id;
+  UInt32 is_running;
+  UInt32 io_starts;
+  UInt64 cycles;
+  UInt64 frames_read;
+  UInt64 frames_written;
+  UInt32 xruns;
+  Float32 peak;
+  Float64 average_io_us;
+  Float64 worst_io_us;
+
+  // UTF-8, empty when unknown or too long.
+  char bundle_id[128];
+};
+
+static_assert(sizeof(client_stats_record) == 192, "the layout of the snapshot records is public");
+
+/// Clients of a device indexed by the client ID of AddDeviceClient and of the IO calls, with the
+/// stream pair each one is routed to.
+///
+/// The table has a fixed capacity and is only changed by the HAL threads, with the state mutex
+/// held. The IO thread looks clients up without locking or allocating: the slot of a client is its
+/// ID modulo the capacity and a collision moves to the next slot. The HAL numbers its clients in
+/// sequence so they rarely collide. A slot is published by storing its ID last, a slot reused
+/// while the IO thread reads it can give the route of its new client for one call.
+template <UInt32 Capacity>
+class client_registry {
+public:
+  static_assert(mts::is_power_of_two(Capacity), "Capacity must be a power of two");
+
+  static constexpr UInt32 capacity = Capacity;
+
+  /// Route of a client that isn't in the table or isn't routed.
+  static constexpr UInt32 no_route = UINT32_MAX;
+
+  struct client {
+    std::atomic<UInt32> id{ empty_id };
+    std::atomic<UInt32> route{ no_route };
+    pid_t process_id = 0;
+
+    // Retained, null when the HAL didn't give one. Never read by the IO thread.
+    CFStringRef bundle_id = nullptr;
+
+    client_stats stats;
+  };
+
+  /// Returns false when the table is full or the client is already in it.
+  inline bool add(UInt32 id, pid_t process_id, CFStringRef bundle_id, UInt32 route) noexcept {
+    if (id == empty_id || id == removed_id || find(id)) {
+      return false;
+    }
+
+    for (UInt32 i = 0; i < Capacity; i++) {
+      client& c = m_clients[(id + i) & mask];
+      const UInt32 slot_id = c.id.load(std::memory_order_relaxed);
+
+      if (slot_id != empty_id && slot_id != removed_id) {
+        continue;
+      }
+
+      c.process_id = process_id;
+      c.bundle_id = bundle_id ? (CFStringRef)CFRetain(bundle_id) : nullptr;
+      c.stats.reset();
+      c.route.store(route, std::memory_order_relaxed);
+      c.id.store(id, std::memory_order_release);
+      return true;
+    }
+
+    return false;
+  }
+
+  inline bool remove(UInt32 id) noexcept {
+    client* c = find(id);
+
+    if (!c) {
+      return false;
+    }
+
+    c->route.store(no_route, std::memory_order_relaxed);
+    c->id.store(removed_id, std::memory_order_release);
+
+    if (c->bundle_id) {
+      CFRelease(c->bundle_id);
+      c->bundle_id = nullptr;
+    }
+
+    // Removed slots before an empty one don't continue any probe, emptying them keeps the lookups
+    // of unknown clients short.
+    UInt32 index = (UInt32)(c - m_clients);
+
+    if (m_clients[(index + 1) & mask].id.load(std::memory_order_relaxed) == empty_id) {
+      for (UInt32 i = 0; i < Capacity && m_clients[index].id.load(std::memory_order_relaxed) == removed_id; i++) {
+        m_clients[index].id.store(empty_id, std::memory_order_release);
+        index = (index - 1) & mask;
+      }
+    }
+
+    return true;
+  }
+
+  /// The client with this ID, or null. Real-time safe.
+  inline client* get(UInt32 id) noexcept {
+    for (UInt32 i = 0; i < Capacity; i++) {
+      client& c = m_clients[(id + i) & mask];
+      const UInt32 slot_id = c.id.load(std::memory_order_acquire);
+
+      if (slot_id == id) {
+        return &c;
+      }
+
+      if (slot_id == empty_id) {
+        break;
+      }
+    }
+
+    return nullptr;
+  }
+
+  /// Sets the route of every client to `fct(const client&)`.
+  template <typename Fct>
+  inline void reroute(Fct&& fct) noexcept {
+    for (client& c : m_clients) {
+      const UInt32 slot_id = c.id.load(std::memory_order_relaxed);
+
+      if (slot_id != empty_id && slot_id != removed_id) {
+        c.route.store(fct((const client&)c), std::memory_order_relaxed);
+      }
+    }
+  }
+
+  /// Writes the records of at most `max_records` clients and returns their number. The peaks
+  /// start again from 0.
+  inline UInt32 snapshot(client_stats_record* records, UInt32 max_records, Float64 ticks_per_microsecond) noexcept {
+    UInt32 count = 0;
+
+    for (client& c : m_clients) {
+      const UInt32 slot_id = c.id.load(std::memory_order_relaxed);
+
+      if (slot_id == empty_id || slot_id == removed_id || count == max_records) {
+        continue;
+      }
+
+      const client_stats& s = c.stats;
+      client_stats_record& r = records[count++];
+      const UInt64 calls = s.io_calls.load(std::memory_order_relaxed);
+
+      r.client_id = slot_id;
+      r.process_id = c.process_id;
+      r.is_running = s.is_running.load(std::memory_order_relaxed);
+      r.io_starts = s.io_starts.load(std::memory_order_relaxed);
+      r.cycles = s.cycles.load(std::memory_order_relaxed);
+      r.frames_read = s.frames_read.load(std::memory_order_relaxed);
+      r.frames_written = s.frames_written.load(std::memory_order_relaxed);
+      r.xruns = s.xruns.load(std::memory_order_relaxed);
+      r.peak = c.stats.peak.exchange(0, std::memory_order_relaxed);
+      r.average_io_us = calls ? (Float64)s.io_ticks.load(std::memory_order_relaxed) / calls / ticks_per_microsecond : 0;
+      r.worst_io_us = (Float64)s.worst_io_ticks.load(std::memory_order_relaxed) / ticks_per_microsecond;
+
+      memset(r.bundle_id, 0, sizeof(r.bundle_id));
+      if (c.bundle_id && !CFStringGetCString(c.bundle_id, r.bundle_id, sizeof(r.bundle_id), kCFStringEncodingUTF8)) {
+        r.bundle_id[0] = 0;
+      }
+    }
+
+    return count;
+  }
+
+private:
+  static constexpr UInt32 mask = Capacity - 1;
+  static constexpr UInt32 empty_id = UINT32_MAX;
+  static constexpr UInt32 removed_id = UINT32_MAX - 1;
+
+  client m_clients[Capacity];
+
+  inline client* find(UInt32 id) noexcept {
+    for (UInt32 i = 0; i < Capacity; i++) {
+      client& c = m_clients[(id + i) & mask];
+      const UInt32 slot_id = c.id.load(std::memory_order_relaxed);
+
+      if (slot_id == id) {
+        return &c;
+      }
+
+      if (slot_id == empty_id) {
+        break;
+      }
+    }
+
+    return nullptr;
+  }
+};
+} // namespace mts.
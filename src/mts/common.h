@@ -2,11 +2,11 @@
 #include <CoreAudio/AudioServerPlugIn.h>
 #include "mts/util.h"
 #include "mts/dsp.h"
+#include "mts/log.h"
 #include <dispatch/dispatch.h>
 #include <mach/mach_time.h>
 #include <pthread.h>
 #include <stdint.h>
-#include <sys/syslog.h>
 #include <stdlib.h>
 #include <array>
 
@@ -21,6 +21,15 @@ struct object_description {
   direction direction;
 };
 
+/// Custom properties can only hold CFString or CFPropertyList values.
+/// A property that isn't available is left out of kAudioObjectPropertyCustomPropertyInfoList.
+struct custom_property_description {
+  AudioObjectPropertySelector selector;
+  AudioServerPlugInCustomPropertyDataType type;
+  bool settable;
+  bool available = true;
+};
+
 class object {
 public:
   using Address = AudioObjectPropertyAddress;
@@ -85,14 +94,16 @@ inline UInt32 assign<CFStringRef>(void* dst, const CFStringRef& src) {
 #define MTS_API __attribute__((visibility("default")))
 #define MTS_HIDDEN __attribute__((visibility("hidden")))
 
+// Both macros only capture a record in the lock-free log ring, the formatting and the syslog call
+// happen later on the log drain thread. This makes them safe to use on the IO thread.
 #if DEBUG
-  #define MTS_TRACE() syslog(LOG_NOTICE, "MTS_DRIVER: %s in file %s(%d)", __FUNCTION__, __FILE__, __LINE__)
-  #define MTS_DBG(msg) syslog(LOG_NOTICE, "MTS_DRIVER: %s in file %s(%d) : %s", __FUNCTION__, __FILE__, __LINE__, msg)
+  #define MTS_TRACE() ::mts::log::post("MTS_DRIVER: %s in file %s(%llu)", __FUNCTION__, __FILE__, __LINE__)
 #else
   #define MTS_TRACE()
-  #define MTS_DBG(msg)
 #endif // DEBUG.
 
+#define MTS_DBG(msg) ::mts::log::post("MTS_DRIVER: %s in file %s(%llu) : %s", __FUNCTION__, __FILE__, __LINE__, msg)
+
 #define RETURN_ERROR_IF(cond, retValue, msg)                                                                           \
   do {                                                                                                                 \
     if ((cond)) {                                                                                                      \
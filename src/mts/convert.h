@@ -0,0 +1,309 @@
+#pragma once
+#include "mts/util.h"
+#include "mts/dsp.h"
+#include <math.h>
+#include <string.h>
+
+namespace mts::dsp {
+/// Packed 24 bits signed integer, native endian.
+using int24 = vDSP_int24;
+
+/// IEEE 754 binary16: 11 bits of precision, about 66dB of signal to noise ratio at full scale
+/// but the same ratio is kept down to -84dBFS thanks to the exponent.
+struct half {
+  UInt16 bits;
+};
+
+/// The upper half of a Float32: the range of a float with 8 bits of precision.
+struct bfloat16 {
+  UInt16 bits;
+};
+
+/// Floating point samples are in [-1, 1), an integer sample of N bits is scaled by 2^(N-1).
+template <typename T>
+inline constexpr Float64 integer_scale = std::is_same_v<T, SInt16> ? 32768.0
+    : std::is_same_v<T, int24>                                     ? 8388608.0
+                                                                   : 2147483648.0;
+
+template <typename T>
+inline constexpr bool is_sample_integer
+    = std::is_same_v<T, SInt16> || std::is_same_v<T, int24> || std::is_same_v<T, SInt32>;
+
+/// Number of samples converted at once through the stack buffer of the vectorized paths.
+inline constexpr size_t convert_block_size = 256;
+
+/// Triangular probability density function dither of +/- 1 LSB, added before rounding to an integer
+/// format. The generator is a xorshift32, good enough for noise and real-time safe.
+class tpdf_dither {
+public:
+  inline Float32 next() noexcept {
+    const Float32 a = (Float32)next_uint() * uint_scale;
+    const Float32 b = (Float32)next_uint() * uint_scale;
+    return a - b;
+  }
+
+private:
+  static constexpr Float32 uint_scale = 1.0f / 4294967296.0f;
+  UInt32 m_state = 0x9E3779B9;
+
+  inline UInt32 next_uint() noexcept {
+    m_state ^= m_state << 13;
+    m_state ^= m_state >> 17;
+    m_state ^= m_state << 5;
+    return m_state;
+  }
+};
+
+inline SInt32 unpack_int24(const int24& v) noexcept {
+  const UInt32 u = (UInt32)v.bytes[0] | ((UInt32)v.bytes[1] << 8) | ((UInt32)v.bytes[2] << 16);
+  return (SInt32)(u << 8) >> 8;
+}
+
+inline int24 pack_int24(SInt32 v) noexcept {
+  int24 r;
+  r.bytes[0] = (UInt8)(v & 0xFF);
+  r.bytes[1] = (UInt8)((v >> 8) & 0xFF);
+  r.bytes[2] = (UInt8)((v >> 16) & 0xFF);
+  return r;
+}
+
+inline UInt32 float_bits(Float32 x) noexcept {
+  UInt32 u;
+  memcpy(&u, &x, sizeof(u));
+  return u;
+}
+
+inline Float32 bits_float(UInt32 u) noexcept {
+  Float32 x;
+  memcpy(&x, &u, sizeof(x));
+  return x;
+}
+
+/// Round to nearest even, overflows to infinity.
+inline half float_to_half(Float32 x) noexcept {
+  const UInt32 u = float_bits(x);
+  const UInt16 sign = (u >> 16) & 0x8000;
+  const UInt32 a = u & 0x7FFFFFFF;
+
+  // Infinity and NaN.
+  if (a >= 0x7F800000) {
+    return { (UInt16)(sign | 0x7C00 | (a > 0x7F800000 ? 0x200 : 0)) };
+  }
+
+  // 65520 and above round to infinity.
+  if (a >= 0x477FF000) {
+    return { (UInt16)(sign | 0x7C00) };
+  }
+
+  // Below 2^-14 the half is subnormal, below 2^-25 it rounds to zero.
+  if (a < 0x38800000) {
+    if (a < 0x33000000) {
+      return { sign };
+    }
+
+    const UInt32 m = (a & 0x7FFFFF) | 0x800000;
+    const UInt32 shift = 126 - (a >> 23);
+    const UInt32 rem = m & ((1u << shift) - 1);
+    const UInt32 halfway = 1u << (shift - 1);
+    UInt32 r = m >> shift;
+    r += rem > halfway || (rem == halfway && (r & 1));
+    return { (UInt16)(sign | r) };
+  }
+
+  // Rebias the exponent from 127 to 15, a carry from the rounding moves to the exponent.
+  const UInt32 rem = a & 0x1FFF;
+  UInt32 r = (a - 0x38000000) >> 13;
+  r += rem > 0x1000 || (rem == 0x1000 && (r & 1));
+  return { (UInt16)(sign | r) };
+}
+
+inline Float32 half_to_float(half h) noexcept {
+  const UInt32 sign = (UInt32)(h.bits & 0x8000) << 16;
+  const UInt32 e = (h.bits >> 10) & 0x1F;
+  const UInt32 m = h.bits & 0x3FF;
+
+  if (e == 0) {
+    const Float32 x = (Float32)m * (1.0f / 16777216.0f);
+    return sign ? -x : x;
+  }
+
+  return bits_float(sign | (e == 31 ? 0x7F800000 : (e + 112) << 23) | (m << 13));
+}
+
+/// Round to nearest even. NaN isn't handled, it can't be a sample.
+inline bfloat16 float_to_bfloat16(Float32 x) noexcept {
+  const UInt32 u = float_bits(x);
+  return { (UInt16)((u + 0x7FFF + ((u >> 16) & 1)) >> 16) };
+}
+
+inline Float32 bfloat16_to_float(bfloat16 b) noexcept { return bits_float((UInt32)b.bits << 16); }
+
+/// Scalar conversion of a single sample, this is the reference of the vectorized paths.
+template <typename To, typename From>
+inline To convert_sample(From x, Float64 dither = 0) noexcept {
+  if constexpr (std::is_same_v<To, From>) {
+    return x;
+  }
+  else if constexpr (std::is_floating_point_v<To> && std::is_floating_point_v<From>) {
+    return (To)x;
+  }
+  else if constexpr (std::is_same_v<To, half>) {
+    return float_to_half((Float32)x);
+  }
+  else if constexpr (std::is_same_v<To, bfloat16>) {
+    return float_to_bfloat16((Float32)x);
+  }
+  else if constexpr (std::is_same_v<From, half>) {
+    return (To)half_to_float(x);
+  }
+  else if constexpr (std::is_same_v<From, bfloat16>) {
+    return (To)bfloat16_to_float(x);
+  }
+  else if constexpr (std::is_floating_point_v<To>) {
+    if constexpr (std::is_same_v<From, int24>) {
+      return (To)((Float64)unpack_int24(x) / integer_scale<From>);
+    }
+    else {
+      return (To)((Float64)x / integer_scale<From>);
+    }
+  }
+  else {
+    static_assert(is_sample_integer<To> && std::is_floating_point_v<From>, "unsupported sample conversion");
+    // A Float32 below 1 is at most 2^31 - 128 in an Int32, where the vectorized path clips.
+    constexpr Float64 scale = integer_scale<To>;
+    constexpr Float64 high = std::is_same_v<To, SInt32> && std::is_same_v<From, Float32> ? 2147483520.0 : scale - 1.0;
+    const SInt64 v = (SInt64)mts::clamp(nearbyint((Float64)x * scale + dither), -scale, high);
+
+    if constexpr (std::is_same_v<To, int24>) {
+      return pack_int24((SInt32)v);
+    }
+    else {
+      return (To)v;
+    }
+  }
+}
+
+/// Convert `size` samples. Float32 from and to every other type goes through vDSP or vImage, the
+/// integer conversions are scaled and clipped in blocks on the stack. Any other pair is converted
+/// with convert_sample.
+///
+/// The dither is only used when converting to an integer type.
+template <typename From, typename To>
+inline void convert(const From* src, To* dst, size_t size, tpdf_dither* dither = nullptr) {
+  if constexpr (std::is_same_v<From, To>) {
+    memcpy((void*)dst, (const void*)src, size * sizeof(To));
+  }
+  else if constexpr (std::is_same_v<To, Float32> && std::is_same_v<From, Float64>) {
+    vDSP_vdpsp(src, 1, dst, 1, size);
+  }
+  else if constexpr (std::is_same_v<To, Float64> && std::is_same_v<From, Float32>) {
+    vDSP_vspdp(src, 1, dst, 1, size);
+  }
+  else if constexpr (std::is_same_v<To, half> && std::is_same_v<From, Float32>) {
+    const vImage_Buffer s = { (void*)src, 1, size, size * sizeof(From) };
+    const vImage_Buffer d = { (void*)dst, 1, size, size * sizeof(To) };
+    vImageConvert_PlanarFtoPlanar16F(&s, &d, kvImageNoFlags);
+  }
+  else if constexpr (std::is_same_v<To, Float32> && std::is_same_v<From, half>) {
+    const vImage_Buffer s = { (void*)src, 1, size, size * sizeof(From) };
+    const vImage_Buffer d = { (void*)dst, 1, size, size * sizeof(To) };
+    vImageConvert_Planar16FtoPlanarF(&s, &d, kvImageNoFlags);
+  }
+  else if constexpr (std::is_same_v<To, Float32> && is_sample_integer<From>) {
+    if constexpr (std::is_same_v<From, SInt16>) {
+      vDSP_vflt16(src, 1, dst, 1, size);
+    }
+    else if constexpr (std::is_same_v<From, int24>) {
+      vDSP_vflt24(src, 1, dst, 1, size);
+    }
+    else {
+      vDSP_vflt32(src, 1, dst, 1, size);
+    }
+
+    const Float32 scale = (Float32)(1.0 / integer_scale<From>);
+    vDSP_vsmul(dst, 1, &scale, dst, 1, size);
+  }
+  else if constexpr (std::is_same_v<From, Float32> && is_sample_integer<To>) {
+    // Near full scale a Float32 only has half a LSB of an Int24, the dither is added in Float64.
+    if constexpr (std::is_same_v<To, int24>) {
+      if (dither) {
+        for (size_t i = 0; i < size; i++) {
+          dst[i] = convert_sample<To>(src[i], (Float64)dither->next());
+        }
+
+        return;
+      }
+    }
+
+    // The largest float below 2^31 is 2^31 - 128, clipping to 2^31 - 1 would round up and overflow.
+    const Float32 scale = (Float32)integer_scale<To>;
+    const Float32 low = -scale;
+    const Float32 high = std::is_same_v<To, SInt32> ? 2147483520.0f : scale - 1.0f;
+    Float32 block[convert_block_size];
+
+    for (size_t offset = 0; offset < size; offset += convert_block_size) {
+      const size_t count = mts::min(convert_block_size, size - offset);
+      vDSP_vsmul(src + offset, 1, &scale, block, 1, count);
+
+      if (dither) {
+        for (size_t i = 0; i < count; i++) {
+          block[i] += dither->next();
+        }
+      }
+
+      vDSP_vclip(block, 1, &low, &high, block, 1, count);
+
+      if constexpr (std::is_same_v<To, SInt16>) {
+        vDSP_vfixr16(block, 1, dst + offset, 1, count);
+      }
+      else if constexpr (std::is_same_v<To, int24>) {
+        vDSP_vfixr24(block, 1, dst + offset, 1, count);
+      }
+      else {
+        vDSP_vfixr32(block, 1, dst + offset, 1, count);
+      }
+    }
+  }
+  else {
+    for (size_t i = 0; i < size; i++) {
+      if constexpr (is_sample_integer<To>) {
+        dst[i] = convert_sample<To>(src[i], dither ? (Float64)dither->next() : 0.0);
+      }
+      else {
+        dst[i] = convert_sample<To>(src[i]);
+      }
+    }
+  }
+}
+/// Convert `size` samples read every `src_stride` samples into `dst`.
+/// The samples are gathered in blocks on the stack so that the conversion itself is vectorized.
+template <typename From, typename To>
+inline void convert_gather(const From* src, size_t src_stride, To* dst, size_t size) {
+  From block[convert_block_size];
+
+  for (size_t offset = 0; offset < size; offset += convert_block_size) {
+    const size_t count = mts::min(convert_block_size, size - offset);
+
+    for (size_t i = 0; i < count; i++) {
+      block[i] = src[(offset + i) * src_stride];
+    }
+
+    convert(block, dst + offset, count);
+  }
+}
+
+/// Convert `size` samples from `src` and write them every `dst_stride` samples.
+template <typename From, typename To>
+inline void convert_scatter(const From* src, To* dst, size_t dst_stride, size_t size) {
+  To block[convert_block_size];
+
+  for (size_t offset = 0; offset < size; offset += convert_block_size) {
+    const size_t count = mts::min(convert_block_size, size - offset);
+    convert(src + offset, block, count);
+
+    for (size_t i = 0; i < count; i++) {
+      dst[(offset + i) * dst_stride] = block[i];
+    }
+  }
+}
+} // namespace mts::dsp.
@@ -0,0 +1,301 @@
+#pragma once
+#include "mts/platform.h"
+#include "mts/util.h"
+#include "mts/fft.h"
+#include "mts/resampler.h"
+#include <math.h>
+#include <new>
+#include <stdlib.h>
+#include <string.h>
+
+namespace mts::dsp {
+/// Uniformly partitioned overlap-save convolution with a long impulse response.
+///
+/// The impulse response is cut in partitions of `block_size` frames whose spectra (real_fft of 2 *
+/// block_size points) are computed once by create(). The input is gathered in blocks of
+/// `block_size` frames, each block and the one before it are transformed and kept in a frequency
+/// domain delay line, and the output block is the inverse transform of the sum of the products of
+/// the delay line with the partitions (real_fft::multiply and multiply_add). A block costs two
+/// FFTs and one complex multiply-add per partition, instead of a multiply-add per tap and frame.
+///
+/// The output is delayed by `block_size` frames, the work happens on the calls that complete a
+/// block. create() and destroy() allocate and must not be called on the IO thread, process() is
+/// real-time safe.
+class partitioned_convolver {
+public:
+  static constexpr UInt32 min_block_size = 32;
+  static constexpr UInt32 max_block_size = 8192;
+  static constexpr UInt32 max_impulse_frames = 1 << 18;
+
+  /// `impulse` has `impulse_channels` interleaved channels, 1 for the same response on every
+  /// channel or `channel_count`. An impulse at another rate than `sample_rate` is resampled first,
+  /// 0 is the same rate. `block_size` must be a power of two. Returns null when an argument is out
+  /// of range or an allocation fails.
+  static partitioned_convolver* create(const Float32* impulse, UInt32 frames, UInt32 impulse_channels,
+      UInt32 channel_count, Float64 impulse_rate, Float64 sample_rate, UInt32 block_size, Float32 gain) {
+    if (!impulse || frames == 0 || frames > max_impulse_frames || channel_count == 0
+        || (impulse_channels != 1 && impulse_channels != channel_count) || !mts::is_power_of_two(block_size)
+        || block_size < min_block_size || block_size > max_block_size) {
+      return nullptr;
+    }
+
+    Float32* resampled = nullptr;
+
+    if (impulse_rate > 0 && impulse_rate != sample_rate) {
+      // The sum of the taps, the gain of the response, scales with the rate.
+      gain *= (Float32)(impulse_rate / sample_rate);
+      resampled = resample(impulse, frames, impulse_channels, (UInt32)impulse_rate, (UInt32)sample_rate);
+
+      if (!resampled) {
+        return nullptr;
+      }
+
+      impulse = resampled;
+    }
+
+    void* memory = calloc(1, sizeof(partitioned_convolver));
+    partitioned_convolver* self = memory ? new (memory) partitioned_convolver() : nullptr;
+
+    if (self && !self->init(impulse, frames, impulse_channels, channel_count, block_size, gain)) {
+      destroy(self);
+      self = nullptr;
+    }
+
+    ::free(resampled);
+    return self;
+  }
+
+  static void destroy(partitioned_convolver* self) {
+    if (!self) {
+      return;
+    }
+
+    self->m_fft.free();
+    ::free(self->m_spectra);
+    ::free(self->m_delay_line);
+    ::free(self->m_input);
+    ::free(self->m_output);
+    ::free(self->m_work);
+    ::free(self);
+  }
+
+  /// Delay of the output in frames.
+  inline UInt32 get_latency() const noexcept { return m_block_size; }
+
+  inline void reset() noexcept {
+    memset(m_delay_line, 0, (size_t)m_channel_count * m_partition_count * m_fft_size * sizeof(Float32));
+    memset(m_input, 0, (size_t)m_channel_count * m_fft_size * sizeof(Float32));
+    memset(m_output, 0, (size_t)m_channel_count * m_block_size * sizeof(Float32));
+    m_fill = 0;
+    m_newest = 0;
+    m_is_stale = false;
+  }
+
+  /// Sample f of channel c is at buffer[f * frame_stride + c * channel_stride]. A bypassed block is
+  /// only delayed, the latency doesn't change, and the response starts again from silence after it.
+  template <typename T>
+  inline void process(
+      T* buffer, UInt32 frames, size_t frame_stride, size_t channel_stride, bool is_bypassed = false) noexcept {
+    for (UInt32 offset = 0; offset < frames;) {
+      const UInt32 count = mts::min(frames - offset, m_block_size - m_fill);
+      T* chunk = buffer + offset * frame_stride;
+
+      for (UInt32 c = 0; c < m_channel_count; c++) {
+        Float32* input = m_input + (size_t)c * m_fft_size + m_block_size + m_fill;
+        const Float32* output = m_output + (size_t)c * m_block_size + m_fill;
+        T* samples = chunk + c * channel_stride;
+
+        for (UInt32 f = 0; f < count; f++) {
+          input[f] = (Float32)samples[f * frame_stride];
+          samples[f * frame_stride] = (T)output[f];
+        }
+      }
+
+      m_fill += count;
+      offset += count;
+
+      if (m_fill == m_block_size) {
+        if (is_bypassed) {
+          bypass_block();
+        }
+        else {
+          process_block();
+        }
+
+        m_fill = 0;
+      }
+    }
+  }
+
+private:
+  real_fft m_fft;
+  UInt32 m_fft_size = 0;
+  UInt32 m_block_size = 0;
+  UInt32 m_partition_count = 0;
+  UInt32 m_channel_count = 0;
+  UInt32 m_impulse_channels = 0;
+
+  // Spectra are split complex: fft_size / 2 real parts then fft_size / 2 imaginary parts. Element 0
+  // is packed, the DC in the real part and the Nyquist frequency in the imaginary one.
+  Float32* m_spectra = nullptr;    // [impulse channel][partition]
+  Float32* m_delay_line = nullptr; // [channel][block], m_newest is the last one
+  UInt32 m_newest = 0;
+
+  // The previous and the current block of each channel, the current one is m_fill frames full.
+  Float32* m_input = nullptr;
+  Float32* m_output = nullptr;
+  UInt32 m_fill = 0;
+
+  // A spectrum and a time block of fft_size points.
+  Float32* m_work = nullptr;
+
+  // The delay line holds blocks from before a bypass.
+  bool m_is_stale = false;
+
+  partitioned_convolver() = default;
+
+  inline DSPSplitComplex get_spectrum(Float32* base, UInt32 channel, UInt32 partition) const noexcept {
+    Float32* p = base + ((size_t)channel * m_partition_count + partition) * m_fft_size;
+    return DSPSplitComplex{ p, p + m_fft_size / 2 };
+  }
+
+  bool init(const Float32* impulse, UInt32 frames, UInt32 impulse_channels, UInt32 channel_count, UInt32 block_size,
+      Float32 gain) {
+    m_block_size = block_size;
+    m_fft_size = 2 * block_size;
+    m_partition_count = (frames + block_size - 1) / block_size;
+    m_channel_count = channel_count;
+    m_impulse_channels = impulse_channels;
+
+    const size_t spectrum_size = (size_t)m_partition_count * m_fft_size;
+    const bool is_fft_ready = m_fft.init(m_fft_size);
+    m_spectra = (Float32*)calloc(impulse_channels * spectrum_size, sizeof(Float32));
+    m_delay_line = (Float32*)calloc(channel_count * spectrum_size, sizeof(Float32));
+    m_input = (Float32*)calloc((size_t)channel_count * m_fft_size, sizeof(Float32));
+    m_output = (Float32*)calloc((size_t)channel_count * block_size, sizeof(Float32));
+    m_work = (Float32*)calloc((size_t)2 * m_fft_size, sizeof(Float32));
+
+    if (!is_fft_ready || !m_spectra || !m_delay_line || !m_input || !m_output || !m_work) {
+      return false;
+    }
+
+    // The inverse transform scales by the size.
+    const Float32 scale = gain / m_fft_size;
+
+    for (UInt32 c = 0; c < impulse_channels; c++) {
+      for (UInt32 p = 0; p < m_partition_count; p++) {
+        const UInt32 first = p * block_size;
+        const UInt32 count = mts::min(block_size, frames - first);
+
+        memset(m_work, 0, m_fft_size * sizeof(Float32));
+        for (UInt32 f = 0; f < count; f++) {
+          m_work[f] = impulse[(size_t)(first + f) * impulse_channels + c];
+        }
+
+        DSPSplitComplex spectrum = get_spectrum(m_spectra, c, p);
+        m_fft.forward(m_work, spectrum.realp, spectrum.imagp);
+        vDSP_vsmul(spectrum.realp, 1, &scale, spectrum.realp, 1, m_fft_size);
+      }
+    }
+
+    return true;
+  }
+
+  inline void bypass_block() noexcept {
+    for (UInt32 c = 0; c < m_channel_count; c++) {
+      Float32* input = m_input + (size_t)c * m_fft_size;
+      memcpy(m_output + (size_t)c * m_block_size, input + m_block_size, m_block_size * sizeof(Float32));
+      memcpy(input, input + m_block_size, m_block_size * sizeof(Float32));
+    }
+
+    m_is_stale = true;
+  }
+
+  inline void process_block() noexcept {
+    const UInt32 half = m_block_size;
+
+    if (m_is_stale) {
+      memset(m_delay_line, 0, (size_t)m_channel_count * m_partition_count * m_fft_size * sizeof(Float32));
+      m_is_stale = false;
+    }
+
+    m_newest = m_newest + 1 == m_partition_count ? 0 : m_newest + 1;
+
+    for (UInt32 c = 0; c < m_channel_count; c++) {
+      Float32* input = m_input + (size_t)c * m_fft_size;
+      DSPSplitComplex x = get_spectrum(m_delay_line, c, m_newest);
+
+      m_fft.forward(input, x.realp, x.imagp);
+      memcpy(input, input + half, half * sizeof(Float32));
+
+      // The packed element 0 holds two real values, multiply() takes it for a complex number.
+      DSPSplitComplex sum = { m_work, m_work + half };
+      Float32 dc = 0;
+      Float32 nyquist = 0;
+
+      for (UInt32 p = 0, block = m_newest; p < m_partition_count; p++) {
+        DSPSplitComplex xp = get_spectrum(m_delay_line, c, block);
+        DSPSplitComplex hp = get_spectrum(m_spectra, m_impulse_channels == 1 ? 0 : c, p);
+
+        dc += xp.realp[0] * hp.realp[0];
+        nyquist += xp.imagp[0] * hp.imagp[0];
+
+        if (p == 0) {
+          real_fft::multiply(xp.realp, xp.imagp, hp.realp, hp.imagp, sum.realp, sum.imagp, half);
+        }
+        else {
+          real_fft::multiply_add(xp.realp, xp.imagp, hp.realp, hp.imagp, sum.realp, sum.imagp, half);
+        }
+
+        block = block == 0 ? m_partition_count - 1 : block - 1;
+      }
+
+      sum.realp[0] = dc;
+      sum.imagp[0] = nyquist;
+
+      // Overlap-save: the first half wraps around, the second half is the output.
+      Float32* time = m_work + m_fft_size;
+      m_fft.inverse(sum.realp, sum.imagp, time);
+      memcpy(m_output + (size_t)c * m_block_size, time + half, half * sizeof(Float32));
+    }
+  }
+
+  /// The impulse at `output_rate`, allocated. The delay of the resampler is removed.
+  static Float32* resample(
+      const Float32* impulse, UInt32& frames, UInt32 channels, UInt32 input_rate, UInt32 output_rate) {
+    polyphase_resampler resampler;
+
+    if (!resampler.init(input_rate, output_rate, channels, resampler_quality::high)) {
+      return nullptr;
+    }
+
+    // Zeros after the impulse push its end out of the filter.
+    const UInt32 latency = resampler.get_latency();
+    const UInt32 input_frames = frames + (UInt32)((UInt64)latency * input_rate / output_rate) + 1;
+    Float32* input = (Float32*)calloc((size_t)input_frames * channels, sizeof(Float32));
+    const size_t output_size = (size_t)resampler.get_max_output_frames(input_frames) * channels;
+    Float32* output = (Float32*)calloc(output_size, sizeof(Float32));
+
+    if (!input || !output) {
+      ::free(input);
+      ::free(output);
+      resampler.free();
+      return nullptr;
+    }
+
+    memcpy(input, impulse, (size_t)frames * channels * sizeof(Float32));
+    const UInt32 output_frames = resampler.process(input, input_frames, output);
+    resampler.free();
+    ::free(input);
+
+    if (output_frames <= latency) {
+      ::free(output);
+      return nullptr;
+    }
+
+    frames = mts::min(output_frames - latency, max_impulse_frames);
+    memmove(output, output + (size_t)latency * channels, (size_t)frames * channels * sizeof(Float32));
+    return output;
+  }
+};
+} // namespace mts::dsp.
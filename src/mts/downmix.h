@@ -0,0 +1,453 @@
+#pragma once
+#include <CoreAudio/AudioServerPlugIn.h>
+#include "mts/util.h"
+#include "mts/routing.h"
+#include <math.h>
+#include <string.h>
+
+namespace mts {
+/// Number of channels of a layout tag known by get_channel_label(), 0 for another tag.
+inline constexpr UInt32 get_layout_channel_count(AudioChannelLayoutTag tag) noexcept {
+  switch (tag) {
+  case kAudioChannelLayoutTag_Mono:
+    return 1;
+  case kAudioChannelLayoutTag_Stereo:
+    return 2;
+  case kAudioChannelLayoutTag_Quadraphonic:
+    return 4;
+  case kAudioChannelLayoutTag_MPEG_5_0_A:
+    return 5;
+  case kAudioChannelLayoutTag_MPEG_5_1_A:
+    return 6;
+  case kAudioChannelLayoutTag_MPEG_7_1_C:
+    return 8;
+  default:
+    return 0;
+  }
+}
+
+/// Label of a channel of a layout, the channels past the layout are discrete.
+inline AudioChannelLabel get_channel_label(AudioChannelLayoutTag tag, UInt32 channel) noexcept {
+  constexpr AudioChannelLabel l = kAudioChannelLabel_Left;
+  constexpr AudioChannelLabel r = kAudioChannelLabel_Right;
+  constexpr AudioChannelLabel c = kAudioChannelLabel_Center;
+  constexpr AudioChannelLabel lfe = kAudioChannelLabel_LFEScreen;
+  constexpr AudioChannelLabel ls = kAudioChannelLabel_LeftSurround;
+  constexpr AudioChannelLabel rs = kAudioChannelLabel_RightSurround;
+
+  static constexpr AudioChannelLabel mono[] = { kAudioChannelLabel_Mono };
+  static constexpr AudioChannelLabel stereo[] = { l, r };
+  static constexpr AudioChannelLabel quadraphonic[] = { l, r, ls, rs };
+  static constexpr AudioChannelLabel mpeg_5_0_a[] = { l, r, c, ls, rs };
+  static constexpr AudioChannelLabel mpeg_5_1_a[] = { l, r, c, lfe, ls, rs };
+  static constexpr AudioChannelLabel mpeg_7_1_c[]
+      = { l, r, c, lfe, ls, rs, kAudioChannelLabel_RearSurroundLeft, kAudioChannelLabel_RearSurroundRight };
+
+  if (channel >= get_layout_channel_count(tag)) {
+    return kAudioChannelLabel_Discrete_0 + channel;
+  }
+
+  switch (tag) {
+  case kAudioChannelLayoutTag_Mono:
+    return mono[channel];
+  case kAudioChannelLayoutTag_Stereo:
+    return stereo[channel];
+  case kAudioChannelLayoutTag_Quadraphonic:
+    return quadraphonic[channel];
+  case kAudioChannelLayoutTag_MPEG_5_0_A:
+    return mpeg_5_0_a[channel];
+  case kAudioChannelLayoutTag_MPEG_5_1_A:
+    return mpeg_5_1_a[channel];
+  default:
+    return mpeg_7_1_c[channel];
+  }
+}
+
+/// First of the `channels` channels of a layout with `label`, -1 when there is none.
+inline SInt32 find_channel_label(AudioChannelLayoutTag tag, UInt32 channels, AudioChannelLabel label) noexcept {
+  for (UInt32 i = 0; i < channels; i++) {
+    if (get_channel_label(tag, i) == label) {
+      return (SInt32)i;
+    }
+  }
+
+  return -1;
+}
+
+/// How the channels of the output that the input layout doesn't have are read.
+///
+/// none:     only the channels with the same label in both layouts go through.
+/// itu:      fold down to the front left and right (ITU-R BS.775), or to the single channel of a mono
+///           layout. The rear surrounds fold into the side ones when the input has them.
+/// binaural: every channel with a position is a virtual speaker rendered to the front left and
+///           right for headphones by a binaural_renderer. Without a front left and right, itu.
+enum class downmix_mode : UInt8 { none, itu, binaural };
+
+/// The gains apply to the channels that are folded or rendered, 0 dB is unchanged.
+struct downmix_settings {
+  downmix_mode mode = downmix_mode::itu;
+  Float32 center_db = -3.0103f;
+  Float32 surround_db = -3.0103f;
+
+  // The LFE is left out unless it has a gain.
+  bool has_lfe = false;
+  Float32 lfe_db = 0;
+};
+
+/// Azimuth in radians of a label, 0 is the front and the right is positive. False for a channel
+/// without a position.
+inline bool get_label_azimuth(AudioChannelLabel label, Float64& azimuth) noexcept {
+  switch (label) {
+  case kAudioChannelLabel_Left:
+    azimuth = -M_PI / 6;
+    return true;
+  case kAudioChannelLabel_Right:
+    azimuth = M_PI / 6;
+    return true;
+  case kAudioChannelLabel_Center:
+  case kAudioChannelLabel_Mono:
+  case kAudioChannelLabel_LFEScreen:
+    azimuth = 0;
+    return true;
+  case kAudioChannelLabel_LeftSurround:
+    azimuth = -110 * M_PI / 180;
+    return true;
+  case kAudioChannelLabel_RightSurround:
+    azimuth = 110 * M_PI / 180;
+    return true;
+  case kAudioChannelLabel_RearSurroundLeft:
+    azimuth = -150 * M_PI / 180;
+    return true;
+  case kAudioChannelLabel_RearSurroundRight:
+    azimuth = 150 * M_PI / 180;
+    return true;
+  default:
+    return false;
+  }
+}
+
+/// Gain of a folded or rendered label, 0 for a label that is left out.
+inline Float32 get_label_gain(AudioChannelLabel label, const downmix_settings& settings) noexcept {
+  switch (label) {
+  case kAudioChannelLabel_Left:
+  case kAudioChannelLabel_Right:
+    return 1;
+  case kAudioChannelLabel_Center:
+  case kAudioChannelLabel_Mono:
+    return mts::decibel_to_amplitude(settings.center_db);
+  case kAudioChannelLabel_LFEScreen:
+    return settings.has_lfe ? mts::decibel_to_amplitude(settings.lfe_db) : 0;
+  case kAudioChannelLabel_LeftSurround:
+  case kAudioChannelLabel_RightSurround:
+  case kAudioChannelLabel_RearSurroundLeft:
+  case kAudioChannelLabel_RearSurroundRight:
+    return mts::decibel_to_amplitude(settings.surround_db);
+  default:
+    return 0;
+  }
+}
+
+/// A channel of the output layout is rendered by the binaural_renderer in binaural mode when it
+/// has a position and the input has a front left and right but not its label. The front left and
+/// right are always rendered, they become speakers in front of the listener.
+inline bool is_label_rendered(AudioChannelLabel label, AudioChannelLayoutTag input, UInt32 channels,
+    const downmix_settings& settings) noexcept {
+  Float64 azimuth;
+
+  return settings.mode == downmix_mode::binaural && get_label_azimuth(label, azimuth)
+      && get_label_gain(label, settings) != 0 && find_channel_label(input, channels, kAudioChannelLabel_Left) >= 0
+      && find_channel_label(input, channels, kAudioChannelLabel_Right) >= 0
+      && (label == kAudioChannelLabel_Left || label == kAudioChannelLabel_Right
+          || find_channel_label(input, channels, label) < 0);
+}
+
+/// Routes of the downmix of `Channels` channels from the output layout to the input layout,
+/// without the rendered channels. Returns their number, at most 2 * Channels.
+template <UInt32 Channels>
+inline UInt32 compile_downmix(AudioChannelLayoutTag output, AudioChannelLayoutTag input,
+    const downmix_settings& settings, route* routes) noexcept {
+  const SInt32 left = find_channel_label(input, Channels, kAudioChannelLabel_Left);
+  const SInt32 right = find_channel_label(input, Channels, kAudioChannelLabel_Right);
+  const SInt32 mono = mts::max(
+      find_channel_label(input, Channels, kAudioChannelLabel_Mono),
+      find_channel_label(input, Channels, kAudioChannelLabel_Center));
+  UInt32 count = 0;
+
+  for (UInt32 s = 0; s < Channels; s++) {
+    const AudioChannelLabel label = get_channel_label(output, s);
+    const SInt32 same = find_channel_label(input, Channels, label);
+
+    if (is_label_rendered(label, input, Channels, settings)) {
+      continue;
+    }
+
+    if (same >= 0) {
+      routes[count++] = { s, (UInt32)same, 1 };
+      continue;
+    }
+
+    const Float32 gain = get_label_gain(label, settings);
+
+    if (settings.mode == downmix_mode::none || gain == 0) {
+      continue;
+    }
+
+    // The rear surrounds are the side ones of a layout without them.
+    const AudioChannelLabel side = label == kAudioChannelLabel_RearSurroundLeft ? kAudioChannelLabel_LeftSurround
+        : label == kAudioChannelLabel_RearSurroundRight                        ? kAudioChannelLabel_RightSurround
+                                                                               : 0;
+    const SInt32 surround = side ? find_channel_label(input, Channels, side) : -1;
+
+    if (surround >= 0) {
+      routes[count++] = { s, (UInt32)surround, 1 };
+      continue;
+    }
+
+    // Share of the front left and right.
+    const bool is_left = label == kAudioChannelLabel_Left || label == kAudioChannelLabel_LeftSurround
+        || label == kAudioChannelLabel_RearSurroundLeft;
+    const bool is_right = label == kAudioChannelLabel_Right || label == kAudioChannelLabel_RightSurround
+        || label == kAudioChannelLabel_RearSurroundRight;
+    const Float32 to_left = is_right ? 0 : gain;
+    const Float32 to_right = is_left ? 0 : gain;
+
+    if (left >= 0 && right >= 0) {
+      if (to_left != 0) {
+        routes[count++] = { s, (UInt32)left, to_left };
+      }
+
+      if (to_right != 0) {
+        routes[count++] = { s, (UInt32)right, to_right };
+      }
+    }
+    else if (mono >= 0) {
+      routes[count++] = { s, (UInt32)mono, (Float32)M_SQRT1_2 * (to_left + to_right) };
+    }
+  }
+
+  return count;
+}
+
+/// Renders channels as virtual speakers for headphones, with the spherical head model of C. P.
+/// Brown and R. O. Duda ("A structural model for binaural sound synthesis", 1998).
+///
+/// Each ear hears a speaker after the interaural delay of Woodworth's formula and through a one
+/// pole, one zero head shadow filter, both set by the angle between the speaker and the ear: the
+/// near ear gets up to 6 dB more highs and the far one up to 20 dB less. The low frequencies reach
+/// both ears at the same level, each speaker is scaled by -3 dB to keep its power. There is no
+/// pinna, elevation or room, but the speakers stay on their side and outside of the head, and
+/// nothing has to be loaded. The delays are rounded to whole frames.
+///
+/// Everything is preallocated, process() is real-time safe.
+template <typename T, UInt32 Channels>
+class binaural_renderer {
+public:
+  /// Longest delay in frames, the head model delays at most 0.66 ms (127 frames at 192 kHz).
+  static constexpr UInt32 max_delay = 128;
+
+  static constexpr Float64 head_radius = 0.0875;
+  static constexpr Float64 speed_of_sound = 343;
+  static constexpr T denormal_threshold = (T)1e-15;
+
+  inline binaural_renderer() noexcept { reset(); }
+
+  inline bool is_active() const noexcept { return m_source_count != 0; }
+
+  inline void reset() noexcept {
+    memset(m_history, 0, sizeof(m_history));
+    m_history_index = 0;
+
+    for (UInt32 s = 0; s < m_source_count; s++) {
+      for (ear& e : m_sources[s].ears) {
+        e.x1 = 0;
+        e.y1 = 0;
+      }
+    }
+  }
+
+  /// Renders the channels of the output layout that is_label_rendered() selects into the front
+  /// left and right of the input layout. The state starts again.
+  inline void set(AudioChannelLayoutTag output, AudioChannelLayoutTag input, const downmix_settings& settings,
+      Float64 sample_rate) noexcept {
+    m_source_count = 0;
+    m_left = (UInt32)mts::max<SInt32>(find_channel_label(input, Channels, kAudioChannelLabel_Left), 0);
+    m_right = (UInt32)mts::max<SInt32>(find_channel_label(input, Channels, kAudioChannelLabel_Right), 0);
+
+    for (UInt32 c = 0; c < Channels; c++) {
+      const AudioChannelLabel label = get_channel_label(output, c);
+      Float64 azimuth;
+
+      if (!is_label_rendered(label, input, Channels, settings) || !get_label_azimuth(label, azimuth)) {
+        continue;
+      }
+
+      source& s = m_sources[m_source_count++];
+      s.channel = c;
+      s.gain = (T)(M_SQRT1_2 * get_label_gain(label, settings));
+      s.ears[0] = make_ear(azimuth + M_PI_2, sample_rate);
+      s.ears[1] = make_ear(azimuth - M_PI_2, sample_rate);
+    }
+
+    reset();
+  }
+
+  /// Adds the rendering of `src` to the front left and right of `dst`, with the layout of
+  /// routing_matrix::process().
+  inline void process(const T* src, T* dst, UInt32 frames, size_t frame_stride, size_t channel_stride) noexcept {
+    constexpr UInt32 mask = max_delay - 1;
+
+    for (UInt32 f = 0; f < frames; f++) {
+      const T* in = src + f * frame_stride;
+      T out[2] = {};
+
+      for (UInt32 i = 0; i < m_source_count; i++) {
+        source& s = m_sources[i];
+        T* history = m_history[i];
+        history[m_history_index] = s.gain * in[s.channel * channel_stride];
+
+        for (UInt32 e = 0; e < 2; e++) {
+          ear& state = s.ears[e];
+          const T x = history[(m_history_index - state.delay) & mask];
+          const T y = state.b0 * x + state.b1 * state.x1 - state.a1 * state.y1;
+          state.x1 = x;
+          state.y1 = y;
+          out[e] += y;
+        }
+      }
+
+      dst[f * frame_stride + m_left * channel_stride] += out[0];
+      dst[f * frame_stride + m_right * channel_stride] += out[1];
+      m_history_index = (m_history_index + 1) & mask;
+    }
+
+    for (UInt32 i = 0; i < m_source_count; i++) {
+      for (ear& e : m_sources[i].ears) {
+        if (fabs(e.y1) < denormal_threshold) {
+          e.y1 = 0;
+        }
+      }
+    }
+  }
+
+private:
+  struct ear {
+    UInt32 delay = 0;
+    T b0 = 1;
+    T b1 = 0;
+    T a1 = 0;
+    T x1 = 0;
+    T y1 = 0;
+  };
+
+  struct source {
+    UInt32 channel = 0;
+    T gain = 0;
+    ear ears[2]; // Left, right.
+  };
+
+  source m_sources[Channels];
+  UInt32 m_source_count = 0;
+  UInt32 m_left = 0;
+  UInt32 m_right = 0;
+
+  T m_history[Channels][max_delay];
+  UInt32 m_history_index = 0;
+
+  /// `angle` is the azimuth of the speaker from the axis of the ear, 0 faces the ear.
+  static inline ear make_ear(Float64 angle, Float64 sample_rate) noexcept {
+    constexpr Float64 alpha_min = 0.1;
+    constexpr Float64 theta_min = 150 * M_PI / 180;
+    constexpr Float64 head_time = head_radius / speed_of_sound;
+
+    // Between 0 and pi.
+    const Float64 theta = acos(cos(angle));
+
+    // Woodworth, shifted so that the near ear isn't delayed in front of it.
+    const Float64 delay = theta < M_PI_2 ? head_time * (1 - cos(theta)) : head_time * (1 + theta - M_PI_2);
+
+    // H(s) = (alpha s + 2 w0) / (s + 2 w0) with w0 = c / a, by the bilinear transform. Its gain is
+    // 1 at 0 Hz and alpha at high frequencies.
+    const Float64 alpha = (1 + alpha_min / 2) + (1 - alpha_min / 2) * cos(theta / theta_min * M_PI);
+    const Float64 w = 2 / head_time;
+    const Float64 k = 2 * sample_rate;
+
+    ear e;
+    e.delay = (UInt32)mts::min<Float64>(round(delay * sample_rate), max_delay - 1);
+    e.b0 = (T)((alpha * k + w) / (k + w));
+    e.b1 = (T)((w - alpha * k) / (k + w));
+    e.a1 = (T)((w - k) / (k + w));
+    return e;
+  }
+};
+
+/// Downmix of the channels of a stream pair read from the ring, from the output layout to the
+/// input layout: a routing_matrix for the channels that go through or fold, and a
+/// binaural_renderer in binaural mode. A degraded binaural downmix falls back to the itu matrix.
+/// set() must not be called while process() runs.
+template <typename T, UInt32 Channels>
+class downmix {
+public:
+  inline void set(AudioChannelLayoutTag output, AudioChannelLayoutTag input, const downmix_settings& settings,
+      Float64 sample_rate) noexcept {
+    compile(m_matrix, output, input, settings);
+    m_renderer.set(output, input, settings, sample_rate);
+
+    if (m_renderer.is_active()) {
+      downmix_settings fallback = settings;
+      fallback.mode = downmix_mode::itu;
+      compile(m_fallback, output, input, fallback);
+    }
+  }
+
+  /// Nothing to do, the frames can be read as they are.
+  inline bool is_identity() const noexcept { return m_matrix.is_identity() && !m_renderer.is_active(); }
+
+  inline void reset() noexcept {
+    m_renderer.reset();
+    m_is_degraded = false;
+  }
+
+  /// `src` and `dst` must not overlap, see routing_matrix::process(). The renderer starts again from
+  /// silence after a degraded call.
+  inline void process(const T* src, T* dst, UInt32 frames, size_t frame_stride, size_t channel_stride,
+      bool is_degraded = false) noexcept {
+    if (!m_renderer.is_active()) {
+      m_matrix.process(src, dst, frames, frame_stride, channel_stride);
+      return;
+    }
+
+    if (is_degraded) {
+      m_fallback.process(src, dst, frames, frame_stride, channel_stride);
+      m_is_degraded = true;
+      return;
+    }
+
+    if (m_is_degraded) {
+      m_renderer.reset();
+      m_is_degraded = false;
+    }
+
+    m_matrix.process(src, dst, frames, frame_stride, channel_stride);
+    m_renderer.process(src, dst, frames, frame_stride, channel_stride);
+  }
+
+private:
+  routing_matrix<T, Channels> m_matrix;
+  routing_matrix<T, Channels> m_fallback;
+  binaural_renderer<T, Channels> m_renderer;
+  bool m_is_degraded = false;
+
+  static inline void compile(routing_matrix<T, Channels>& matrix, AudioChannelLayoutTag output,
+      AudioChannelLayoutTag input, const downmix_settings& settings) noexcept {
+    route routes[routing_matrix<T, Channels>::max_routes];
+    const UInt32 count = compile_downmix<Channels>(output, input, settings, routes);
+
+    // An empty list is the identity for the matrix, a silent route clears every channel.
+    if (count == 0) {
+      routes[0] = { 0, 0, 0 };
+    }
+
+    matrix.compile(routes, mts::max<UInt32>(count, 1));
+  }
+};
+} // namespace mts.
@@ -1,7 +1,7 @@
 #pragma once
 #include "mts/util.h"
 #include <string.h>
-#include <Accelerate/Accelerate.h>
+#include "mts/platform.h"
 
 namespace mts::dsp {
 /// Clear a buffer of floating points.
@@ -25,6 +25,73 @@ inline void copy(const T* src, T* dst, size_t size) {
   memcpy((void*)dst, (const void*)src, size * sizeof(T));
 }
 
+/// Copy a buffer of floating points with non-temporal stores, the destination isn't brought into
+/// the cache. Only worth it when the destination won't be read again soon.
+template <typename T, std::enable_if_t<std::is_floating_point_v<T>, bool> = true>
+inline void copy_non_temporal(const T* src, T* dst, size_t size) {
+  for (size_t i = 0; i < size; i++) {
+    __builtin_nontemporal_store(src[i], dst + i);
+  }
+}
+
+/// Deinterleave `frames` frames of `channels` channels, channel c goes to dst + c * dst_stride.
+/// Stereo uses vDSP_ctoz, a contiguous destination is a single vDSP_mtrans.
+template <typename T, std::enable_if_t<std::is_floating_point_v<T>, bool> = true>
+inline void deinterleave(const T* src, T* dst, size_t channels, size_t frames, size_t dst_stride) {
+  if constexpr (sizeof(T) == 4) {
+    if (channels == 2) {
+      const DSPSplitComplex split = { dst, dst + dst_stride };
+      vDSP_ctoz((const DSPComplex*)src, 2, &split, 1, frames);
+      return;
+    }
+
+    if (dst_stride == frames) {
+      vDSP_mtrans(src, 1, dst, 1, channels, frames);
+      return;
+    }
+
+    for (size_t c = 0; c < channels; c++) {
+      cblas_scopy((int)frames, src + c, (int)channels, dst + c * dst_stride, 1);
+    }
+  }
+  else {
+    for (size_t c = 0; c < channels; c++) {
+      for (size_t f = 0; f < frames; f++) {
+        dst[c * dst_stride + f] = src[f * channels + c];
+      }
+    }
+  }
+}
+
+/// Interleave `frames` frames of `channels` channels, channel c is read from src + c * src_stride.
+/// Stereo uses vDSP_ztoc, a contiguous source is a single vDSP_mtrans.
+template <typename T, std::enable_if_t<std::is_floating_point_v<T>, bool> = true>
+inline void interleave(const T* src, size_t src_stride, T* dst, size_t channels, size_t frames) {
+  if constexpr (sizeof(T) == 4) {
+    if (channels == 2) {
+      const DSPSplitComplex split = { const_cast<T*>(src), const_cast<T*>(src + src_stride) };
+      vDSP_ztoc(&split, 1, (DSPComplex*)dst, 2, frames);
+      return;
+    }
+
+    if (src_stride == frames) {
+      vDSP_mtrans(src, 1, dst, 1, frames, channels);
+      return;
+    }
+
+    for (size_t c = 0; c < channels; c++) {
+      cblas_scopy((int)frames, src + c * src_stride, 1, dst + c, (int)channels);
+    }
+  }
+  else {
+    for (size_t c = 0; c < channels; c++) {
+      for (size_t f = 0; f < frames; f++) {
+        dst[f * channels + c] = src[c * src_stride + f];
+      }
+    }
+  }
+}
+
 /// Multiply vector with value.
 template <typename T, std::enable_if_t<std::is_floating_point_v<T> && is_one_of(sizeof(T), 4, 8), bool> = true>
 inline void mul(T* buffer, T value, size_t size) {
@@ -35,4 +102,30 @@ inline void mul(T* buffer, T value, size_t size) {
     vDSP_vsmulD((const T*)buffer, 1, (const T*)&value, buffer, 1, size);
   }
 }
+
+/// Largest absolute value of a vector.
+template <typename T, std::enable_if_t<std::is_floating_point_v<T> && is_one_of(sizeof(T), 4, 8), bool> = true>
+inline T max_magnitude(const T* buffer, size_t size) {
+  T value = 0;
+
+  if constexpr (sizeof(T) == 4) {
+    vDSP_maxmgv(buffer, 1, &value, size);
+  }
+  else if constexpr (sizeof(T) == 8) {
+    vDSP_maxmgvD(buffer, 1, &value, size);
+  }
+
+  return value;
+}
+
+/// Add a vector to another one.
+template <typename T, std::enable_if_t<std::is_floating_point_v<T> && is_one_of(sizeof(T), 4, 8), bool> = true>
+inline void add(const T* src, T* dst, size_t size) {
+  if constexpr (sizeof(T) == 4) {
+    vDSP_vadd(src, 1, dst, 1, dst, 1, size);
+  }
+  else if constexpr (sizeof(T) == 8) {
+    vDSP_vaddD(src, 1, dst, 1, dst, 1, size);
+  }
+}
 } // namespace mts::dsp.
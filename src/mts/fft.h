@@ -0,0 +1,378 @@
+#pragma once
+#include "mts/platform.h"
+#include "mts/util.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+namespace mts::dsp {
+/// FFT of a real signal of a power of two size, the same vector code on every platform.
+///
+/// The N real points are transformed as N / 2 complex points, the even samples being the real
+/// parts and the odd ones the imaginary parts, and the result is split into the spectrum of the
+/// real signal. The complex FFT is a Stockham autosort FFT, without bit reversal: radix-4 passes,
+/// then a radix-2 pass when log2(N / 2) is odd, going back and forth between two buffers. Points
+/// are split complex, the real parts then the imaginary parts, so that the butterflies of a pass
+/// run on 16 bytes vectors of 4 points sharing a twiddle. In the first pass the 4 points of a
+/// butterfly are adjacent in the output, it runs 4 butterflies with their own twiddles at once
+/// and transposes the results.
+///
+/// Spectra are packed like vDSP_fft_zrip: N / 2 real parts and N / 2 imaginary parts, with the DC
+/// in re[0] and the Nyquist frequency in im[0]. forward() is the DFT and inverse() of a forward()
+/// is N times the signal, without the factor 2 of vDSP. init() and free() allocate, forward() and
+/// inverse() are real-time safe.
+class real_fft {
+public:
+  typedef Float32 vector __attribute__((vector_size(16)));
+
+  static constexpr UInt32 lanes = 4;
+  static constexpr UInt32 min_size = 32;
+
+  /// `size` must be a power of two of at least min_size.
+  inline bool init(UInt32 size) {
+    free();
+
+    if (!mts::is_power_of_two(size) || size < min_size) {
+      return false;
+    }
+
+    const UInt32 m = size / 2;
+    size_t twiddle_count = 0;
+
+    for (UInt32 n = m; n >= 4; n /= 4) {
+      twiddle_count += 6 * (size_t)(n / 4);
+    }
+
+    // Two buffers of m points, the twiddles of the passes, then W^k for k <= m / 2.
+    m_memory = (Float32*)calloc(4 * (size_t)m + twiddle_count + 2 * (size_t)(m / 2 + 1), sizeof(Float32));
+
+    if (!m_memory) {
+      return false;
+    }
+
+    m_size = size;
+    m_half = m;
+    m_twiddles = m_memory + 4 * (size_t)m;
+    m_split = m_twiddles + twiddle_count;
+
+    Float32* t = m_twiddles;
+
+    for (UInt32 n = m; n >= 4; n /= 4) {
+      const UInt32 n1 = n / 4;
+
+      for (UInt32 p = 0; p < n1; p++) {
+        for (UInt32 j = 1; j <= 3; j++) {
+          const Float64 angle = -2 * M_PI * j * p / n;
+          t[(2 * j - 2) * n1 + p] = (Float32)cos(angle);
+          t[(2 * j - 1) * n1 + p] = (Float32)sin(angle);
+        }
+      }
+
+      t += 6 * (size_t)n1;
+    }
+
+    for (UInt32 k = 0; k <= m / 2; k++) {
+      const Float64 angle = -2 * M_PI * k / size;
+      m_split[k] = (Float32)cos(angle);
+      m_split[m / 2 + 1 + k] = (Float32)sin(angle);
+    }
+
+    return true;
+  }
+
+  inline void free() {
+    ::free(m_memory);
+    m_memory = nullptr;
+    m_size = 0;
+    m_half = 0;
+  }
+
+  inline UInt32 get_size() const noexcept { return m_size; }
+
+  /// Spectrum of the `size` points of `time` in `re` and `im`, size / 2 points each.
+  inline void forward(const Float32* time, Float32* re, Float32* im) const noexcept {
+    const UInt32 m = m_half;
+    Float32* x = m_memory;
+
+    for (UInt32 k = 0; k < m; k += lanes) {
+      const vector a = load(time + 2 * k);
+      const vector b = load(time + 2 * k + lanes);
+      store(x + k, __builtin_shufflevector(a, b, 0, 2, 4, 6));
+      store(x + m + k, __builtin_shufflevector(a, b, 1, 3, 5, 7));
+    }
+
+    const Float32* z = transform(x, x + 2 * (size_t)m);
+    const Float32* zr = z;
+    const Float32* zi = z + m;
+    const Float32* wr = m_split;
+    const Float32* wi = m_split + m / 2 + 1;
+    const vector half = { 0.5f, 0.5f, 0.5f, 0.5f };
+
+    re[0] = zr[0] + zi[0];
+    im[0] = zr[0] - zi[0];
+
+    // Z[k] is the spectrum of the even points plus i times the one of the odd points, each of them
+    // has a conjugate symmetry that Z[m - k] gives back.
+    for (UInt32 k = 1; k < m / 2; k += lanes) {
+      const UInt32 r = m - k - (lanes - 1);
+      const vector ar = load(zr + k);
+      const vector ai = load(zi + k);
+      const vector br = reverse(load(zr + r));
+      const vector bi = -reverse(load(zi + r));
+
+      const vector er = (ar + br) * half;
+      const vector ei = (ai + bi) * half;
+      const vector o_r = (ai - bi) * half;
+      const vector o_i = (br - ar) * half;
+
+      const vector c = load(wr + k);
+      const vector s = load(wi + k);
+      const vector tr = c * o_r - s * o_i;
+      const vector ti = c * o_i + s * o_r;
+
+      store(re + k, er + tr);
+      store(im + k, ei + ti);
+      store(re + r, reverse(er - tr));
+      store(im + r, reverse(ti - ei));
+    }
+  }
+
+  /// Signal of the spectrum in `re` and `im` in the `size` points of `time`, scaled by `size`.
+  inline void inverse(const Float32* re, const Float32* im, Float32* time) const noexcept {
+    const UInt32 m = m_half;
+    const Float32* wr = m_split;
+    const Float32* wi = m_split + m / 2 + 1;
+
+    // The inverse transform is the forward one with the real and imaginary parts swapped, in and
+    // out, so the imaginary parts go first.
+    Float32* x = m_memory;
+    Float32* xi = x;
+    Float32* xr = x + m;
+
+    xr[0] = re[0] + im[0];
+    xi[0] = re[0] - im[0];
+
+    for (UInt32 k = 1; k < m / 2; k += lanes) {
+      const UInt32 r = m - k - (lanes - 1);
+      const vector ar = load(re + k);
+      const vector ai = load(im + k);
+      const vector br = reverse(load(re + r));
+      const vector bi = -reverse(load(im + r));
+
+      const vector er = ar + br;
+      const vector ei = ai + bi;
+      const vector dr = ar - br;
+      const vector di = ai - bi;
+
+      const vector c = load(wr + k);
+      const vector s = load(wi + k);
+      const vector o_r = dr * c + di * s;
+      const vector o_i = di * c - dr * s;
+
+      store(xr + k, er - o_i);
+      store(xi + k, ei + o_r);
+      store(xr + r, reverse(er + o_i));
+      store(xi + r, reverse(o_r - ei));
+    }
+
+    const Float32* z = transform(x, x + 2 * (size_t)m);
+    const Float32* zi = z;
+    const Float32* zr = z + m;
+
+    for (UInt32 k = 0; k < m; k += lanes) {
+      const vector a = load(zr + k);
+      const vector b = load(zi + k);
+      store(time + 2 * k, __builtin_shufflevector(a, b, 0, 4, 1, 5));
+      store(time + 2 * k + lanes, __builtin_shufflevector(a, b, 2, 6, 3, 7));
+    }
+  }
+
+  /// (dr, di) = (ar, ai) * (br, bi) on `size` split complex points.
+  static inline void multiply(const Float32* ar, const Float32* ai, const Float32* br, const Float32* bi, Float32* dr,
+      Float32* di, UInt32 size) noexcept {
+    UInt32 i = 0;
+
+    for (; i + lanes <= size; i += lanes) {
+      const vector xr = load(ar + i), xi = load(ai + i), yr = load(br + i), yi = load(bi + i);
+      store(dr + i, xr * yr - xi * yi);
+      store(di + i, xr * yi + xi * yr);
+    }
+
+    for (; i < size; i++) {
+      const Float32 xr = ar[i], xi = ai[i];
+      dr[i] = xr * br[i] - xi * bi[i];
+      di[i] = xr * bi[i] + xi * br[i];
+    }
+  }
+
+  /// (dr, di) += (ar, ai) * (br, bi) on `size` split complex points.
+  static inline void multiply_add(const Float32* ar, const Float32* ai, const Float32* br, const Float32* bi,
+      Float32* dr, Float32* di, UInt32 size) noexcept {
+    UInt32 i = 0;
+
+    for (; i + lanes <= size; i += lanes) {
+      const vector xr = load(ar + i), xi = load(ai + i), yr = load(br + i), yi = load(bi + i);
+      store(dr + i, load(dr + i) + xr * yr - xi * yi);
+      store(di + i, load(di + i) + xr * yi + xi * yr);
+    }
+
+    for (; i < size; i++) {
+      const Float32 xr = ar[i], xi = ai[i];
+      dr[i] += xr * br[i] - xi * bi[i];
+      di[i] += xr * bi[i] + xi * br[i];
+    }
+  }
+
+private:
+  UInt32 m_size = 0;
+  UInt32 m_half = 0;
+  Float32* m_memory = nullptr;
+
+  // Per radix-4 pass of n points, n / 4 real and imaginary parts of W^p, W^2p and W^3p.
+  Float32* m_twiddles = nullptr;
+
+  // W^k = e^(-2 pi i k / size) for k <= size / 4, the real parts then the imaginary parts.
+  Float32* m_split = nullptr;
+
+  static inline vector load(const Float32* p) noexcept {
+    vector v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+  }
+
+  static inline void store(Float32* p, vector v) noexcept { memcpy(p, &v, sizeof(v)); }
+
+  static inline vector reverse(vector v) noexcept { return __builtin_shufflevector(v, v, 3, 2, 1, 0); }
+
+  static inline vector broadcast(Float32 f) noexcept { return vector{ f, f, f, f }; }
+
+  /// DFT of the m_half split complex points of `x`, using `y` as the other buffer. Returns the
+  /// one that holds the result.
+  inline const Float32* transform(Float32* x, Float32* y) const noexcept {
+    const UInt32 m = m_half;
+    const Float32* twiddles = m_twiddles;
+    Float32* in = x;
+    Float32* out = y;
+    UInt32 n = m;
+    UInt32 s = 1;
+
+    for (; n >= 4; n /= 4, s *= 4) {
+      const UInt32 n1 = n / 4;
+
+      if (s == 1) {
+        first_pass(in, in + m, out, out + m, twiddles, n1);
+      }
+      else {
+        pass(in, in + m, out, out + m, twiddles, n1, s);
+      }
+
+      twiddles += 6 * (size_t)n1;
+      Float32* swap = in;
+      in = out;
+      out = swap;
+    }
+
+    if (n == 2) {
+      for (UInt32 q = 0; q < s; q += lanes) {
+        const vector ar = load(in + q), ai = load(in + m + q);
+        const vector br = load(in + s + q), bi = load(in + m + s + q);
+        store(out + q, ar + br);
+        store(out + m + q, ai + bi);
+        store(out + s + q, ar - br);
+        store(out + m + s + q, ai - bi);
+      }
+
+      in = out;
+    }
+
+    return in;
+  }
+
+  /// Radix-4 butterfly of a, b, c and d, n1 points apart, the outputs being twiddled by W^0, W^p,
+  /// W^2p and W^3p of the pass.
+  static inline void butterfly(vector* yr, vector* yi, vector ar, vector ai, vector br, vector bi, vector cr, vector ci,
+      vector dr, vector di, vector w1r, vector w1i, vector w2r, vector w2i, vector w3r, vector w3i) noexcept {
+    const vector apcr = ar + cr, apci = ai + ci;
+    const vector amcr = ar - cr, amci = ai - ci;
+    const vector bpdr = br + dr, bpdi = bi + di;
+
+    // -i (b - d)
+    const vector jbmdr = bi - di, jbmdi = dr - br;
+
+    yr[0] = apcr + bpdr;
+    yi[0] = apci + bpdi;
+
+    const vector r1 = amcr + jbmdr, i1 = amci + jbmdi;
+    yr[1] = w1r * r1 - w1i * i1;
+    yi[1] = w1r * i1 + w1i * r1;
+
+    const vector r2 = apcr - bpdr, i2 = apci - bpdi;
+    yr[2] = w2r * r2 - w2i * i2;
+    yi[2] = w2r * i2 + w2i * r2;
+
+    const vector r3 = amcr - jbmdr, i3 = amci - jbmdi;
+    yr[3] = w3r * r3 - w3i * i3;
+    yi[3] = w3r * i3 + w3i * r3;
+  }
+
+  /// Lane l of row r becomes lane r of row l.
+  static inline void transpose(vector* v) noexcept {
+    const vector t0 = __builtin_shufflevector(v[0], v[1], 0, 4, 1, 5);
+    const vector t1 = __builtin_shufflevector(v[2], v[3], 0, 4, 1, 5);
+    const vector t2 = __builtin_shufflevector(v[0], v[1], 2, 6, 3, 7);
+    const vector t3 = __builtin_shufflevector(v[2], v[3], 2, 6, 3, 7);
+    v[0] = __builtin_shufflevector(t0, t1, 0, 1, 4, 5);
+    v[1] = __builtin_shufflevector(t0, t1, 2, 3, 6, 7);
+    v[2] = __builtin_shufflevector(t2, t3, 0, 1, 4, 5);
+    v[3] = __builtin_shufflevector(t2, t3, 2, 3, 6, 7);
+  }
+
+  /// The pass with a stride of 1: butterfly p writes the points 4p to 4p + 3.
+  static inline void first_pass(const Float32* xr, const Float32* xi, Float32* yr, Float32* yi, const Float32* t,
+      UInt32 n1) noexcept {
+    for (UInt32 p = 0; p < n1; p += lanes) {
+      vector r[4], i[4];
+      butterfly(r, i, load(xr + p), load(xi + p), load(xr + n1 + p), load(xi + n1 + p), load(xr + 2 * n1 + p),
+          load(xi + 2 * n1 + p), load(xr + 3 * n1 + p), load(xi + 3 * n1 + p), load(t + p), load(t + n1 + p),
+          load(t + 2 * n1 + p), load(t + 3 * n1 + p), load(t + 4 * n1 + p), load(t + 5 * n1 + p));
+
+      transpose(r);
+      transpose(i);
+
+      for (UInt32 j = 0; j < 4; j++) {
+        store(yr + 4 * p + j * lanes, r[j]);
+        store(yi + 4 * p + j * lanes, i[j]);
+      }
+    }
+  }
+
+  /// A pass with a stride `s` of at least 4: butterfly p runs on the s points q of each of its
+  /// inputs, xr[q + s * (p + j * n1)], and writes them to yr[q + s * (4p + j)].
+  static inline void pass(const Float32* xr, const Float32* xi, Float32* yr, Float32* yi, const Float32* t, UInt32 n1,
+      UInt32 s) noexcept {
+    const size_t stride = (size_t)s * n1;
+
+    for (UInt32 p = 0; p < n1; p++) {
+      const vector w1r = broadcast(t[p]), w1i = broadcast(t[n1 + p]);
+      const vector w2r = broadcast(t[2 * n1 + p]), w2i = broadcast(t[3 * n1 + p]);
+      const vector w3r = broadcast(t[4 * n1 + p]), w3i = broadcast(t[5 * n1 + p]);
+      const Float32* ar = xr + (size_t)s * p;
+      const Float32* ai = xi + (size_t)s * p;
+      Float32* br = yr + (size_t)s * 4 * p;
+      Float32* bi = yi + (size_t)s * 4 * p;
+
+      for (UInt32 q = 0; q < s; q += lanes) {
+        vector r[4], i[4];
+        butterfly(r, i, load(ar + q), load(ai + q), load(ar + stride + q), load(ai + stride + q),
+            load(ar + 2 * stride + q), load(ai + 2 * stride + q), load(ar + 3 * stride + q), load(ai + 3 * stride + q),
+            w1r, w1i, w2r, w2i, w3r, w3i);
+
+        for (UInt32 j = 0; j < 4; j++) {
+          store(br + (size_t)j * s + q, r[j]);
+          store(bi + (size_t)j * s + q, i[j]);
+        }
+      }
+    }
+  }
+};
+} // namespace mts::dsp.
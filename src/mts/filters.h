@@ -0,0 +1,317 @@
+#pragma once
+#include "mts/platform.h"
+#include "mts/util.h"
+#include <math.h>
+#include <string.h>
+
+namespace mts::dsp {
+/// Coefficients of a biquad normalized by a0, see the Audio EQ Cookbook (R. Bristow-Johnson).
+/// The default is a pass-through.
+struct biquad_coefficients {
+  Float64 b0 = 1;
+  Float64 b1 = 0;
+  Float64 b2 = 0;
+  Float64 a1 = 0;
+  Float64 a2 = 0;
+};
+
+enum class biquad_type : UInt8 { high_pass, peak, low_shelf, high_shelf };
+
+/// `gain_db` is only used by the peak and shelf filters. The frequency must be below Nyquist.
+inline biquad_coefficients make_biquad(
+    biquad_type type, Float64 sample_rate, Float64 frequency, Float64 q, Float64 gain_db) noexcept {
+  const Float64 w0 = 2 * M_PI * frequency / sample_rate;
+  const Float64 cos_w0 = cos(w0);
+  const Float64 alpha = sin(w0) / (2 * q);
+  const Float64 a = pow(10.0, gain_db / 40);
+  const Float64 shelf = 2 * sqrt(a) * alpha;
+
+  // A pass-through for a type out of the enum.
+  Float64 b0 = 1, b1 = 0, b2 = 0, a0 = 1, a1 = 0, a2 = 0;
+
+  switch (type) {
+  case biquad_type::high_pass:
+    b0 = (1 + cos_w0) / 2;
+    b1 = -(1 + cos_w0);
+    b2 = (1 + cos_w0) / 2;
+    a0 = 1 + alpha;
+    a1 = -2 * cos_w0;
+    a2 = 1 - alpha;
+    break;
+
+  case biquad_type::peak:
+    b0 = 1 + alpha * a;
+    b1 = -2 * cos_w0;
+    b2 = 1 - alpha * a;
+    a0 = 1 + alpha / a;
+    a1 = -2 * cos_w0;
+    a2 = 1 - alpha / a;
+    break;
+
+  case biquad_type::low_shelf:
+    b0 = a * ((a + 1) - (a - 1) * cos_w0 + shelf);
+    b1 = 2 * a * ((a - 1) - (a + 1) * cos_w0);
+    b2 = a * ((a + 1) - (a - 1) * cos_w0 - shelf);
+    a0 = (a + 1) + (a - 1) * cos_w0 + shelf;
+    a1 = -2 * ((a - 1) + (a + 1) * cos_w0);
+    a2 = (a + 1) + (a - 1) * cos_w0 - shelf;
+    break;
+
+  case biquad_type::high_shelf:
+    b0 = a * ((a + 1) + (a - 1) * cos_w0 + shelf);
+    b1 = -2 * a * ((a - 1) + (a + 1) * cos_w0);
+    b2 = a * ((a + 1) + (a - 1) * cos_w0 - shelf);
+    a0 = (a + 1) - (a - 1) * cos_w0 + shelf;
+    a1 = 2 * ((a - 1) - (a + 1) * cos_w0);
+    a2 = (a + 1) - (a - 1) * cos_w0 - shelf;
+    break;
+  }
+
+  return { b0 / a0, b1 / a0, b2 / a0, a1 / a0, a2 / a0 };
+}
+
+/// Cascade of biquads in transposed direct form II, applied to every channel of a buffer.
+///
+/// The recursion is serial in time, so the parallelism is across channels: the channels of a
+/// frame are loaded into 16 bytes vectors (4 Float32 or 2 Float64 lanes) and every section runs on
+/// all the lanes of a vector at once. Interleaved frames are contiguous loads, other layouts are
+/// gathered lane by lane. process_reference() is the same filter one channel at a time with
+/// scalars, it gives the same result and is what the vector code is checked against.
+///
+/// Coefficient changes ramp linearly over `ramp_frames`, in steps of smoothing_block frames. The
+/// stable (a1, a2) pairs form a triangle, so a ramp between two stable filters stays stable.
+/// Sections that are added start as a pass-through and sections that are removed ramp to one
+/// before they stop running, so changing the number of sections doesn't click.
+///
+/// State that decays below denormal_threshold is flushed to zero after each call, before it gets
+/// to the denormal range where each operation can cost a hundred times more.
+template <typename T, UInt32 Channels, UInt32 MaxSections>
+class biquad_cascade {
+public:
+  typedef T vector __attribute__((vector_size(16)));
+
+  static constexpr UInt32 lanes = 16 / sizeof(T);
+  static constexpr UInt32 vector_count = (Channels + lanes - 1) / lanes;
+  static constexpr UInt32 smoothing_block = 16;
+  static constexpr T denormal_threshold = (T)1e-15;
+
+  inline biquad_cascade() noexcept { reset(); }
+
+  /// At least one section is running.
+  inline bool is_active() const noexcept { return m_section_count != 0; }
+
+  inline void reset() noexcept {
+    for (UInt32 s = 0; s < MaxSections; s++) {
+      reset_section(s);
+    }
+  }
+
+  /// Sets the first `count` sections, at most MaxSections, and stops the other ones.
+  inline void set(const biquad_coefficients* c, UInt32 count, UInt32 ramp_frames) noexcept {
+    count = mts::min(count, MaxSections);
+    const UInt32 running = mts::min(mts::max(m_section_count, count), MaxSections);
+    const UInt32 ramp_blocks = (ramp_frames + smoothing_block - 1) / smoothing_block;
+
+    for (UInt32 s = m_section_count; s < count; s++) {
+      reset_section(s);
+      m_coefficients[s] = coefficients{};
+    }
+
+    for (UInt32 s = 0; s < running; s++) {
+      m_targets[s] = s < count ? coefficients{ (T)c[s].b0, (T)c[s].b1, (T)c[s].b2, (T)c[s].a1, (T)c[s].a2 }
+                               : coefficients{};
+    }
+
+    m_section_count = running;
+    m_target_count = count;
+    m_ramp_blocks = ramp_blocks;
+
+    if (ramp_blocks == 0) {
+      settle();
+      return;
+    }
+
+    for (UInt32 s = 0; s < running; s++) {
+      const coefficients& from = m_coefficients[s];
+      const coefficients& to = m_targets[s];
+      const T n = (T)ramp_blocks;
+      m_steps[s] = { (to.b0 - from.b0) / n, (to.b1 - from.b1) / n, (to.b2 - from.b2) / n, (to.a1 - from.a1) / n,
+        (to.a2 - from.a2) / n };
+    }
+  }
+
+  /// Sample f of channel c is at buffer[f * frame_stride + c * channel_stride].
+  inline void process(T* buffer, UInt32 frames, size_t frame_stride, size_t channel_stride) noexcept {
+    process_blocks<false>(buffer, frames, frame_stride, channel_stride);
+  }
+
+  /// Scalar version of process().
+  inline void process_reference(T* buffer, UInt32 frames, size_t frame_stride, size_t channel_stride) noexcept {
+    process_blocks<true>(buffer, frames, frame_stride, channel_stride);
+  }
+
+private:
+  struct coefficients {
+    T b0 = 1;
+    T b1 = 0;
+    T b2 = 0;
+    T a1 = 0;
+    T a2 = 0;
+  };
+
+  coefficients m_coefficients[MaxSections];
+  coefficients m_targets[MaxSections];
+  coefficients m_steps[MaxSections];
+  UInt32 m_section_count = 0;
+  UInt32 m_target_count = 0;
+  UInt32 m_ramp_blocks = 0;
+
+  // Lane l of vector v is channel v * lanes + l, the lanes past the last channel stay at 0.
+  vector m_s1[MaxSections][vector_count];
+  vector m_s2[MaxSections][vector_count];
+
+  inline void reset_section(UInt32 s) noexcept {
+    for (UInt32 v = 0; v < vector_count; v++) {
+      m_s1[s][v] = vector{};
+      m_s2[s][v] = vector{};
+    }
+  }
+
+  inline void settle() noexcept {
+    for (UInt32 s = 0; s < m_section_count; s++) {
+      m_coefficients[s] = m_targets[s];
+    }
+
+    m_section_count = m_target_count;
+    m_ramp_blocks = 0;
+  }
+
+  template <bool Reference>
+  inline void process_blocks(T* buffer, UInt32 frames, size_t frame_stride, size_t channel_stride) noexcept {
+    UInt32 offset = 0;
+
+    while (offset < frames && m_section_count) {
+      const UInt32 count = m_ramp_blocks ? mts::min(smoothing_block, frames - offset) : frames - offset;
+      T* block = buffer + offset * frame_stride;
+
+      if constexpr (Reference) {
+        process_scalar(block, count, frame_stride, channel_stride);
+      }
+      else {
+        process_vector(block, count, frame_stride, channel_stride);
+      }
+
+      offset += count;
+
+      if (m_ramp_blocks) {
+        step();
+      }
+    }
+
+    flush_denormals();
+  }
+
+  inline void step() noexcept {
+    if (--m_ramp_blocks == 0) {
+      settle();
+      return;
+    }
+
+    for (UInt32 s = 0; s < m_section_count; s++) {
+      coefficients& c = m_coefficients[s];
+      const coefficients& d = m_steps[s];
+      c = { c.b0 + d.b0, c.b1 + d.b1, c.b2 + d.b2, c.a1 + d.a1, c.a2 + d.a2 };
+    }
+  }
+
+  inline void process_vector(T* buffer, UInt32 frames, size_t frame_stride, size_t channel_stride) noexcept {
+    const UInt32 sections = m_section_count;
+
+    for (UInt32 v = 0; v < vector_count; v++) {
+      const UInt32 first = v * lanes;
+      const UInt32 width = mts::min(lanes, Channels - first);
+      vector s1[MaxSections];
+      vector s2[MaxSections];
+
+      for (UInt32 s = 0; s < sections; s++) {
+        s1[s] = m_s1[s][v];
+        s2[s] = m_s2[s][v];
+      }
+
+      for (UInt32 f = 0; f < frames; f++) {
+        T* frame = buffer + f * frame_stride + first * channel_stride;
+        vector x = {};
+
+        if (channel_stride == 1) {
+          memcpy(&x, frame, width * sizeof(T));
+        }
+        else {
+          for (UInt32 l = 0; l < width; l++) {
+            x[l] = frame[l * channel_stride];
+          }
+        }
+
+        for (UInt32 s = 0; s < sections; s++) {
+          const coefficients& c = m_coefficients[s];
+          const vector y = c.b0 * x + s1[s];
+          s1[s] = c.b1 * x - c.a1 * y + s2[s];
+          s2[s] = c.b2 * x - c.a2 * y;
+          x = y;
+        }
+
+        if (channel_stride == 1) {
+          memcpy(frame, &x, width * sizeof(T));
+        }
+        else {
+          for (UInt32 l = 0; l < width; l++) {
+            frame[l * channel_stride] = x[l];
+          }
+        }
+      }
+
+      for (UInt32 s = 0; s < sections; s++) {
+        m_s1[s][v] = s1[s];
+        m_s2[s][v] = s2[s];
+      }
+    }
+  }
+
+  inline void process_scalar(T* buffer, UInt32 frames, size_t frame_stride, size_t channel_stride) noexcept {
+    for (UInt32 ch = 0; ch < Channels; ch++) {
+      const UInt32 v = ch / lanes;
+      const UInt32 l = ch % lanes;
+
+      for (UInt32 f = 0; f < frames; f++) {
+        T& sample = buffer[f * frame_stride + ch * channel_stride];
+        T x = sample;
+
+        for (UInt32 s = 0; s < m_section_count; s++) {
+          const coefficients& c = m_coefficients[s];
+          const T y = c.b0 * x + m_s1[s][v][l];
+          m_s1[s][v][l] = c.b1 * x - c.a1 * y + m_s2[s][v][l];
+          m_s2[s][v][l] = c.b2 * x - c.a2 * y;
+          x = y;
+        }
+
+        sample = x;
+      }
+    }
+  }
+
+  inline void flush_denormals() noexcept {
+    for (UInt32 s = 0; s < m_section_count; s++) {
+      for (UInt32 v = 0; v < vector_count; v++) {
+        for (UInt32 l = 0; l < lanes; l++) {
+          if (fabs(m_s1[s][v][l]) < denormal_threshold) {
+            m_s1[s][v][l] = 0;
+          }
+
+          if (fabs(m_s2[s][v][l]) < denormal_threshold) {
+            m_s2[s][v][l] = 0;
+          }
+        }
+      }
+    }
+  }
+};
+} // namespace mts::dsp.
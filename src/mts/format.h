@@ -0,0 +1,127 @@
+#pragma once
+#include "mts/platform.h"
+#include "mts/convert.h"
+
+namespace mts {
+/// Sample formats a stream can be set to.
+/// The available formats of a stream are listed in this order.
+enum class sample_format : UInt32 { float32, float64, int16, int24, int32 };
+
+inline constexpr UInt32 sample_format_count = 5;
+
+inline constexpr UInt32 get_bits_per_sample(sample_format format) {
+  switch (format) {
+  case sample_format::float32:
+    return 32;
+  case sample_format::float64:
+    return 64;
+  case sample_format::int16:
+    return 16;
+  case sample_format::int24:
+    return 24;
+  case sample_format::int32:
+    return 32;
+  }
+
+  return 0;
+}
+
+inline constexpr UInt32 get_bytes_per_sample(sample_format format) { return get_bits_per_sample(format) / 8; }
+
+inline constexpr bool is_float(sample_format format) {
+  return format == sample_format::float32 || format == sample_format::float64;
+}
+
+/// Format of the samples of a stream and whether the channels are interleaved or one buffer each.
+struct stream_format {
+  sample_format format = sample_format::float32;
+  bool non_interleaved = false;
+
+  inline bool operator==(const stream_format& f) const noexcept {
+    return format == f.format && non_interleaved == f.non_interleaved;
+  }
+
+  inline bool operator!=(const stream_format& f) const noexcept { return !operator==(f); }
+};
+
+/// Every combination of sample format and layout, interleaved ones first.
+inline constexpr UInt32 stream_format_count = sample_format_count * 2;
+
+inline constexpr stream_format get_stream_format(UInt32 index) {
+  return stream_format{ static_cast<sample_format>(index % sample_format_count), index >= sample_format_count };
+}
+
+/// A non-interleaved buffer holds one channel, the packet and frame sizes are those of a single
+/// channel while mChannelsPerFrame is still the number of buffers.
+inline void fill_description(
+    AudioStreamBasicDescription& desc, Float64 sample_rate, UInt32 channel_count, stream_format format) {
+  const UInt32 bytes_per_sample = get_bytes_per_sample(format.format);
+  const UInt32 bytes_per_frame = format.non_interleaved ? bytes_per_sample : bytes_per_sample * channel_count;
+
+  desc.mSampleRate = sample_rate;
+  desc.mFormatID = kAudioFormatLinearPCM;
+  desc.mFormatFlags = (is_float(format.format) ? kAudioFormatFlagIsFloat : kAudioFormatFlagIsSignedInteger)
+      | kAudioFormatFlagsNativeEndian | kAudioFormatFlagIsPacked
+      | (format.non_interleaved ? kAudioFormatFlagIsNonInterleaved : 0);
+  desc.mBytesPerPacket = bytes_per_frame;
+  desc.mFramesPerPacket = 1;
+  desc.mBytesPerFrame = bytes_per_frame;
+  desc.mChannelsPerFrame = channel_count;
+  desc.mBitsPerChannel = get_bits_per_sample(format.format);
+  desc.mReserved = 0;
+}
+
+/// Find the stream format described by `desc`, the sample rate is not checked.
+inline bool find_stream_format(const AudioStreamBasicDescription& desc, UInt32 channel_count, stream_format& format) {
+  for (UInt32 i = 0; i < stream_format_count; i++) {
+    AudioStreamBasicDescription expected;
+    fill_description(expected, desc.mSampleRate, channel_count, get_stream_format(i));
+
+    if (desc.mFormatID == expected.mFormatID && desc.mFormatFlags == expected.mFormatFlags
+        && desc.mBytesPerPacket == expected.mBytesPerPacket && desc.mFramesPerPacket == expected.mFramesPerPacket
+        && desc.mBytesPerFrame == expected.mBytesPerFrame && desc.mChannelsPerFrame == expected.mChannelsPerFrame
+        && desc.mBitsPerChannel == expected.mBitsPerChannel) {
+      format = get_stream_format(i);
+      return true;
+    }
+  }
+
+  return false;
+}
+
+/// Convert `size` samples of an IO buffer in `format` to floating points.
+template <typename T>
+inline void convert_from_format(const void* src, sample_format format, T* dst, size_t size) {
+  switch (format) {
+  case sample_format::float32:
+    return mts::dsp::convert((const Float32*)src, dst, size);
+  case sample_format::float64:
+    return mts::dsp::convert((const Float64*)src, dst, size);
+  case sample_format::int16:
+    return mts::dsp::convert((const SInt16*)src, dst, size);
+  case sample_format::int24:
+    return mts::dsp::convert((const mts::dsp::int24*)src, dst, size);
+  case sample_format::int32:
+    return mts::dsp::convert((const SInt32*)src, dst, size);
+  }
+}
+
+/// Convert `size` floating points to an IO buffer in `format`.
+/// The dither is only used for the 16 and 24 bits formats, a float has fewer bits than an int32.
+template <typename T>
+inline void convert_to_format(
+    const T* src, void* dst, sample_format format, size_t size, mts::dsp::tpdf_dither* dither) {
+  switch (format) {
+  case sample_format::float32:
+    return mts::dsp::convert(src, (Float32*)dst, size);
+  case sample_format::float64:
+    return mts::dsp::convert(src, (Float64*)dst, size);
+  case sample_format::int16:
+    return mts::dsp::convert(src, (SInt16*)dst, size, dither);
+  case sample_format::int24:
+    return mts::dsp::convert(src, (mts::dsp::int24*)dst, size, dither);
+  case sample_format::int32:
+    return mts::dsp::convert(src, (SInt32*)dst, size);
+  }
+}
+} // namespace mts.
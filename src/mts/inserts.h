@@ -0,0 +1,271 @@
+#pragma once
+#include "mts/platform.h"
+#include "mts/util.h"
+#include "mts/filters.h"
+#include "mts/limiter.h"
+#include "mts/convolver.h"
+#include <atomic>
+
+namespace mts {
+/// Nodes of an insert_chain, always processed in this order.
+enum class insert_node : UInt8 { high_pass, eq, convolution, limiter };
+inline constexpr UInt32 insert_node_count = 4;
+
+inline constexpr UInt32 insert_eq_band_count = 4;
+
+/// Longest lookahead of the limiter in frames, its delay line is preallocated.
+inline constexpr UInt32 insert_max_lookahead = 1024;
+
+struct insert_eq_band {
+  dsp::biquad_type type = dsp::biquad_type::peak;
+  Float32 frequency = 1000;
+  Float32 gain_db = 0;
+  Float32 q = 0.707f;
+};
+
+/// Parameters of an insert_chain. A disabled node costs nothing, the EQ is disabled without bands.
+struct insert_config {
+  bool has_high_pass = false;
+  Float32 high_pass_frequency = 20;
+
+  UInt32 eq_band_count = 0;
+  insert_eq_band eq_bands[insert_eq_band_count];
+
+  // Impulse response of the convolution, `impulse_frames` frames of `impulse_channels` interleaved
+  // channels (1 or Channels) at `impulse_sample_rate` (0 is the rate of the device). Not owned,
+  // only read by insert_chain::set(). The convolution is disabled without an impulse.
+  const Float32* impulse = nullptr;
+  UInt32 impulse_frames = 0;
+  UInt32 impulse_channels = 1;
+  Float64 impulse_sample_rate = 0;
+  UInt32 convolution_block_size = 256;
+  Float32 convolution_gain_db = 0;
+
+  bool has_limiter = false;
+  Float32 limiter_ceiling_db = -1;
+  Float32 limiter_release_ms = 50;
+  Float32 limiter_lookahead_ms = 1.5f;
+};
+
+/// An insert_config compiled for a sample rate, what the IO thread uses.
+struct insert_program {
+  bool has_high_pass = false;
+  dsp::biquad_coefficients high_pass;
+
+  UInt32 eq_band_count = 0;
+  dsp::biquad_coefficients eq_bands[insert_eq_band_count];
+
+  // Owned by the program, see insert_chain::set().
+  dsp::partitioned_convolver* convolution = nullptr;
+
+  bool has_limiter = false;
+  Float64 limiter_ceiling = 1;
+  Float64 limiter_release = 0;
+  UInt32 limiter_lookahead = 0;
+};
+
+/// The frequencies are kept below Nyquist and the lookahead below insert_max_lookahead. The
+/// convolution is left to insert_chain::set().
+inline insert_program compile_inserts(const insert_config& config, Float64 sample_rate) noexcept {
+  const Float64 max_frequency = 0.45 * sample_rate;
+  insert_program p;
+
+  p.has_high_pass = config.has_high_pass;
+  p.high_pass = dsp::make_biquad(dsp::biquad_type::high_pass, sample_rate,
+      mts::clamp<Float64>(config.high_pass_frequency, 1, max_frequency), M_SQRT1_2, 0);
+
+  p.eq_band_count = mts::min(config.eq_band_count, insert_eq_band_count);
+
+  for (UInt32 i = 0; i < p.eq_band_count; i++) {
+    const insert_eq_band& band = config.eq_bands[i];
+    p.eq_bands[i] = dsp::make_biquad(band.type, sample_rate, mts::clamp<Float64>(band.frequency, 1, max_frequency),
+        mts::max<Float64>(band.q, 0.01), band.gain_db);
+  }
+
+  p.has_limiter = config.has_limiter;
+  p.limiter_ceiling = mts::decibel_to_amplitude((Float64)mts::min(config.limiter_ceiling_db, 0.0f));
+  p.limiter_release = exp(-1.0 / (mts::max<Float64>(config.limiter_release_ms, 1) * 0.001 * sample_rate));
+  p.limiter_lookahead = (UInt32)mts::clamp<Float64>(
+      round(config.limiter_lookahead_ms * 0.001 * sample_rate), 0, insert_max_lookahead);
+  return p;
+}
+
+/// Time spent in a node, in host ticks.
+struct insert_cost {
+  std::atomic<UInt64> calls{ 0 };
+  std::atomic<UInt64> ticks{ 0 };
+  std::atomic<UInt64> worst_ticks{ 0 };
+
+  inline void add(UInt64 value) noexcept {
+    calls.store(calls.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    ticks.store(ticks.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+
+    if (value > worst_ticks.load(std::memory_order_relaxed)) {
+      worst_ticks.store(value, std::memory_order_relaxed);
+    }
+  }
+};
+
+/// Chain of DSP nodes applied by the IO thread: high-pass, EQ, convolution and true peak limiter.
+///
+/// The topology is fixed, a program only enables nodes and sets their coefficients. Programs are
+/// set by a single thread at a time and the IO thread swaps to the last one at the start of
+/// process(), whatever the number of programs set since, a node keeps its state unless it was
+/// disabled. The filters ramp to their new
+/// coefficients, an enabled or disabled filter fades from or to a pass-through. The convolution
+/// delays the output by its block size and the limiter by its lookahead. Each node measures the
+/// time it takes.
+///
+/// The programs are a triple buffer: the IO thread uses one, set() writes another and they swap
+/// through the third. Everything is preallocated except the convolution, which set() allocates
+/// with its program. set() also frees the convolution of the program it gets back, one the IO
+/// thread dropped or never took, so the IO thread never allocates or frees and at most one
+/// program waits with its convolution.
+template <typename T, UInt32 Channels>
+class insert_chain {
+public:
+  /// Duration of the coefficient ramps of the filters.
+  static constexpr UInt32 smoothing_frames = 512;
+
+  /// Compiles `config` for the IO thread, it replaces a program the IO thread didn't take yet.
+  /// Allocates, must only be called from one thread at a time and not from the IO thread. Fails
+  /// when the impulse response is invalid, the convolution is then disabled.
+  inline bool set(const insert_config& config, Float64 sample_rate) {
+    insert_program& program = m_programs[m_back];
+    program = compile_inserts(config, sample_rate);
+    bool is_valid = true;
+
+    if (config.impulse && config.impulse_frames) {
+      program.convolution = dsp::partitioned_convolver::create(config.impulse, config.impulse_frames,
+          config.impulse_channels, Channels, config.impulse_sample_rate, sample_rate, config.convolution_block_size,
+          mts::decibel_to_amplitude(config.convolution_gain_db));
+      is_valid = program.convolution != nullptr;
+    }
+
+    m_set_latency = (program.convolution ? program.convolution->get_latency() : 0)
+        + (program.has_limiter ? mts::min(program.limiter_lookahead, insert_max_lookahead) + dsp::true_peak_delay : 0);
+
+    m_back = m_middle.exchange(m_back | is_fresh, std::memory_order_acq_rel) & ~is_fresh;
+    dsp::partitioned_convolver::destroy(m_programs[m_back].convolution);
+    m_programs[m_back].convolution = nullptr;
+    return is_valid;
+  }
+
+  /// Nothing to do and nothing pending. Must only be called from the IO thread.
+  inline bool is_bypassed() const noexcept {
+    return !m_high_pass.is_active() && !m_eq.is_active() && !m_programs[m_front].convolution
+        && !m_programs[m_front].has_limiter && !(m_middle.load(std::memory_order_relaxed) & is_fresh);
+  }
+
+  /// Must only be called from the IO thread, or while it is stopped.
+  inline void reset() noexcept {
+    m_high_pass.reset();
+    m_eq.reset();
+    m_limiter.reset();
+
+    if (m_programs[m_front].convolution) {
+      m_programs[m_front].convolution->reset();
+    }
+  }
+
+  inline const insert_cost& get_cost(insert_node node) const noexcept { return m_costs[(UInt32)node]; }
+
+  /// Delay of the output in frames once the IO thread takes the last program set. Must only be
+  /// called from the thread that sets the programs.
+  inline UInt32 get_set_latency() const noexcept { return m_set_latency; }
+
+  /// Delay of the output in frames. Must only be called from the IO thread.
+  inline UInt32 get_latency() const noexcept {
+    const insert_program& program = m_programs[m_front];
+    return (program.convolution ? program.convolution->get_latency() : 0)
+        + (program.has_limiter ? m_limiter.get_latency() : 0);
+  }
+
+  /// Only delays through the convolution, see partitioned_convolver::process(). Must only be
+  /// called from the IO thread, or while it is stopped.
+  inline void set_convolution_bypassed(bool is_bypassed) noexcept { m_is_convolution_bypassed = is_bypassed; }
+
+  /// Largest gain reduction of the limiter in dB since the last call, 0 is no reduction.
+  inline Float32 take_limiter_reduction() noexcept {
+    return m_limiter_reduction.exchange(0, std::memory_order_relaxed);
+  }
+
+  /// Sample f of channel c is at buffer[f * frame_stride + c * channel_stride].
+  inline void process(T* buffer, UInt32 frames, size_t frame_stride, size_t channel_stride) noexcept {
+    update();
+    const insert_program& program = m_programs[m_front];
+
+    if (m_high_pass.is_active()) {
+      const UInt64 start = mach_absolute_time();
+      m_high_pass.process(buffer, frames, frame_stride, channel_stride);
+      m_costs[(UInt32)insert_node::high_pass].add(mach_absolute_time() - start);
+    }
+
+    if (m_eq.is_active()) {
+      const UInt64 start = mach_absolute_time();
+      m_eq.process(buffer, frames, frame_stride, channel_stride);
+      m_costs[(UInt32)insert_node::eq].add(mach_absolute_time() - start);
+    }
+
+    if (program.convolution) {
+      const UInt64 start = mach_absolute_time();
+      program.convolution->process(buffer, frames, frame_stride, channel_stride, m_is_convolution_bypassed);
+      m_costs[(UInt32)insert_node::convolution].add(mach_absolute_time() - start);
+    }
+
+    if (program.has_limiter) {
+      const UInt64 start = mach_absolute_time();
+      m_limiter.process(buffer, frames, frame_stride, channel_stride);
+      m_costs[(UInt32)insert_node::limiter].add(mach_absolute_time() - start);
+
+      const Float32 reduction = -mts::amplitude_to_decibel((Float32)m_limiter.get_gain());
+
+      if (reduction > m_limiter_reduction.load(std::memory_order_relaxed)) {
+        m_limiter_reduction.store(reduction, std::memory_order_relaxed);
+      }
+    }
+  }
+
+private:
+  // Marks a middle program the IO thread didn't take.
+  static constexpr UInt32 is_fresh = 4;
+
+  // The IO thread uses m_programs[m_front] and set() writes m_programs[m_back], they swap through
+  // the middle one. The three indices are always different.
+  insert_program m_programs[3];
+  UInt32 m_front = 0;
+  UInt32 m_back = 1;
+  std::atomic<UInt32> m_middle{ 2 };
+
+  // Only used by set().
+  UInt32 m_set_latency = 0;
+
+  dsp::biquad_cascade<T, Channels, 1> m_high_pass;
+  dsp::biquad_cascade<T, Channels, insert_eq_band_count> m_eq;
+  dsp::true_peak_limiter<T, Channels, insert_max_lookahead> m_limiter;
+
+  insert_cost m_costs[insert_node_count];
+  std::atomic<Float32> m_limiter_reduction{ 0 };
+  bool m_is_convolution_bypassed = false;
+
+  /// Takes the last program set, the previous one goes back to set().
+  inline void update() noexcept {
+    if (!(m_middle.load(std::memory_order_relaxed) & is_fresh)) {
+      return;
+    }
+
+    // set() may write the previous program as soon as it is swapped.
+    const bool had_limiter = m_programs[m_front].has_limiter;
+    m_front = m_middle.exchange(m_front, std::memory_order_acq_rel) & ~is_fresh;
+    const insert_program& program = m_programs[m_front];
+
+    if (program.has_limiter && !had_limiter) {
+      m_limiter.reset();
+    }
+
+    m_high_pass.set(&program.high_pass, program.has_high_pass ? 1 : 0, smoothing_frames);
+    m_eq.set(program.eq_bands, program.eq_band_count, smoothing_frames);
+    m_limiter.set((T)program.limiter_ceiling, (T)program.limiter_release, program.limiter_lookahead);
+  }
+};
+} // namespace mts.
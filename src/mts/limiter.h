@@ -0,0 +1,290 @@
+#pragma once
+#include "mts/platform.h"
+#include "mts/util.h"
+#include <math.h>
+#include <string.h>
+
+namespace mts::dsp {
+/// 4x interpolation filter of the true peak meter of ITU-R BS.1770-4 (Annex 2), 12 taps per
+/// phase. Each phase is in time order, the last tap goes with the newest sample.
+inline constexpr UInt32 true_peak_phases = 4;
+inline constexpr UInt32 true_peak_taps = 12;
+
+/// The interpolations of a frame fall between the samples 6 and 5 frames before it, a sample is
+/// between the interpolations of two frames.
+inline constexpr UInt32 true_peak_delay = true_peak_taps / 2;
+
+inline constexpr Float64 true_peak_coefficients[true_peak_phases][true_peak_taps] = {
+  { 0.0017089843750, 0.0109863281250, -0.0196533203125, 0.0332031250000, -0.0594482421875, 0.1373291015625,
+      0.9721679687500, -0.1022949218750, 0.0476074218750, -0.0266113281250, 0.0148925781250, -0.0083007812500 },
+  { -0.0291748046875, 0.0292968750000, -0.0517578125000, 0.0891113281250, -0.1665039062500, 0.4650878906250,
+      0.7797851562500, -0.2003173828125, 0.1015625000000, -0.0582275390625, 0.0330810546875, -0.0189208984375 },
+  { -0.0189208984375, 0.0330810546875, -0.0582275390625, 0.1015625000000, -0.2003173828125, 0.7797851562500,
+      0.4650878906250, -0.1665039062500, 0.0891113281250, -0.0517578125000, 0.0292968750000, -0.0291748046875 },
+  { -0.0083007812500, 0.0148925781250, -0.0266113281250, 0.0476074218750, -0.1022949218750, 0.9721679687500,
+      0.1373291015625, -0.0594482421875, 0.0332031250000, -0.0196533203125, 0.0109863281250, 0.0017089843750 },
+};
+
+/// Brickwall limiter on the true peak of the channels, with a lookahead delay.
+///
+/// Detection: each frame is interpolated 4 times with the BS.1770 filter, the channels are lanes
+/// of 16 bytes vectors as in biquad_cascade. The peak of a frame is the largest magnitude of its
+/// samples and of their interpolations over every channel, known true_peak_delay frames later.
+///
+/// Gain computer: the gain a frame needs is ceiling / peak (vvsqrt, vDSP_svdiv and vDSP_vclip on
+/// a block). Its minimum over the lookahead window and one more frame is held (a monotonic queue),
+/// released exponentially towards 1 and averaged over the lookahead. Every gain in the average of
+/// a sample is at most the ones of the peaks around it, so no sample goes over the ceiling and the
+/// gain reaches it in a ramp of `lookahead` frames instead of a step. The output is delayed by `lookahead` frames plus
+/// the delay of the detection.
+///
+/// Everything is preallocated for MaxLookahead frames, process() is real-time safe.
+template <typename T, UInt32 Channels, UInt32 MaxLookahead>
+class true_peak_limiter {
+public:
+  typedef T vector __attribute__((vector_size(16)));
+
+  static constexpr UInt32 lanes = 16 / sizeof(T);
+  static constexpr UInt32 vector_count = (Channels + lanes - 1) / lanes;
+  static constexpr UInt32 block_size = 64;
+  static constexpr UInt32 max_lookahead = MaxLookahead;
+
+  inline true_peak_limiter() noexcept {
+    for (UInt32 p = 0; p < true_peak_phases; p++) {
+      for (UInt32 k = 0; k < true_peak_taps; k++) {
+        m_coefficients[p][k] = (T)true_peak_coefficients[p][k];
+      }
+    }
+
+    reset();
+  }
+
+  /// `release` is the factor of the distance to a gain of one per frame. A new lookahead starts
+  /// the delay again from silence.
+  inline void set(T ceiling, T release, UInt32 lookahead) noexcept {
+    m_ceiling = ceiling;
+    m_release = release;
+    lookahead = mts::min(lookahead, MaxLookahead);
+
+    if (lookahead != m_lookahead) {
+      m_lookahead = lookahead;
+      reset();
+    }
+  }
+
+  /// Delay of the output in frames.
+  inline UInt32 get_latency() const noexcept { return m_lookahead + true_peak_delay; }
+
+  /// Smallest gain of the last call, 1 is no reduction.
+  inline T get_gain() const noexcept { return m_gain; }
+
+  inline void reset() noexcept {
+    memset(m_history, 0, sizeof(m_history));
+    memset(m_delay, 0, sizeof(m_delay));
+    m_history_index = 0;
+    m_delay_index = 0;
+
+    m_queue_head = 0;
+    m_queue_size = 0;
+    m_frame = 0;
+    m_envelope = 1;
+
+    for (UInt32 i = 0; i < MaxLookahead; i++) {
+      m_window[i] = 1;
+    }
+
+    m_window_index = 0;
+    m_window_sum = m_lookahead;
+    m_gain = 1;
+  }
+
+  /// Sample f of channel c is at buffer[f * frame_stride + c * channel_stride].
+  inline void process(T* buffer, UInt32 frames, size_t frame_stride, size_t channel_stride) noexcept {
+    T gains[block_size];
+    T min_gain = 1;
+
+    for (UInt32 offset = 0; offset < frames; offset += block_size) {
+      const UInt32 count = mts::min(block_size, frames - offset);
+      T* block = buffer + offset * frame_stride;
+
+      detect(block, count, frame_stride, channel_stride, gains);
+      compute_gains(gains, count);
+      min_gain = mts::min(min_gain, apply(block, count, frame_stride, channel_stride, gains));
+    }
+
+    m_gain = min_gain;
+  }
+
+private:
+  T m_coefficients[true_peak_phases][true_peak_taps];
+  T m_ceiling = 1;
+  T m_release = 0;
+  UInt32 m_lookahead = 0;
+
+  // Input of the interpolation filter, stored twice in a row so that the last taps are contiguous.
+  vector m_history[2 * true_peak_taps][vector_count];
+  UInt32 m_history_index = 0;
+
+  // Delay line of get_latency() frames, interleaved.
+  T m_delay[(MaxLookahead + true_peak_delay) * Channels];
+  UInt32 m_delay_index = 0;
+
+  // Gains of the frames of the lookahead window in increasing order, the front is the minimum.
+  static constexpr UInt32 queue_capacity = MaxLookahead + 2;
+  T m_queue_gains[queue_capacity];
+  UInt32 m_queue_frames[queue_capacity];
+  UInt32 m_queue_head = 0;
+  UInt32 m_queue_size = 0;
+  UInt32 m_frame = 0;
+
+  T m_envelope = 1;
+
+  // The last m_lookahead envelopes and their sum.
+  T m_window[MaxLookahead ? MaxLookahead : 1];
+  UInt32 m_window_index = 0;
+  Float64 m_window_sum = 0;
+
+  T m_gain = 1;
+
+  /// Writes the gain each frame needs to `gains`.
+  inline void detect(const T* block, UInt32 frames, size_t frame_stride, size_t channel_stride, T* gains) noexcept {
+    for (UInt32 f = 0; f < frames; f++) {
+      const T* frame = block + f * frame_stride;
+      m_history_index = m_history_index + 1 == true_peak_taps ? 0 : m_history_index + 1;
+      T peak = 0;
+
+      for (UInt32 v = 0; v < vector_count; v++) {
+        const UInt32 first = v * lanes;
+        const UInt32 width = mts::min(lanes, Channels - first);
+        vector x = {};
+
+        if (channel_stride == 1) {
+          memcpy(&x, frame + first, width * sizeof(T));
+        }
+        else {
+          for (UInt32 l = 0; l < width; l++) {
+            x[l] = frame[(first + l) * channel_stride];
+          }
+        }
+
+        m_history[m_history_index][v] = x;
+        m_history[m_history_index + true_peak_taps][v] = x;
+
+        // The window is the last true_peak_taps frames in time order.
+        const UInt32 start = m_history_index + 1;
+        const vector sample = m_history[start + true_peak_taps - true_peak_delay][v];
+        vector squares = sample * sample;
+
+        for (UInt32 p = 0; p < true_peak_phases; p++) {
+          vector sum = {};
+
+          for (UInt32 k = 0; k < true_peak_taps; k++) {
+            sum += m_coefficients[p][k] * m_history[start + k][v];
+          }
+
+          sum *= sum;
+
+          for (UInt32 l = 0; l < lanes; l++) {
+            squares[l] = mts::max(squares[l], sum[l]);
+          }
+        }
+
+        for (UInt32 l = 0; l < lanes; l++) {
+          peak = mts::max(peak, squares[l]);
+        }
+      }
+
+      gains[f] = peak;
+    }
+
+    // gain = min(ceiling / peak, 1), a silent frame divides by 0 and is clipped to 1.
+    const int n = (int)frames;
+    const T low = 0;
+    const T high = 1;
+
+    if constexpr (sizeof(T) == 4) {
+      vvsqrtf(gains, gains, &n);
+      vDSP_svdiv(&m_ceiling, gains, 1, gains, 1, frames);
+      vDSP_vclip(gains, 1, &low, &high, gains, 1, frames);
+    }
+    else {
+      vvsqrt(gains, gains, &n);
+      vDSP_svdivD(&m_ceiling, gains, 1, gains, 1, frames);
+      vDSP_vclipD(gains, 1, &low, &high, gains, 1, frames);
+    }
+  }
+
+  /// Turns the gains each frame needs into the gains of the delayed frames, in place.
+  inline void compute_gains(T* gains, UInt32 frames) noexcept {
+    for (UInt32 f = 0; f < frames; f++, m_frame++) {
+      const T needed = gains[f];
+
+      if (m_queue_size && m_frame - m_queue_frames[m_queue_head] >= m_lookahead + 2) {
+        m_queue_head = (m_queue_head + 1) % queue_capacity;
+        m_queue_size--;
+      }
+
+      while (m_queue_size && m_queue_gains[(m_queue_head + m_queue_size - 1) % queue_capacity] >= needed) {
+        m_queue_size--;
+      }
+
+      const UInt32 back = (m_queue_head + m_queue_size++) % queue_capacity;
+      m_queue_gains[back] = needed;
+      m_queue_frames[back] = m_frame;
+
+      m_envelope = mts::min(m_queue_gains[m_queue_head], 1 - (1 - m_envelope) * m_release);
+
+      if (m_lookahead) {
+        m_window_sum += m_envelope - m_window[m_window_index];
+        m_window[m_window_index] = m_envelope;
+        m_window_index = m_window_index + 1 == m_lookahead ? 0 : m_window_index + 1;
+        gains[f] = mts::min((T)(m_window_sum / m_lookahead), (T)1);
+      }
+      else {
+        gains[f] = m_envelope;
+      }
+    }
+  }
+
+  /// Delays the frames and applies the gains, returns the smallest one.
+  inline T apply(T* block, UInt32 frames, size_t frame_stride, size_t channel_stride, const T* gains) noexcept {
+    const UInt32 length = get_latency();
+
+    for (UInt32 f = 0; f < frames; f++) {
+      T* frame = block + f * frame_stride;
+      T* delayed = m_delay + (size_t)m_delay_index * Channels;
+
+      for (UInt32 c = 0; c < Channels; c++) {
+        const T x = frame[c * channel_stride];
+        frame[c * channel_stride] = delayed[c];
+        delayed[c] = x;
+      }
+
+      m_delay_index = m_delay_index + 1 == length ? 0 : m_delay_index + 1;
+    }
+
+    T min_gain = 1;
+
+    for (UInt32 f = 0; f < frames; f++) {
+      min_gain = mts::min(min_gain, gains[f]);
+    }
+
+    if (min_gain == 1) {
+      return min_gain;
+    }
+
+    for (UInt32 c = 0; c < Channels; c++) {
+      T* channel = block + c * channel_stride;
+
+      if constexpr (sizeof(T) == 4) {
+        vDSP_vmul(channel, frame_stride, gains, 1, channel, frame_stride, frames);
+      }
+      else {
+        vDSP_vmulD(channel, frame_stride, gains, 1, channel, frame_stride, frames);
+      }
+    }
+
+    return min_gain;
+  }
+};
+} // namespace mts::dsp.
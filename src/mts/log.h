@@ -0,0 +1,305 @@
+#pragma once
+#include <CoreAudio/AudioServerPlugIn.h>
+#include "mts/util.h"
+#include <atomic>
+#include <mach/mach_time.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/syslog.h>
+#include <type_traits>
+#include <unistd.h>
+
+namespace mts::log {
+inline constexpr UInt32 max_arguments = 4;
+inline constexpr UInt32 ring_capacity = 256;
+inline constexpr UInt32 ring_mask = ring_capacity - 1;
+inline constexpr useconds_t drain_interval_us = 20000;
+
+/// What an argument was before it was widened to 64 bits, none for a missing one.
+enum class argument_kind : UInt8 { none, integer, pointer };
+
+/// A log record is captured on the calling thread and formatted later on the drain thread.
+/// The format must be a string literal and every argument is widened to 64 bits. emit() casts
+/// each one back to the type its conversion asks for, so any integer conversion can be used with
+/// any integer argument; %s and %p need a pointer.
+struct record {
+  const char* format = nullptr;
+  UInt64 host_time = 0;
+  UInt64 args[max_arguments] = {};
+  argument_kind kinds[max_arguments] = {};
+};
+
+/// Fixed size multiple producer, single consumer ring of log records.
+///
+/// Each slot carries a turn counter that is zero initialized so that the ring can be a constant
+/// initialized global: for the n-th lap around the ring, a slot is writable when its turn is
+/// 2n and readable when it is 2n + 1. Producers never wait, a full ring drops the record and
+/// bumps the drop counter instead.
+class ring {
+public:
+  inline bool push(const record& r) noexcept {
+    UInt64 pos = m_head.load(std::memory_order_relaxed);
+
+    for (;;) {
+      slot& s = m_slots[pos & ring_mask];
+      const UInt64 lap = pos / ring_capacity;
+      const UInt64 turn = s.turn.load(std::memory_order_acquire);
+
+      if (turn == 2 * lap) {
+        if (m_head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+          s.rec = r;
+          s.turn.store(2 * lap + 1, std::memory_order_release);
+          return true;
+        }
+      }
+      else if (turn < 2 * lap) {
+        // The consumer hasn't caught up with this slot yet.
+        m_dropped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+      }
+      else {
+        pos = m_head.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  /// Must only be called from the drain thread.
+  inline bool pop(record& r) noexcept {
+    const UInt64 pos = m_tail.load(std::memory_order_relaxed);
+    slot& s = m_slots[pos & ring_mask];
+    const UInt64 lap = pos / ring_capacity;
+
+    if (s.turn.load(std::memory_order_acquire) != 2 * lap + 1) {
+      return false;
+    }
+
+    r = s.rec;
+    s.turn.store(2 * lap + 2, std::memory_order_release);
+    m_tail.store(pos + 1, std::memory_order_relaxed);
+    return true;
+  }
+
+  inline UInt64 take_dropped() noexcept { return m_dropped.exchange(0, std::memory_order_relaxed); }
+
+private:
+  struct slot {
+    std::atomic<UInt64> turn{ 0 };
+    record rec;
+  };
+
+  slot m_slots[ring_capacity];
+  alignas(64) std::atomic<UInt64> m_head{ 0 };
+  alignas(64) std::atomic<UInt64> m_tail{ 0 };
+  alignas(64) std::atomic<UInt64> m_dropped{ 0 };
+};
+
+// Constant initialized, no static constructor is generated for this.
+inline ring g_ring;
+inline std::atomic<bool> g_drain_started{ false };
+
+template <typename T>
+inline UInt64 to_argument(T value) noexcept {
+  if constexpr (std::is_pointer_v<T>) {
+    return static_cast<UInt64>(reinterpret_cast<uintptr_t>(value));
+  }
+  else {
+    static_assert(std::is_integral_v<T> || std::is_enum_v<T>, "only integral and pointer arguments can be logged");
+    return static_cast<UInt64>(static_cast<SInt64>(value));
+  }
+}
+
+template <typename T>
+inline constexpr argument_kind get_argument_kind() noexcept {
+  return std::is_pointer_v<T> ? argument_kind::pointer : argument_kind::integer;
+}
+
+/// Capture a log record. This is real-time safe: it never blocks, allocates or formats.
+template <typename... Args>
+inline bool post(const char* format, Args... args) noexcept {
+  static_assert(sizeof...(Args) <= max_arguments, "too many log arguments");
+
+  record r;
+  r.format = format;
+  r.host_time = mach_absolute_time();
+
+  UInt32 i = 0;
+  ((r.args[i] = to_argument(args), r.kinds[i++] = get_argument_kind<Args>()), ...);
+  (void)i;
+
+  return g_ring.push(r);
+}
+
+/// Length modifier of a conversion.
+enum class length_modifier : UInt8 { none, hh, h, l, ll, j, z, t };
+
+/// Formats `value` with the single conversion `spec` (from the % to the conversion character),
+/// cast to the type that the conversion and its length modifier read.
+inline int format_argument(char* out, size_t size, const char* spec, UInt64 value, argument_kind kind) noexcept {
+  const size_t length = strlen(spec);
+  const char conversion = spec[length - 1];
+  const char* modifier = spec + strcspn(spec, "hljzt");
+  length_modifier m = length_modifier::none;
+
+  switch (*modifier) {
+  case 'h':
+    m = modifier[1] == 'h' ? length_modifier::hh : length_modifier::h;
+    break;
+  case 'l':
+    m = modifier[1] == 'l' ? length_modifier::ll : length_modifier::l;
+    break;
+  case 'j':
+    m = length_modifier::j;
+    break;
+  case 'z':
+    m = length_modifier::z;
+    break;
+  case 't':
+    m = length_modifier::t;
+    break;
+  }
+
+  if (kind == argument_kind::none) {
+    return snprintf(out, size, "%s", "(missing)");
+  }
+
+  switch (conversion) {
+  case 'd':
+  case 'i':
+    switch (m) {
+    case length_modifier::l:
+      return snprintf(out, size, spec, (long)value);
+    case length_modifier::ll:
+      return snprintf(out, size, spec, (long long)value);
+    case length_modifier::j:
+      return snprintf(out, size, spec, (intmax_t)value);
+    case length_modifier::z:
+      return snprintf(out, size, spec, (std::make_signed_t<size_t>)value);
+    case length_modifier::t:
+      return snprintf(out, size, spec, (ptrdiff_t)value);
+    default:
+      return snprintf(out, size, spec, (int)value);
+    }
+
+  case 'u':
+  case 'o':
+  case 'x':
+  case 'X':
+    switch (m) {
+    case length_modifier::l:
+      return snprintf(out, size, spec, (unsigned long)value);
+    case length_modifier::ll:
+      return snprintf(out, size, spec, (unsigned long long)value);
+    case length_modifier::j:
+      return snprintf(out, size, spec, (uintmax_t)value);
+    case length_modifier::z:
+      return snprintf(out, size, spec, (size_t)value);
+    case length_modifier::t:
+      return snprintf(out, size, spec, (std::make_unsigned_t<ptrdiff_t>)value);
+    default:
+      return snprintf(out, size, spec, (unsigned int)value);
+    }
+
+  case 'c':
+    return snprintf(out, size, spec, (int)value);
+
+  case 's':
+  case 'p':
+    if (kind == argument_kind::pointer && m == length_modifier::none) {
+      return conversion == 's' ? snprintf(out, size, spec, value ? (const char*)(uintptr_t)value : "(null)")
+                               : snprintf(out, size, spec, (void*)(uintptr_t)value);
+    }
+    break;
+  }
+
+  return snprintf(out, size, "%s", "(bad conversion)");
+}
+
+/// Formats a record one conversion at a time, every argument with its own type.
+inline void format(const record& r, char* buffer, size_t size) noexcept {
+  const char* p = r.format;
+  size_t length = 0;
+  UInt32 argument = 0;
+
+  while (*p && length + 1 < size) {
+    if (p[0] != '%' || p[1] == '%') {
+      buffer[length++] = *p;
+      p += p[0] == '%' ? 2 : 1;
+      continue;
+    }
+
+    // The conversion runs from the % to the first character that isn't a flag, a width, a
+    // precision or a length modifier.
+    char spec[16];
+    size_t spec_length = 0;
+    spec[spec_length++] = *p++;
+
+    while (*p && strchr("-+ #0123456789.hljzt", *p) && spec_length + 2 < sizeof(spec)) {
+      spec[spec_length++] = *p++;
+    }
+
+    if (!*p) {
+      break;
+    }
+
+    spec[spec_length++] = *p++;
+    spec[spec_length] = 0;
+
+    const bool is_valid = argument < max_arguments;
+    const int written = format_argument(buffer + length, size - length, spec, is_valid ? r.args[argument] : 0,
+        is_valid ? r.kinds[argument] : argument_kind::none);
+    argument++;
+
+    if (written > 0) {
+      length = mts::min(length + (size_t)written, size - 1);
+    }
+  }
+
+  buffer[length] = 0;
+}
+
+inline void emit(const record& r) noexcept {
+  char buffer[512];
+  format(r, buffer, sizeof(buffer));
+  syslog(LOG_NOTICE, "%s [host time %llu]", buffer, (unsigned long long)r.host_time);
+}
+
+inline void* drain(void*) {
+  record r;
+
+  for (;;) {
+    while (g_ring.pop(r)) {
+      emit(r);
+    }
+
+    if (UInt64 dropped = g_ring.take_dropped()) {
+      syslog(LOG_WARNING, "MTS_DRIVER: %llu log records dropped", (unsigned long long)dropped);
+    }
+
+    usleep(drain_interval_us);
+  }
+
+  return nullptr;
+}
+
+/// Start the background thread that formats and emits the records.
+/// Records posted before this is called are kept in the ring until the thread starts.
+inline void start() {
+  if (g_drain_started.exchange(true)) {
+    return;
+  }
+
+  pthread_t thread;
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+  if (pthread_create(&thread, &attr, &drain, nullptr) != 0) {
+    g_drain_started = false;
+  }
+
+  pthread_attr_destroy(&attr);
+}
+} // namespace mts::log.
@@ -0,0 +1,421 @@
+#pragma once
+#include <CoreAudio/AudioServerPlugIn.h>
+#include "mts/util.h"
+#include "mts/filters.h"
+#include "mts/automation.h"
+#include "mts/downmix.h"
+#include <Accelerate/Accelerate.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <atomic>
+#include <math.h>
+#include <string.h>
+
+namespace mts {
+/// Loudness measured by ITU-R BS.1770-4 and EBU R128, in LUFS. The IO thread filters the frames
+/// and sums their squares over steps of 100 ms, a background thread gates and integrates the steps.
+inline constexpr UInt32 loudness_step_ms = 100;
+
+/// A loudness that isn't known yet, or below the absolute gate.
+inline constexpr Float32 loudness_none = -HUGE_VALF;
+
+inline Float64 energy_to_lufs(Float64 energy) noexcept { return -0.691 + 10 * log10(energy); }
+inline Float64 lufs_to_energy(Float64 lufs) noexcept { return pow(10.0, (lufs + 0.691) / 10); }
+
+/// The K-weighting of BS.1770: a high shelf for the effect of the head and the RLB high-pass. The
+/// analog prototypes are transformed for the sample rate, at 48 kHz these are the coefficients of
+/// the standard.
+inline void make_k_weighting(Float64 sample_rate, dsp::biquad_coefficients (&c)[2]) noexcept {
+  Float64 k = tan(M_PI * 1681.974450955533 / sample_rate);
+  Float64 q = 0.7071752369554196;
+  const Float64 vh = pow(10.0, 3.999843853973347 / 20);
+  const Float64 vb = pow(vh, 0.4996667741545416);
+  Float64 a0 = 1 + k / q + k * k;
+
+  c[0].b0 = (vh + vb * k / q + k * k) / a0;
+  c[0].b1 = 2 * (k * k - vh) / a0;
+  c[0].b2 = (vh - vb * k / q + k * k) / a0;
+  c[0].a1 = 2 * (k * k - 1) / a0;
+  c[0].a2 = (1 - k / q + k * k) / a0;
+
+  k = tan(M_PI * 38.13547087602444 / sample_rate);
+  q = 0.5003270373238773;
+  a0 = 1 + k / q + k * k;
+
+  c[1].b0 = 1;
+  c[1].b1 = -2;
+  c[1].b2 = 1;
+  c[1].a1 = 2 * (k * k - 1) / a0;
+  c[1].a2 = (1 - k / q + k * k) / a0;
+}
+
+/// Weight of a channel in the sum of BS.1770: 1.41 (+1.5 dB) for the surrounds, 0 for the LFE and 1
+/// for the other channels, discrete ones included.
+inline Float64 get_loudness_weight(AudioChannelLabel label) noexcept {
+  switch (label) {
+  case kAudioChannelLabel_LFEScreen:
+    return 0;
+  case kAudioChannelLabel_LeftSurround:
+  case kAudioChannelLabel_RightSurround:
+  case kAudioChannelLabel_RearSurroundLeft:
+  case kAudioChannelLabel_RearSurroundRight:
+    return 1.41;
+  default:
+    return 1;
+  }
+}
+
+/// The IO side of the loudness of a stream: the K-weighting and the weighted mean square of each
+/// step, and the gain the monitor asks for. The weights come from the channel layout, every
+/// channel has a weight of 1 until set_layout(). Real-time safe, except set_sample_rate().
+template <typename T, UInt32 Channels>
+class loudness_meter {
+public:
+  static constexpr UInt32 block_size = 64;
+
+  /// Must be called while IO is stopped.
+  inline void set_sample_rate(Float64 sample_rate) noexcept {
+    dsp::biquad_coefficients c[2];
+    make_k_weighting(sample_rate, c);
+
+    m_filter.set(c, 2, 0);
+    m_step_frames = (UInt32)round(sample_rate * loudness_step_ms / 1000);
+    reset();
+  }
+
+  /// Weights the channels by their label in `tag`. Must be called while IO is stopped.
+  inline void set_layout(AudioChannelLayoutTag tag) noexcept {
+    m_is_weighted = false;
+
+    for (UInt32 c = 0; c < Channels; c++) {
+      m_weights[c] = (T)get_loudness_weight(get_channel_label(tag, c));
+      m_is_weighted = m_is_weighted || m_weights[c] != 1;
+    }
+  }
+
+  inline void reset() noexcept {
+    m_filter.reset();
+    m_sum = 0;
+    m_frames = 0;
+  }
+
+  /// Calls `fct(Float64 energy)` with the mean square of each step that ends in the buffer.
+  /// Sample f of channel c is at buffer[f * frame_stride + c * channel_stride].
+  template <typename Fct>
+  inline void process(const T* buffer, UInt32 frames, size_t frame_stride, size_t channel_stride, Fct&& fct) noexcept {
+    T block[block_size * Channels];
+
+    for (UInt32 offset = 0; offset < frames;) {
+      const UInt32 count = mts::min(mts::min(block_size, frames - offset), m_step_frames - m_frames);
+      const T* frame = buffer + offset * frame_stride;
+
+      for (UInt32 f = 0; f < count; f++) {
+        for (UInt32 c = 0; c < Channels; c++) {
+          block[f * Channels + c] = frame[f * frame_stride + c * channel_stride];
+        }
+      }
+
+      m_filter.process(block, count, Channels, 1);
+
+      m_sum += m_is_weighted ? get_weighted_sum(block, count) : get_sum(block, count * Channels, 1);
+      m_frames += count;
+      offset += count;
+
+      if (m_frames == m_step_frames) {
+        fct(m_sum / m_step_frames);
+        m_sum = 0;
+        m_frames = 0;
+      }
+    }
+  }
+
+  /// Nothing to apply for this gain.
+  inline bool is_unity(T gain) const noexcept { return gain == 1 && m_gain == 1; }
+
+  /// Applies `gain` with a ramp from the last one over the buffer.
+  inline void apply_gain(T* buffer, UInt32 frames, size_t frame_stride, size_t channel_stride, T gain) noexcept {
+    const T step = (gain - m_gain) / frames;
+
+    for (UInt32 c = 0; c < Channels; c++) {
+      T* channel = buffer + c * channel_stride;
+      T start = m_gain;
+
+      if constexpr (sizeof(T) == 4) {
+        vDSP_vrampmul(channel, frame_stride, &start, &step, channel, frame_stride, frames);
+      }
+      else {
+        vDSP_vrampmulD(channel, frame_stride, &start, &step, channel, frame_stride, frames);
+      }
+    }
+
+    m_gain = gain;
+  }
+
+private:
+  dsp::biquad_cascade<T, Channels, 2> m_filter;
+  T m_weights[Channels];
+  bool m_is_weighted = false;
+  UInt32 m_step_frames = 4800;
+  UInt32 m_frames = 0;
+  Float64 m_sum = 0;
+  T m_gain = 1;
+
+  /// Sum of the squares of `count` samples `stride` apart.
+  static inline T get_sum(const T* samples, UInt32 count, UInt32 stride) noexcept {
+    T sum;
+
+    if constexpr (sizeof(T) == 4) {
+      vDSP_svesq(samples, stride, &sum, count);
+    }
+    else {
+      vDSP_svesqD(samples, stride, &sum, count);
+    }
+
+    return sum;
+  }
+
+  /// Sum of the squares of the interleaved frames of `block`, scaled by the weight of their channel.
+  inline Float64 get_weighted_sum(const T* block, UInt32 frames) const noexcept {
+    Float64 sum = 0;
+
+    for (UInt32 c = 0; c < Channels; c++) {
+      if (m_weights[c] != 0) {
+        sum += m_weights[c] * get_sum(block + c, frames, Channels);
+      }
+    }
+
+    return sum;
+  }
+};
+
+/// Momentary (400 ms), short-term (3 s) and integrated loudness of a sequence of steps.
+///
+/// Every step ends a gating block of 400 ms, the blocks overlap by 75%. The integrated loudness is
+/// gated at -70 LUFS and then 10 LU below the loudness of the blocks above that. The blocks are
+/// summed in a histogram of 0.1 LU bins so the memory doesn't grow with the duration, the relative
+/// gate is rounded down to a bin. A block louder than the last bin counts in it.
+class loudness_integrator {
+public:
+  static constexpr UInt32 momentary_steps = 4;
+  static constexpr UInt32 short_term_steps = 30;
+  static constexpr Float64 absolute_gate = -70;
+  static constexpr Float64 relative_gate = -10;
+  static constexpr Float64 bin_width = 0.1;
+  static constexpr UInt32 bin_count = 800;
+
+  inline void reset() noexcept {
+    m_step_count = 0;
+    m_step_index = 0;
+    m_block_count = 0;
+    memset(m_counts, 0, sizeof(m_counts));
+    memset(m_energies, 0, sizeof(m_energies));
+  }
+
+  inline void add(Float64 energy) noexcept {
+    m_steps[m_step_index] = energy;
+    m_step_index = (m_step_index + 1) % short_term_steps;
+    m_step_count = mts::min(m_step_count + 1, short_term_steps);
+
+    const Float64 momentary = get_momentary();
+
+    if (momentary >= absolute_gate) {
+      const UInt32 bin = get_bin(momentary);
+      m_counts[bin]++;
+      m_energies[bin] += lufs_to_energy(momentary);
+      m_block_count++;
+    }
+  }
+
+  inline Float64 get_momentary() const noexcept { return get_mean(momentary_steps); }
+  inline Float64 get_short_term() const noexcept { return get_mean(short_term_steps); }
+
+  inline Float64 get_integrated() const noexcept {
+    if (!m_block_count) {
+      return loudness_none;
+    }
+
+    // The bins below the relative gate are left out.
+    const Float64 gate = energy_to_lufs(get_energy(0)) + relative_gate;
+    const Float64 energy = get_energy(gate > absolute_gate ? get_bin(gate) : 0);
+    return energy > 0 ? energy_to_lufs(energy) : loudness_none;
+  }
+
+private:
+  Float64 m_steps[short_term_steps];
+  UInt32 m_step_index = 0;
+  UInt32 m_step_count = 0;
+
+  UInt32 m_counts[bin_count] = {};
+  Float64 m_energies[bin_count] = {};
+  UInt64 m_block_count = 0;
+
+  static inline UInt32 get_bin(Float64 lufs) noexcept {
+    return (UInt32)mts::clamp<Float64>((lufs - absolute_gate) / bin_width, 0, bin_count - 1);
+  }
+
+  /// Mean energy of the blocks from bin `first`.
+  inline Float64 get_energy(UInt32 first) const noexcept {
+    Float64 sum = 0;
+    UInt64 count = 0;
+
+    for (UInt32 b = first; b < bin_count; b++) {
+      sum += m_energies[b];
+      count += m_counts[b];
+    }
+
+    return count ? sum / count : 0;
+  }
+
+  /// Loudness of the last `steps` steps, none before there are that many.
+  inline Float64 get_mean(UInt32 steps) const noexcept {
+    if (m_step_count < steps) {
+      return loudness_none;
+    }
+
+    Float64 sum = 0;
+
+    for (UInt32 i = 1; i <= steps; i++) {
+      sum += m_steps[(m_step_index + short_term_steps - i) % short_term_steps];
+    }
+
+    const Float64 lufs = sum > 0 ? energy_to_lufs(sum / steps) : loudness_none;
+    return lufs >= absolute_gate ? lufs : loudness_none;
+  }
+};
+
+/// Loudness of a stream as published by the monitor.
+struct loudness_values {
+  std::atomic<Float32> momentary{ loudness_none };
+  std::atomic<Float32> short_term{ loudness_none };
+  std::atomic<Float32> integrated{ loudness_none };
+  std::atomic<Float32> gain_db{ 0 };
+};
+
+/// Background side of the loudness of `Streams` streams.
+///
+/// The IO thread pushes the steps of every stream to one lock-free queue, a background thread
+/// polls it, integrates the steps and publishes the values and the auto gain in atomics. The auto
+/// gain moves the short-term loudness towards the target by at most gain_rate_db per second and
+/// max_gain_db in total, and holds below quiet_lufs so that silence isn't boosted. When it is
+/// disabled the gain goes back to 0 dB at the same rate.
+template <UInt32 Streams>
+class loudness_monitor {
+public:
+  static constexpr UInt32 queue_capacity = 256;
+  static constexpr UInt32 poll_interval_us = 50000;
+  static constexpr Float32 max_gain_db = 12;
+  static constexpr Float32 gain_rate_db = 1;
+  static constexpr Float32 quiet_lufs = -50;
+
+  /// Must only be called from the IO thread. Fails when the background thread is too far behind.
+  inline bool push(UInt32 stream, Float64 energy) noexcept { return m_queue.push(step{ stream, energy }); }
+
+  /// Linear auto gain of a stream, 1 when it is disabled and back at 0 dB.
+  inline Float32 get_gain(UInt32 stream) const noexcept {
+    return mts::decibel_to_amplitude(m_values[stream].gain_db.load(std::memory_order_relaxed));
+  }
+
+  inline const loudness_values& get_values(UInt32 stream) const noexcept { return m_values[stream]; }
+
+  inline Float32 get_target() const noexcept { return m_target.load(std::memory_order_relaxed); }
+  inline void set_target(Float32 lufs) noexcept { m_target.store(lufs, std::memory_order_relaxed); }
+
+  inline bool is_auto_gain() const noexcept { return m_is_auto_gain.load(std::memory_order_relaxed); }
+  inline void set_auto_gain(bool enabled) noexcept { m_is_auto_gain.store(enabled, std::memory_order_relaxed); }
+
+  /// The background thread starts the values again from its next poll.
+  inline void request_reset() noexcept { m_reset_requests.fetch_add(1, std::memory_order_relaxed); }
+
+  /// Start the background thread.
+  inline void start() noexcept {
+    if (m_is_started.exchange(true)) {
+      return;
+    }
+
+    pthread_t thread;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+    if (pthread_create(&thread, &attr, &run, this) != 0) {
+      m_is_started = false;
+    }
+
+    pthread_attr_destroy(&attr);
+  }
+
+private:
+  struct step {
+    UInt32 stream;
+    Float64 energy;
+  };
+
+  spsc_queue<step, queue_capacity> m_queue;
+  loudness_values m_values[Streams];
+  std::atomic<Float32> m_target{ -23 };
+  std::atomic<bool> m_is_auto_gain{ false };
+  std::atomic<UInt32> m_reset_requests{ 0 };
+  std::atomic<bool> m_is_started{ false };
+
+  // Only used by the background thread.
+  loudness_integrator m_integrators[Streams];
+  Float32 m_gains_db[Streams] = {};
+  UInt32 m_resets = 0;
+
+  static void* run(void* self) {
+    ((loudness_monitor*)self)->poll();
+    return nullptr;
+  }
+
+  void poll() noexcept {
+    for (loudness_integrator& integrator : m_integrators) {
+      integrator.reset();
+    }
+
+    for (;;) {
+      const UInt32 resets = m_reset_requests.load(std::memory_order_relaxed);
+
+      if (resets != m_resets) {
+        m_resets = resets;
+
+        for (loudness_integrator& integrator : m_integrators) {
+          integrator.reset();
+        }
+      }
+
+      step s;
+
+      while (m_queue.pop(s)) {
+        if (s.stream < Streams) {
+          m_integrators[s.stream].add(s.energy);
+          update(s.stream);
+        }
+      }
+
+      usleep(poll_interval_us);
+    }
+  }
+
+  inline void update(UInt32 stream) noexcept {
+    const loudness_integrator& integrator = m_integrators[stream];
+    loudness_values& values = m_values[stream];
+    const Float32 short_term = (Float32)integrator.get_short_term();
+
+    values.momentary.store((Float32)integrator.get_momentary(), std::memory_order_relaxed);
+    values.short_term.store(short_term, std::memory_order_relaxed);
+    values.integrated.store((Float32)integrator.get_integrated(), std::memory_order_relaxed);
+
+    Float32& gain_db = m_gains_db[stream];
+    Float32 target_db = 0;
+
+    if (is_auto_gain()) {
+      target_db = short_term >= quiet_lufs ? mts::clamp(get_target() - short_term, -max_gain_db, max_gain_db) : gain_db;
+    }
+
+    const Float32 max_step = gain_rate_db * loudness_step_ms / 1000;
+    gain_db += mts::clamp(target_db - gain_db, -max_step, max_step);
+
+    values.gain_db.store(gain_db, std::memory_order_relaxed);
+  }
+};
+} // namespace mts.
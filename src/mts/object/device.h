@@ -7,6 +7,7 @@ namespace mts::core {
 /// Interface:
 /// @code
 ///     static constexpr std::array objectsDescription;
+///     static constexpr std::array customProperties;
 ///     bool is_hidden() const;
 ///     bool allows_default() const;
 ///     Float64 get_sample_rate() const;
@@ -14,14 +15,22 @@ namespace mts::core {
 ///     UInt32 get_sample_rates(AudioValueRange* ranges, UInt32 itemCount) const;
 ///     OSStatus set_sample_rate(Float64 sr) const;
 ///     UInt32 get_channel_count() const;
+///     AudioChannelLayoutTag get_channel_layout_tag(AudioObjectPropertyScope scope) const;
+///     AudioChannelLabel get_channel_label(AudioObjectPropertyScope scope, UInt32 channel) const;
 ///     bool is_io_running() const;
-///     UInt32 get_ring_buffer_size() const;
+///     UInt32 get_zero_timestamp_period() const;
+///     AudioValueRange get_buffer_frame_size_range() const;
+///     UInt32 get_latency(AudioObjectPropertyScope scope) const;
+///     UInt32 get_safety_offset(AudioObjectPropertyScope scope) const;
 ///     CFStringRef get_device_name() const;
 ///     CFStringRef get_manufacturer_name() const;
 ///     CFStringRef get_device_uid() const;
 ///     CFStringRef get_device_model_uid() const;
 ///     CFStringRef get_bundle_id() const;
 ///     CFStringRef get_icon_file() const;
+///     OSStatus get_custom_property(AudioObjectPropertySelector selector, CFPropertyListRef* value) const;
+///     OSStatus set_custom_property(
+///         AudioObjectPropertySelector selector, CFPropertyListRef value, bool& changed) const;
 /// @endcode
 ///
 template <typename ImplObject>
@@ -53,8 +62,10 @@ public:
     case kAudioDevicePropertyAvailableNominalSampleRates:
     case kAudioDevicePropertyIsHidden:
     case kAudioDevicePropertyZeroTimeStampPeriod:
+    case kAudioDevicePropertyBufferFrameSizeRange:
     case kAudioDevicePropertyIcon:
     case kAudioDevicePropertyStreams:
+    case kAudioObjectPropertyCustomPropertyInfoList:
       return true;
 
     case kAudioDevicePropertyDeviceCanBeDefaultDevice:
@@ -66,7 +77,7 @@ public:
       return mts::is_one_of(inAddress->mScope, kAudioObjectPropertyScopeInput, kAudioObjectPropertyScopeOutput);
     }
 
-    return false;
+    return find_custom_property(inAddress->mSelector) != nullptr;
   }
 
   inline OSStatus is_settable(const Address* inAddress, Boolean* outIsSettable) const {
@@ -95,7 +106,9 @@ public:
     case kAudioDevicePropertyPreferredChannelsForStereo:
     case kAudioDevicePropertyPreferredChannelLayout:
     case kAudioDevicePropertyZeroTimeStampPeriod:
+    case kAudioDevicePropertyBufferFrameSizeRange:
     case kAudioDevicePropertyIcon:
+    case kAudioObjectPropertyCustomPropertyInfoList:
       *outIsSettable = false;
       break;
 
@@ -104,6 +117,11 @@ public:
       break;
 
     default:
+      if (const custom_property_description* desc = find_custom_property(inAddress->mSelector)) {
+        *outIsSettable = desc->settable;
+        break;
+      }
+
       return kAudioHardwareUnknownPropertyError;
     }
 
@@ -239,11 +257,24 @@ public:
       *outDataSize = sizeof(UInt32);
       break;
 
+    case kAudioDevicePropertyBufferFrameSizeRange:
+      *outDataSize = sizeof(AudioValueRange);
+      break;
+
     case kAudioDevicePropertyIcon:
       *outDataSize = sizeof(CFURLRef);
       break;
 
+    case kAudioObjectPropertyCustomPropertyInfoList:
+      *outDataSize = get_custom_property_list_size() * sizeof(AudioServerPlugInCustomPropertyInfo);
+      break;
+
     default:
+      if (find_custom_property(inAddress->mSelector)) {
+        *outDataSize = sizeof(CFPropertyListRef);
+        break;
+      }
+
       return kAudioHardwareUnknownPropertyError;
     }
 
@@ -399,11 +430,11 @@ public:
       *outDataSize = mts::assign<UInt32>(outData, allows_default());
     } break;
 
-    // This property returns the presentation latency of the device. For this,
-    // device, the value is 0 due to the fact that it always vends silence.
+    // This property returns the presentation latency of the device for the
+    // input or output scope.
     case kAudioDevicePropertyLatency: {
       RETURN_SIZE_ERROR_IF(inDataSize < sizeof(UInt32));
-      *outDataSize = mts::assign<UInt32>(outData, 0);
+      *outDataSize = mts::assign<UInt32>(outData, get_latency(inAddress->mScope));
     } break;
 
     // Calculate the number of items that have been requested. Note that this
@@ -443,11 +474,11 @@ public:
       *outDataSize = itemCount * sizeof(AudioObjectID);
     } break;
 
-    // This property returns the how close to now the HAL can read and write. For
-    // this, device, the value is 0 due to the fact that it always vends silence.
+    // This property returns the how close to now the HAL can read and write for
+    // the input or output scope.
     case kAudioDevicePropertySafetyOffset: {
       RETURN_SIZE_ERROR_IF(inDataSize < sizeof(UInt32));
-      *outDataSize = mts::assign<UInt32>(outData, 0);
+      *outDataSize = mts::assign<UInt32>(outData, get_safety_offset(inAddress->mScope));
     } break;
 
     // This property returns the nominal sample rate of the device. Note that we
@@ -486,7 +517,8 @@ public:
     } break;
 
     // This property returns the default AudioChannelLayout to use for the device
-    // by default. For this device, we return a stereo ACL.
+    // by default, the layout of its scope. The descriptions are always there, the
+    // tag is only set when it describes every channel of the device.
     case kAudioDevicePropertyPreferredChannelLayout: {
       UInt32 theACLSize = offsetof(AudioChannelLayout, mChannelDescriptions)
           + (get_channel_count() * sizeof(AudioChannelDescription));
@@ -494,13 +526,13 @@ public:
       RETURN_SIZE_ERROR_IF(inDataSize < theACLSize);
 
       AudioChannelLayout* layout = (AudioChannelLayout*)outData;
-      layout->mChannelLayoutTag = kAudioChannelLayoutTag_UseChannelDescriptions;
+      layout->mChannelLayoutTag = get_channel_layout_tag(inAddress->mScope);
       layout->mChannelBitmap = 0;
       layout->mNumberChannelDescriptions = get_channel_count();
 
       for (UInt32 i = 0; i < get_channel_count(); i++) {
         AudioChannelDescription& desc = layout->mChannelDescriptions[i];
-        desc.mChannelLabel = kAudioChannelLabel_Left + i;
+        desc.mChannelLabel = get_channel_label(inAddress->mScope, i);
         desc.mChannelFlags = 0;
         desc.mCoordinates[0] = 0;
         desc.mCoordinates[1] = 0;
@@ -515,7 +547,13 @@ public:
     // successive sample times in the zero time stamps this device provides.
     case kAudioDevicePropertyZeroTimeStampPeriod: {
       RETURN_SIZE_ERROR_IF(inDataSize < sizeof(UInt32));
-      *outDataSize = mts::assign<UInt32>(outData, get_ring_buffer_size());
+      *outDataSize = mts::assign<UInt32>(outData, get_zero_timestamp_period());
+    } break;
+
+    // The range of IO buffer sizes the clients can ask for.
+    case kAudioDevicePropertyBufferFrameSizeRange: {
+      RETURN_SIZE_ERROR_IF(inDataSize < sizeof(AudioValueRange));
+      *outDataSize = mts::assign<AudioValueRange>(outData, get_buffer_frame_size_range());
     } break;
 
     // This is a CFURL that points to the device's Icon in the plug-in's resource bundle.
@@ -538,8 +576,25 @@ public:
       *outDataSize = sizeof(CFURLRef);
     } break;
 
-    default:
-      return kAudioHardwareUnknownPropertyError;
+    // This returns an array of AudioServerPlugInCustomPropertyInfo describing the custom
+    // properties of the device.
+    case kAudioObjectPropertyCustomPropertyInfoList: {
+      UInt32 itemCount = inDataSize / sizeof(AudioServerPlugInCustomPropertyInfo);
+      itemCount = get_custom_property_list((AudioServerPlugInCustomPropertyInfo*)outData, itemCount);
+      *outDataSize = itemCount * sizeof(AudioServerPlugInCustomPropertyInfo);
+    } break;
+
+    // Custom properties are returned as a CFString or a CFPropertyList that the caller
+    // is responsible for releasing.
+    default: {
+      if (!find_custom_property(inAddress->mSelector)) {
+        return kAudioHardwareUnknownPropertyError;
+      }
+
+      RETURN_SIZE_ERROR_IF(inDataSize < sizeof(CFPropertyListRef));
+      *outDataSize = sizeof(CFPropertyListRef);
+      return get_custom_property(inAddress->mSelector, (CFPropertyListRef*)outData);
+    }
     }
 
     return kAudioHardwareNoError;
@@ -553,8 +608,26 @@ public:
       return set_sample_rate(*(const Float64*)inData);
     } break;
 
-    default:
-      return kAudioHardwareUnknownPropertyError;
+    default: {
+      const custom_property_description* desc = find_custom_property(inAddress->mSelector);
+      if (!desc || !desc->settable) {
+        return kAudioHardwareUnknownPropertyError;
+      }
+
+      RETURN_SIZE_ERROR_IF(inDataSize < sizeof(CFPropertyListRef));
+
+      bool changed = false;
+      OSStatus status = set_custom_property(inAddress->mSelector, *(const CFPropertyListRef*)inData, changed);
+
+      if (status == kAudioHardwareNoError && changed) {
+        *outNumberPropertiesChanged = 1;
+        outChangedAddresses[0].mSelector = inAddress->mSelector;
+        outChangedAddresses[0].mScope = kAudioObjectPropertyScopeGlobal;
+        outChangedAddresses[0].mElement = kAudioObjectPropertyElementMain;
+      }
+
+      return status;
+    }
     }
 
     return kAudioHardwareNoError;
@@ -696,6 +769,39 @@ private:
     return itemCount;
   }
 
+  inline static constexpr UInt32 get_custom_property_list_size() {
+    UInt32 count = 0;
+    for (auto p : ImplObject::customProperties) {
+      count += p.available;
+    }
+
+    return count;
+  }
+
+  inline static UInt32 get_custom_property_list(AudioServerPlugInCustomPropertyInfo* infos, UInt32 itemCount) {
+    itemCount = mts::min(itemCount, get_custom_property_list_size());
+    for (UInt32 i = 0, k = 0; k < itemCount; i++) {
+      if (ImplObject::customProperties[i].available) {
+        infos[k].mSelector = ImplObject::customProperties[i].selector;
+        infos[k].mPropertyDataType = ImplObject::customProperties[i].type;
+        infos[k].mQualifierDataType = kAudioServerPlugInCustomPropertyDataTypeNone;
+        k++;
+      }
+    }
+
+    return itemCount;
+  }
+
+  inline static const custom_property_description* find_custom_property(AudioObjectPropertySelector selector) {
+    for (const custom_property_description& p : ImplObject::customProperties) {
+      if (p.available && p.selector == selector) {
+        return &p;
+      }
+    }
+
+    return nullptr;
+  }
+
   inline const ImplObject* impl() const { return (const ImplObject*)this; }
   inline bool is_hidden() const { return impl()->is_hidden(); }
   inline bool allows_default() const { return impl()->allows_default(); }
@@ -708,13 +814,31 @@ private:
 
   inline OSStatus set_sample_rate(Float64 sr) const { return impl()->set_sample_rate(sr); }
   inline UInt32 get_channel_count() const { return impl()->get_channel_count(); }
+  inline AudioChannelLayoutTag get_channel_layout_tag(AudioObjectPropertyScope scope) const {
+    return impl()->get_channel_layout_tag(scope);
+  }
+  inline AudioChannelLabel get_channel_label(AudioObjectPropertyScope scope, UInt32 channel) const {
+    return impl()->get_channel_label(scope, channel);
+  }
   inline bool is_io_running() const { return impl()->is_io_running(); }
-  inline UInt32 get_ring_buffer_size() const { return impl()->get_ring_buffer_size(); }
+  inline UInt32 get_zero_timestamp_period() const { return impl()->get_zero_timestamp_period(); }
+  inline AudioValueRange get_buffer_frame_size_range() const { return impl()->get_buffer_frame_size_range(); }
+  inline UInt32 get_latency(AudioObjectPropertyScope scope) const { return impl()->get_latency(scope); }
+  inline UInt32 get_safety_offset(AudioObjectPropertyScope scope) const { return impl()->get_safety_offset(scope); }
   inline CFStringRef get_device_name() const { return impl()->get_device_name(); }
   inline CFStringRef get_manufacturer_name() const { return impl()->get_manufacturer_name(); }
   inline CFStringRef get_device_uid() const { return impl()->get_device_uid(); }
   inline CFStringRef get_device_model_uid() const { return impl()->get_device_model_uid(); }
   inline CFStringRef get_bundle_id() const { return impl()->get_bundle_id(); }
   inline CFStringRef get_icon_file() const { return impl()->get_icon_file(); }
+
+  inline OSStatus get_custom_property(AudioObjectPropertySelector selector, CFPropertyListRef* value) const {
+    return impl()->get_custom_property(selector, value);
+  }
+
+  inline OSStatus set_custom_property(
+      AudioObjectPropertySelector selector, CFPropertyListRef value, bool& changed) const {
+    return impl()->set_custom_property(selector, value, changed);
+  }
 };
 } // namespace mts::core.
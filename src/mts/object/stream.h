@@ -6,7 +6,8 @@ namespace mts::core {
 ///
 /// Interface:
 /// @code
-///     UInt32 get_sample_rate_count() const;
+///     UInt32 get_format_count() const; // Number of AudioStreamRangedDescription.
+///     UInt32 get_starting_channel() const; // Device channel of the first channel, starting at 1.
 ///     bool is_active() const;
 ///     bool set_active(bool active) const;
 ///     void get_basic_description(AudioStreamBasicDescription& desc) const;
@@ -121,7 +122,7 @@ public:
 
     case kAudioStreamPropertyAvailableVirtualFormats:
     case kAudioStreamPropertyAvailablePhysicalFormats:
-      *outDataSize = get_sample_rate_count() * sizeof(AudioStreamRangedDescription);
+      *outDataSize = get_format_count() * sizeof(AudioStreamRangedDescription);
       break;
 
     default:
@@ -186,7 +187,7 @@ public:
     // and ths starting channel number fo the second stream is 3.
     case kAudioStreamPropertyStartingChannel: {
       RETURN_SIZE_ERROR_IF(inDataSize < sizeof(UInt32));
-      *outDataSize = mts::assign<UInt32>(outData, 1);
+      *outDataSize = mts::assign<UInt32>(outData, get_starting_channel());
     } break;
 
     // This property returns any additonal presentation latency the stream has.
@@ -214,7 +215,7 @@ public:
       // Calculate the number of items that have been requested. Note that this
       // number is allowed to be smaller than the actual size of the list. In such
       // case, only that number of items will be returned.
-      UInt32 itemCount = mts::min<UInt32>(inDataSize / sizeof(AudioStreamRangedDescription), get_sample_rate_count());
+      UInt32 itemCount = mts::min<UInt32>(inDataSize / sizeof(AudioStreamRangedDescription), get_format_count());
       AudioStreamRangedDescription* desc = (AudioStreamRangedDescription*)outData;
       get_ranged_descriptions(desc, itemCount);
       *outDataSize = itemCount * sizeof(AudioStreamRangedDescription);
@@ -268,7 +269,8 @@ private:
   mts::direction m_direction;
 
   inline const ImplObject* impl() const { return (const ImplObject*)this; }
-  inline UInt32 get_sample_rate_count() const { return impl()->get_sample_rate_count(); }
+  inline UInt32 get_format_count() const { return impl()->get_format_count(); }
+  inline UInt32 get_starting_channel() const { return impl()->get_starting_channel(); }
   inline bool is_active() const { return impl()->is_active(); }
   inline bool set_active(bool active) const { return impl()->set_active(active); }
   inline void get_basic_description(AudioStreamBasicDescription& desc) const { impl()->get_basic_description(desc); }
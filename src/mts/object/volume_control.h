@@ -18,15 +18,20 @@ namespace mts::core {
 template <typename ImplObject>
 class volume_control : public mts::object {
 public:
-  inline volume_control(AudioObjectID objID, AudioObjectID deviceID, mts::direction direction)
+  /// The element is the channel of the control, or kAudioObjectPropertyElementMain for all of them.
+  inline volume_control(AudioObjectID objID, AudioObjectID deviceID, mts::direction direction,
+      AudioObjectPropertyElement element = kAudioObjectPropertyElementMain)
       : object(objID)
       , m_device(deviceID)
-      , m_direction(direction) {}
+      , m_direction(direction)
+      , m_element(element) {}
 
   inline AudioObjectID get_device_id() const { return m_device; }
 
   inline mts::direction get_direction() const { return m_direction; }
 
+  inline AudioObjectPropertyElement get_element() const { return m_element; }
+
   inline bool exists(const Address* inAddress) const {
     switch (inAddress->mSelector) {
     case kAudioObjectPropertyBaseClass:
@@ -164,7 +169,7 @@ public:
     // This property returns the element that the control is attached to.
     case kAudioControlPropertyElement:
       RETURN_SIZE_ERROR_IF(inDataSize < sizeof(AudioObjectPropertyElement));
-      *outDataSize = mts::assign<AudioObjectPropertyElement>(outData, kAudioObjectPropertyElementMain);
+      *outDataSize = mts::assign<AudioObjectPropertyElement>(outData, m_element);
       break;
 
     // This returns the value of the control in the normalized range of 0 to 1.
@@ -253,6 +258,7 @@ public:
 private:
   AudioObjectID m_device;
   mts::direction m_direction;
+  AudioObjectPropertyElement m_element;
 
   inline const ImplObject* impl() const { return (const ImplObject*)this; }
   inline bool set_volume_normalized(Float32 value) const { return impl()->set_volume_normalized(value); }
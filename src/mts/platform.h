@@ -0,0 +1,461 @@
+#pragma once
+// The SDK of the DSP headers. On macOS these are the system headers. Elsewhere, for the benchmarks
+// in bench/, the types and the vDSP, vForce, BLAS and mach functions the DSP headers use are
+// scalar stand-ins with the same semantics: the results match, the timings don't. Only the half
+// precision conversions are vectorized, with F16C when the target has it.
+#if defined(__APPLE__)
+#include <CoreAudio/AudioServerPlugIn.h>
+#include <Accelerate/Accelerate.h>
+#include <mach/mach_time.h>
+#else
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__F16C__)
+#include <immintrin.h>
+#endif
+
+using UInt8 = uint8_t;
+using UInt16 = uint16_t;
+using UInt32 = uint32_t;
+using UInt64 = uint64_t;
+using SInt8 = int8_t;
+using SInt16 = int16_t;
+using SInt32 = int32_t;
+using SInt64 = int64_t;
+using Float32 = float;
+using Float64 = double;
+using Boolean = unsigned char;
+using OSStatus = SInt32;
+
+enum : UInt32 {
+  kAudioTimeStampSampleTimeValid = 1U << 0,
+  kAudioTimeStampHostTimeValid = 1U << 1,
+  kAudioTimeStampRateScalarValid = 1U << 2,
+  kAudioTimeStampSampleHostTimeValid = kAudioTimeStampSampleTimeValid | kAudioTimeStampHostTimeValid
+};
+
+// Without the SMPTE time, which nothing uses.
+struct AudioTimeStamp {
+  Float64 mSampleTime;
+  UInt64 mHostTime;
+  Float64 mRateScalar;
+  UInt64 mWordClockTime;
+  UInt32 mFlags;
+  UInt32 mReserved;
+};
+
+// 'lpcm'.
+enum : UInt32 { kAudioFormatLinearPCM = 0x6C70636D };
+
+// Native endian is little endian.
+enum : UInt32 {
+  kAudioFormatFlagIsFloat = 1U << 0,
+  kAudioFormatFlagIsBigEndian = 1U << 1,
+  kAudioFormatFlagIsSignedInteger = 1U << 2,
+  kAudioFormatFlagIsPacked = 1U << 3,
+  kAudioFormatFlagIsNonInterleaved = 1U << 5,
+  kAudioFormatFlagsNativeEndian = 0
+};
+
+struct AudioStreamBasicDescription {
+  Float64 mSampleRate;
+  UInt32 mFormatID;
+  UInt32 mFormatFlags;
+  UInt32 mBytesPerPacket;
+  UInt32 mFramesPerPacket;
+  UInt32 mBytesPerFrame;
+  UInt32 mChannelsPerFrame;
+  UInt32 mBitsPerChannel;
+  UInt32 mReserved;
+};
+
+// Host ticks are nanoseconds.
+struct mach_timebase_info {
+  uint32_t numer;
+  uint32_t denom;
+};
+
+using mach_timebase_info_data_t = mach_timebase_info;
+
+inline uint64_t mach_absolute_time() {
+  timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (uint64_t)t.tv_sec * 1000000000ULL + (uint64_t)t.tv_nsec;
+}
+
+inline int mach_timebase_info(mach_timebase_info* info) {
+  info->numer = 1;
+  info->denom = 1;
+  return 0;
+}
+
+#if !defined(__has_builtin) || !__has_builtin(__builtin_nontemporal_store)
+#define __builtin_nontemporal_store(value, address) (*(address) = (value))
+#endif
+
+inline void memset_pattern4(void* b, const void* pattern, size_t size) {
+  for (size_t i = 0; i + 4 <= size; i += 4) {
+    memcpy((char*)b + i, pattern, 4);
+  }
+}
+
+inline void memset_pattern8(void* b, const void* pattern, size_t size) {
+  for (size_t i = 0; i + 8 <= size; i += 8) {
+    memcpy((char*)b + i, pattern, 8);
+  }
+}
+
+using vDSP_Stride = long;
+using vDSP_Length = unsigned long;
+
+struct DSPComplex {
+  float real;
+  float imag;
+};
+
+struct DSPSplitComplex {
+  float* realp;
+  float* imagp;
+};
+
+inline void cblas_scopy(int n, const float* x, int incx, float* y, int incy) {
+  for (int i = 0; i < n; i++) {
+    y[i * incy] = x[i * incx];
+  }
+}
+
+inline void vDSP_vclr(float* c, vDSP_Stride ic, vDSP_Length n) {
+  for (vDSP_Length i = 0; i < n; i++) {
+    c[i * ic] = 0;
+  }
+}
+
+template <typename T>
+inline void mts_vadd(const T* a, vDSP_Stride ia, const T* b, vDSP_Stride ib, T* c, vDSP_Stride ic, vDSP_Length n) {
+  for (vDSP_Length i = 0; i < n; i++) {
+    c[i * ic] = a[i * ia] + b[i * ib];
+  }
+}
+
+template <typename T>
+inline void mts_vmul(const T* a, vDSP_Stride ia, const T* b, vDSP_Stride ib, T* c, vDSP_Stride ic, vDSP_Length n) {
+  for (vDSP_Length i = 0; i < n; i++) {
+    c[i * ic] = a[i * ia] * b[i * ib];
+  }
+}
+
+template <typename T>
+inline void mts_vsmul(const T* a, vDSP_Stride ia, const T* b, T* c, vDSP_Stride ic, vDSP_Length n) {
+  for (vDSP_Length i = 0; i < n; i++) {
+    c[i * ic] = a[i * ia] * *b;
+  }
+}
+
+template <typename T>
+inline void mts_vramp(const T* a, const T* b, T* c, vDSP_Stride ic, vDSP_Length n) {
+  for (vDSP_Length i = 0; i < n; i++) {
+    c[i * ic] = *a + (T)i * *b;
+  }
+}
+
+template <typename T>
+inline void mts_vrampmul(const T* i, vDSP_Stride is, T* start, const T* step, T* o, vDSP_Stride os, vDSP_Length n) {
+  for (vDSP_Length k = 0; k < n; k++) {
+    o[k * os] = *start * i[k * is];
+    *start += *step;
+  }
+}
+
+template <typename T>
+inline void mts_svdiv(const T* a, const T* b, vDSP_Stride ib, T* c, vDSP_Stride ic, vDSP_Length n) {
+  for (vDSP_Length i = 0; i < n; i++) {
+    c[i * ic] = *a / b[i * ib];
+  }
+}
+
+template <typename T>
+inline void mts_vclip(const T* a, vDSP_Stride ia, const T* low, const T* high, T* d, vDSP_Stride id, vDSP_Length n) {
+  for (vDSP_Length i = 0; i < n; i++) {
+    const T x = a[i * ia];
+    d[i * id] = x < *low ? *low : (x > *high ? *high : x);
+  }
+}
+
+template <typename T>
+inline void mts_maxmgv(const T* a, vDSP_Stride ia, T* c, vDSP_Length n) {
+  T m = 0;
+
+  for (vDSP_Length i = 0; i < n; i++) {
+    m = fabs(a[i * ia]) > m ? fabs(a[i * ia]) : m;
+  }
+
+  *c = m;
+}
+
+inline void vDSP_vadd(const float* a, vDSP_Stride ia, const float* b, vDSP_Stride ib, float* c, vDSP_Stride ic,
+    vDSP_Length n) {
+  mts_vadd(a, ia, b, ib, c, ic, n);
+}
+
+inline void vDSP_vaddD(const double* a, vDSP_Stride ia, const double* b, vDSP_Stride ib, double* c, vDSP_Stride ic,
+    vDSP_Length n) {
+  mts_vadd(a, ia, b, ib, c, ic, n);
+}
+
+inline void vDSP_vmul(const float* a, vDSP_Stride ia, const float* b, vDSP_Stride ib, float* c, vDSP_Stride ic,
+    vDSP_Length n) {
+  mts_vmul(a, ia, b, ib, c, ic, n);
+}
+
+inline void vDSP_vmulD(const double* a, vDSP_Stride ia, const double* b, vDSP_Stride ib, double* c, vDSP_Stride ic,
+    vDSP_Length n) {
+  mts_vmul(a, ia, b, ib, c, ic, n);
+}
+
+inline void vDSP_vsmul(const float* a, vDSP_Stride ia, const float* b, float* c, vDSP_Stride ic, vDSP_Length n) {
+  mts_vsmul(a, ia, b, c, ic, n);
+}
+
+inline void vDSP_vsmulD(const double* a, vDSP_Stride ia, const double* b, double* c, vDSP_Stride ic, vDSP_Length n) {
+  mts_vsmul(a, ia, b, c, ic, n);
+}
+
+inline void vDSP_vramp(const float* a, const float* b, float* c, vDSP_Stride ic, vDSP_Length n) {
+  mts_vramp(a, b, c, ic, n);
+}
+
+inline void vDSP_vrampD(const double* a, const double* b, double* c, vDSP_Stride ic, vDSP_Length n) {
+  mts_vramp(a, b, c, ic, n);
+}
+
+inline void vDSP_vrampmul(const float* i, vDSP_Stride is, float* start, const float* step, float* o, vDSP_Stride os,
+    vDSP_Length n) {
+  mts_vrampmul(i, is, start, step, o, os, n);
+}
+
+inline void vDSP_vrampmulD(const double* i, vDSP_Stride is, double* start, const double* step, double* o,
+    vDSP_Stride os, vDSP_Length n) {
+  mts_vrampmul(i, is, start, step, o, os, n);
+}
+
+inline void vDSP_svdiv(const float* a, const float* b, vDSP_Stride ib, float* c, vDSP_Stride ic, vDSP_Length n) {
+  mts_svdiv(a, b, ib, c, ic, n);
+}
+
+inline void vDSP_svdivD(const double* a, const double* b, vDSP_Stride ib, double* c, vDSP_Stride ic, vDSP_Length n) {
+  mts_svdiv(a, b, ib, c, ic, n);
+}
+
+inline void vDSP_vclip(const float* a, vDSP_Stride ia, const float* low, const float* high, float* d, vDSP_Stride id,
+    vDSP_Length n) {
+  mts_vclip(a, ia, low, high, d, id, n);
+}
+
+inline void vDSP_vclipD(const double* a, vDSP_Stride ia, const double* low, const double* high, double* d,
+    vDSP_Stride id, vDSP_Length n) {
+  mts_vclip(a, ia, low, high, d, id, n);
+}
+
+inline void vDSP_maxmgv(const float* a, vDSP_Stride ia, float* c, vDSP_Length n) { mts_maxmgv(a, ia, c, n); }
+
+inline void vDSP_maxmgvD(const double* a, vDSP_Stride ia, double* c, vDSP_Length n) { mts_maxmgv(a, ia, c, n); }
+
+inline void vDSP_dotpr(const float* a, vDSP_Stride ia, const float* b, vDSP_Stride ib, float* c, vDSP_Length n) {
+  float sum = 0;
+
+  for (vDSP_Length i = 0; i < n; i++) {
+    sum += a[i * ia] * b[i * ib];
+  }
+
+  *c = sum;
+}
+
+/// C is M rows of N columns, A is N rows of M columns.
+inline void vDSP_mtrans(const float* a, vDSP_Stride ia, float* c, vDSP_Stride ic, vDSP_Length m, vDSP_Length n) {
+  for (vDSP_Length row = 0; row < m; row++) {
+    for (vDSP_Length column = 0; column < n; column++) {
+      c[(row * n + column) * ic] = a[(column * m + row) * ia];
+    }
+  }
+}
+
+inline void cblas_dcopy(int n, const double* x, int incx, double* y, int incy) {
+  for (int i = 0; i < n; i++) {
+    y[i * incy] = x[i * incx];
+  }
+}
+
+inline void vDSP_vclrD(double* c, vDSP_Stride ic, vDSP_Length n) {
+  for (vDSP_Length i = 0; i < n; i++) {
+    c[i * ic] = 0;
+  }
+}
+
+template <typename T>
+inline void mts_vsma(const T* a, vDSP_Stride ia, const T* b, const T* c, vDSP_Stride ic, T* d, vDSP_Stride id,
+    vDSP_Length n) {
+  for (vDSP_Length i = 0; i < n; i++) {
+    d[i * id] = a[i * ia] * *b + c[i * ic];
+  }
+}
+
+inline void vDSP_vsma(const float* a, vDSP_Stride ia, const float* b, const float* c, vDSP_Stride ic, float* d,
+    vDSP_Stride id, vDSP_Length n) {
+  mts_vsma(a, ia, b, c, ic, d, id, n);
+}
+
+inline void vDSP_vsmaD(const double* a, vDSP_Stride ia, const double* b, const double* c, vDSP_Stride ic, double* d,
+    vDSP_Stride id, vDSP_Length n) {
+  mts_vsma(a, ia, b, c, ic, d, id, n);
+}
+
+/// Packed 24 bits integer, little endian.
+struct vDSP_int24 {
+  unsigned char bytes[3];
+};
+
+template <typename From, typename To>
+inline void mts_vconvert(const From* a, vDSP_Stride ia, To* c, vDSP_Stride ic, vDSP_Length n) {
+  for (vDSP_Length i = 0; i < n; i++) {
+    c[i * ic] = (To)a[i * ia];
+  }
+}
+
+inline void vDSP_vdpsp(const double* a, vDSP_Stride ia, float* c, vDSP_Stride ic, vDSP_Length n) {
+  mts_vconvert(a, ia, c, ic, n);
+}
+
+inline void vDSP_vspdp(const float* a, vDSP_Stride ia, double* c, vDSP_Stride ic, vDSP_Length n) {
+  mts_vconvert(a, ia, c, ic, n);
+}
+
+inline void vDSP_vflt16(const short* a, vDSP_Stride ia, float* c, vDSP_Stride ic, vDSP_Length n) {
+  mts_vconvert(a, ia, c, ic, n);
+}
+
+inline void vDSP_vflt32(const int* a, vDSP_Stride ia, float* c, vDSP_Stride ic, vDSP_Length n) {
+  mts_vconvert(a, ia, c, ic, n);
+}
+
+inline void vDSP_vflt24(const vDSP_int24* a, vDSP_Stride ia, float* c, vDSP_Stride ic, vDSP_Length n) {
+  for (vDSP_Length i = 0; i < n; i++) {
+    const unsigned char* b = a[i * ia].bytes;
+    c[i * ic] = (float)((int32_t)((uint32_t)b[0] << 8 | (uint32_t)b[1] << 16 | (uint32_t)b[2] << 24) >> 8);
+  }
+}
+
+/// Round to nearest, the values must be in the range of the integer.
+template <typename To>
+inline void mts_vfixr(const float* a, vDSP_Stride ia, To* c, vDSP_Stride ic, vDSP_Length n) {
+  for (vDSP_Length i = 0; i < n; i++) {
+    c[i * ic] = (To)nearbyint((double)a[i * ia]);
+  }
+}
+
+inline void vDSP_vfixr16(const float* a, vDSP_Stride ia, short* c, vDSP_Stride ic, vDSP_Length n) {
+  mts_vfixr(a, ia, c, ic, n);
+}
+
+inline void vDSP_vfixr32(const float* a, vDSP_Stride ia, int* c, vDSP_Stride ic, vDSP_Length n) {
+  mts_vfixr(a, ia, c, ic, n);
+}
+
+inline void vDSP_vfixr24(const float* a, vDSP_Stride ia, vDSP_int24* c, vDSP_Stride ic, vDSP_Length n) {
+  for (vDSP_Length i = 0; i < n; i++) {
+    const int32_t v = (int32_t)nearbyint((double)a[i * ia]);
+    c[i * ic].bytes[0] = (unsigned char)(v & 0xFF);
+    c[i * ic].bytes[1] = (unsigned char)((v >> 8) & 0xFF);
+    c[i * ic].bytes[2] = (unsigned char)((v >> 16) & 0xFF);
+  }
+}
+
+/// Only the planar conversions between Float32 and binary16 of a single row, round to nearest
+/// even. Eight samples at a time with F16C, with the _Float16 of the compiler otherwise.
+struct vImage_Buffer {
+  void* data;
+  vDSP_Length height;
+  vDSP_Length width;
+  size_t rowBytes;
+};
+
+using vImage_Error = long;
+using vImage_Flags = uint32_t;
+enum : vImage_Flags { kvImageNoFlags = 0 };
+
+inline vImage_Error vImageConvert_PlanarFtoPlanar16F(const vImage_Buffer* src, const vImage_Buffer* dst, vImage_Flags) {
+  const float* s = (const float*)src->data;
+  _Float16* d = (_Float16*)dst->data;
+  vDSP_Length i = 0;
+
+#if defined(__F16C__)
+  for (; i + 8 <= src->width; i += 8) {
+    _mm_storeu_si128((__m128i*)(d + i), _mm256_cvtps_ph(_mm256_loadu_ps(s + i), _MM_FROUND_TO_NEAREST_INT));
+  }
+#endif
+
+  mts_vconvert(s + i, 1, d + i, 1, src->width - i);
+  return 0;
+}
+
+inline vImage_Error vImageConvert_Planar16FtoPlanarF(const vImage_Buffer* src, const vImage_Buffer* dst, vImage_Flags) {
+  const _Float16* s = (const _Float16*)src->data;
+  float* d = (float*)dst->data;
+  vDSP_Length i = 0;
+
+#if defined(__F16C__)
+  for (; i + 8 <= src->width; i += 8) {
+    _mm256_storeu_ps(d + i, _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)(s + i))));
+  }
+#endif
+
+  mts_vconvert(s + i, 1, d + i, 1, src->width - i);
+  return 0;
+}
+
+inline void vvexpf(float* y, const float* x, const int* n) {
+  for (int i = 0; i < *n; i++) {
+    y[i] = expf(x[i]);
+  }
+}
+
+inline void vvexp(double* y, const double* x, const int* n) {
+  for (int i = 0; i < *n; i++) {
+    y[i] = exp(x[i]);
+  }
+}
+
+inline void vvsqrtf(float* y, const float* x, const int* n) {
+  for (int i = 0; i < *n; i++) {
+    y[i] = sqrtf(x[i]);
+  }
+}
+
+inline void vvsqrt(double* y, const double* x, const int* n) {
+  for (int i = 0; i < *n; i++) {
+    y[i] = sqrt(x[i]);
+  }
+}
+
+/// The stride of the interleaved side is in floats and must be even.
+inline void vDSP_ctoz(const DSPComplex* c, vDSP_Stride ic, const DSPSplitComplex* z, vDSP_Stride iz, vDSP_Length n) {
+  const float* f = (const float*)c;
+
+  for (vDSP_Length i = 0; i < n; i++) {
+    z->realp[i * iz] = f[i * ic];
+    z->imagp[i * iz] = f[i * ic + 1];
+  }
+}
+
+inline void vDSP_ztoc(const DSPSplitComplex* z, vDSP_Stride iz, DSPComplex* c, vDSP_Stride ic, vDSP_Length n) {
+  float* f = (float*)c;
+
+  for (vDSP_Length i = 0; i < n; i++) {
+    f[i * ic] = z->realp[i * iz];
+    f[i * ic + 1] = z->imagp[i * iz];
+  }
+}
+#endif
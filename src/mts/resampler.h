@@ -0,0 +1,202 @@
+#pragma once
+#include "mts/platform.h"
+#include "mts/util.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+namespace mts::dsp {
+enum class resampler_quality { low, medium, high, best };
+
+/// Windowed-sinc prototype of a quality tier.
+/// `taps` is the number of input samples per output sample (the length of a phase), `cutoff` is
+/// relative to the lowest Nyquist frequency and `kaiser_beta` sets the stop band attenuation
+/// (about 60, 80, 100 and 120dB).
+struct resampler_tier {
+  UInt32 taps;
+  Float64 cutoff;
+  Float64 kaiser_beta;
+};
+
+inline constexpr resampler_tier get_resampler_tier(resampler_quality quality) {
+  switch (quality) {
+  case resampler_quality::low:
+    return { 8, 0.85, 5.7 };
+  case resampler_quality::medium:
+    return { 16, 0.90, 7.9 };
+  case resampler_quality::high:
+    return { 32, 0.94, 10.1 };
+  case resampler_quality::best:
+    return { 64, 0.97, 12.3 };
+  }
+
+  return { 16, 0.90, 7.9 };
+}
+
+/// Zeroth order modified Bessel function of the first kind, for the Kaiser window.
+inline Float64 bessel_i0(Float64 x) {
+  Float64 sum = 1.0;
+  Float64 term = 1.0;
+  const Float64 y = x * x * 0.25;
+
+  for (int k = 1; k < 64 && term > sum * 1e-12; k++) {
+    term *= y / ((Float64)k * (Float64)k);
+    sum += term;
+  }
+
+  return sum;
+}
+
+/// Polyphase windowed-sinc resampler for a rational ratio L/M between two integer sample rates.
+///
+/// The prototype low pass runs at L times the input rate and is split in L phases of `taps`
+/// coefficients. Each output sample is one dot product (vDSP_dotpr) between a phase and the last
+/// `taps` input samples of its channel. The input history is stored twice in a row so that this
+/// window is always contiguous.
+///
+/// init() and free() allocate and must not be called on the IO thread, process() is real-time safe.
+class polyphase_resampler {
+public:
+  inline bool init(UInt32 input_rate, UInt32 output_rate, UInt32 channel_count, resampler_quality quality) {
+    free();
+
+    if (input_rate == 0 || output_rate == 0 || channel_count == 0) {
+      return false;
+    }
+
+    const UInt32 g = gcd(input_rate, output_rate);
+    const resampler_tier tier = get_resampler_tier(quality);
+
+    m_up = output_rate / g;
+    m_down = input_rate / g;
+    m_taps = tier.taps;
+    m_channel_count = channel_count;
+
+    m_coefficients = (Float32*)calloc((size_t)m_up * m_taps, sizeof(Float32));
+    m_history = (Float32*)calloc((size_t)channel_count * m_taps * 2, sizeof(Float32));
+    m_history_index = (UInt32*)calloc(channel_count, sizeof(UInt32));
+
+    if (!m_coefficients || !m_history || !m_history_index) {
+      free();
+      return false;
+    }
+
+    design(tier);
+    reset();
+    return true;
+  }
+
+  inline void free() {
+    ::free(m_coefficients);
+    ::free(m_history);
+    ::free(m_history_index);
+    m_coefficients = nullptr;
+    m_history = nullptr;
+    m_history_index = nullptr;
+  }
+
+  inline bool is_initialized() const { return m_coefficients != nullptr; }
+
+  inline void reset() {
+    memset(m_history, 0, (size_t)m_channel_count * m_taps * 2 * sizeof(Float32));
+    memset(m_history_index, 0, m_channel_count * sizeof(UInt32));
+    m_phase = 0;
+  }
+
+  /// Delay of the filter in output frames.
+  inline UInt32 get_latency() const { return (UInt32)(((UInt64)m_taps * m_up / 2) / m_down); }
+
+  /// Largest number of frames produced from `input_frames` frames.
+  inline UInt32 get_max_output_frames(UInt32 input_frames) const {
+    return (UInt32)(((UInt64)input_frames * m_up + m_down - 1) / m_down) + 1;
+  }
+
+  /// Resample `input_frames` interleaved frames into `output`, which must hold
+  /// get_max_output_frames(input_frames) frames. Returns the number of frames written.
+  inline UInt32 process(const Float32* input, UInt32 input_frames, Float32* output) {
+    const UInt32 start_phase = m_phase;
+    UInt32 output_frames = 0;
+
+    // Channel outer, the phase sequence is the same for every channel.
+    for (UInt32 c = 0; c < m_channel_count; c++) {
+      Float32* history = m_history + (size_t)c * m_taps * 2;
+      UInt32 index = m_history_index[c];
+      UInt32 phase = start_phase;
+      UInt32 n = 0;
+
+      for (UInt32 i = 0; i < input_frames; i++) {
+        const Float32 x = input[(size_t)i * m_channel_count + c];
+        index = index + 1 == m_taps ? 0 : index + 1;
+        history[index] = x;
+        history[index + m_taps] = x;
+
+        // The window is the last m_taps samples in time order.
+        const Float32* window = history + index + 1;
+
+        for (; phase < m_up; phase += m_down) {
+          vDSP_dotpr(window, 1, m_coefficients + (size_t)phase * m_taps, 1,
+              output + (size_t)n * m_channel_count + c, m_taps);
+          n++;
+        }
+
+        phase -= m_up;
+      }
+
+      m_history_index[c] = index;
+      m_phase = phase;
+      output_frames = n;
+    }
+
+    return output_frames;
+  }
+
+private:
+  Float32* m_coefficients = nullptr;
+  Float32* m_history = nullptr;
+  UInt32* m_history_index = nullptr;
+  UInt32 m_up = 1;
+  UInt32 m_down = 1;
+  UInt32 m_taps = 0;
+  UInt32 m_channel_count = 0;
+  UInt32 m_phase = 0;
+
+  static inline UInt32 gcd(UInt32 a, UInt32 b) {
+    while (b) {
+      const UInt32 t = a % b;
+      a = b;
+      b = t;
+    }
+    return a;
+  }
+
+  /// Coefficient k of phase p is h[p + k * L] of the prototype, stored in reverse so that the
+  /// phase lines up with the window (oldest sample first).
+  inline void design(const resampler_tier& tier) {
+    const UInt32 length = m_up * m_taps;
+    const Float64 center = (Float64)(length - 1) * 0.5;
+
+    // Cutoff in cycles per sample at the upsampled rate.
+    const Float64 fc = 0.5 * tier.cutoff / (Float64)mts::max(m_up, m_down);
+    const Float64 window_scale = 1.0 / bessel_i0(tier.kaiser_beta);
+    Float64 sum = 0;
+
+    for (UInt32 i = 0; i < length; i++) {
+      const Float64 t = (Float64)i - center;
+      const Float64 x = 2.0 * fc * t;
+      const Float64 sinc = t == 0 ? 1.0 : sin(M_PI * x) / (M_PI * x);
+      const Float64 r = t / (center + 0.5);
+      const Float64 w = bessel_i0(tier.kaiser_beta * sqrt(mts::max(0.0, 1.0 - r * r))) * window_scale;
+      const Float64 h = 2.0 * fc * sinc * w;
+
+      const UInt32 phase = i % m_up;
+      const UInt32 k = i / m_up;
+      m_coefficients[(size_t)phase * m_taps + (m_taps - 1 - k)] = (Float32)h;
+      sum += h;
+    }
+
+    // Each phase has a gain of one on average.
+    const Float32 gain = (Float32)((Float64)m_up / sum);
+    vDSP_vsmul(m_coefficients, 1, &gain, m_coefficients, 1, length);
+  }
+};
+} // namespace mts::dsp.
@@ -0,0 +1,348 @@
+#pragma once
+#include "mts/platform.h"
+#include "mts/util.h"
+#include "mts/dsp.h"
+#include "mts/convert.h"
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+namespace mts {
+/// Memory layout of the ring buffer.
+///
+/// interleaved: frame after frame, like the IO buffers. Each cycle is one or two memcpy.
+///
+/// planar: the ring is cut in tiles of `tile_frames` frames and each tile stores its channels one
+///         after the other. A tile is about `ring_tile_bytes` so that the transposition between
+///         the interleaved IO buffers and the tile stays in L1, while every channel of the tile
+///         is contiguous. This is meant for high channel counts where an interleaved frame is
+///         already a few cache lines.
+enum class ring_layout { interleaved, planar };
+
+inline constexpr UInt32 ring_tile_bytes = 16384;
+
+/// A reader further behind the writer than this won't find the written frames in cache, these
+/// are written with non-temporal stores to avoid evicting the rest of the cache.
+inline constexpr UInt32 ring_non_temporal_distance_bytes = 1024 * 1024;
+
+/// Frames [sample_time, sample_time + frames) of a ring, split where the ring wraps around. It only
+/// depends on the frame count of the ring, so it can be computed once per IO cycle for every ring of
+/// the same size (see ring_buffer::get_span()).
+struct ring_span {
+  UInt32 ring_frame;
+  UInt32 first_count;
+  UInt32 second_count;
+};
+
+/// Parses a read delay, a number of frames or a duration followed by "ms", into `frames` clamped
+/// to `max_frames`. Fails for anything else, including an empty text or a negative amount.
+inline bool parse_read_delay(const char* text, Float64 sample_rate, UInt32 max_frames, UInt32& frames) noexcept {
+  char* end = nullptr;
+  const Float64 amount = strtod(text, &end);
+
+  if (end == text || !isfinite(amount) || amount < 0) {
+    return false;
+  }
+
+  while (isspace((unsigned char)*end)) {
+    end++;
+  }
+
+  const bool is_milliseconds = strncmp(end, "ms", 2) == 0;
+  end += is_milliseconds ? 2 : 0;
+
+  while (isspace((unsigned char)*end)) {
+    end++;
+  }
+
+  if (*end) {
+    return false;
+  }
+
+  const Float64 f = is_milliseconds ? round(amount * sample_rate / 1000.0) : round(amount);
+  frames = (UInt32)mts::min(f, (Float64)max_frames);
+  return true;
+}
+
+/// Audio ring buffer indexed by sample time.
+/// The frame count must be a power of two so that 'sample_time % frame_count' is a mask.
+///
+/// T is the storage type of the samples. The IO side of read and write can be another type, the
+/// conversion is then done in the copy (see mts::dsp::convert).
+template <typename T, ring_layout Layout>
+class ring_buffer {
+public:
+  inline bool allocate(UInt32 frame_count, UInt32 channel_count) {
+    if (!mts::is_power_of_two(frame_count) || channel_count == 0) {
+      return false;
+    }
+
+    m_data = (T*)calloc((size_t)frame_count * channel_count, sizeof(T));
+    if (!m_data) {
+      return false;
+    }
+
+    m_frame_count = frame_count;
+    m_frame_mask = frame_count - 1;
+    m_channel_count = channel_count;
+
+    // Largest power of two frame count that fits in a tile.
+    UInt32 tile_frames = 1;
+    while (tile_frames * 2 * channel_count * sizeof(T) <= ring_tile_bytes && tile_frames * 2 <= frame_count) {
+      tile_frames *= 2;
+    }
+
+    m_tile_frames = tile_frames;
+    m_tile_mask = tile_frames - 1;
+    return true;
+  }
+
+  inline void free() {
+    ::free(m_data);
+    m_data = nullptr;
+  }
+
+  inline bool is_allocated() const { return m_data != nullptr; }
+  inline UInt32 get_frame_count() const { return m_frame_count; }
+  inline UInt32 get_channel_count() const { return m_channel_count; }
+
+  inline void clear() {
+    if constexpr (std::is_floating_point_v<T>) {
+      mts::dsp::clear(m_data, (size_t)m_frame_count * m_channel_count);
+    }
+    else {
+      memset(m_data, 0, (size_t)m_frame_count * m_channel_count * sizeof(T));
+    }
+  }
+
+  /// Number of frames between a writer and a reader from which stores should bypass the cache.
+  inline UInt32 get_non_temporal_distance() const {
+    return ring_non_temporal_distance_bytes / (m_channel_count * sizeof(T));
+  }
+
+  inline ring_span get_span(UInt64 sample_time, UInt32 frames) const {
+    const UInt32 ring_frame = sample_time & m_frame_mask;
+    const UInt32 first_count = mts::min(frames, m_frame_count - ring_frame);
+    return { ring_frame, first_count, frames - first_count };
+  }
+
+  /// Copy the interleaved frames of `span` from `src` into the ring.
+  template <typename U>
+  inline void write(const U* src, const ring_span& span, bool non_temporal) {
+    for_each_segment(span, [&](UInt32 ring_frame, UInt32 offset, UInt32 count) {
+      write_segment(src + (size_t)offset * m_channel_count, ring_frame, count, non_temporal);
+    });
+  }
+
+  /// Copy the frames of `span` from the ring into `dst`, interleaved.
+  template <typename U>
+  inline void read(U* dst, const ring_span& span) const {
+    for_each_segment(span, [&](UInt32 ring_frame, UInt32 offset, UInt32 count) {
+      read_segment(dst + (size_t)offset * m_channel_count, ring_frame, count);
+    });
+  }
+
+  /// Copy the non-interleaved frames of `span` into the ring.
+  /// Channel c of the source starts at src + c * stride.
+  template <typename U>
+  inline void write_planar(const U* src, size_t stride, const ring_span& span, bool non_temporal) {
+    for_each_segment(span, [&](UInt32 ring_frame, UInt32 offset, UInt32 count) {
+      write_planar_segment(src + offset, stride, ring_frame, count, non_temporal);
+    });
+  }
+
+  /// Copy the frames of `span` from the ring into non-interleaved channels.
+  /// Channel c of the destination starts at dst + c * stride.
+  template <typename U>
+  inline void read_planar(U* dst, size_t stride, const ring_span& span) const {
+    for_each_segment(span, [&](UInt32 ring_frame, UInt32 offset, UInt32 count) {
+      read_planar_segment(dst + offset, stride, ring_frame, count);
+    });
+  }
+
+  /// Copy `frames` interleaved frames from `src` into the ring starting at `sample_time`.
+  template <typename U>
+  inline void write(const U* src, UInt64 sample_time, UInt32 frames, bool non_temporal) {
+    write(src, get_span(sample_time, frames), non_temporal);
+  }
+
+  /// Copy `frames` interleaved frames starting at `sample_time` from the ring into `dst`.
+  template <typename U>
+  inline void read(U* dst, UInt64 sample_time, UInt32 frames) const {
+    read(dst, get_span(sample_time, frames));
+  }
+
+  /// Copy `frames` non-interleaved frames into the ring starting at `sample_time`.
+  template <typename U>
+  inline void write_planar(const U* src, size_t stride, UInt64 sample_time, UInt32 frames, bool non_temporal) {
+    write_planar(src, stride, get_span(sample_time, frames), non_temporal);
+  }
+
+  /// Copy `frames` frames starting at `sample_time` from the ring into non-interleaved channels.
+  template <typename U>
+  inline void read_planar(U* dst, size_t stride, UInt64 sample_time, UInt32 frames) const {
+    read_planar(dst, stride, get_span(sample_time, frames));
+  }
+
+private:
+  T* m_data = nullptr;
+  UInt32 m_frame_count = 0;
+  UInt32 m_frame_mask = 0;
+  UInt32 m_channel_count = 0;
+  UInt32 m_tile_frames = 0;
+  UInt32 m_tile_mask = 0;
+
+  /// Calls `fct` on both parts of the span and, for the planar layout, splits them at the tile
+  /// boundaries. The tile size divides the ring size so a wrap is always on a tile boundary.
+  template <typename Fct>
+  inline void for_each_segment(const ring_span& span, Fct&& fct) const {
+    if constexpr (Layout == ring_layout::interleaved) {
+      fct(span.ring_frame, 0, span.first_count);
+
+      if (span.second_count) {
+        fct(0, span.first_count, span.second_count);
+      }
+    }
+    else {
+      const UInt32 frames = span.first_count + span.second_count;
+      UInt32 ring_frame = span.ring_frame;
+      UInt32 offset = 0;
+
+      while (offset < frames) {
+        const UInt32 count = mts::min(m_tile_frames - (ring_frame & m_tile_mask), frames - offset);
+        fct(ring_frame, offset, count);
+        offset += count;
+        ring_frame = (ring_frame + count) & m_frame_mask;
+      }
+    }
+  }
+
+  inline T* get_tile(UInt32 ring_frame) const { return m_data + (size_t)(ring_frame & ~m_tile_mask) * m_channel_count; }
+
+  template <typename U>
+  inline void write_segment(const U* src, UInt32 ring_frame, UInt32 count, bool non_temporal) {
+    if constexpr (Layout == ring_layout::interleaved) {
+      T* dst = m_data + (size_t)ring_frame * m_channel_count;
+
+      if constexpr (!std::is_same_v<U, T>) {
+        mts::dsp::convert(src, dst, (size_t)count * m_channel_count);
+      }
+      else if (non_temporal) {
+        mts::dsp::copy_non_temporal(src, dst, (size_t)count * m_channel_count);
+      }
+      else {
+        mts::dsp::copy(src, dst, (size_t)count * m_channel_count);
+      }
+    }
+    else {
+      T* tile = get_tile(ring_frame);
+      const UInt32 first = ring_frame & m_tile_mask;
+
+      // Channel outer so that the stores are contiguous, the strided loads stay in the tile.
+      for (UInt32 c = 0; c < m_channel_count; c++) {
+        T* dst = tile + (size_t)c * m_tile_frames + first;
+
+        if constexpr (!std::is_same_v<U, T>) {
+          mts::dsp::convert_gather(src + c, m_channel_count, dst, count);
+        }
+        else if (non_temporal) {
+          for (UInt32 f = 0; f < count; f++) {
+            __builtin_nontemporal_store(src[(size_t)f * m_channel_count + c], dst + f);
+          }
+        }
+        else {
+          for (UInt32 f = 0; f < count; f++) {
+            dst[f] = src[(size_t)f * m_channel_count + c];
+          }
+        }
+      }
+    }
+  }
+
+  template <typename U>
+  inline void write_planar_segment(const U* src, size_t stride, UInt32 ring_frame, UInt32 count, bool non_temporal) {
+    if constexpr (Layout == ring_layout::interleaved) {
+      T* dst = m_data + (size_t)ring_frame * m_channel_count;
+
+      if constexpr (std::is_same_v<U, T>) {
+        mts::dsp::interleave(src, stride, dst, m_channel_count, count);
+      }
+      else {
+        for (UInt32 c = 0; c < m_channel_count; c++) {
+          mts::dsp::convert_scatter(src + c * stride, dst + c, m_channel_count, count);
+        }
+      }
+    }
+    else {
+      // Both sides are planar, this is one copy per channel.
+      T* tile = get_tile(ring_frame);
+      const UInt32 first = ring_frame & m_tile_mask;
+
+      for (UInt32 c = 0; c < m_channel_count; c++) {
+        T* dst = tile + (size_t)c * m_tile_frames + first;
+
+        if constexpr (!std::is_same_v<U, T>) {
+          mts::dsp::convert(src + c * stride, dst, count);
+        }
+        else if (non_temporal) {
+          mts::dsp::copy_non_temporal(src + c * stride, dst, count);
+        }
+        else {
+          mts::dsp::copy(src + c * stride, dst, count);
+        }
+      }
+    }
+  }
+
+  template <typename U>
+  inline void read_planar_segment(U* dst, size_t stride, UInt32 ring_frame, UInt32 count) const {
+    if constexpr (Layout == ring_layout::interleaved) {
+      const T* src = m_data + (size_t)ring_frame * m_channel_count;
+
+      if constexpr (std::is_same_v<U, T>) {
+        mts::dsp::deinterleave(src, dst, m_channel_count, count, stride);
+      }
+      else {
+        for (UInt32 c = 0; c < m_channel_count; c++) {
+          mts::dsp::convert_gather(src + c, m_channel_count, dst + c * stride, count);
+        }
+      }
+    }
+    else {
+      const T* tile = get_tile(ring_frame);
+      const UInt32 first = ring_frame & m_tile_mask;
+
+      for (UInt32 c = 0; c < m_channel_count; c++) {
+        mts::dsp::convert(tile + (size_t)c * m_tile_frames + first, dst + c * stride, count);
+      }
+    }
+  }
+
+  template <typename U>
+  inline void read_segment(U* dst, UInt32 ring_frame, UInt32 count) const {
+    if constexpr (Layout == ring_layout::interleaved) {
+      mts::dsp::convert(m_data + (size_t)ring_frame * m_channel_count, dst, (size_t)count * m_channel_count);
+    }
+    else {
+      const T* tile = get_tile(ring_frame);
+      const UInt32 first = ring_frame & m_tile_mask;
+
+      if constexpr (!std::is_same_v<U, T>) {
+        for (UInt32 c = 0; c < m_channel_count; c++) {
+          mts::dsp::convert_scatter(tile + (size_t)c * m_tile_frames + first, dst + c, m_channel_count, count);
+        }
+      }
+      else {
+        // Frame outer so that the stores into the IO buffer are contiguous.
+        for (UInt32 f = 0; f < count; f++) {
+          U* frame = dst + (size_t)f * m_channel_count;
+
+          for (UInt32 c = 0; c < m_channel_count; c++) {
+            frame[c] = tile[(size_t)c * m_tile_frames + first + f];
+          }
+        }
+      }
+    }
+  }
+};
+} // namespace mts.
@@ -0,0 +1,202 @@
+#pragma once
+#include "mts/platform.h"
+#include "mts/util.h"
+#include "mts/dsp.h"
+#include <string.h>
+
+namespace mts {
+/// Channel `source` of the output is added to channel `destination` of the input with `gain`.
+/// Channels start at 0.
+struct route {
+  UInt32 source;
+  UInt32 destination;
+  Float32 gain;
+};
+
+/// Kernels of a routing_matrix, from the fastest to the most general one.
+///
+/// identity:    every channel goes to itself, a single copy.
+/// permutation: each destination is one source with a gain of one or silence, one strided copy per
+///              destination channel.
+/// sparse:      each destination is a sum of scaled sources, one vDSP_vsmul for its first source and
+///              one vDSP_vsma for each other one. Only the non-zero entries of the matrix cost anything.
+///              Interleaved frames are mixed in a single pass instead, each frame is read once and
+///              written once rather than once per route.
+enum class routing_kernel : UInt8 { identity, permutation, sparse };
+
+/// Routing and mixing matrix between the channels of the output and of the input.
+/// compile() picks the kernel once so that process() doesn't look at the matrix anymore.
+template <typename T, UInt32 Channels>
+class routing_matrix {
+public:
+  static constexpr UInt32 max_routes = Channels * Channels;
+
+  /// Returns false when a channel is out of range. Routes with the same source and destination
+  /// add up, an empty list is the identity.
+  inline bool compile(const route* routes, UInt32 count) {
+    T gains[Channels][Channels] = {};
+
+    for (UInt32 i = 0; i < count; i++) {
+      if (routes[i].source >= Channels || routes[i].destination >= Channels) {
+        return false;
+      }
+
+      gains[routes[i].destination][routes[i].source] += (T)routes[i].gain;
+    }
+
+    if (count == 0) {
+      set_identity();
+      return true;
+    }
+
+    bool is_identity = true;
+    bool is_permutation = true;
+    m_route_count = 0;
+
+    for (UInt32 d = 0; d < Channels; d++) {
+      UInt32 source_count = 0;
+      m_first[d] = m_route_count;
+      m_sources[d] = -1;
+
+      for (UInt32 s = 0; s < Channels; s++) {
+        if (gains[d][s] == 0) {
+          continue;
+        }
+
+        m_routes[m_route_count++] = { s, d, (Float32)gains[d][s] };
+        m_sources[d] = (SInt32)s;
+        source_count++;
+        is_permutation = is_permutation && gains[d][s] == 1;
+      }
+
+      is_permutation = is_permutation && source_count <= 1;
+      is_identity = is_identity && source_count == 1 && m_sources[d] == (SInt32)d && gains[d][d] == 1;
+    }
+
+    m_first[Channels] = m_route_count;
+    m_kernel = is_identity ? routing_kernel::identity
+        : is_permutation   ? routing_kernel::permutation
+                           : routing_kernel::sparse;
+    return true;
+  }
+
+  inline void set_identity() {
+    m_kernel = routing_kernel::identity;
+    m_route_count = 0;
+  }
+
+  inline routing_kernel get_kernel() const { return m_kernel; }
+  inline bool is_identity() const { return m_kernel == routing_kernel::identity; }
+
+  /// Route `frames` frames from `src` to `dst`, which must not overlap. Both buffers have the same
+  /// layout, sample f of channel c is at f * frame_stride + c * channel_stride.
+  inline void process(const T* src, T* dst, UInt32 frames, size_t frame_stride, size_t channel_stride) const {
+    switch (m_kernel) {
+    case routing_kernel::identity:
+      mts::dsp::copy(src, dst, (size_t)frames * Channels);
+      break;
+
+    case routing_kernel::permutation:
+      for (UInt32 d = 0; d < Channels; d++) {
+        T* out = dst + d * channel_stride;
+
+        if (m_sources[d] < 0) {
+          clear(out, frame_stride, frames);
+        }
+        else {
+          strided_copy(src + m_sources[d] * channel_stride, out, frame_stride, frames);
+        }
+      }
+      break;
+
+    case routing_kernel::sparse:
+      if (channel_stride == 1) {
+        process_interleaved(src, dst, frames, frame_stride);
+        break;
+      }
+
+      for (UInt32 d = 0; d < Channels; d++) {
+        T* out = dst + d * channel_stride;
+
+        if (m_first[d] == m_first[d + 1]) {
+          clear(out, frame_stride, frames);
+          continue;
+        }
+
+        for (UInt32 i = m_first[d]; i < m_first[d + 1]; i++) {
+          const T* in = src + m_routes[i].source * channel_stride;
+          const T gain = (T)m_routes[i].gain;
+
+          if (i == m_first[d]) {
+            scale(in, gain, out, frame_stride, frames);
+          }
+          else {
+            scale_add(in, gain, out, frame_stride, frames);
+          }
+        }
+      }
+      break;
+    }
+  }
+
+private:
+  routing_kernel m_kernel = routing_kernel::identity;
+  UInt32 m_route_count = 0;
+
+  // Permutation: source of each destination, -1 is silence.
+  SInt32 m_sources[Channels];
+
+  // Sparse: the routes sorted by destination, those of destination d are [m_first[d], m_first[d + 1]).
+  route m_routes[max_routes];
+  UInt32 m_first[Channels + 1];
+
+  inline void process_interleaved(const T* src, T* dst, UInt32 frames, size_t frame_stride) const {
+    for (UInt32 f = 0; f < frames; f++) {
+      const T* in = src + f * frame_stride;
+      T mix[Channels] = {};
+
+      for (UInt32 i = 0; i < m_route_count; i++) {
+        mix[m_routes[i].destination] += (T)m_routes[i].gain * in[m_routes[i].source];
+      }
+
+      memcpy(dst + f * frame_stride, mix, sizeof(mix));
+    }
+  }
+
+  static inline void clear(T* dst, size_t stride, UInt32 frames) {
+    if constexpr (sizeof(T) == 4) {
+      vDSP_vclr(dst, stride, frames);
+    }
+    else {
+      vDSP_vclrD(dst, stride, frames);
+    }
+  }
+
+  static inline void strided_copy(const T* src, T* dst, size_t stride, UInt32 frames) {
+    if constexpr (sizeof(T) == 4) {
+      cblas_scopy((int)frames, src, (int)stride, dst, (int)stride);
+    }
+    else {
+      cblas_dcopy((int)frames, src, (int)stride, dst, (int)stride);
+    }
+  }
+
+  static inline void scale(const T* src, T gain, T* dst, size_t stride, UInt32 frames) {
+    if constexpr (sizeof(T) == 4) {
+      vDSP_vsmul(src, stride, &gain, dst, stride, frames);
+    }
+    else {
+      vDSP_vsmulD(src, stride, &gain, dst, stride, frames);
+    }
+  }
+
+  static inline void scale_add(const T* src, T gain, T* dst, size_t stride, UInt32 frames) {
+    if constexpr (sizeof(T) == 4) {
+      vDSP_vsma(src, stride, &gain, dst, stride, dst, stride, frames);
+    }
+    else {
+      vDSP_vsmaD(src, stride, &gain, dst, stride, dst, stride, frames);
+    }
+  }
+};
+} // namespace mts.
@@ -0,0 +1,214 @@
+#pragma once
+#include "mts/platform.h"
+#include "mts/util.h"
+#include "mts/automation.h"
+#include <atomic>
+
+namespace mts {
+/// A change of the quality level of a deadline_scheduler.
+struct quality_transition {
+  // Current time of the IO cycle after which it happened, and the host time.
+  Float64 sample_time = 0;
+  UInt64 host_time = 0;
+
+  UInt32 from = 0;
+  UInt32 to = 0;
+
+  // Rolling load, 1 is the whole duration of a cycle.
+  Float32 load = 0;
+};
+
+/// Keeps the IO calls within the deadline of their cycle by degrading optional stages, in
+/// priority order, while the IO thread is overloaded.
+///
+/// The times of the IO calls of a cycle add up to its load, relative to its duration (the buffer
+/// size over the sample rate), and the load is averaged over about average_seconds. Above
+/// degrade_load the level goes up by one and one more stage is degraded, at most once per
+/// degrade_hold_seconds so that the average sees the new cost first. Below restore_load for the
+/// restore delay the level goes down by one. A degrade within the restore delay of the last
+/// restore doubles the delay, up to max_restore_seconds, so that a stage that doesn't fit isn't
+/// restored every few seconds. Stage s is degraded when the level is above s.
+///
+/// add() and get_level() must only be called from the IO thread. The statistics are atomics and
+/// the transitions go through a queue, a single other thread can read them at any time. That thread
+/// resets the peak and the counters with an exchange, so the IO thread updates them with a
+/// read-modify-write instead of a load and a store that could bring back what it took.
+template <UInt32 Stages>
+class deadline_scheduler {
+public:
+  static constexpr UInt32 max_level = Stages;
+  static constexpr UInt32 transition_capacity = 64;
+
+  static constexpr Float64 average_seconds = 0.05;
+  static constexpr Float64 degrade_load = 0.5;
+  static constexpr Float64 restore_load = 0.2;
+  static constexpr Float64 degrade_hold_seconds = 0.1;
+  static constexpr Float64 restore_seconds = 2;
+  static constexpr Float64 max_restore_seconds = 60;
+
+  std::atomic<UInt32> level{ 0 };
+  std::atomic<Float32> load{ 0 };
+
+  // Load of the worst cycle and number of cycles over their duration, since the last read.
+  std::atomic<Float32> peak_load{ 0 };
+  std::atomic<UInt32> overruns{ 0 };
+
+  std::atomic<UInt64> transition_count{ 0 };
+  std::atomic<UInt32> dropped_transitions{ 0 };
+
+  /// A disabled scheduler only measures. Must be called while the IO thread is stopped.
+  inline void set_enabled(bool is_enabled) noexcept { m_is_enabled = is_enabled; }
+  inline bool is_enabled() const noexcept { return m_is_enabled; }
+
+  /// Must be called while the IO thread is stopped.
+  inline void set_timing(Float64 sample_rate, Float64 host_ticks_per_frame) noexcept {
+    m_sample_rate = sample_rate;
+    m_ticks_per_frame = host_ticks_per_frame;
+  }
+
+  /// Starts again from full quality. Must be called while the IO thread is stopped.
+  inline void reset() noexcept {
+    m_cycle_time = -1;
+    m_cycle_frames = 0;
+    m_cycle_ticks = 0;
+    m_load = 0;
+    m_level = 0;
+    m_since_transition = degrade_hold_seconds;
+    m_since_restore = max_restore_seconds;
+    m_restore_delay = restore_seconds;
+    m_below = 0;
+    level.store(0, std::memory_order_relaxed);
+    load.store(0, std::memory_order_relaxed);
+  }
+
+  inline UInt32 get_level() const noexcept { return m_level; }
+  inline bool is_degraded(UInt32 stage) const noexcept { return m_level > stage; }
+
+  /// Adds the duration of an IO call of the cycle at `cycle_time` of `frames` frames, in host
+  /// ticks. The first call of a cycle completes the one before it.
+  inline void add(Float64 cycle_time, UInt32 frames, UInt64 ticks) noexcept {
+    if (cycle_time != m_cycle_time) {
+      if (m_cycle_frames) {
+        end_cycle();
+      }
+
+      m_cycle_time = cycle_time;
+      m_cycle_frames = frames;
+      m_cycle_ticks = 0;
+    }
+
+    m_cycle_ticks += ticks;
+  }
+
+  /// Must only be called from one thread at a time.
+  inline bool pop_transition(quality_transition& transition) noexcept { return m_transitions.pop(transition); }
+
+private:
+  spsc_queue<quality_transition, transition_capacity> m_transitions;
+  bool m_is_enabled = true;
+  Float64 m_sample_rate = 0;
+  Float64 m_ticks_per_frame = 0;
+
+  Float64 m_cycle_time = -1;
+  UInt32 m_cycle_frames = 0;
+  UInt64 m_cycle_ticks = 0;
+
+  Float64 m_load = 0;
+  UInt32 m_level = 0;
+
+  // Seconds of IO since the last transition and the last restore, and below restore_load.
+  Float64 m_since_transition = degrade_hold_seconds;
+  Float64 m_since_restore = max_restore_seconds;
+  Float64 m_restore_delay = restore_seconds;
+  Float64 m_below = 0;
+
+  inline void end_cycle() noexcept {
+    if (m_sample_rate <= 0 || m_ticks_per_frame <= 0) {
+      return;
+    }
+
+    const Float64 cycle_load = (Float64)m_cycle_ticks / (m_cycle_frames * m_ticks_per_frame);
+    const Float64 seconds = m_cycle_frames / m_sample_rate;
+    m_load += mts::min(seconds / average_seconds, 1.0) * (cycle_load - m_load);
+    m_since_transition += seconds;
+    m_since_restore += seconds;
+
+    load.store((Float32)m_load, std::memory_order_relaxed);
+
+    Float32 peak = peak_load.load(std::memory_order_relaxed);
+
+    while ((Float32)cycle_load > peak
+        && !peak_load.compare_exchange_weak(peak, (Float32)cycle_load, std::memory_order_relaxed)) {
+    }
+
+    if (cycle_load > 1) {
+      overruns.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    if (!m_is_enabled) {
+      return;
+    }
+
+    if (m_load > degrade_load) {
+      m_below = 0;
+
+      if (m_level < max_level && m_since_transition >= degrade_hold_seconds) {
+        if (m_since_restore < m_restore_delay) {
+          m_restore_delay = mts::min(2 * m_restore_delay, max_restore_seconds);
+        }
+
+        transition(m_level + 1);
+      }
+    }
+    else if (m_load < restore_load && m_level > 0) {
+      m_below += seconds;
+
+      if (m_below >= m_restore_delay) {
+        transition(m_level - 1);
+        m_below = 0;
+        m_since_restore = 0;
+      }
+    }
+    else {
+      m_below = 0;
+    }
+  }
+
+  inline void transition(UInt32 to) noexcept {
+    quality_transition t;
+    t.sample_time = m_cycle_time;
+    t.host_time = mach_absolute_time();
+    t.from = m_level;
+    t.to = to;
+    t.load = (Float32)m_load;
+
+    if (!m_transitions.push(t)) {
+      dropped_transitions.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    m_level = to;
+    m_since_transition = 0;
+    level.store(to, std::memory_order_relaxed);
+    transition_count.store(transition_count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+  }
+};
+
+/// Adds the duration of its scope to a deadline_scheduler.
+template <UInt32 Stages>
+class deadline_scope {
+public:
+  inline deadline_scope(deadline_scheduler<Stages>& scheduler, Float64 cycle_time, UInt32 frames) noexcept
+      : m_scheduler(scheduler)
+      , m_cycle_time(cycle_time)
+      , m_frames(frames)
+      , m_start(mach_absolute_time()) {}
+
+  inline ~deadline_scope() noexcept { m_scheduler.add(m_cycle_time, m_frames, mach_absolute_time() - m_start); }
+
+private:
+  deadline_scheduler<Stages>& m_scheduler;
+  Float64 m_cycle_time;
+  UInt32 m_frames;
+  UInt64 m_start;
+};
+} // namespace mts.
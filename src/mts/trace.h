@@ -0,0 +1,300 @@
+#pragma once
+#include "mts/platform.h"
+#include <atomic>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+namespace mts::trace {
+inline constexpr UInt32 file_version = 2;
+
+/// Fixed size records written by a set of threads into per-thread single writer rings.
+/// The oldest records get overwritten. A thread claims a ring the first time it records and gives
+/// it back when it exits, the HAL starts a new IO thread for every IO session. A free ring is
+/// taken before the ring of a thread that exited, whose records are kept until then and dropped
+/// when its ring is taken again. Every thread that claims a ring gets the next thread index, the
+/// records of one index are those of a single thread. Threads beyond MaxThreads live at the same
+/// time are not recorded.
+///
+/// With a PayloadCapacity, a record can also keep some bytes in a second per-thread ring, the
+/// Record then has a `payload_offset` and a `payload_size`.
+template <typename Record, UInt32 Capacity, UInt32 MaxThreads, UInt32 PayloadCapacity = 0>
+class recorder {
+public:
+  static_assert((Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+  static_assert((PayloadCapacity & (PayloadCapacity - 1)) == 0, "PayloadCapacity must be a power of two");
+
+  inline void record(const Record& r) noexcept {
+    buffer* b = get_thread_buffer();
+
+    if (!b) {
+      m_dropped.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+
+    push(b, r);
+  }
+
+  /// Records `r` with `size` bytes of `payload`. A payload larger than PayloadCapacity isn't kept.
+  inline void record(Record r, const void* payload, UInt32 size) noexcept {
+    static_assert(PayloadCapacity > 0, "the recorder has no payload");
+    buffer* b = get_thread_buffer();
+
+    if (!b) {
+      m_dropped.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+
+    const UInt64 begin = b->payload_index.load(std::memory_order_relaxed);
+    const UInt32 kept = payload && size <= PayloadCapacity ? size : 0;
+    const UInt32 offset = (UInt32)(begin & (PayloadCapacity - 1));
+    const UInt32 first = kept < PayloadCapacity - offset ? kept : PayloadCapacity - offset;
+
+    memcpy(b->payload + offset, payload, first);
+    memcpy(b->payload, (const UInt8*)payload + first, kept - first);
+    b->payload_index.store(begin + kept, std::memory_order_release);
+
+    r.payload_offset = begin;
+    r.payload_size = kept;
+    push(b, r);
+  }
+
+  /// Write the records of every thread in the user temporary directory, the path of the file is
+  /// copied in `path`. This must not be called on the IO thread.
+  ///
+  /// Threads keep recording while the dump is written, so the oldest records of a busy thread can
+  /// be torn. These are the ones about to be overwritten anyway.
+  inline bool dump(const char* name, const char magic[4], char* path, size_t path_size) const {
+    char directory[PATH_MAX];
+#if defined(__APPLE__)
+    if (confstr(_CS_DARWIN_USER_TEMP_DIR, directory, sizeof(directory)) == 0) {
+      return false;
+    }
+#else
+    // With the trailing slash of the macOS directory.
+    const char* tmpdir = getenv("TMPDIR");
+    snprintf(directory, sizeof(directory), "%s/", tmpdir ? tmpdir : "/tmp");
+#endif
+
+    snprintf(path, path_size, "%s%s_%d_%llu.bin", directory, name, (int)getpid(),
+        (unsigned long long)mach_absolute_time());
+
+    FILE* file = fopen(path, "wb");
+    if (!file) {
+      return false;
+    }
+
+    struct mach_timebase_info timebase;
+    mach_timebase_info(&timebase);
+
+    UInt32 thread_count = 0;
+    for (const buffer& b : m_buffers) {
+      thread_count += b.state.load(std::memory_order_acquire) != buffer_state::free;
+    }
+
+    file_header header;
+    memcpy(header.magic, magic, sizeof(header.magic));
+    header.version = file_version;
+    header.timebase_numer = timebase.numer;
+    header.timebase_denom = timebase.denom;
+    header.thread_count = thread_count;
+    header.dropped = (UInt32)m_dropped.load(std::memory_order_relaxed);
+    fwrite(&header, sizeof(header), 1, file);
+
+    for (UInt32 i = 0, k = 0; i < MaxThreads && k < thread_count; i++) {
+      const buffer& b = m_buffers[i];
+      if (b.state.load(std::memory_order_acquire) == buffer_state::free) {
+        continue;
+      }
+
+      // The payload of every record up to `end` was written before it.
+      const UInt64 end = b.write_index.load(std::memory_order_acquire);
+      const UInt64 begin = end > Capacity ? end - Capacity : 0;
+      const UInt64 payload_end = b.payload_index.load(std::memory_order_acquire);
+      const UInt64 payload_begin = payload_end > PayloadCapacity ? payload_end - PayloadCapacity : 0;
+
+      thread_header th = { b.thread_index.load(std::memory_order_relaxed), (UInt32)(end - begin), payload_begin,
+          payload_end - payload_begin };
+      fwrite(&th, sizeof(th), 1, file);
+
+      for (UInt64 n = begin; n < end; n++) {
+        fwrite(&b.records[n & (Capacity - 1)], sizeof(Record), 1, file);
+      }
+
+      for (UInt64 n = payload_begin; n < payload_end;) {
+        const UInt64 offset = n & (PayloadCapacity - 1);
+        const UInt64 count = payload_end - n < PayloadCapacity - offset ? payload_end - n : PayloadCapacity - offset;
+        fwrite(b.payload + offset, 1, count, file);
+        n += count;
+      }
+
+      k++;
+    }
+
+    fclose(file);
+    return true;
+  }
+
+private:
+  enum class buffer_state : UInt32 { free, owned, released };
+
+  struct buffer {
+    std::atomic<buffer_state> state{ buffer_state::free };
+    std::atomic<UInt32> thread_index{ 0 };
+    std::atomic<UInt64> write_index{ 0 };
+    std::atomic<UInt64> payload_index{ 0 };
+    Record records[Capacity];
+    UInt8 payload[PayloadCapacity > 0 ? PayloadCapacity : 1];
+  };
+
+  struct file_header {
+    char magic[4];
+    UInt32 version;
+    UInt32 timebase_numer;
+    UInt32 timebase_denom;
+    UInt32 thread_count;
+    UInt32 dropped;
+  };
+
+  // Followed by the records, then by the payload bytes from payload_begin, the offset of the
+  // oldest byte still in the ring.
+  struct thread_header {
+    UInt32 thread_index;
+    UInt32 record_count;
+    UInt64 payload_begin;
+    UInt64 payload_size;
+  };
+
+  // Zero initialized, the pages are only touched once a thread starts recording.
+  buffer m_buffers[MaxThreads];
+  std::atomic<UInt64> m_dropped{ 0 };
+  std::atomic<UInt32> m_thread_count{ 0 };
+
+  /// The ring of a thread, released by its destructor when the thread exits.
+  struct thread_slot {
+    buffer* owned = nullptr;
+    bool is_full = false;
+
+    inline ~thread_slot() {
+      if (owned) {
+        owned->state.store(buffer_state::released, std::memory_order_release);
+      }
+    }
+  };
+
+  static inline thread_local thread_slot t_slot;
+
+  static inline void push(buffer* b, const Record& r) noexcept {
+    const UInt64 index = b->write_index.load(std::memory_order_relaxed);
+    b->records[index & (Capacity - 1)] = r;
+    b->write_index.store(index + 1, std::memory_order_release);
+  }
+
+  inline buffer* get_thread_buffer() noexcept {
+    if (t_slot.owned) {
+      return t_slot.owned;
+    }
+
+    if (t_slot.is_full) {
+      return nullptr;
+    }
+
+    const buffer_state order[] = { buffer_state::free, buffer_state::released };
+
+    for (buffer_state from : order) {
+      for (buffer& b : m_buffers) {
+        buffer_state expected = from;
+        if (b.state.compare_exchange_strong(expected, buffer_state::owned, std::memory_order_acq_rel)) {
+          // The records of the thread that exited don't go under the index of this one.
+          b.thread_index.store(m_thread_count.fetch_add(1, std::memory_order_relaxed), std::memory_order_relaxed);
+          b.write_index.store(0, std::memory_order_release);
+          b.payload_index.store(0, std::memory_order_release);
+          t_slot.owned = &b;
+          return t_slot.owned;
+        }
+      }
+    }
+
+    // All buffers are taken, this thread won't be recorded.
+    t_slot.is_full = true;
+    return nullptr;
+  }
+};
+
+/// Keep in sync with tools/trace.
+enum class event_type : UInt16 {
+  start_io,
+  stop_io,
+  zero_timestamp,
+  begin_io_operation,
+  do_io_operation,
+  end_io_operation,
+  set_property
+};
+
+enum class event_phase : UInt16 { instant, begin, end };
+
+struct event {
+  UInt64 host_time;
+  UInt32 client_id;
+  UInt32 arg0;
+  UInt32 arg1;
+  event_type type;
+  event_phase phase;
+};
+
+static_assert(sizeof(event) == 24, "trace events must stay compact");
+
+inline constexpr char event_file_magic[4] = { 'M', 'T', 'S', 'T' };
+
+inline recorder<event, 4096, 16> g_events;
+
+inline void record(event_type type, event_phase phase, UInt32 client, UInt32 arg0, UInt32 arg1) noexcept {
+  g_events.record(event{ mach_absolute_time(), client, arg0, arg1, type, phase });
+}
+
+/// Records a begin event on construction and an end event on destruction.
+/// Everything is compiled out when Enabled is false.
+template <bool Enabled>
+class scope {
+public:
+  inline scope(event_type type, UInt32 client, UInt32 arg0 = 0, UInt32 arg1 = 0) noexcept
+      : m_type(type)
+      , m_client(client)
+      , m_arg0(arg0)
+      , m_arg1(arg1) {
+    if constexpr (Enabled) {
+      record(m_type, event_phase::begin, m_client, m_arg0, m_arg1);
+    }
+  }
+
+  inline ~scope() {
+    if constexpr (Enabled) {
+      record(m_type, event_phase::end, m_client, m_arg0, m_arg1);
+    }
+  }
+
+  scope(const scope&) = delete;
+  scope& operator=(const scope&) = delete;
+
+private:
+  event_type m_type;
+  UInt32 m_client;
+  UInt32 m_arg0;
+  UInt32 m_arg1;
+};
+
+template <bool Enabled>
+inline void instant(event_type type, UInt32 client, UInt32 arg0 = 0, UInt32 arg1 = 0) noexcept {
+  if constexpr (Enabled) {
+    record(type, event_phase::instant, client, arg0, arg1);
+  }
+}
+
+/// Write the trace events in the user temporary directory.
+inline bool dump(char* path, size_t path_size) {
+  return g_events.dump("mts_io_trace", event_file_magic, path, path_size);
+}
+} // namespace mts::trace.
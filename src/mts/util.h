@@ -35,7 +35,7 @@ inline constexpr T is_power_of_two(T v) {
   return v && !(v & (v - 1));
 }
 
-/// Check if the first value is the same as one of the other ones.
+/// Check if the first value is the same as one of the other ones, converted to its type.
 ///
 /// These two conditions are equivalent:
 /// @code
@@ -50,10 +50,10 @@ inline constexpr T is_power_of_two(T v) {
 template <typename T, typename T1, typename... Ts>
 inline constexpr bool is_one_of(T t, T1 t1, Ts... ts) {
   if constexpr (sizeof...(Ts) == 0) {
-    return t == t1;
+    return t == static_cast<T>(t1);
   }
   else {
-    return (t == t1) || is_one_of(t, ts...);
+    return (t == static_cast<T>(t1)) || is_one_of(t, ts...);
   }
 }
 
@@ -0,0 +1,561 @@
+//
+// Replays an IO capture of the driver without the HAL.
+//
+// The driver must be built with io_capture = true, the capture is written to the user temporary
+// directory by setting the 'mcap' custom property of the device. The replay links the same driver
+// sources with the same config, creates the driver with a host of its own and feeds it the
+// captured calls in their order: the clients, StartIO and StopIO, GetZeroTimeStamp with the
+// captured host times, and every DoIOOperation with its cycle info and the buffers the clients
+// wrote. It checks that the zero time stamps and the frames of every ReadInput are the same, bit
+// for bit, and measures the time of every IO cycle.
+//
+// The cycle times can be saved as a baseline and compared with later runs on the same machine, a
+// run slower than the baseline by more than the tolerance fails. The exit status is 0 when
+// everything matched, 1 on a mismatch or a regression and 2 when the replay couldn't run.
+//
+// The audio only matches when the capture starts with the IO session, before the ring was
+// written, and when the settings of the device are the same: pass the host storage of the driver
+// with --storage (a plist with the keys of MTS_PROPERTY_*). The auto gain of the loudness monitor
+// runs on its own thread and must be off.
+//
+// usage: mts_replay <capture> [--storage <plist>] [--save-baseline <file>]
+//                   [--baseline <file>] [--tolerance <ratio>]
+
+#include "config.h"
+#include "mts/capture.h"
+#include <CoreAudio/AudioServerPlugIn.h>
+#include <CoreFoundation/CoreFoundation.h>
+#include <mach/mach_time.h>
+#include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+extern "C" void* MTS_DRIVER_CREATE_PLUGIN(CFAllocatorRef inAllocator, CFUUIDRef inRequestedTypeUUID);
+
+namespace {
+using mts::capture::cycle_record;
+using mts::capture::record_type;
+
+// Keep in sync with mts::trace::recorder.
+struct file_header {
+  char magic[4];
+  UInt32 version;
+  UInt32 timebase_numer;
+  UInt32 timebase_denom;
+  UInt32 thread_count;
+  UInt32 dropped;
+};
+
+struct thread_header {
+  UInt32 thread_index;
+  UInt32 record_count;
+  UInt64 payload_begin;
+  UInt64 payload_size;
+};
+
+// A captured call and its payload, null when the payload ring overwrote it.
+struct entry {
+  cycle_record record;
+  const UInt8* payload;
+};
+
+struct options {
+  const char* capture = nullptr;
+  const char* storage = nullptr;
+  const char* save_baseline = nullptr;
+  const char* baseline = nullptr;
+  double tolerance = 1.25;
+};
+
+// Slower cycles than this over their baseline are noise.
+constexpr double slack_us = 5;
+
+UInt64 g_clock = 0;
+CFMutableDictionaryRef g_storage = nullptr;
+
+UInt64 replay_clock() { return g_clock; }
+
+OSStatus host_properties_changed(AudioServerPlugInHostRef, AudioObjectID, UInt32, const AudioObjectPropertyAddress*) {
+  return kAudioHardwareNoError;
+}
+
+OSStatus host_copy_from_storage(AudioServerPlugInHostRef, CFStringRef key, CFPropertyListRef* out) {
+  CFPropertyListRef value = CFDictionaryGetValue(g_storage, key);
+  *out = value ? CFRetain(value) : nullptr;
+  return kAudioHardwareNoError;
+}
+
+OSStatus host_write_to_storage(AudioServerPlugInHostRef, CFStringRef key, CFPropertyListRef value) {
+  CFDictionarySetValue(g_storage, key, value);
+  return kAudioHardwareNoError;
+}
+
+OSStatus host_delete_from_storage(AudioServerPlugInHostRef, CFStringRef key) {
+  CFDictionaryRemoveValue(g_storage, key);
+  return kAudioHardwareNoError;
+}
+
+// The capture has no configuration changes, a request means that the replay diverged.
+OSStatus host_request_configuration_change(AudioServerPlugInHostRef, AudioObjectID, UInt64 action, void*) {
+  fprintf(stderr, "replay: the driver requested the configuration change %llu, ignored\n", (unsigned long long)action);
+  return kAudioHardwareNoError;
+}
+
+const AudioServerPlugInHostInterface g_host = { host_properties_changed, host_copy_from_storage,
+  host_write_to_storage, host_delete_from_storage, host_request_configuration_change };
+
+bool parse_options(int argc, char** argv, options& o) {
+  for (int i = 1; i < argc; i++) {
+    const bool has_value = i + 1 < argc;
+
+    if (!strcmp(argv[i], "--storage") && has_value) {
+      o.storage = argv[++i];
+    }
+    else if (!strcmp(argv[i], "--save-baseline") && has_value) {
+      o.save_baseline = argv[++i];
+    }
+    else if (!strcmp(argv[i], "--baseline") && has_value) {
+      o.baseline = argv[++i];
+    }
+    else if (!strcmp(argv[i], "--tolerance") && has_value) {
+      o.tolerance = atof(argv[++i]);
+    }
+    else if (argv[i][0] != '-' && !o.capture) {
+      o.capture = argv[i];
+    }
+    else {
+      return false;
+    }
+  }
+
+  return o.capture && o.tolerance >= 1;
+}
+
+bool read_file(const char* path, std::vector<UInt8>& data) {
+  FILE* file = fopen(path, "rb");
+
+  if (!file) {
+    return false;
+  }
+
+  fseek(file, 0, SEEK_END);
+  data.resize((size_t)ftell(file));
+  fseek(file, 0, SEEK_SET);
+  const bool is_read = fread(data.data(), 1, data.size(), file) == data.size();
+  fclose(file);
+  return is_read;
+}
+
+/// The records of every thread in call order.
+bool parse_capture(const std::vector<UInt8>& data, std::vector<entry>& entries, file_header& header) {
+  if (data.size() < sizeof(header)) {
+    return false;
+  }
+
+  memcpy(&header, data.data(), sizeof(header));
+
+  if (memcmp(header.magic, mts::capture::file_magic, 4) || header.version != mts::trace::file_version) {
+    return false;
+  }
+
+  size_t offset = sizeof(header);
+
+  for (UInt32 t = 0; t < header.thread_count; t++) {
+    thread_header th;
+
+    if (offset + sizeof(th) > data.size()) {
+      return false;
+    }
+
+    memcpy(&th, data.data() + offset, sizeof(th));
+    offset += sizeof(th);
+
+    const size_t records = offset;
+    const size_t payload = records + (size_t)th.record_count * sizeof(cycle_record);
+
+    if (payload + th.payload_size > data.size()) {
+      return false;
+    }
+
+    for (UInt32 i = 0; i < th.record_count; i++) {
+      entry e;
+      memcpy(&e.record, data.data() + records + i * sizeof(cycle_record), sizeof(cycle_record));
+
+      const cycle_record& r = e.record;
+      const bool is_kept = r.payload_size && r.payload_offset >= th.payload_begin
+          && r.payload_offset + r.payload_size <= th.payload_begin + th.payload_size;
+      e.payload = is_kept ? data.data() + payload + (r.payload_offset - th.payload_begin) : nullptr;
+      entries.push_back(e);
+    }
+
+    offset = payload + th.payload_size;
+  }
+
+  std::sort(entries.begin(), entries.end(),
+      [](const entry& a, const entry& b) { return a.record.sequence < b.record.sequence; });
+  return true;
+}
+
+bool load_storage(const char* path) {
+  std::vector<UInt8> bytes;
+
+  if (!read_file(path, bytes)) {
+    return false;
+  }
+
+  CFDataRef data = CFDataCreate(kCFAllocatorDefault, bytes.data(), (CFIndex)bytes.size());
+  CFPropertyListRef plist = CFPropertyListCreateWithData(kCFAllocatorDefault, data, 0, nullptr, nullptr);
+  CFRelease(data);
+
+  if (!plist || CFGetTypeID(plist) != CFDictionaryGetTypeID()) {
+    if (plist) {
+      CFRelease(plist);
+    }
+
+    return false;
+  }
+
+  CFRelease(g_storage);
+  g_storage = CFDictionaryCreateMutableCopy(kCFAllocatorDefault, 0, (CFDictionaryRef)plist);
+  CFRelease(plist);
+  return true;
+}
+
+bool read_baseline(const char* path, std::vector<double>& cycles) {
+  FILE* file = fopen(path, "r");
+
+  if (!file) {
+    return false;
+  }
+
+  char line[128];
+
+  while (fgets(line, sizeof(line), file)) {
+    if (line[0] != '#') {
+      cycles.push_back(atof(line));
+    }
+  }
+
+  fclose(file);
+  return true;
+}
+
+bool write_baseline(const char* path, const std::vector<double>& cycles) {
+  FILE* file = fopen(path, "w");
+
+  if (!file) {
+    return false;
+  }
+
+  fprintf(file, "# mts_replay baseline, microseconds per IO cycle\n");
+
+  for (double us : cycles) {
+    fprintf(file, "%.3f\n", us);
+  }
+
+  fclose(file);
+  return true;
+}
+
+/// Number of level changes of the adaptive quality scheduler, see the 'mlod' custom property.
+double get_quality_transitions(AudioServerPlugInDriverRef driver, AudioObjectID device) {
+  const AudioObjectPropertyAddress address = { 'mlod', kAudioObjectPropertyScopeGlobal,
+    kAudioObjectPropertyElementMain };
+  CFDictionaryRef load = nullptr;
+  UInt32 size = sizeof(load);
+  double count = 0;
+
+  if ((*driver)->GetPropertyData(driver, device, 0, &address, 0, nullptr, size, &size, &load) != kAudioHardwareNoError
+      || !load) {
+    return 0;
+  }
+
+  CFNumberRef number = (CFNumberRef)CFDictionaryGetValue(load, CFSTR("transition_count"));
+
+  if (number) {
+    CFNumberGetValue(number, kCFNumberFloat64Type, &count);
+  }
+
+  CFRelease(load);
+  return count;
+}
+
+bool is_same_operation(const cycle_record& a, const cycle_record& b) {
+  return a.type == record_type::io_operation && b.type == record_type::io_operation && a.client_id == b.client_id
+      && a.operation_id == b.operation_id && a.current_sample_time == b.current_sample_time;
+}
+
+AudioServerPlugInIOCycleInfo make_cycle_info(const cycle_record& r) {
+  AudioServerPlugInIOCycleInfo info = {};
+  info.mIOCycleCounter = r.cycle_counter;
+  info.mNominalIOBufferFrameSize = r.nominal_frame_size;
+  info.mInputTime.mSampleTime = r.input_sample_time;
+  info.mInputTime.mHostTime = r.input_host_time;
+  info.mInputTime.mRateScalar = r.rate_scalar;
+  info.mInputTime.mFlags = kAudioTimeStampSampleHostTimeValid | kAudioTimeStampRateScalarValid;
+  info.mOutputTime = info.mInputTime;
+  info.mOutputTime.mSampleTime = r.output_sample_time;
+  info.mOutputTime.mHostTime = r.output_host_time;
+  info.mCurrentTime = info.mInputTime;
+  info.mCurrentTime.mSampleTime = r.current_sample_time;
+  info.mCurrentTime.mHostTime = r.current_host_time;
+  return info;
+}
+} // namespace
+
+int main(int argc, char** argv) {
+  options o;
+
+  if (!parse_options(argc, argv, o)) {
+    fprintf(stderr,
+        "usage: mts_replay <capture> [--storage <plist>] [--save-baseline <file>] [--baseline <file>]"
+        " [--tolerance <ratio>]\n");
+    return 2;
+  }
+
+  std::vector<UInt8> data;
+  std::vector<entry> entries;
+  file_header header;
+
+  if (!read_file(o.capture, data) || !parse_capture(data, entries, header)) {
+    fprintf(stderr, "replay: %s is not an IO capture of this version\n", o.capture);
+    return 2;
+  }
+
+  g_storage = CFDictionaryCreateMutable(
+      kCFAllocatorDefault, 0, &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
+
+  if (o.storage && !load_storage(o.storage)) {
+    fprintf(stderr, "replay: unable to read the storage %s\n", o.storage);
+    return 2;
+  }
+
+  // The time line of the driver follows the captured host times.
+  mts::capture::g_host_time = replay_clock;
+
+  AudioServerPlugInDriverRef driver
+      = (AudioServerPlugInDriverRef)MTS_DRIVER_CREATE_PLUGIN(kCFAllocatorDefault, kAudioServerPlugInTypeUUID);
+  AudioObjectID device = kAudioObjectUnknown;
+  const AudioObjectPropertyAddress devices = { kAudioPlugInPropertyDeviceList, kAudioObjectPropertyScopeGlobal,
+    kAudioObjectPropertyElementMain };
+  UInt32 size = sizeof(device);
+
+  if (!driver || (*driver)->Initialize(driver, &g_host) != kAudioHardwareNoError
+      || (*driver)->GetPropertyData(driver, kAudioObjectPlugInObject, 0, &devices, 0, nullptr, size, &size, &device)
+          != kAudioHardwareNoError
+      || device == kAudioObjectUnknown) {
+    fprintf(stderr, "replay: unable to create the device\n");
+    return 2;
+  }
+
+  // What came before the first StartIO depends on a state the capture doesn't have, except the
+  // clients.
+  const auto first_start = std::find_if(
+      entries.begin(), entries.end(), [](const entry& e) { return e.record.type == record_type::start_io; });
+
+  if (first_start == entries.end()) {
+    fprintf(stderr, "replay: the capture has no StartIO\n");
+    return 2;
+  }
+
+  std::vector<UInt32> clients;
+  std::vector<UInt8> buffer;
+  std::vector<double> cycles;
+  std::vector<double> captured_cycles;
+  UInt64 skipped = 0;
+  UInt64 read_count = 0;
+  UInt64 read_mismatches = 0;
+  UInt64 zero_mismatches = 0;
+  UInt64 missing_payloads = 0;
+  Float64 cycle_time = -1;
+
+  mach_timebase_info_data_t timebase;
+  mach_timebase_info(&timebase);
+  const double ticks_to_us = (double)timebase.numer / timebase.denom / 1000.0;
+  const double captured_ticks_to_us = (double)header.timebase_numer / header.timebase_denom / 1000.0;
+
+  auto add_client = [&](UInt32 id, pid_t process_id, const UInt8* bundle_id, UInt32 bundle_id_size) {
+    if (std::find(clients.begin(), clients.end(), id) != clients.end()) {
+      return;
+    }
+
+    CFStringRef bundle = bundle_id
+        ? CFStringCreateWithBytes(kCFAllocatorDefault, bundle_id, bundle_id_size, kCFStringEncodingUTF8, false)
+        : nullptr;
+    const AudioServerPlugInClientInfo info = { id, process_id, true, bundle };
+    (*driver)->AddDeviceClient(driver, device, &info);
+    clients.push_back(id);
+
+    if (bundle) {
+      CFRelease(bundle);
+    }
+  };
+
+  for (auto it = entries.begin(); it != entries.end(); ++it) {
+    const cycle_record& r = it->record;
+
+    if (it < first_start && r.type != record_type::add_client && r.type != record_type::remove_client) {
+      skipped++;
+      continue;
+    }
+
+    switch (r.type) {
+    case record_type::add_client:
+      add_client(r.client_id, (pid_t)r.process_id, it->payload, it->payload ? r.payload_size : 0);
+      break;
+
+    case record_type::remove_client: {
+      const AudioServerPlugInClientInfo info = { r.client_id, (pid_t)r.process_id, true, nullptr };
+      (*driver)->RemoveDeviceClient(driver, device, &info);
+      clients.erase(std::remove(clients.begin(), clients.end(), r.client_id), clients.end());
+    } break;
+
+    case record_type::start_io:
+      add_client(r.client_id, 0, nullptr, 0);
+      g_clock = r.current_host_time;
+      (*driver)->StartIO(driver, device, r.client_id);
+      break;
+
+    case record_type::stop_io:
+      (*driver)->StopIO(driver, device, r.client_id);
+      break;
+
+    case record_type::zero_timestamp: {
+      Float64 sample_time = 0;
+      UInt64 host_time = 0;
+      UInt64 seed = 0;
+      g_clock = r.current_host_time;
+      (*driver)->GetZeroTimeStamp(driver, device, r.client_id, &sample_time, &host_time, &seed);
+
+      if (sample_time != r.zero_sample_time || host_time != r.zero_host_time || seed != r.zero_seed) {
+        if (zero_mismatches++ < 10) {
+          fprintf(stderr, "replay: zero time stamp %llu: %.0f %llu instead of %.0f %llu\n",
+              (unsigned long long)r.sequence, sample_time, (unsigned long long)host_time, r.zero_sample_time,
+              (unsigned long long)r.zero_host_time);
+        }
+      }
+    } break;
+
+    case record_type::io_operation: {
+      const AudioServerPlugInIOCycleInfo info = make_cycle_info(r);
+      const bool is_reading = r.operation_id == kAudioServerPlugInIOOperationReadInput;
+      const bool is_first = it == entries.begin() || !is_same_operation(it[-1].record, r);
+      const bool is_last = it + 1 == entries.end() || !is_same_operation(it[1].record, r);
+
+      // The buffer of an operation without a payload is as large as it can be.
+      const size_t buffer_size = r.payload_size ? r.payload_size : (size_t)r.frame_size * 64 * sizeof(Float64);
+      buffer.assign(buffer_size, 0);
+
+      if (!is_reading && r.payload_size) {
+        if (it->payload) {
+          memcpy(buffer.data(), it->payload, r.payload_size);
+        }
+        else {
+          missing_payloads++;
+        }
+      }
+
+      if (r.current_sample_time != cycle_time) {
+        cycle_time = r.current_sample_time;
+        cycles.push_back(0);
+        captured_cycles.push_back(0);
+      }
+
+      add_client(r.client_id, 0, nullptr, 0);
+      g_clock = r.current_host_time;
+
+      const UInt64 start = mach_absolute_time();
+
+      if (is_first) {
+        (*driver)->BeginIOOperation(driver, device, r.client_id, r.operation_id, r.frame_size, &info);
+      }
+
+      (*driver)->DoIOOperation(
+          driver, device, r.stream_id, r.client_id, r.operation_id, r.frame_size, &info, buffer.data(), nullptr);
+
+      if (is_last) {
+        (*driver)->EndIOOperation(driver, device, r.client_id, r.operation_id, r.frame_size, &info);
+      }
+
+      cycles.back() += (mach_absolute_time() - start) * ticks_to_us;
+      captured_cycles.back() += r.duration * captured_ticks_to_us;
+
+      if (is_reading && r.payload_size) {
+        if (!it->payload) {
+          missing_payloads++;
+          break;
+        }
+
+        read_count++;
+
+        if (memcmp(buffer.data(), it->payload, r.payload_size) && read_mismatches++ < 10) {
+          size_t first = 0;
+          while (buffer[first] == it->payload[first]) {
+            first++;
+          }
+
+          fprintf(stderr, "replay: ReadInput %llu of stream %u at %.0f differs from byte %zu\n",
+              (unsigned long long)r.sequence, r.stream_id, r.input_sample_time, first);
+        }
+      }
+    } break;
+    }
+  }
+
+  const double transitions = get_quality_transitions(driver, device);
+  double total = 0;
+  double captured_total = 0;
+
+  for (size_t i = 0; i < cycles.size(); i++) {
+    total += cycles[i];
+    captured_total += captured_cycles[i];
+  }
+
+  printf("%zu records, %llu skipped before the first StartIO, %u dropped by the capture\n", entries.size(),
+      (unsigned long long)skipped, header.dropped);
+  printf("%llu ReadInput compared, %llu differ, %llu zero time stamps differ, %llu payloads missing\n",
+      (unsigned long long)read_count, (unsigned long long)read_mismatches, (unsigned long long)zero_mismatches,
+      (unsigned long long)missing_payloads);
+
+  if (!cycles.empty()) {
+    printf("%zu cycles, %.2f us per cycle (%.2f us when captured), worst %.2f us\n", cycles.size(),
+        total / cycles.size(), captured_total / cycles.size(), *std::max_element(cycles.begin(), cycles.end()));
+  }
+
+  if (transitions > 0) {
+    printf("warning: the adaptive quality changed %.0f times, the degraded stages change the audio\n", transitions);
+  }
+
+  bool is_regression = false;
+
+  if (o.baseline) {
+    std::vector<double> baseline;
+
+    if (!read_baseline(o.baseline, baseline) || baseline.size() != cycles.size()) {
+      fprintf(stderr, "replay: the baseline %s isn't a baseline of this capture\n", o.baseline);
+      return 2;
+    }
+
+    double baseline_total = 0;
+    size_t slower = 0;
+
+    for (size_t i = 0; i < cycles.size(); i++) {
+      baseline_total += baseline[i];
+      slower += cycles[i] > baseline[i] * o.tolerance + slack_us;
+    }
+
+    const double ratio = baseline_total > 0 ? total / baseline_total : 1;
+    is_regression = ratio > o.tolerance;
+    printf("%.3fx the baseline, %zu cycles slower than %.2fx%s\n", ratio, slower, o.tolerance,
+        is_regression ? ": REGRESSION" : "");
+  }
+
+  if (o.save_baseline && !write_baseline(o.save_baseline, cycles)) {
+    fprintf(stderr, "replay: unable to write the baseline %s\n", o.save_baseline);
+    return 2;
+  }
+
+  return read_mismatches || zero_mismatches || is_regression ? 1 : 0;
+}